@@ -697,8 +697,14 @@ typedef enum
     CFG_TASK_FS_LOG_SYNC_ID,
     CFG_TASK_FS_AUDIO_CONTROL_PRODUCER_ID,
     CFG_TASK_FS_AUDIO_CONTROL_CONSUMER_ID,
+    CFG_TASK_FS_AUDIO_CONTROL_BARO_ID,
+    CFG_TASK_FS_ACTIVE_CONTROL_BARO_ID,
+    CFG_TASK_FS_KALMAN_UPDATE_ID,
+    CFG_TASK_FS_PHASE_UPDATE_ID,
     CFG_TASK_FS_CONFIG_UPDATE_ID,
     CFG_TASK_FS_WATCHDOG_UPDATE_ID,
+    CFG_TASK_FS_SENSOR_INIT_ID,
+    CFG_TASK_FS_TIMESTAMP_FIT_ID,
   /* USER CODE END CFG_Task_Id_With_NO_HCI_Cmd_t */
   CFG_LAST_TASK_ID_WITH_NO_HCICMD                                            /**< Shall be LAST in the list */
 } CFG_Task_Id_With_NO_HCI_Cmd_t;
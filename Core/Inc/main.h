@@ -74,6 +74,7 @@ void MX_SPI2_Init(void);
 void MX_USART1_UART_Init(void);
 void MX_RNG_Init(void);
 void MX_LPUART1_UART_Init(void);
+void MX_TIM2_Init(void);
 
 /* USER CODE BEGIN EFP */
 void PeriphClock_Config(void);
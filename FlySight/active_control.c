@@ -25,24 +25,34 @@
 
 #include "main.h"
 #include "app_common.h"
+#include "ahrs.h"
+#include "altitude.h"
 #include "audio_control.h"
 #include "baro.h"
+#include "capture.h"
 #include "charge.h"
 #include "config.h"
 #include "custom_app.h"
+#include "decimate.h"
 #include "gnss.h"
 #include "hum.h"
 #include "imu.h"
+#include "kalman.h"
 #include "led.h"
 #include "log.h"
 #include "mag.h"
+#include "mic.h"
+#include "phase.h"
 #include "state.h"
+#include "stm32_seq.h"
 #include "time.h"
 #include "vbat.h"
 
 #define LED_BLINK_MSEC      900
 #define LED_BLINK_TICKS     (LED_BLINK_MSEC*1000/CFG_TS_TICK_VAL)
 
+#define BARO_COUNT          (2 * FS_CONFIG_MAX_BARO_FIFO)	// barometer samples buffered for the baro task
+
 static uint8_t led_timer_id;
 
 static volatile bool hasFix;
@@ -54,12 +64,25 @@ static volatile enum {
 
 static FS_GNSS_Time_t savedTime;
 
+// Logging decimation
+static FS_Decimate_t imuDec;
+static FS_Decimate_t baroDec;
+
+// Barometer samples waiting for the baro task
+static FS_Baro_Data_t baroBuf[BARO_COUNT];
+static volatile uint32_t baroRdI;
+static volatile uint32_t baroWrI;
+static uint32_t baroDropped;
+
 extern RTC_HandleTypeDef hrtc;
 
 void FS_ActiveControl_DataReady_Callback(void);
 void FS_ActiveControl_TimeReady_Callback(bool validTime);
 void FS_ActiveControl_RawReady_Callback(void);
 
+static void FS_ActiveControl_FlushCapture(void);
+static void baroTask(void);
+
 static void FS_ActiveControl_LED_Timer(void)
 {
 	// Turn on LED
@@ -90,6 +113,18 @@ void FS_ActiveControl_Init(void)
 
 	// Initialize saved GNSS time
 	memset(&savedTime, 0, sizeof(FS_GNSS_Time_t));
+
+	// Decimation filters are set up on first sample
+	imuDec.rate = 0;
+	baroDec.rate = 0;
+
+	// Initialize barometer queue
+	baroRdI = 0;
+	baroWrI = 0;
+	baroDropped = 0;
+
+	// Initialize barometer task
+	UTIL_SEQ_RegTask(1<<CFG_TASK_FS_ACTIVE_CONTROL_BARO_ID, UTIL_SEQ_RFU, baroTask);
 }
 
 void FS_ActiveControl_DeInit(void)
@@ -111,9 +146,26 @@ void FS_ActiveControl_DeInit(void)
 	RTC_TimeTypeDef sTime = {0};
 	RTC_DateTypeDef sDate = {0};
 
+	// Save the final partial raw GNSS buffer
+	FS_GNSS_FlushRaw();
+
+	// Process barometer samples still queued
+	baroTask();
+
 	// Update state
 	state = FS_CONTROL_INACTIVE;
 
+	if (baroDropped)
+	{
+		FS_Log_WriteEvent("%lu barometer samples dropped", baroDropped);
+	}
+
+	if (FS_Config_Get()->enable_logging && FS_Capture_IsEnabled())
+	{
+		// Write samples still held in pre-trigger ring
+		FS_ActiveControl_FlushCapture();
+	}
+
 	// Delete timer
 	HW_TS_Delete(led_timer_id);
 
@@ -170,15 +222,115 @@ void FS_ActiveControl_DeInit(void)
 	}
 }
 
+static void FS_ActiveControl_LogBaro(const FS_Baro_Data_t *data, bool fullRate)
+{
+	const uint8_t rate = fullRate ? 1 : FS_Phase_GetBaroLogDec();
+	FS_Baro_Data_t out;
+	int32_t in[2], y[2];
+
+	if (rate <= 1)
+	{
+		// Restart filter once decimation resumes
+		baroDec.rate = 0;
+		FS_Log_WriteBaroData(data);
+		return;
+	}
+
+	if (baroDec.rate != rate)
+	{
+		FS_Decimate_Init(&baroDec, 2, rate);
+	}
+
+	in[0] = data->pressure;
+	in[1] = data->temperature;
+
+	out.time = data->time;
+	out.timeUs = data->timeUs;
+
+	if (FS_Decimate_Update(&baroDec, in, y, &out.time, &out.timeUs))
+	{
+		out.pressure = y[0];
+		out.temperature = y[1];
+		FS_Log_WriteBaroData(&out);
+	}
+}
+
+static void FS_ActiveControl_CaptureBaro(const FS_Baro_Data_t *data)
+{
+	FS_Baro_Data_t out;
+	bool fullRate;
+
+	// Delay samples through pre-trigger ring
+	FS_Capture_PushBaro(data);
+	while (FS_Capture_PopBaro(&out, &fullRate, false))
+	{
+		FS_ActiveControl_LogBaro(&out, fullRate);
+	}
+}
+
+static void FS_ActiveControl_UpdateBaro(const FS_Baro_Data_t *data)
+{
+	// Update fused altitude
+	FS_Altitude_UpdateBaro(data);
+
+	// Update flight phase
+	FS_Phase_UpdateBaro();
+
+	if (FS_Config_Get()->enable_kf)
+	{
+		// Update navigation filter
+		FS_Kalman_UpdateBaro(data);
+	}
+
+	if (FS_Config_Get()->enable_audio)
+	{
+		// Update audio
+		FS_AudioControl_UpdateBaro();
+	}
+
+	if (FS_Config_Get()->enable_logging)
+	{
+		if (FS_Capture_IsEnabled())
+		{
+			// Save to log file after pre-trigger delay
+			FS_ActiveControl_CaptureBaro(data);
+		}
+		else
+		{
+			// Save to log file
+			FS_ActiveControl_LogBaro(data, false);
+		}
+	}
+}
+
+static void baroTask(void)
+{
+	while (baroRdI != baroWrI)
+	{
+		if (state == FS_CONTROL_ACTIVE)
+		{
+			FS_ActiveControl_UpdateBaro(&baroBuf[baroRdI % BARO_COUNT]);
+		}
+		++baroRdI;
+	}
+}
+
 void FS_Baro_DataReady_Callback(void)
 {
 	if (state != FS_CONTROL_ACTIVE) return;
 
-	if (FS_Config_Get()->enable_logging)
+	// Queue sample and leave processing to the baro task
+	if (baroWrI < baroRdI + BARO_COUNT)
 	{
-		// Save to log file
-		FS_Log_WriteBaroData(FS_Baro_GetData());
+		baroBuf[baroWrI % BARO_COUNT] = *FS_Baro_GetData();
+		++baroWrI;
+	}
+	else
+	{
+		++baroDropped;
 	}
+
+	UTIL_SEQ_SetTask(1<<CFG_TASK_FS_ACTIVE_CONTROL_BARO_ID, CFG_SCH_PRIO_1);
 }
 
 void FS_Hum_DataReady_Callback(void)
@@ -196,6 +348,12 @@ void FS_Mag_DataReady_Callback(void)
 {
 	if (state != FS_CONTROL_ACTIVE) return;
 
+	if (FS_Config_Get()->enable_ahrs)
+	{
+		// Update attitude estimate
+		FS_AHRS_UpdateMag(FS_Mag_GetData());
+	}
+
 	if (FS_Config_Get()->enable_logging)
 	{
 		// Save to log file
@@ -209,6 +367,21 @@ void FS_ActiveControl_DataReady_Callback(void)
 
 	if (state != FS_CONTROL_ACTIVE) return;
 
+	// Anchor fused altitude
+	FS_Altitude_UpdateGNSS(data);
+
+	// Update flight phase
+	FS_Phase_UpdateGNSS(data);
+
+	// Check capture trigger
+	FS_Capture_UpdateGNSS(data);
+
+	if (FS_Config_Get()->enable_kf)
+	{
+		// Update navigation filter
+		FS_Kalman_UpdateGNSS(data);
+	}
+
 	if (FS_Config_Get()->enable_audio)
 	{
 		// Update audio
@@ -269,14 +442,233 @@ void FS_ActiveControl_RawReady_Callback(void)
 	}
 }
 
+static void FS_ActiveControl_LogIMU(const FS_IMU_Raw_t *data)
+{
+	FS_IMU_Raw_t out;
+	int32_t in[7], y[7];
+
+	in[0] = data->gx;
+	in[1] = data->gy;
+	in[2] = data->gz;
+	in[3] = data->ax;
+	in[4] = data->ay;
+	in[5] = data->az;
+	in[6] = data->temperature;
+
+	out.time = data->time;
+	out.timeUs = data->timeUs;
+
+	if (FS_Decimate_Update(&imuDec, in, y, &out.time, &out.timeUs))
+	{
+		out.gx = y[0];
+		out.gy = y[1];
+		out.gz = y[2];
+		out.ax = y[3];
+		out.ay = y[4];
+		out.az = y[5];
+		out.temperature = y[6];
+		FS_Log_WriteIMUData(&out);
+	}
+}
+
+static void FS_ActiveControl_WriteIMU(const FS_IMU_Raw_t *data, bool fullRate)
+{
+	const uint8_t rate = fullRate ? 1 : FS_Phase_GetIMULogDec();
+
+	if (rate <= 1)
+	{
+		// Restart filter once decimation resumes
+		imuDec.rate = 0;
+		FS_Log_WriteIMUData(data);
+		return;
+	}
+
+	if (imuDec.rate != rate)
+	{
+		FS_Decimate_Init(&imuDec, 7, rate);
+	}
+
+	FS_ActiveControl_LogIMU(data);
+}
+
+static void FS_ActiveControl_CaptureIMU(const FS_IMU_Raw_t *data, uint32_t count)
+{
+	FS_IMU_Raw_t out;
+	bool fullRate;
+	uint32_t i;
+
+	// Delay samples through pre-trigger ring
+	for (i = 0; i < count; ++i)
+	{
+		FS_Capture_PushIMU(&data[i]);
+		while (FS_Capture_PopIMU(&out, &fullRate, false))
+		{
+			FS_ActiveControl_WriteIMU(&out, fullRate);
+		}
+	}
+}
+
+static void FS_ActiveControl_FlushCapture(void)
+{
+	FS_IMU_Raw_t imu;
+	FS_Baro_Data_t baro;
+	bool fullRate;
+
+	// Drain log rings whenever they fill so no samples are dropped
+	for (;;)
+	{
+		if (FS_Log_GetIMUSpace() == 0)
+		{
+			FS_Log_FlushSensors();
+		}
+		if (!FS_Capture_PopIMU(&imu, &fullRate, true)) break;
+		FS_ActiveControl_WriteIMU(&imu, fullRate);
+	}
+
+	for (;;)
+	{
+		if (FS_Log_GetBaroSpace() == 0)
+		{
+			FS_Log_FlushSensors();
+		}
+		if (!FS_Capture_PopBaro(&baro, &fullRate, true)) break;
+		FS_ActiveControl_LogBaro(&baro, fullRate);
+	}
+}
+
 void FS_IMU_DataReady_Callback(void)
+{
+	const uint8_t rate = FS_Phase_GetIMULogDec();
+
+	if (state != FS_CONTROL_ACTIVE) return;
+
+	if (FS_Config_Get()->enable_kf)
+	{
+		// Update navigation filter
+		FS_Kalman_UpdateIMU(FS_IMU_GetRaw(), 1);
+	}
+
+	if (FS_Config_Get()->enable_ahrs)
+	{
+		// Update attitude estimate
+		FS_AHRS_UpdateIMU(FS_IMU_GetRaw(), 1);
+	}
+
+	if (FS_Config_Get()->enable_logging)
+	{
+		if (FS_Capture_IsEnabled())
+		{
+			// Save to log file after pre-trigger delay
+			FS_ActiveControl_CaptureIMU(FS_IMU_GetRaw(), 1);
+			return;
+		}
+
+		if (rate <= 1)
+		{
+			// Save to log file and restart filter for next decimated phase
+			imuDec.rate = 0;
+			FS_Log_WriteIMUData(FS_IMU_GetRaw());
+			return;
+		}
+
+		if (imuDec.rate != rate)
+		{
+			FS_Decimate_Init(&imuDec, 7, rate);
+		}
+
+		// Filter and save to log file
+		FS_ActiveControl_LogIMU(FS_IMU_GetRaw());
+	}
+}
+
+void FS_IMU_BatchReady_Callback(void)
+{
+	const uint8_t rate = FS_Phase_GetIMULogDec();
+	const FS_IMU_Raw_t *data;
+	uint32_t count, i;
+
+	if (state != FS_CONTROL_ACTIVE) return;
+
+	data = FS_IMU_GetBatch(&count);
+
+	if (FS_Config_Get()->enable_kf)
+	{
+		// Update navigation filter
+		FS_Kalman_UpdateIMU(data, count);
+	}
+
+	if (FS_Config_Get()->enable_ahrs)
+	{
+		// Update attitude estimate
+		FS_AHRS_UpdateIMU(data, count);
+	}
+
+	if (FS_Config_Get()->enable_logging)
+	{
+		if (FS_Capture_IsEnabled())
+		{
+			// Save to log file after pre-trigger delay
+			FS_ActiveControl_CaptureIMU(data, count);
+			return;
+		}
+
+		if (rate <= 1)
+		{
+			// Save to log file and restart filter for next decimated phase
+			imuDec.rate = 0;
+			FS_Log_WriteIMUBatch(data, count);
+			return;
+		}
+
+		if (imuDec.rate != rate)
+		{
+			FS_Decimate_Init(&imuDec, 7, rate);
+		}
+
+		// Filter and save to log file
+		for (i = 0; i < count; ++i)
+		{
+			FS_ActiveControl_LogIMU(&data[i]);
+		}
+	}
+}
+
+void FS_AHRS_DataReady_Callback(void)
+{
+	if (state != FS_CONTROL_ACTIVE) return;
+
+	if (FS_Config_Get()->enable_logging)
+	{
+		// Save to log file
+		FS_Log_WriteAHRSData(FS_AHRS_GetData());
+	}
+}
+
+void FS_Kalman_DataReady_Callback(void)
+{
+	if (state != FS_CONTROL_ACTIVE) return;
+
+	if (FS_Config_Get()->enable_audio)
+	{
+		// Update audio
+		FS_AudioControl_UpdateKalman();
+	}
+
+	if (FS_Config_Get()->enable_logging)
+	{
+		// Save to log file
+		FS_Log_WriteKalmanData(FS_Kalman_GetData());
+	}
+}
+
+void FS_Mic_DataReady_Callback(void)
 {
 	if (state != FS_CONTROL_ACTIVE) return;
 
 	if (FS_Config_Get()->enable_logging)
 	{
 		// Save to log file
-		FS_Log_WriteIMUData(FS_IMU_GetData());
+		FS_Log_WriteMicData(FS_Mic_GetData());
 	}
 }
 
@@ -23,29 +23,97 @@
 
 #include "main.h"
 #include "active_control.h"
+#include "adc.h"
+#include "ahrs.h"
+#include "altitude.h"
 #include "app_common.h"
 #include "app_fatfs.h"
 #include "audio.h"
 #include "audio_control.h"
 #include "baro.h"
+#include "capture.h"
 #include "config.h"
 #include "gnss.h"
 #include "hum.h"
 #include "imu.h"
+#include "kalman.h"
 #include "log.h"
 #include "mag.h"
+#include "mic.h"
+#include "phase.h"
 #include "resource_manager.h"
 #include "sensor.h"
+#include "sensor_init.h"
 #include "state.h"
 #include "vbat.h"
 
 extern UART_HandleTypeDef huart1;
 extern ADC_HandleTypeDef hadc1;
 
+static bool isSystemHealthy;
+static uint8_t sensorsStarted = 0;	// bit for each FS_SensorInit_Sensor_t
+static bool startPending = false;
+
+#define SENSOR_BIT(sensor) (1 << (sensor))
+
+static void FS_ActiveMode_StartSensor(FS_SensorInit_Sensor_t sensor)
+{
+	if (sensorsStarted & SENSOR_BIT(sensor)) return;
+
+	if ((sensor == FS_SENSOR_INIT_BARO) && FS_Config_Get()->enable_baro)
+	{
+		/* Start barometer */
+		if (FS_Baro_Start() != HAL_OK)
+		{
+			isSystemHealthy = false;
+			FS_Log_WriteEvent("Barometer start failed");
+		}
+		sensorsStarted |= SENSOR_BIT(sensor);
+	}
+
+	if ((sensor == FS_SENSOR_INIT_HUM) && FS_Config_Get()->enable_hum)
+	{
+		/* Start humidity and temperature */
+		if (FS_Hum_Start() != HAL_OK)
+		{
+			isSystemHealthy = false;
+			FS_Log_WriteEvent("Humidity sensor start failed");
+		}
+		sensorsStarted |= SENSOR_BIT(sensor);
+	}
+
+	if ((sensor == FS_SENSOR_INIT_MAG) && FS_Config_Get()->enable_mag)
+	{
+		/* Start magnetometer */
+		if (FS_Mag_Start() != HAL_OK)
+		{
+			isSystemHealthy = false;
+			FS_Log_WriteEvent("Magnetometer start failed");
+		}
+		sensorsStarted |= SENSOR_BIT(sensor);
+	}
+}
+
+static void FS_ActiveMode_StartSensors(void)
+{
+	FS_ActiveMode_StartSensor(FS_SENSOR_INIT_BARO);
+	FS_ActiveMode_StartSensor(FS_SENSOR_INIT_HUM);
+	FS_ActiveMode_StartSensor(FS_SENSOR_INIT_MAG);
+
+	if (sensorsStarted)
+	{
+		/* Start reading sensors */
+		FS_Sensor_Resume();
+	}
+}
+
 void FS_ActiveMode_Init(void)
 {
 	uint8_t enable_flags;
-	bool isSystemHealthy = true;
+
+	isSystemHealthy = true;
+	sensorsStarted = 0;
+	startPending = false;
 
 	/* Initialize FatFS */
 	FS_ResourceManager_RequestResource(FS_RESOURCE_FATFS);
@@ -79,6 +147,7 @@ void FS_ActiveMode_Init(void)
 		if (FS_Config_Get()->enable_imu)  enable_flags |= FS_LOG_ENABLE_SENSOR;
 		if (FS_Config_Get()->enable_mag)  enable_flags |= FS_LOG_ENABLE_SENSOR;
 		if (FS_Config_Get()->enable_vbat) enable_flags |= FS_LOG_ENABLE_SENSOR;
+		if (FS_Config_Get()->enable_mic)  enable_flags |= FS_LOG_ENABLE_SENSOR;
 		if (FS_Config_Get()->enable_raw)  enable_flags |= FS_LOG_ENABLE_RAW;
 
 		// Enable logging
@@ -95,6 +164,13 @@ void FS_ActiveMode_Init(void)
 		FS_Log_WriteEvent("%lu/%lu timers used before active mode initialization",
 				HW_TS_CountUsed() - 2, CFG_HW_TS_MAX_NBR_CONCURRENT_TIMER);
 		FS_Log_WriteEvent("----------");
+
+		if (FS_SensorInit_IsDone())
+		{
+			// Log sensor bring-up times
+			FS_SensorInit_LogTimes();
+			FS_Log_WriteEvent("----------");
+		}
 	}
 
 	if (FS_Config_Get()->enable_audio)
@@ -110,6 +186,24 @@ void FS_ActiveMode_Init(void)
 		FS_AudioControl_Init();
 	}
 
+	if (FS_Config_Get()->enable_logging)
+	{
+		// Enable pre-trigger capture
+		FS_Capture_Init();
+	}
+
+	if (FS_Config_Get()->enable_kf)
+	{
+		// Enable navigation filter
+		FS_Kalman_Init();
+	}
+
+	if (FS_Config_Get()->enable_ahrs)
+	{
+		// Enable attitude estimate
+		FS_AHRS_Init();
+	}
+
 	if (FS_Config_Get()->enable_vbat || FS_Config_Get()->enable_mic)
 	{
 		// Enable ADC
@@ -132,7 +226,16 @@ void FS_ActiveMode_Init(void)
 	if (FS_Config_Get()->enable_mic)
 	{
 		// Enable microphone
-		HAL_GPIO_WritePin(MIC_EN_GPIO_Port, MIC_EN_Pin, GPIO_PIN_SET);
+		FS_Mic_Init();
+	}
+
+	if (FS_Config_Get()->enable_vbat || FS_Config_Get()->enable_mic)
+	{
+		// Start background ADC scan
+		if (FS_ADC_Start() != HAL_OK)
+		{
+			isSystemHealthy = false;
+		}
 	}
 
 	/* Enable USART */
@@ -141,6 +244,12 @@ void FS_ActiveMode_Init(void)
 	/* Initialize GNSS */
 	FS_GNSS_Init();
 
+	// Initialize fused altitude
+	FS_Altitude_Init();
+
+	// Initialize flight phase
+	FS_Phase_Init();
+
 	if (FS_Config_Get()->enable_gnss)
 	{
 		/* Start GNSS */
@@ -152,40 +261,18 @@ void FS_ActiveMode_Init(void)
 		FS_GNSS_Stop();
 	}
 
-	if (FS_Config_Get()->enable_baro)
-	{
-		/* Start barometer */
-		if (FS_Baro_Start() != HAL_OK)
-		{
-			isSystemHealthy = false;
-			FS_Log_WriteEvent("Barometer start failed");
-		}
-	}
+	/* Reset I2C statistics for this session */
+	FS_Sensor_ResetStats();
 
-	if (FS_Config_Get()->enable_hum)
+	if (FS_SensorInit_IsDone())
 	{
-		/* Start humidity and temperature */
-		if (FS_Hum_Start() != HAL_OK)
-		{
-			isSystemHealthy = false;
-			FS_Log_WriteEvent("Humidity sensor start failed");
-		}
+		/* Start I2C sensors */
+		FS_ActiveMode_StartSensors();
 	}
-
-	if (FS_Config_Get()->enable_mag)
-	{
-		/* Start magnetometer */
-		if (FS_Mag_Start() != HAL_OK)
-		{
-			isSystemHealthy = false;
-			FS_Log_WriteEvent("Magnetometer start failed");
-		}
-	}
-
-	if (FS_Config_Get()->enable_baro || FS_Config_Get()->enable_hum || FS_Config_Get()->enable_mag)
+	else
 	{
-		/* Start reading sensors */
-		FS_Sensor_Start();
+		/* Start I2C sensors when bring-up completes */
+		startPending = true;
 	}
 
 	if (FS_Config_Get()->enable_imu)
@@ -207,34 +294,51 @@ void FS_ActiveMode_DeInit(void)
 	/* Disable controller */
 	FS_ActiveControl_DeInit();
 
+	// Disable flight phase
+	FS_Phase_DeInit();
+
+	// Disable pre-trigger capture
+	FS_Capture_DeInit();
+
 	if (FS_Config_Get()->enable_imu)
 	{
 		/* Stop IMU */
 		FS_IMU_Stop();
 	}
 
-	if (FS_Config_Get()->enable_baro || FS_Config_Get()->enable_hum || FS_Config_Get()->enable_mag)
+	/* Cancel deferred sensor start */
+	startPending = false;
+
+	if (sensorsStarted)
 	{
 		/* Stop reading sensors */
 		FS_Sensor_Stop();
-	}
 
-	if (FS_Config_Get()->enable_mag)
-	{
-		/* Stop magnetometer */
-		FS_Mag_Stop();
-	}
+		if (sensorsStarted & SENSOR_BIT(FS_SENSOR_INIT_MAG))
+		{
+			/* Stop magnetometer */
+			FS_Mag_Stop();
+		}
 
-	if (FS_Config_Get()->enable_hum)
-	{
-		/* Stop humidity and temperature */
-		FS_Hum_Stop();
-	}
+		if (sensorsStarted & SENSOR_BIT(FS_SENSOR_INIT_HUM))
+		{
+			/* Stop humidity and temperature */
+			FS_Hum_Stop();
+		}
 
-	if (FS_Config_Get()->enable_baro)
-	{
-		/* Stop barometer */
-		FS_Baro_Stop();
+		if (sensorsStarted & SENSOR_BIT(FS_SENSOR_INIT_BARO))
+		{
+			/* Stop barometer */
+			FS_Baro_Stop();
+		}
+
+		if (!FS_SensorInit_IsDone())
+		{
+			/* Let bring-up of the remaining sensors finish */
+			FS_Sensor_Resume();
+		}
+
+		sensorsStarted = 0;
 	}
 
 	/* Disable GNSS */
@@ -243,10 +347,16 @@ void FS_ActiveMode_DeInit(void)
 	/* Disable USART */
 	HAL_UART_DeInit(&huart1);
 
+	if (FS_Config_Get()->enable_vbat || FS_Config_Get()->enable_mic)
+	{
+		// Stop background ADC scan
+		FS_ADC_Stop();
+	}
+
 	if (FS_Config_Get()->enable_mic)
 	{
 		// Disable microphone
-		HAL_GPIO_WritePin(MIC_EN_GPIO_Port, MIC_EN_Pin, GPIO_PIN_RESET);
+		FS_Mic_DeInit();
 	}
 
 	if (FS_Config_Get()->enable_vbat)
@@ -264,6 +374,18 @@ void FS_ActiveMode_DeInit(void)
 		}
 	}
 
+	if (FS_Config_Get()->enable_kf)
+	{
+		// Disable navigation filter
+		FS_Kalman_DeInit();
+	}
+
+	if (FS_Config_Get()->enable_ahrs)
+	{
+		// Disable attitude estimate
+		FS_AHRS_DeInit();
+	}
+
 	if (FS_Config_Get()->enable_audio)
 	{
 		// Disable audio control
@@ -288,3 +410,30 @@ void FS_ActiveMode_DeInit(void)
 	/* De-initialize FatFS */
 	FS_ResourceManager_ReleaseResource(FS_RESOURCE_FATFS);
 }
+
+void FS_SensorInit_Ready_Callback(FS_SensorInit_Sensor_t sensor)
+{
+	if (startPending)
+	{
+		/* Start logging from this sensor while the others are probed */
+		FS_ActiveMode_StartSensor(sensor);
+	}
+}
+
+void FS_SensorInit_Done_Callback(void)
+{
+	if (startPending)
+	{
+		startPending = false;
+
+		// Log sensor bring-up times
+		FS_SensorInit_LogTimes();
+		FS_Log_WriteEvent("----------");
+
+		/* Start I2C sensors */
+		FS_ActiveMode_StartSensors();
+
+		/* Update health status */
+		FS_ActiveControl_SetHealthStatus(isSystemHealthy);
+	}
+}
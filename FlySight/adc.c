@@ -0,0 +1,114 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2024 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#include "main.h"
+#include "adc.h"
+#include "log.h"
+#include "mic.h"
+#include "stm32wbxx_ll_rcc.h"
+#include "vbat.h"
+
+extern ADC_HandleTypeDef hadc1;
+extern TIM_HandleTypeDef htim2;
+
+static uint16_t adcBuf[2 * FS_ADC_BLOCK_LEN * FS_ADC_CHANNELS];
+
+// Error logging
+static volatile uint32_t adc_error_code;
+
+void HAL_ADC_ErrorCallback(ADC_HandleTypeDef *hadc)
+{
+	adc_error_code = hadc->ErrorCode;
+
+	// Check for a recoverable overrun error.
+	if (adc_error_code & HAL_ADC_ERROR_OVR)
+	{
+		// This is non-fatal. We will log it and the DMA will carry on with the next scan.
+		FS_Log_WriteEventAsync("ADC non-fatal error: 0x%lX", adc_error_code);
+	}
+	else
+	{
+		// Any other error (especially DMA or Internal) is critical and unrecoverable.
+		Error_Handler();
+	}
+}
+
+static uint32_t FS_ADC_GetTimerClock(void)
+{
+	// APB1 timers run at twice PCLK1 unless the APB1 prescaler is 1
+	if (LL_RCC_GetAPB1Prescaler() == LL_RCC_APB1_DIV_1)
+	{
+		return HAL_RCC_GetPCLK1Freq();
+	}
+	else
+	{
+		return 2 * HAL_RCC_GetPCLK1Freq();
+	}
+}
+
+HAL_StatusTypeDef FS_ADC_Start(void)
+{
+	// TIM2 update event triggers each scan
+	MX_TIM2_Init();
+	__HAL_TIM_SET_AUTORELOAD(&htim2, FS_ADC_GetTimerClock() / FS_ADC_RATE - 1);
+
+	if (HAL_ADC_Start_DMA(&hadc1, (uint32_t *) adcBuf,
+			sizeof(adcBuf) / sizeof(adcBuf[0])) != HAL_OK)
+	{
+		FS_Log_WriteEvent("Couldn't start ADC");
+		return HAL_ERROR;
+	}
+
+	// Start triggering conversions
+	if (HAL_TIM_Base_Start(&htim2) != HAL_OK)
+	{
+		FS_Log_WriteEvent("Couldn't start ADC trigger");
+		HAL_ADC_Stop_DMA(&hadc1);
+		return HAL_ERROR;
+	}
+
+	return HAL_OK;
+}
+
+void FS_ADC_Stop(void)
+{
+	// Stop triggering conversions
+	HAL_TIM_Base_Stop(&htim2);
+	HAL_TIM_Base_DeInit(&htim2);
+
+	HAL_ADC_Stop_DMA(&hadc1);
+}
+
+void FS_ADC_HalfComplete(void)
+{
+	// First half of the buffer is ready
+	FS_Mic_ProcessBlock(&adcBuf[0], FS_ADC_BLOCK_LEN);
+	FS_VBAT_ProcessBlock(&adcBuf[0], FS_ADC_BLOCK_LEN);
+}
+
+void FS_ADC_Complete(void)
+{
+	// Second half of the buffer is ready
+	FS_Mic_ProcessBlock(&adcBuf[FS_ADC_BLOCK_LEN * FS_ADC_CHANNELS], FS_ADC_BLOCK_LEN);
+	FS_VBAT_ProcessBlock(&adcBuf[FS_ADC_BLOCK_LEN * FS_ADC_CHANNELS], FS_ADC_BLOCK_LEN);
+}
@@ -0,0 +1,41 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2024 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#ifndef ADC_H_
+#define ADC_H_
+
+#define FS_ADC_RATE       8000	// scan rate (Hz)
+#define FS_ADC_BLOCK_LEN  256	// scans per half buffer
+
+// Position of each channel within a scan
+#define FS_ADC_RANK_MIC   0
+#define FS_ADC_RANK_VBAT  1
+#define FS_ADC_CHANNELS   2
+
+HAL_StatusTypeDef FS_ADC_Start(void);
+void FS_ADC_Stop(void);
+
+void FS_ADC_HalfComplete(void);
+void FS_ADC_Complete(void);
+
+#endif /* ADC_H_ */
@@ -0,0 +1,439 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2024 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "main.h"
+#include "app_common.h"
+#include "ahrs.h"
+#include "config.h"
+#include "log.h"
+
+#define AHRS_CONVERT_COUNT  16		// IMU samples converted at a time
+
+#define AHRS_KP             1.0f	// proportional gain
+#define AHRS_KI             0.01f	// integral gain
+#define AHRS_KP_INIT        10.0f	// proportional gain while converging
+#define AHRS_INIT_MSEC      2000	// time spent converging
+#define AHRS_ACCEL_GATE     0.2f	// maximum deviation of |a| from 1 g (g)
+#define AHRS_MAG_MSEC       1000	// maximum age of magnetometer sample
+#define AHRS_MAX_DT         0.1f	// maximum integration step (s)
+
+#define AHRS_DEG_TO_RAD     ((float) (M_PI / 180))
+#define AHRS_RAD_TO_DEG     ((float) (180 / M_PI))
+
+// Orientation of body frame relative to local level (x north, y west, z up)
+static float q0, q1, q2, q3;
+
+// Integral feedback (rad/s)
+static float ix, iy, iz;
+
+// Last magnetometer sample, normalized and rotated with the gyro since
+static float mx, my, mz;
+static uint32_t magTime;
+static bool magValid;
+static bool magFresh;		// not yet rotated to an IMU sample time
+
+static uint32_t lastMs;
+static uint16_t lastUs;
+static uint32_t startTime;
+static bool started;
+static uint32_t outputCount;
+
+static FS_IMU_Data_t imuConv[AHRS_CONVERT_COUNT];
+
+static FS_AHRS_Data_t ahrsData;
+static FS_AHRS_Stats_t stats;
+
+static void FS_AHRS_Update(const FS_IMU_Data_t *data)
+{
+	const uint32_t start = DWT->CYCCNT;
+	float gx, gy, gz, ax, ay, az, norm, dt, dtMag, kp;
+	float q0q0, q0q1, q0q2, q0q3, q1q1, q1q2, q1q3, q2q2, q2q3, q3q3;
+	float hx, hy;
+	float vx, vy, vz;
+	float ex = 0, ey = 0, ez = 0;
+	float qa, qb, qc;
+
+	dt = ((int32_t) (data->time - lastMs) * 1000 + ((int32_t) data->timeUs - lastUs)) * 1e-6f;
+	dt = MIN(MAX(dt, 0), AHRS_MAX_DT);
+
+	lastMs = data->time;
+	lastUs = data->timeUs;
+
+	gx = data->wx * (AHRS_DEG_TO_RAD / 1000);
+	gy = data->wy * (AHRS_DEG_TO_RAD / 1000);
+	gz = data->wz * (AHRS_DEG_TO_RAD / 1000);
+
+	ax = data->ax * 1e-5f;
+	ay = data->ay * 1e-5f;
+	az = data->az * 1e-5f;
+
+	// Keep the held magnetometer sample current in body axes, rotating a
+	// new sample only from its own timestamp
+	dtMag = dt;
+	if (magFresh)
+	{
+		dtMag = MIN(MAX((int32_t) (data->time - magTime) * 1e-3f, 0), dt);
+		magFresh = false;
+	}
+
+	vx = (my * gz - mz * gy) * dtMag;
+	vy = (mz * gx - mx * gz) * dtMag;
+	vz = (mx * gy - my * gx) * dtMag;
+	mx += vx;
+	my += vy;
+	mz += vz;
+
+	q0q0 = q0 * q0;
+	q0q1 = q0 * q1;
+	q0q2 = q0 * q2;
+	q0q3 = q0 * q3;
+	q1q1 = q1 * q1;
+	q1q2 = q1 * q2;
+	q1q3 = q1 * q3;
+	q2q2 = q2 * q2;
+	q2q3 = q2 * q3;
+	q3q3 = q3 * q3;
+
+	// Use accelerometer only when it measures mostly gravity
+	norm = sqrtf(ax * ax + ay * ay + az * az);
+	if (fabsf(norm - 1.0f) < AHRS_ACCEL_GATE)
+	{
+		ax /= norm;
+		ay /= norm;
+		az /= norm;
+
+		// Estimated direction of gravity (half)
+		vx = q1q3 - q0q2;
+		vy = q0q1 + q2q3;
+		vz = q0q0 - 0.5f + q3q3;
+
+		ex = ay * vz - az * vy;
+		ey = az * vx - ax * vz;
+		ez = ax * vy - ay * vx;
+
+		if (magValid && (data->time - magTime < AHRS_MAG_MSEC))
+		{
+			// Magnetic field in local level frame
+			hx = 2.0f * (mx * (0.5f - q2q2 - q3q3) + my * (q1q2 - q0q3) + mz * (q1q3 + q0q2));
+			hy = 2.0f * (mx * (q1q2 + q0q3) + my * (0.5f - q1q1 - q3q3) + mz * (q2q3 - q0q1));
+			norm = sqrtf(hx * hx + hy * hy);
+
+			if (norm > 0)
+			{
+				// Correct heading about the vertical only, so the
+				// magnetometer cannot disturb pitch and roll
+				hy /= norm;
+
+				// Full correction when more than 90 degrees out
+				if (hx < 0) hy = (hy < 0) ? -1.0f : 1.0f;
+
+				ex -= 2.0f * hy * vx;
+				ey -= 2.0f * hy * vy;
+				ez -= 2.0f * hy * vz;
+			}
+		}
+
+		kp = (lastMs - startTime < AHRS_INIT_MSEC) ? AHRS_KP_INIT : AHRS_KP;
+
+		// Integral feedback estimates gyro bias
+		ix += AHRS_KI * ex * dt;
+		iy += AHRS_KI * ey * dt;
+		iz += AHRS_KI * ez * dt;
+
+		gx += kp * ex;
+		gy += kp * ey;
+		gz += kp * ez;
+	}
+	else
+	{
+		++stats.accelRejects;
+	}
+
+	gx += ix;
+	gy += iy;
+	gz += iz;
+
+	// Integrate rate of change of quaternion
+	gx *= 0.5f * dt;
+	gy *= 0.5f * dt;
+	gz *= 0.5f * dt;
+
+	qa = q0;
+	qb = q1;
+	qc = q2;
+
+	q0 += -qb * gx - qc * gy - q3 * gz;
+	q1 += qa * gx + qc * gz - q3 * gy;
+	q2 += qa * gy - qb * gz + q3 * gx;
+	q3 += qa * gz + qb * gy - qc * gx;
+
+	norm = 1.0f / sqrtf(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+	q0 *= norm;
+	q1 *= norm;
+	q2 *= norm;
+	q3 *= norm;
+
+	++stats.updateCount;
+	stats.updateMax = MAX(stats.updateMax, DWT->CYCCNT - start);
+}
+
+// Start from the attitude given by the first accelerometer sample, and
+// by the magnetometer if a sample is available, so the estimator does
+// not have to converge from an arbitrary guess. Starting level when the
+// device is upside down leaves no gravity correction at all.
+static void FS_AHRS_Align(const FS_IMU_Data_t *data)
+{
+	float ux, uy, uz, nx, ny, nz, wx, wy, wz, norm, s;
+
+	// Up in body axes
+	ux = data->ax;
+	uy = data->ay;
+	uz = data->az;
+	norm = sqrtf(ux * ux + uy * uy + uz * uz);
+	if (norm == 0) return;
+	ux /= norm;
+	uy /= norm;
+	uz /= norm;
+
+	// West is up crossed with north, or with body x without a field
+	if (magValid)
+	{
+		wx = uy * mz - uz * my;
+		wy = uz * mx - ux * mz;
+		wz = ux * my - uy * mx;
+	}
+	else
+	{
+		wx = 0;
+		wy = uz;
+		wz = -uy;
+	}
+
+	norm = sqrtf(wx * wx + wy * wy + wz * wz);
+	if (norm < 0.1f)
+	{
+		// Reference is vertical, use body y instead
+		wx = -uz;
+		wy = 0;
+		wz = ux;
+		norm = sqrtf(wx * wx + wz * wz);
+	}
+	wx /= norm;
+	wy /= norm;
+	wz /= norm;
+
+	// North completes the frame
+	nx = wy * uz - wz * uy;
+	ny = wz * ux - wx * uz;
+	nz = wx * uy - wy * ux;
+
+	// Rows of the body to local level rotation are north, west and up
+	if (nx + wy + uz > 0)
+	{
+		s = 0.5f / sqrtf(1.0f + nx + wy + uz);
+		q0 = 0.25f / s;
+		q1 = (uy - wz) * s;
+		q2 = (nz - ux) * s;
+		q3 = (wx - ny) * s;
+	}
+	else if (nx > wy && nx > uz)
+	{
+		s = 0.5f / sqrtf(1.0f + nx - wy - uz);
+		q0 = (uy - wz) * s;
+		q1 = 0.25f / s;
+		q2 = (ny + wx) * s;
+		q3 = (nz + ux) * s;
+	}
+	else if (wy > uz)
+	{
+		s = 0.5f / sqrtf(1.0f + wy - nx - uz);
+		q0 = (nz - ux) * s;
+		q1 = (ny + wx) * s;
+		q2 = 0.25f / s;
+		q3 = (wz + uy) * s;
+	}
+	else
+	{
+		s = 0.5f / sqrtf(1.0f + uz - nx - wy);
+		q0 = (wx - ny) * s;
+		q1 = (nz + ux) * s;
+		q2 = (wz + uy) * s;
+		q3 = 0.25f / s;
+	}
+}
+
+static void FS_AHRS_Output(void)
+{
+	float heading;
+
+	ahrsData.time = lastMs;
+	ahrsData.timeUs = lastUs;
+
+	ahrsData.q0 = lroundf(q0 * 10000);
+	ahrsData.q1 = lroundf(q1 * 10000);
+	ahrsData.q2 = lroundf(q2 * 10000);
+	ahrsData.q3 = lroundf(q3 * 10000);
+
+	// Heading clockwise from magnetic north, pitch nose up, roll right side down
+	heading = -atan2f(q1 * q2 + q0 * q3, 0.5f - q2 * q2 - q3 * q3) * AHRS_RAD_TO_DEG;
+	if (heading < 0) heading += 360;
+
+	ahrsData.heading = lroundf(heading * 10) % 3600;
+	ahrsData.pitch = lroundf(asinf(MIN(MAX(2.0f * (q1 * q3 - q0 * q2), -1.0f), 1.0f)) * AHRS_RAD_TO_DEG * 10);
+	ahrsData.roll = lroundf(atan2f(q0 * q1 + q2 * q3, 0.5f - q1 * q1 - q2 * q2) * AHRS_RAD_TO_DEG * 10);
+}
+
+void FS_AHRS_Init(void)
+{
+	// Enable cycle counter
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	q0 = 1;
+	q1 = 0;
+	q2 = 0;
+	q3 = 0;
+
+	ix = 0;
+	iy = 0;
+	iz = 0;
+
+	magValid = false;
+	started = false;
+	outputCount = 0;
+
+	memset(&ahrsData, 0, sizeof(ahrsData));
+	memset(&stats, 0, sizeof(stats));
+}
+
+void FS_AHRS_DeInit(void)
+{
+	// Log estimator statistics
+	FS_Log_WriteEvent("AHRS: %lu updates, max %lu cycles, %lu without accelerometer",
+			stats.updateCount, stats.updateMax, stats.accelRejects);
+}
+
+void FS_AHRS_UpdateIMU(const FS_IMU_Raw_t *raw, uint32_t count)
+{
+	const FS_IMU_Scale_t *scale = FS_IMU_GetScale();
+	const uint8_t rate = FS_Config_Get()->ahrs_log_dec;
+	uint32_t primask_bit;
+	uint32_t i, j, n;
+	bool output;
+
+	for (i = 0; i < count; i += n)
+	{
+		n = MIN(count - i, AHRS_CONVERT_COUNT);
+
+		FS_IMU_Convert(scale, &raw[i], imuConv, n);
+
+		for (j = 0; j < n; ++j)
+		{
+			output = false;
+
+			primask_bit = __get_PRIMASK();
+			__disable_irq();
+
+			if (!started)
+			{
+				lastMs = startTime = imuConv[j].time;
+				lastUs = imuConv[j].timeUs;
+				started = true;
+
+				FS_AHRS_Align(&imuConv[j]);
+			}
+
+			FS_AHRS_Update(&imuConv[j]);
+
+			if (++outputCount >= rate)
+			{
+				FS_AHRS_Output();
+				outputCount = 0;
+				output = true;
+			}
+
+			__set_PRIMASK(primask_bit);
+
+			if (output)
+			{
+				FS_AHRS_DataReady_Callback();
+			}
+		}
+	}
+}
+
+void FS_AHRS_UpdateMag(const FS_Mag_Data_t *mag)
+{
+	const FS_Config_Data_t *config = FS_Config_Get();
+	uint32_t primask_bit;
+	float x, y, z, norm;
+
+	// Remove hard-iron offset, which is fixed in the magnetometer frame
+	x = mag->x - config->mag_off_x;
+	y = mag->y - config->mag_off_y;
+	z = mag->z - config->mag_off_z;
+
+	norm = sqrtf(x * x + y * y + z * z);
+	if (norm == 0) return;
+
+	primask_bit = __get_PRIMASK();
+	__disable_irq();
+
+	// FS_Mag_Read negates z, which leaves the magnetometer frame aligned
+	// with the IMU sensor frame. Rotate it into body axes the same way
+	// FS_IMU_Convert does.
+	mx = -y / norm;
+	my = x / norm;
+	mz = z / norm;
+	magTime = mag->time;
+	magValid = true;
+	magFresh = true;
+
+	__set_PRIMASK(primask_bit);
+}
+
+bool FS_AHRS_IsValid(void)
+{
+	return started && (lastMs - startTime >= AHRS_INIT_MSEC);
+}
+
+const FS_AHRS_Data_t *FS_AHRS_GetData(void)
+{
+	return &ahrsData;
+}
+
+const FS_AHRS_Stats_t *FS_AHRS_GetStats(void)
+{
+	return &stats;
+}
+
+__weak void FS_AHRS_DataReady_Callback(void)
+{
+  /* NOTE: This function should not be modified, when the callback is needed,
+           the FS_AHRS_DataReady_Callback could be implemented in the user file
+   */
+}
@@ -0,0 +1,61 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2024 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#ifndef AHRS_H_
+#define AHRS_H_
+
+#include <stdbool.h>
+
+#include "imu.h"
+#include "mag.h"
+
+typedef struct
+{
+	uint32_t time;		// ms
+	int16_t  q0;		// quaternion * 10000, body to local level
+	int16_t  q1;
+	int16_t  q2;
+	int16_t  q3;
+	int16_t  heading;	// magnetic heading (deg * 10)
+	int16_t  pitch;		// nose up (deg * 10)
+	int16_t  roll;		// right side down (deg * 10)
+	uint16_t timeUs;	// us past time
+} FS_AHRS_Data_t;
+
+typedef struct
+{
+	uint32_t updateMax;		// maximum cycles per update
+	uint32_t updateCount;	// updates
+	uint32_t accelRejects;	// updates without accelerometer correction
+} FS_AHRS_Stats_t;
+
+void FS_AHRS_Init(void);
+void FS_AHRS_DeInit(void);
+void FS_AHRS_UpdateIMU(const FS_IMU_Raw_t *raw, uint32_t count);
+void FS_AHRS_UpdateMag(const FS_Mag_Data_t *mag);
+bool FS_AHRS_IsValid(void);
+const FS_AHRS_Data_t *FS_AHRS_GetData(void);
+const FS_AHRS_Stats_t *FS_AHRS_GetStats(void);
+void FS_AHRS_DataReady_Callback(void);
+
+#endif /* AHRS_H_ */
@@ -0,0 +1,180 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2024 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#include <math.h>
+#include <stdbool.h>
+
+#include "main.h"
+#include "altitude.h"
+#include "timestamp.h"
+
+#define ALT_COUNT        32		// estimates buffered for the reader
+#define ALT_ALPHA        0.25f	// altitude gain
+#define ALT_BETA         0.0357f	// vertical speed gain
+#define ALT_ANCHOR_GAIN  0.05f	// fraction of GNSS error corrected per epoch
+#define ALT_ANCHOR_JUMP  50.0f	// GNSS error above which offset is reset (m)
+#define ALT_ANCHOR_VACC  10000	// maximum GNSS vertical accuracy for anchoring (mm)
+#define ALT_ANCHOR_MSEC  10000	// maximum time since last anchor (ms)
+#define ALT_BARO_MSEC    1000	// maximum time between barometer samples (ms)
+
+static FS_Altitude_Data_t altBuf[ALT_COUNT];
+static volatile uint32_t altRdI;
+static volatile uint32_t altWrI;
+
+static FS_Altitude_Data_t altData;	// latest estimate
+
+// Filter state driven at barometer rate
+static float altH;				// pressure altitude (m)
+static float altV;				// rate of climb (m/s)
+static uint32_t baroMs;			// time of last barometer sample (ms)
+static uint16_t baroUs;			// time of last barometer sample (us past baroMs)
+static bool baroValid;
+
+// Anchor to GNSS altitude
+static float offset;			// GNSS height minus pressure altitude (m)
+static uint32_t anchorTime;		// time of last anchor (ms)
+static bool anchored;
+
+void FS_Altitude_Init(void)
+{
+	altRdI = 0;
+	altWrI = 0;
+
+	baroValid = false;
+	offset = 0;
+	anchored = false;
+}
+
+void FS_Altitude_UpdateBaro(const FS_Baro_Data_t *baro)
+{
+	FS_Altitude_Data_t *data;
+	float z, dt, r;
+
+	// Standard atmosphere pressure altitude
+	z = 44330.8f * (1.0f - powf(baro->pressure / (100.0f * 101325.0f), 0.190263f));
+
+	dt = ((int32_t) (baro->time - baroMs) * 1000 + ((int32_t) baro->timeUs - baroUs)) * 1e-6f;
+
+	if (!baroValid || dt <= 0 || dt > ALT_BARO_MSEC / 1000.0f)
+	{
+		// Restart filter
+		altH = z;
+		altV = 0;
+		baroValid = true;
+	}
+	else
+	{
+		// Alpha-beta filter
+		altH += altV * dt;
+		r = z - altH;
+		altH += ALT_ALPHA * r;
+		altV += ALT_BETA * r / dt;
+	}
+
+	baroMs = baro->time;
+	baroUs = baro->timeUs;
+
+	if (!anchored) return;
+
+	altData.time = baro->time;
+	altData.timeUs = baro->timeUs;
+	altData.hMSL = lroundf((altH + offset) * 1000);
+	altData.velD = lroundf(-altV * 1000);
+
+	if (altWrI < altRdI + ALT_COUNT)
+	{
+		data = &altBuf[altWrI % ALT_COUNT];
+		*data = altData;
+		++altWrI;
+	}
+}
+
+void FS_Altitude_UpdateGNSS(const FS_GNSS_Data_t *gnss)
+{
+	uint32_t primask_bit;
+	uint32_t towMS;
+	uint16_t towUs, week;
+	int32_t age;
+	float h, e;
+
+	if (gnss->gpsFix != 3) return;
+	if (gnss->vAcc >= ALT_ANCHOR_VACC) return;
+
+	primask_bit = __get_PRIMASK();
+	__disable_irq();
+
+	if (baroValid)
+	{
+		h = altH;
+
+		// Move pressure altitude back to the GNSS epoch
+		if (FS_Timestamp_ToGNSS(baroMs, baroUs, &week, &towMS, &towUs))
+		{
+			age = (int32_t) (towMS - gnss->iTOW) * 1000 + towUs;
+			if (age > 0 && age < ALT_BARO_MSEC * 1000)
+			{
+				h -= altV * age * 1e-6f;
+			}
+		}
+
+		e = gnss->hMSL / 1000.0f - (h + offset);
+
+		if (!anchored || fabsf(e) > ALT_ANCHOR_JUMP)
+		{
+			offset += e;
+			anchored = true;
+		}
+		else
+		{
+			offset += ALT_ANCHOR_GAIN * e;
+		}
+
+		anchorTime = HAL_GetTick();
+	}
+
+	__set_PRIMASK(primask_bit);
+}
+
+bool FS_Altitude_IsValid(void)
+{
+	const uint32_t now = HAL_GetTick();
+
+	return anchored && baroValid
+			&& (now - anchorTime < ALT_ANCHOR_MSEC)
+			&& (now - baroMs < ALT_BARO_MSEC);
+}
+
+bool FS_Altitude_Read(FS_Altitude_Data_t *data)
+{
+	if (altRdI == altWrI) return false;
+
+	*data = altBuf[altRdI % ALT_COUNT];
+	++altRdI;
+
+	return true;
+}
+
+const FS_Altitude_Data_t *FS_Altitude_GetData(void)
+{
+	return &altData;
+}
@@ -0,0 +1,47 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2024 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#ifndef ALTITUDE_H_
+#define ALTITUDE_H_
+
+#include <stdbool.h>
+
+#include "baro.h"
+#include "gnss.h"
+
+typedef struct
+{
+	uint32_t time;		// ms
+	int32_t  hMSL;		// Height above mean sea level  (mm)
+	int32_t  velD;		// Down velocity                (mm/s)
+	uint16_t timeUs;	// us past time
+} FS_Altitude_Data_t;
+
+void FS_Altitude_Init(void);
+void FS_Altitude_UpdateBaro(const FS_Baro_Data_t *baro);
+void FS_Altitude_UpdateGNSS(const FS_GNSS_Data_t *gnss);
+bool FS_Altitude_IsValid(void);
+bool FS_Altitude_Read(FS_Altitude_Data_t *data);
+const FS_Altitude_Data_t *FS_Altitude_GetData(void);
+
+#endif /* ALTITUDE_H_ */
@@ -22,6 +22,7 @@
 ****************************************************************************/
 
 #include <stdbool.h>
+#include <string.h>
 
 #include "main.h"
 #include "app_common.h"
@@ -29,6 +30,7 @@
 #include "ff.h"
 #include "log.h"
 #include "stm32_seq.h"
+#include "wav.h"
 
 #define PLLSAI1_TIMEOUT_VALUE (2U) /* 2 ms */
 
@@ -47,7 +49,7 @@
 #define MAX9850_REG_DIGITAL_AUDIO 0x0a
 #define MAX9850_REG_RESERVED      0x0b
 
-#define AUDIO_SAMPLE_RATE      24000
+#define AUDIO_SAMPLE_RATE      WAV_OUTPUT_RATE
 #define AUDIO_INDEX_BITS       7
 #define AUDIO_INTERPOLATE_BITS 8
 
@@ -56,8 +58,18 @@
 #define AUDIO_UPDATE_MSEC 40
 #define AUDIO_UPDATE_RATE (AUDIO_UPDATE_MSEC*1000/CFG_TS_TICK_VAL)
 
-#define AUDIO_OP_TIMEOUT    100
 #define AUDIO_RETRY_TIMEOUT 1000
+#define AUDIO_WAIT_TIMEOUT  (2*AUDIO_RETRY_TIMEOUT)
+
+#define AUDIO_CODEC_QUEUE_LEN   16		// must be a power of 2
+#define AUDIO_CODEC_RETRY_MSEC  10
+#define AUDIO_CODEC_RETRY_TICKS (AUDIO_CODEC_RETRY_MSEC*1000/CFG_TS_TICK_VAL)
+
+#define AUDIO_VOLUME_UNKNOWN 0xff
+
+#define AUDIO_PACK_FILE    "/audio/speech.pak"
+#define AUDIO_PACK_VERSION 2
+#define AUDIO_PACK_MAX     128		// clips held in RAM index
 
 static const int16_t sineTable[] =
 {
@@ -76,7 +88,8 @@ static const int16_t sineTable[] =
 	-32767, -32728, -32610, -32413, -32138, -31786, -31357, -30852,
 	-30273, -29622, -28898, -28106, -27245, -26319, -25330, -24279,
 	-23170, -22005, -20788, -19520, -18205, -16846, -15447, -14010,
-	-12540, -11039,  -9512,  -7962,  -6393,  -4808,  -3212,  -1608
+	-12540, -11039,  -9512,  -7962,  -6393,  -4808,  -3212,  -1608,
+		 0		// guard sample, so index + 1 needs no wrap
 };
 
 static uint32_t audioStep;
@@ -92,11 +105,74 @@ static uint32_t readPos;
 static uint32_t writePos;
 
 static FIL audioFile;
+static FS_WAV_Decoder_t audioDec;	// decoder for current clip
+
+typedef struct
+{
+	char     magic[4];	// "FSPK"
+	uint16_t version;	// pack format version
+	uint16_t count;		// number of clips
+} FS_Audio_PackHeader_t;
+
+typedef struct
+{
+	char     name[12];	// 8.3 file name, terminated only if shorter
+	uint32_t offset;	// start of WAV file in pack (bytes)
+	uint32_t length;	// length of WAV file (bytes)
+} FS_Audio_PackEntry_t;
+
+static FIL packFile;
+static FS_Audio_PackEntry_t packIndex[AUDIO_PACK_MAX];
+static uint32_t packCount;			// 0 if no pack is open
 
 static char audioList[AUDIO_LIST_LEN];
 static char *audioListPtr;
 
-static uint8_t audioVolume;
+typedef struct FS_Audio_CodecWrite
+{
+	uint8_t reg;
+	uint8_t value;
+	void (*callback)(const struct FS_Audio_CodecWrite *write, HAL_StatusTypeDef result);
+} FS_Audio_CodecWrite_t;
+
+typedef enum
+{
+	AUDIO_ENTRY_BEEP,
+	AUDIO_ENTRY_PLAY,
+	AUDIO_ENTRY_PLAY_LIST,
+	AUDIO_ENTRY_STOP,
+	AUDIO_ENTRY_COUNT
+} FS_Audio_Entry_t;
+
+static const char *const entryNames[AUDIO_ENTRY_COUNT] =
+{
+	"FS_Audio_Beep",
+	"FS_Audio_Play",
+	"FS_Audio_PlayList",
+	"FS_Audio_Stop"
+};
+
+static FS_Audio_CodecWrite_t codecQueue[AUDIO_CODEC_QUEUE_LEN];
+static volatile uint32_t codecHead;		// next free entry
+static volatile uint32_t codecTail;		// write in progress
+static volatile bool codecBusy;
+static volatile bool codecAbort;		// abandon queue on first failure
+static uint8_t codecBuf;				// value on the bus
+static uint32_t codecStart;				// time current write was first tried (ms)
+static uint8_t codec_timer_id;
+
+static volatile uint8_t audioVolume;	// volume set in codec
+static volatile uint8_t codecVolume;	// volume most recently requested
+static volatile bool volumeQueued;		// volume write waiting to start
+
+static uint32_t codecWrites;			// register writes completed
+static uint32_t codecMerged;			// volume changes merged into a waiting write
+static uint32_t codecRetries;			// attempts repeated after an error
+static volatile uint32_t codecFailures;	// writes abandoned
+static uint32_t codecDropped;			// writes refused with queue full
+static volatile uint8_t codecFailReg;	// last register abandoned
+
+static uint32_t entryMaxCycles[AUDIO_ENTRY_COUNT];
 
 typedef enum
 {
@@ -116,11 +192,21 @@ static uint32_t updateLastCall;
 static uint32_t updateMaxInterval;
 static uint32_t bufferUsed;
 
+// Joins between clips in a list
+static uint32_t joinCount;		// clips queued behind a playing clip
+static uint32_t gapCount;		// clips started after the stream stopped
+static uint32_t gapTotalTime;	// total silence between clips (ms)
+static uint32_t gapMaxTime;		// longest silence between clips (ms)
+static volatile uint32_t stopTime;	// time the stream last stopped (ms)
+
 extern I2C_HandleTypeDef hi2c1;
 extern SAI_HandleTypeDef hsai_BlockA1;
 
 void FS_Audio_Stop(void);
 static void FS_Audio_Timer(void);
+static void FS_Audio_OpenPack(void);
+static void FS_Audio_ClosePack(void);
+static bool FS_Audio_QueueClip(void);
 static void FS_Audio_Update(void);
 
 void HAL_SAI_TxCpltCallback(SAI_HandleTypeDef *hsai)
@@ -132,6 +218,9 @@ void HAL_SAI_TxCpltCallback(SAI_HandleTypeDef *hsai)
 	}
 	else
 	{
+		// Remember when the stream stopped
+		stopTime = HAL_GetTick();
+
 		// Stop audio update timer
 		HW_TS_Stop(timer_id);
 
@@ -140,155 +229,297 @@ void HAL_SAI_TxCpltCallback(SAI_HandleTypeDef *hsai)
 	}
 }
 
-static HAL_StatusTypeDef FS_Audio_SetVolume(uint8_t volume)
+static void FS_Audio_CodecStart(void)
 {
-	uint8_t buf[1];
-	HAL_StatusTypeDef result;
-	uint32_t timeout;
+	FS_Audio_CodecWrite_t *write = &codecQueue[codecTail % AUDIO_CODEC_QUEUE_LEN];
 
-	if (audioVolume != volume)
+	// A waiting volume write takes the latest requested volume
+	if (write->reg == MAX9850_REG_VOLUME)
 	{
-		/* Set volume */
-		timeout = HAL_GetTick() + AUDIO_RETRY_TIMEOUT;
-		do
+		write->value = codecVolume;
+		volumeQueued = false;
+	}
+
+	codecBuf = write->value;
+
+	if (HAL_I2C_Mem_Write_IT(&hi2c1, MAX9850_ADDR, write->reg, 1, &codecBuf, 1) != HAL_OK)
+	{
+		FS_Audio_CodecError();
+	}
+}
+
+static void FS_Audio_CodecFinish(HAL_StatusTypeDef result)
+{
+	const FS_Audio_CodecWrite_t *write = &codecQueue[codecTail % AUDIO_CODEC_QUEUE_LEN];
+
+	if (result == HAL_OK)
+	{
+		++codecWrites;
+	}
+	else
+	{
+		++codecFailures;
+		codecFailReg = write->reg;
+	}
+
+	if (write->callback)
+	{
+		write->callback(write, result);
+	}
+
+	if ((result != HAL_OK) && codecAbort)
+	{
+		// Abandon writes queued behind the failed write
+		while (codecTail + 1 != codecHead)
 		{
-			buf[0] = volume;
-			result = HAL_I2C_Mem_Write(&hi2c1, MAX9850_ADDR, MAX9850_REG_VOLUME, 1, buf, 1, AUDIO_OP_TIMEOUT);
-			if (HAL_GetTick() > timeout)
+			write = &codecQueue[++codecTail % AUDIO_CODEC_QUEUE_LEN];
+			++codecFailures;
+
+			if (write->reg == MAX9850_REG_VOLUME)
 			{
-				FS_Log_WriteEvent("Couldn't set audio volume");
-				return HAL_ERROR;
+				volumeQueued = false;
 			}
-		}
-		while (result != HAL_OK);
 
-		audioVolume = volume;
+			if (write->callback)
+			{
+				write->callback(write, HAL_ERROR);
+			}
+		}
 	}
 
-	return HAL_OK;
+	if (++codecTail != codecHead)
+	{
+		// Begin next write
+		codecStart = HAL_GetTick();
+		FS_Audio_CodecStart();
+	}
+	else
+	{
+		codecBusy = false;
+	}
 }
 
-HAL_StatusTypeDef FS_Audio_Init(void)
+void FS_Audio_CodecComplete(void)
 {
-	uint8_t buf[1];
-	HAL_StatusTypeDef result;
-	uint32_t timeout;
+	// Ignore a late interrupt for a write abandoned in FS_Audio_DeInit
+	if (!codecBusy) return;
 
-	// Reset state
-	updateCount = 0;
-	updateTotalTime = 0;
-	updateMaxTime = 0;
-	updateMaxInterval = 0;
-	bufferUsed = 0;
+	FS_Audio_CodecFinish(HAL_OK);
+}
 
-	/* Initialize I2C1 */
-	MX_I2C1_Init();
+void FS_Audio_CodecError(void)
+{
+	if (!codecBusy) return;
 
-	/* Mute audio outputs */
-	timeout = HAL_GetTick() + AUDIO_RETRY_TIMEOUT;
-	do
+	if (HAL_GetTick() - codecStart < AUDIO_RETRY_TIMEOUT)
 	{
-		buf[0] = (0x3f << 0);
-		result = HAL_I2C_Mem_Write(&hi2c1, MAX9850_ADDR, MAX9850_REG_VOLUME, 1, buf, 1, AUDIO_OP_TIMEOUT);
-		if (HAL_GetTick() > timeout)
-		{
-			return HAL_ERROR;
-		}
+		// Try again later rather than spinning in the interrupt
+		++codecRetries;
+		HW_TS_Start(codec_timer_id, AUDIO_CODEC_RETRY_TICKS);
 	}
-	while (result != HAL_OK);
+	else
+	{
+		FS_Audio_CodecFinish(HAL_ERROR);
+	}
+}
 
-	audioVolume = 0x3f;
+static void FS_Audio_CodecTimer(void)
+{
+	FS_Audio_CodecStart();
+}
 
-	/* Set stereo mode */
-	timeout = HAL_GetTick() + AUDIO_RETRY_TIMEOUT;
-	do
+static bool FS_Audio_CodecWrite(
+		uint8_t reg,
+		uint8_t value,
+		void (*callback)(const FS_Audio_CodecWrite_t *, HAL_StatusTypeDef))
+{
+	FS_Audio_CodecWrite_t *write;
+	uint32_t primask_bit;
+	bool start = false;
+
+	/* Enter critical section */
+	primask_bit = __get_PRIMASK();
+	__disable_irq();
+
+	if (codecHead - codecTail >= AUDIO_CODEC_QUEUE_LEN)
 	{
-		buf[0] = 0;
-		result = HAL_I2C_Mem_Write(&hi2c1, MAX9850_ADDR, MAX9850_REG_GENERAL, 1, buf, 1, AUDIO_OP_TIMEOUT);
-		if (HAL_GetTick() > timeout)
-		{
-			return HAL_ERROR;
-		}
+		/* Exit critical section */
+		__set_PRIMASK(primask_bit);
+
+		++codecDropped;
+		return false;
 	}
-	while (result != HAL_OK);
 
-	/* Set IC = 0x0 (SF = 1) */
-	timeout = HAL_GetTick() + AUDIO_RETRY_TIMEOUT;
-	do
+	write = &codecQueue[codecHead % AUDIO_CODEC_QUEUE_LEN];
+	write->reg = reg;
+	write->value = value;
+	write->callback = callback;
+	++codecHead;
+
+	if (!codecBusy)
 	{
-		buf[0] = (0x0 << 2);
-		result = HAL_I2C_Mem_Write(&hi2c1, MAX9850_ADDR, MAX9850_REG_CLOCK, 1, buf, 1, AUDIO_OP_TIMEOUT);
-		if (HAL_GetTick() > timeout)
-		{
-			return HAL_ERROR;
-		}
+		codecBusy = true;
+		start = true;
 	}
-	while (result != HAL_OK);
 
-	/* Set CP = 0x09 */
-	timeout = HAL_GetTick() + AUDIO_RETRY_TIMEOUT;
-	do
+	/* Exit critical section */
+	__set_PRIMASK(primask_bit);
+
+	if (start)
 	{
-		buf[0] = (0x09 << 0);
-		result = HAL_I2C_Mem_Write(&hi2c1, MAX9850_ADDR, MAX9850_REG_CHARGE_PUMP, 1, buf, 1, AUDIO_OP_TIMEOUT);
-		if (HAL_GetTick() > timeout)
-		{
-			return HAL_ERROR;
-		}
+		codecStart = HAL_GetTick();
+		FS_Audio_CodecStart();
 	}
-	while (result != HAL_OK);
 
-	/* Set INT = 1 */
-	timeout = HAL_GetTick() + AUDIO_RETRY_TIMEOUT;
-	do
+	return true;
+}
+
+static bool FS_Audio_CodecWait(void)
+{
+	const uint32_t failures = codecFailures;
+	const uint32_t start = HAL_GetTick();
+	bool result = true;
+
+	// Each write gives up after AUDIO_RETRY_TIMEOUT
+	while (codecBusy)
 	{
-		buf[0] = (1 << 7);
-		result = HAL_I2C_Mem_Write(&hi2c1, MAX9850_ADDR, MAX9850_REG_LRCLK_MSB, 1, buf, 1, AUDIO_OP_TIMEOUT);
-		if (HAL_GetTick() > timeout)
+		if (HAL_GetTick() - start >= AUDIO_WAIT_TIMEOUT)
 		{
-			return HAL_ERROR;
+			result = false;
+			break;
 		}
 	}
-	while (result != HAL_OK);
 
-	/* Set LSB = 32 */
-	timeout = HAL_GetTick() + AUDIO_RETRY_TIMEOUT;
-	do
+	codecAbort = false;
+
+	return result && (codecFailures == failures);
+}
+
+static void FS_Audio_VolumeDone(
+		const FS_Audio_CodecWrite_t *write,
+		HAL_StatusTypeDef result)
+{
+	if (result == HAL_OK)
 	{
-		buf[0] = 32;
-		result = HAL_I2C_Mem_Write(&hi2c1, MAX9850_ADDR, MAX9850_REG_LRCLK_LSB, 1, buf, 1, AUDIO_OP_TIMEOUT);
-		if (HAL_GetTick() > timeout)
-		{
-			return HAL_ERROR;
-		}
+		audioVolume = write->value;
+	}
+	else if (!volumeQueued)
+	{
+		// Allow the next request to retry
+		codecVolume = audioVolume;
 	}
-	while (result != HAL_OK);
+}
 
-	/* Set slave mode, I2S, 16 bits */
-	timeout = HAL_GetTick() + AUDIO_RETRY_TIMEOUT;
-	do
+static void FS_Audio_SetVolume(uint8_t volume)
+{
+	uint32_t primask_bit;
+	bool queue = false;
+
+	/* Enter critical section */
+	primask_bit = __get_PRIMASK();
+	__disable_irq();
+
+	if (codecVolume != volume)
 	{
-		buf[0] = (0 << 7) | (0 << 6) | (0 << 5) | (0 << 4) | (1 << 3) | (0 << 2) | (0 << 0);
-		result = HAL_I2C_Mem_Write(&hi2c1, MAX9850_ADDR, MAX9850_REG_DIGITAL_AUDIO, 1, buf, 1, AUDIO_OP_TIMEOUT);
-		if (HAL_GetTick() > timeout)
+		codecVolume = volume;
+
+		if (volumeQueued)
 		{
-			return HAL_ERROR;
+			// Waiting write will pick up the new volume
+			++codecMerged;
+		}
+		else
+		{
+			volumeQueued = true;
+			queue = true;
 		}
 	}
-	while (result != HAL_OK);
 
-	/* Enable MCLK, charge pump, headphone output and DAC */
-	timeout = HAL_GetTick() + AUDIO_RETRY_TIMEOUT;
-	do
+	/* Exit critical section */
+	__set_PRIMASK(primask_bit);
+
+	if (queue && !FS_Audio_CodecWrite(MAX9850_REG_VOLUME, volume, FS_Audio_VolumeDone))
 	{
-		buf[0] = (1 << 7) | (1 << 6) | (1 << 5) | (1 << 4) | (1 << 3) | (1 << 2) | (1 << 0);
-		result = HAL_I2C_Mem_Write(&hi2c1, MAX9850_ADDR, MAX9850_REG_ENABLE, 1, buf, 1, AUDIO_OP_TIMEOUT);
-		if (HAL_GetTick() > timeout)
-		{
-			return HAL_ERROR;
-		}
+		volumeQueued = false;
+		codecVolume = audioVolume;
 	}
-	while (result != HAL_OK);
+}
+
+static void FS_Audio_EntryTime(
+		FS_Audio_Entry_t entry,
+		uint32_t start)
+{
+	entryMaxCycles[entry] = MAX(entryMaxCycles[entry], DWT->CYCCNT - start);
+}
+
+HAL_StatusTypeDef FS_Audio_Init(void)
+{
+	HAL_StatusTypeDef result = HAL_OK;
+	uint32_t timeout;
+
+	// Enable cycle counter
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	// Reset state
+	updateCount = 0;
+	updateTotalTime = 0;
+	updateMaxTime = 0;
+	updateMaxInterval = 0;
+	bufferUsed = 0;
+
+	joinCount = 0;
+	gapCount = 0;
+	gapTotalTime = 0;
+	gapMaxTime = 0;
+
+	codecHead = 0;
+	codecTail = 0;
+	codecBusy = false;
+	volumeQueued = false;
+	audioVolume = AUDIO_VOLUME_UNKNOWN;
+	codecVolume = AUDIO_VOLUME_UNKNOWN;
+
+	codecWrites = 0;
+	codecMerged = 0;
+	codecRetries = 0;
+	codecFailures = 0;
+	codecDropped = 0;
+
+	memset(entryMaxCycles, 0, sizeof(entryMaxCycles));
+
+	/* Initialize I2C1 */
+	MX_I2C1_Init();
+
+	// Initialize codec retry timer
+	HW_TS_Create(CFG_TIM_PROC_ID_ISR, &codec_timer_id, hw_ts_SingleShot, FS_Audio_CodecTimer);
+
+	// Abandon codec setup after the first failed write
+	codecAbort = true;
+
+	/* Mute audio outputs */
+	FS_Audio_SetVolume((0x3f << 0));
+
+	/* Set stereo mode */
+	FS_Audio_CodecWrite(MAX9850_REG_GENERAL, 0, NULL);
+
+	/* Set IC = 0x0 (SF = 1) */
+	FS_Audio_CodecWrite(MAX9850_REG_CLOCK, (0x0 << 2), NULL);
+
+	/* Set CP = 0x09 */
+	FS_Audio_CodecWrite(MAX9850_REG_CHARGE_PUMP, (0x09 << 0), NULL);
+
+	/* Set INT = 1 */
+	FS_Audio_CodecWrite(MAX9850_REG_LRCLK_MSB, (1 << 7), NULL);
+
+	/* Set LSB = 32 */
+	FS_Audio_CodecWrite(MAX9850_REG_LRCLK_LSB, 32, NULL);
+
+	/* Set slave mode, I2S, 16 bits */
+	FS_Audio_CodecWrite(MAX9850_REG_DIGITAL_AUDIO, (0 << 7) | (0 << 6) | (0 << 5) | (0 << 4) | (1 << 3) | (0 << 2) | (0 << 0), NULL);
+
+	/* Enable MCLK, charge pump, headphone output and DAC */
+	FS_Audio_CodecWrite(MAX9850_REG_ENABLE, (1 << 7) | (1 << 6) | (1 << 5) | (1 << 4) | (1 << 3) | (1 << 2) | (1 << 0), NULL);
 
 	/* Enable PLLSAI1 */
 	__HAL_RCC_PLLSAI1_ENABLE();
@@ -315,31 +546,58 @@ HAL_StatusTypeDef FS_Audio_Init(void)
 	// Initialize audio update timer
 	HW_TS_Create(CFG_TIM_PROC_ID_ISR, &timer_id, hw_ts_Repeated, FS_Audio_Timer);
 
-	return HAL_OK;
+	// Load speech pack index
+	FS_Audio_OpenPack();
+
+	// Wait for codec configuration queued above
+	if (!FS_Audio_CodecWait())
+	{
+		result = HAL_ERROR;
+	}
+
+	return result;
 }
 
 void FS_Audio_DeInit(void)
 {
-	uint8_t buf[1];
-	HAL_StatusTypeDef result;
-	uint32_t timeout;
+	uint32_t primask_bit;
+	uint8_t i;
 
 	// Stop audio output
 	FS_Audio_Stop();
 
+	// Close speech pack
+	FS_Audio_ClosePack();
+
 	/* Disable MCLK, charge pump, headphone output and DAC */
-	timeout = HAL_GetTick() + AUDIO_RETRY_TIMEOUT;
-	do
+	codecAbort = true;
+	if (!FS_Audio_CodecWrite(MAX9850_REG_ENABLE, 0, NULL) || !FS_Audio_CodecWait())
 	{
-		buf[0] = 0;
-		result = HAL_I2C_Mem_Write(&hi2c1, MAX9850_ADDR, MAX9850_REG_ENABLE, 1, buf, 1, AUDIO_OP_TIMEOUT);
-		if (HAL_GetTick() > timeout)
-		{
-			FS_Log_WriteEvent("Couldn't disable audio DAC");
-			break;
-		}
+		FS_Log_WriteEvent("Couldn't disable audio DAC");
+	}
+
+	// Delete codec retry timer
+	HW_TS_Delete(codec_timer_id);
+
+	if (codecBusy)
+	{
+		// Stop the write still on the bus, if any, before releasing I2C1
+		HAL_I2C_Master_Abort_IT(&hi2c1, MAX9850_ADDR);
+
+		/* Enter critical section */
+		primask_bit = __get_PRIMASK();
+		__disable_irq();
+
+		// Abandon the queue so that no write outlives the peripheral
+		codecFailures += codecHead - codecTail;
+		codecHead = 0;
+		codecTail = 0;
+		codecBusy = false;
+		volumeQueued = false;
+
+		/* Exit critical section */
+		__set_PRIMASK(primask_bit);
 	}
-	while (result != HAL_OK);
 
 	/* Disable I2C1 */
 	if (HAL_I2C_DeInit(&hi2c1) != HAL_OK)
@@ -363,40 +621,76 @@ void FS_Audio_DeInit(void)
 			(updateCount > 0) ? (updateTotalTime / updateCount) : 0);
 	FS_Log_WriteEvent("%lu ms maximum time spent in audio update task", updateMaxTime);
 	FS_Log_WriteEvent("%lu ms maximum time between calls to audio update task", updateMaxInterval);
+	FS_Log_WriteEvent("%lu clips joined without a gap, %lu restarted", joinCount, gapCount);
+	FS_Log_WriteEvent("%lu ms average silence between restarted clips",
+			(gapCount > 0) ? (gapTotalTime / gapCount) : 0);
+	FS_Log_WriteEvent("%lu ms maximum silence between restarted clips", gapMaxTime);
+	FS_Log_WriteEvent("%lu codec writes, %lu volume changes merged, %lu retries",
+			codecWrites, codecMerged, codecRetries);
+	if (codecFailures || codecDropped)
+	{
+		FS_Log_WriteEvent("%lu codec writes failed (last to register 0x%02x), %lu dropped",
+				codecFailures, codecFailReg, codecDropped);
+	}
+	for (i = 0; i < AUDIO_ENTRY_COUNT; ++i)
+	{
+		FS_Log_WriteEvent("%lu cycles maximum time spent in %s", entryMaxCycles[i], entryNames[i]);
+	}
 }
 
-static void FS_Audio_LoadTone(void)
+static inline int16_t FS_Audio_ToneSample(uint32_t phase)
 {
-	static uint32_t phase = 0;
+	const uint32_t index = phase >> (32 - AUDIO_INDEX_BITS);
+	const uint32_t a1 = (phase << AUDIO_INDEX_BITS) >> (32 - AUDIO_INTERPOLATE_BITS);
+	const uint32_t a2 = (1 << AUDIO_INTERPOLATE_BITS) - a1;
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+	uint32_t vals;
+
+	// Load both table entries at once and interpolate in one multiply
+	memcpy(&vals, &sineTable[index], sizeof(vals));
+	return (int16_t) ((int32_t) __SMLAD(vals, (a1 << 16) | a2, 0) >> AUDIO_INTERPOLATE_BITS);
+#else
+	const int32_t val1 = sineTable[index];
+	const int32_t val2 = sineTable[index + 1];
+
+	return (int16_t) ((val1 * (int32_t) a2 + val2 * (int32_t) a1) >> AUDIO_INTERPOLATE_BITS);
+#endif
+}
 
-	uint32_t size, i;
+static void FS_Audio_SynthTone(int16_t *dst, uint32_t count)
+{
+	static uint32_t phase = 0;
 
-	size = MIN(readPos + AUDIO_FRAME_LEN - writePos, audioLen);
-	size = MIN(AUDIO_FRAME_LEN, size);
+	uint32_t step = audioStep;
+	const uint32_t chirp = audioChirp;
+	uint32_t i;
 
-	for (i = 0; i < size; ++i, phase += audioStep, audioStep += audioChirp)
+	// Two samples per pass
+	for (i = 0; i + 1 < count; i += 2)
 	{
-		// Get sample value
-		const uint32_t index = phase >> (32 - AUDIO_INDEX_BITS);
-		const uint32_t a1 = (phase << AUDIO_INDEX_BITS) >> (32 - AUDIO_INTERPOLATE_BITS);
-		const uint32_t a2 = (1 << AUDIO_INTERPOLATE_BITS) - a1;
-		const int16_t val1 = sineTable[index];
-		const int16_t val2 = sineTable[(index + 1) % (1 << AUDIO_INDEX_BITS)];
-		const int16_t val = (val1 * a2 + val2 * a1) / (1 << AUDIO_INTERPOLATE_BITS);
+		dst[i] = FS_Audio_ToneSample(phase);
+		phase += step;
+		step += chirp;
 
-		// Copy sample into audioBuffer
-		audioBuffer[writePos % AUDIO_FRAME_LEN] = val;
+		dst[i + 1] = FS_Audio_ToneSample(phase);
+		phase += step;
+		step += chirp;
+	}
 
-		++writePos;
+	if (i < count)
+	{
+		dst[i] = FS_Audio_ToneSample(phase);
+		phase += step;
+		step += chirp;
 	}
 
-	audioLen -= size;
+	audioStep = step;
 }
 
-static void FS_Audio_LoadFile(void)
+static void FS_Audio_LoadTone(void)
 {
 	uint32_t size, s1, s2;
-	UINT br;
 
 	size = MIN(readPos + AUDIO_FRAME_LEN - writePos, audioLen);
 	size = MIN(AUDIO_FRAME_LEN, size);
@@ -404,14 +698,74 @@ static void FS_Audio_LoadFile(void)
 	s1 = MIN(AUDIO_FRAME_LEN - (writePos % AUDIO_FRAME_LEN), size);
 	s2 = size - s1;
 
-	// Read a block of data
-	f_read(&audioFile, &audioBuffer[writePos % AUDIO_FRAME_LEN], s1 * sizeof(audioBuffer[0]), &br);
-	f_read(&audioFile, &audioBuffer[0], s2 * sizeof(audioBuffer[0]), &br);
+	// Fill up to the end of the buffer, then from the start
+	FS_Audio_SynthTone(&audioBuffer[writePos % AUDIO_FRAME_LEN], s1);
+	FS_Audio_SynthTone(&audioBuffer[0], s2);
 
 	writePos += size;
 	audioLen -= size;
 }
 
+static void FS_Audio_LoadSilence(uint32_t space)
+{
+	uint32_t size, s1, s2;
+
+	// Pad out the last frame
+	size = MIN(lastFrame * AUDIO_FRAME_LEN - writePos, space);
+
+	s1 = MIN(AUDIO_FRAME_LEN - (writePos % AUDIO_FRAME_LEN), size);
+	s2 = size - s1;
+
+	memset(&audioBuffer[writePos % AUDIO_FRAME_LEN], 0, s1 * sizeof(audioBuffer[0]));
+	memset(&audioBuffer[0], 0, s2 * sizeof(audioBuffer[0]));
+
+	writePos += size;
+}
+
+static void FS_Audio_ReadClip(int16_t *dst, uint32_t count)
+{
+	const uint32_t n = FS_WAV_Read(&audioDec, dst, count);
+
+	// Fill with silence if the file ends early
+	memset(&dst[n], 0, (count - n) * sizeof(dst[0]));
+}
+
+static void FS_Audio_LoadFile(void)
+{
+	uint32_t space, size, s1, s2;
+
+	space = MIN(readPos + AUDIO_FRAME_LEN - writePos, AUDIO_FRAME_LEN);
+
+	while (space > 0)
+	{
+		if (audioLen == 0)
+		{
+			if ((audioState != AUDIO_PLAY_LIST) || !FS_Audio_QueueClip())
+			{
+				if (audioLen == 0)
+				{
+					// No more clips
+					FS_Audio_LoadSilence(space);
+				}
+				return;
+			}
+		}
+
+		size = MIN(space, audioLen);
+
+		s1 = MIN(AUDIO_FRAME_LEN - (writePos % AUDIO_FRAME_LEN), size);
+		s2 = size - s1;
+
+		// Decode a block of data
+		FS_Audio_ReadClip(&audioBuffer[writePos % AUDIO_FRAME_LEN], s1);
+		FS_Audio_ReadClip(&audioBuffer[0], s2);
+
+		writePos += size;
+		audioLen -= size;
+		space -= size;
+	}
+}
+
 static void FS_Audio_Load(void)
 {
 	switch (audioState)
@@ -449,6 +803,8 @@ void FS_Audio_Beep(
 		uint32_t duration,
 		uint8_t volume)
 {
+	const uint32_t start = DWT->CYCCNT;
+
 	if (audioState != AUDIO_IDLE)
 	{
 		FS_Audio_Stop();
@@ -456,7 +812,7 @@ void FS_Audio_Beep(
 
 	audioState = AUDIO_PLAY_TONE;
 
-	// Set volume
+	// Queue volume change
 	FS_Audio_SetVolume(volume);
 
 	// Remember frequency and duration
@@ -476,28 +832,131 @@ void FS_Audio_Beep(
 
 	// Start audio update timer
 	HW_TS_Start(timer_id, AUDIO_UPDATE_RATE);
+
+	FS_Audio_EntryTime(AUDIO_ENTRY_BEEP, start);
 }
 
-static bool FS_Audio_PlayFile(
+static void FS_Audio_OpenPack(void)
+{
+	FS_Audio_PackHeader_t header;
+	UINT br;
+
+	packCount = 0;
+
+	if (f_open(&packFile, AUDIO_PACK_FILE, FA_READ) != FR_OK)
+		return;
+
+	// Load clip index into RAM
+	if ((f_read(&packFile, &header, sizeof(header), &br) != FR_OK)
+			|| (br != sizeof(header))
+			|| (memcmp(header.magic, "FSPK", sizeof(header.magic)) != 0)
+			|| (header.version != AUDIO_PACK_VERSION)
+			|| (header.count > AUDIO_PACK_MAX)
+			|| (f_read(&packFile, packIndex, header.count * sizeof(packIndex[0]), &br) != FR_OK)
+			|| (br != header.count * sizeof(packIndex[0])))
+	{
+		FS_Log_WriteEvent("Couldn't read speech pack");
+		f_close(&packFile);
+		return;
+	}
+
+	packCount = header.count;
+	FS_Log_WriteEvent("Speech pack loaded with %lu clips", packCount);
+}
+
+static void FS_Audio_ClosePack(void)
+{
+	if (packCount > 0)
+	{
+		f_close(&packFile);
+		packCount = 0;
+	}
+}
+
+static const FS_Audio_PackEntry_t *FS_Audio_FindClip(
 		const char *filename)
 {
-	f_chdir("/audio");
+	const FS_Audio_PackEntry_t *entry;
+	uint32_t i, j;
+	char a, b;
 
-	if (f_open(&audioFile, filename, FA_READ) != FR_OK)
-		return false;
+	for (i = 0; i < packCount; ++i)
+	{
+		entry = &packIndex[i];
+
+		// Compare names without regard to case, as FatFs does
+		for (j = 0; j < sizeof(entry->name); ++j)
+		{
+			a = filename[j];
+			b = entry->name[j];
+			if ('A' <= a && a <= 'Z') a += 'a' - 'A';
+			if ('A' <= b && b <= 'Z') b += 'a' - 'A';
+			if (a != b || a == '\0') break;
+		}
+
+		// Match if both names end together, or the name fills the field
+		if ((j < sizeof(entry->name)) ? (a == b) : (filename[j] == '\0'))
+		{
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+static void FS_Audio_CloseClip(void)
+{
+	if (audioDec.file == &audioFile)
+	{
+		f_close(&audioFile);
+	}
+
+	audioDec.file = NULL;
+}
+
+static bool FS_Audio_OpenClip(
+		const char *filename)
+{
+	const FS_Audio_PackEntry_t *clip = FS_Audio_FindClip(filename);
+
+	// Close previous clip
+	FS_Audio_CloseClip();
 
-	// TODO: Change this to parse WAV file properly
-	f_lseek(&audioFile, 0x28);
+	if (clip)
+	{
+		// Seek to clip within speech pack
+		if (f_lseek(&packFile, clip->offset) != FR_OK)
+			return false;
+
+		if (!FS_WAV_Open(&audioDec, &packFile))
+		{
+			audioDec.file = NULL;
+			return false;
+		}
+	}
+	else
+	{
+		f_chdir("/audio");
+
+		if (f_open(&audioFile, filename, FA_READ) != FR_OK)
+			return false;
+
+		if (!FS_WAV_Open(&audioDec, &audioFile))
+		{
+			FS_Log_WriteEvent("Unsupported audio file %s", filename);
+			FS_Audio_CloseClip();
+			return false;
+		}
+	}
 
 	// Remember duration
-	UINT br;
-	uint32_t len;
-	f_read(&audioFile, &len, 4, &br);
-	audioLen = len / sizeof(audioBuffer[0]);
+	audioLen = FS_WAV_GetLength(&audioDec);
 
-	// TODO: Change this to parse WAV file properly
-	f_lseek(&audioFile, 0x2c);
+	return true;
+}
 
+static void FS_Audio_StartClip(void)
+{
 	// Initialize audio buffer
 	FS_Audio_InitTransfer(audioLen);
 
@@ -506,6 +965,15 @@ static bool FS_Audio_PlayFile(
 
 	// Start audio update timer
 	HW_TS_Start(timer_id, AUDIO_UPDATE_RATE);
+}
+
+static bool FS_Audio_PlayFile(
+		const char *filename)
+{
+	if (!FS_Audio_OpenClip(filename))
+		return false;
+
+	FS_Audio_StartClip();
 
 	return true;
 }
@@ -514,6 +982,8 @@ void FS_Audio_Play(
 		const char *filename,
 		uint8_t volume)
 {
+	const uint32_t start = DWT->CYCCNT;
+
 	if (audioState != AUDIO_IDLE)
 	{
 		FS_Audio_Stop();
@@ -521,16 +991,18 @@ void FS_Audio_Play(
 
 	audioState = AUDIO_PLAY_FILE;
 
-	// Set volume
+	// Queue volume change
 	FS_Audio_SetVolume(volume);
 
 	if (!FS_Audio_PlayFile(filename))
 	{
 		audioState = AUDIO_IDLE;
 	}
+
+	FS_Audio_EntryTime(AUDIO_ENTRY_PLAY, start);
 }
 
-static bool FS_Audio_LoadList(void)
+static bool FS_Audio_NextClip(void)
 {
 	char filename[20];
 	char ch;
@@ -540,27 +1012,74 @@ static bool FS_Audio_LoadList(void)
 		if ('0' <= ch && ch <= '9')
 		{
 			sprintf(filename, "%c.wav", ch);
-			if (FS_Audio_PlayFile(filename))
+			if (FS_Audio_OpenClip(filename))
 				return true;
 		}
 		else if (ch == '-')
 		{
-			if (FS_Audio_PlayFile("minus.wav"))
+			if (FS_Audio_OpenClip("minus.wav"))
 				return true;
 		}
 		else if (ch == '.')
 		{
-			if (FS_Audio_PlayFile("dot.wav"))
+			if (FS_Audio_OpenClip("dot.wav"))
 				return true;
 		}
 	}
+
+	// Stay at end of list
+	--audioListPtr;
+
 	return false;
 }
 
+static bool FS_Audio_QueueClip(void)
+{
+	uint32_t primask_bit;
+	bool queued = false;
+
+	if (!FS_Audio_NextClip())
+		return false;
+
+	/* Enter critical section */
+	primask_bit = __get_PRIMASK();
+	__disable_irq();
+
+	// Extend the stream if the last frame is still playing
+	if (frameCount < lastFrame)
+	{
+		lastFrame = (writePos + audioLen + AUDIO_FRAME_LEN - 1) / AUDIO_FRAME_LEN;
+		queued = true;
+	}
+
+	/* Exit critical section */
+	__set_PRIMASK(primask_bit);
+
+	if (queued)
+	{
+		++joinCount;
+	}
+
+	// Otherwise the clip is started when the stream stops
+	return queued;
+}
+
+static bool FS_Audio_LoadList(void)
+{
+	if (!FS_Audio_NextClip())
+		return false;
+
+	FS_Audio_StartClip();
+
+	return true;
+}
+
 void FS_Audio_PlayList(
 		const char *list,
 		uint8_t volume)
 {
+	const uint32_t start = DWT->CYCCNT;
+
 	if (audioState != AUDIO_IDLE)
 	{
 		FS_Audio_Stop();
@@ -572,7 +1091,7 @@ void FS_Audio_PlayList(
 	strncpy(audioList, list, sizeof(audioList));
 	audioListPtr = audioList;
 
-	// Set volume
+	// Queue volume change
 	FS_Audio_SetVolume(volume);
 
 	// Initialize audio buffer
@@ -580,6 +1099,8 @@ void FS_Audio_PlayList(
 	{
 		audioState = AUDIO_IDLE;
 	}
+
+	FS_Audio_EntryTime(AUDIO_ENTRY_PLAY_LIST, start);
 }
 
 static void FS_Audio_Idle(void)
@@ -589,7 +1110,7 @@ static void FS_Audio_Idle(void)
 		return;
 	case AUDIO_PLAY_FILE:
 	case AUDIO_PLAY_LIST:
-		f_close(&audioFile);
+		FS_Audio_CloseClip();
 		break;
 	default:
 		break;
@@ -605,6 +1126,7 @@ bool FS_Audio_IsIdle(void)
 
 void FS_Audio_Stop(void)
 {
+	const uint32_t start = DWT->CYCCNT;
 	uint32_t primask_bit;
 
 	/* Enter critical section */
@@ -622,6 +1144,8 @@ void FS_Audio_Stop(void)
 
 	// Go to idle state
 	FS_Audio_Idle();
+
+	FS_Audio_EntryTime(AUDIO_ENTRY_STOP, start);
 }
 
 static void FS_Audio_Timer(void)
@@ -658,20 +1182,21 @@ static void FS_Audio_Update(void)
 
 	if (count == lastFrame)
 	{
-		uint32_t prevState = audioState;
-
-		// Last frame complete
-		FS_Audio_Idle();
-
-		if (prevState == AUDIO_PLAY_LIST)
+		if ((audioState == AUDIO_PLAY_LIST)
+				&& ((audioLen > 0) || FS_Audio_NextClip()))
 		{
-			audioState = AUDIO_PLAY_LIST;
+			// Measure silence before the next clip
+			gapTotalTime += msStart - stopTime;
+			gapMaxTime = MAX(gapMaxTime, msStart - stopTime);
+			++gapCount;
 
-			// Initialize audio buffer
-			if (!FS_Audio_LoadList())
-			{
-				audioState = AUDIO_IDLE;
-			}
+			// Restart stream with a clip that could not be queued
+			FS_Audio_StartClip();
+		}
+		else
+		{
+			// Last frame complete
+			FS_Audio_Idle();
 		}
 	}
 	else
@@ -37,4 +37,7 @@ void FS_Audio_PlayList(const char *list, uint8_t volume);
 void FS_Audio_Stop(void);
 bool FS_Audio_IsIdle(void);
 
+void FS_Audio_CodecComplete(void);
+void FS_Audio_CodecError(void);
+
 #endif /* AUDIO_H_ */
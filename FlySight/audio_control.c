@@ -26,12 +26,17 @@
 
 #include "main.h"
 #include "app_common.h"
+#include "ahrs.h"
+#include "altitude.h"
 #include "audio.h"
 #include "audio_control.h"
 #include "common.h"
 #include "config.h"
+#include "kalman.h"
+#include "log.h"
 #include "nav.h"
 #include "stm32_seq.h"
+#include "timestamp.h"
 
 #define CONSUMER_TIMER_MSEC    10
 #define CONSUMER_TIMER_TICKS   (CONSUMER_TIMER_MSEC*1000/CFG_TS_TICK_VAL)
@@ -41,6 +46,8 @@
 #define INVALID_VALUE   INT32_MAX
 
 #define ALT_MIN         1500L // Minimum announced altitude (m)
+#define ALARM_REARM     3000L // Distance from last crossing before it can repeat (mm)
+#define GSPEED_MAX_AGE  2     // GNSS epochs before ground speed is stale
 
 #define FLAG_HAS_FIX         0x01
 #define FLAG_FIRST_FIX       0x02
@@ -51,13 +58,67 @@
 #define TONE_MIN_PITCH 220
 #define TONE_MAX_PITCH 1760
 
-static const uint16_t sas_table[] =
+#define SAS_TABLE_LEN  12
+
+typedef struct
+{
+	uint32_t count;			// alarms fired
+	uint64_t total;			// sum of latencies (us)
+	uint32_t max;			// maximum latency (us)
+} FS_AudioControl_Latency_t;
+
+typedef struct
+{
+	uint32_t count;			// calls
+	uint64_t total;			// sum of run times (cycles)
+	uint32_t max;			// maximum run time (cycles)
+} FS_AudioControl_Cycles_t;
+
+typedef struct
+{
+	int32_t elev;			// alarm elevation above MSL (mm)
+	uint8_t index;			// position in configuration
+	uint8_t type;
+	char    filename[13];	// clip name including extension
+} FS_AudioControl_Alarm_t;
+
+typedef struct
+{
+	// Alarms sorted by elevation
+	FS_AudioControl_Alarm_t alarms[FS_CONFIG_MAX_ALARMS];
+	uint8_t  num_alarms;
+	uint8_t  cursor;		// first alarm at or above last elevation sought
+
+	// Silence windows above MSL (mm)
+	int32_t  windowTop[FS_CONFIG_MAX_WINDOWS];
+	int32_t  windowBottom[FS_CONFIG_MAX_WINDOWS];
+
+	int32_t  altStepSize;	// altitude callout step (mm * 10), 0 = off
+	int32_t  altMin;		// minimum announced altitude above MSL (mm)
+
+	uint16_t volume;		// tone volume passed to audio
+	uint16_t spVolume;		// speech volume passed to audio
+
+	// Speech constants
+	uint32_t speechUnitMul[FS_CONFIG_MAX_SPEECH];	// speed units (1/65536)
+	int32_t  speechStepSize[FS_CONFIG_MAX_SPEECH];	// altitude step (mm * 10)
+
+	// Speed scaling
+	int16_t  sasSlope[SAS_TABLE_LEN - 1];
+	int32_t  sasHMSL;		// altitude of cached multiplier
+	uint16_t sasMul;		// cached multiplier
+	uint8_t  sasValid;
+} FS_AudioControl_Program_t;
+
+static const uint16_t sas_table[SAS_TABLE_LEN] =
 {
 	1024, 1077, 1135, 1197,
 	1265, 1338, 1418, 1505,
 	1600, 1704, 1818, 1944
 };
 
+static FS_AudioControl_Program_t program;
+
 static uint8_t timer_id;
 
 static uint8_t cur_speech;
@@ -68,8 +129,36 @@ static uint8_t flags;
 static uint8_t prev_flags;
 
 static int32_t prevHMSL;
+static uint32_t prevITOW;
+static int32_t lastGSpeed;
+static uint32_t lastGSpeedMs;
+
+static int32_t lastCross;
+static uint8_t lastCrossValid;
+
+static FS_Altitude_Data_t prevAlt;
+static uint8_t prevAltValid;
+
+static FS_AudioControl_Latency_t baroLatency;
+static FS_AudioControl_Latency_t gnssLatency;
+static FS_AudioControl_Latency_t decisionLatency;
+static FS_AudioControl_Latency_t speechLatency;
+
+static FS_AudioControl_Cycles_t producerCycles;
+static FS_AudioControl_Cycles_t consumerCycles;
+
+static uint32_t epochMs;			// arrival of current GNSS epoch or filter output
+static uint16_t epochUs;
+static uint8_t  epochKalman;		// current epoch is a filter output
+static uint16_t epochPeriod;		// time since previous update (ms)
+static uint32_t kalmanMs;			// filter time of previous update
+static uint8_t  kalmanValid;
+static uint32_t speechMs;			// epoch of value waiting to be spoken
+static uint16_t speechUs;
+static uint8_t  speechPending;
 
 static uint8_t g_suppress_tone;
+static uint8_t g_suppress_alt;
 
 static char speech_buf[16];
 static char *speech_ptr;
@@ -95,7 +184,7 @@ static void setChirp(uint32_t chirp)
 }
 
 static void setTone(
-	FS_Config_Data_t *config,
+	const FS_Config_Data_t *config,
 	int32_t val_1,
 	int32_t min_1,
 	int32_t max_1,
@@ -188,41 +277,54 @@ static void setTone(
 	#undef UNDER
 }
 
-static void getValues(
-	FS_GNSS_Data_t *current,
-	FS_Config_Data_t *config,
-	uint8_t mode,
-	int32_t *val,
-	int32_t *min,
-	int32_t *max)
+static uint16_t getSpeedMul(
+	const FS_Config_Data_t *config,
+	int32_t hMSL)
 {
-	const int32_t velD = current->velD / 10;
-
-	uint16_t speed_mul = 1024;
-
-	int32_t tVal;
+	if (!config->use_sas)
+	{
+		return 1024;
+	}
 
-	if (config->use_sas)
+	// Altitude usually changes between epochs, but not between callers
+	if (!program.sasValid || program.sasHMSL != hMSL)
 	{
-		if (current->hMSL < 0)
+		if (hMSL < 0)
 		{
-			speed_mul = sas_table[0];
+			program.sasMul = sas_table[0];
 		}
-		else if (current->hMSL >= 11534336L)
+		else if (hMSL >= 11534336L)
 		{
-			speed_mul = sas_table[11];
+			program.sasMul = sas_table[SAS_TABLE_LEN - 1];
 		}
 		else
 		{
-			int32_t h = current->hMSL / 1024;
-			uint16_t i = h / 1024;
-			uint16_t j = h % 1024;
-			uint16_t y1 = sas_table[i];
-			uint16_t y2 = sas_table[i + 1];
-			speed_mul = y1 + ((y2 - y1) * j) / 1024;
+			const int32_t h = hMSL / 1024;
+			const uint16_t i = h / 1024;
+			const uint16_t j = h % 1024;
+			program.sasMul = sas_table[i] + (program.sasSlope[i] * j) / 1024;
 		}
+
+		program.sasHMSL = hMSL;
+		program.sasValid = 1;
 	}
 
+	return program.sasMul;
+}
+
+static void getValues(
+	const FS_GNSS_Data_t *current,
+	const FS_Config_Data_t *config,
+	uint8_t mode,
+	int32_t *val,
+	int32_t *min,
+	int32_t *max)
+{
+	const int32_t velD = current->velD / 10;
+	const uint16_t speed_mul = getSpeedMul(config, current->hMSL);
+
+	int32_t tVal;
+
 	switch (mode)
 	{
 	case FS_CONFIG_MODE_HORIZONTAL_SPEED:
@@ -349,6 +451,18 @@ static void getValues(
 	case FS_CONFIG_MODE_DIVE_ANGLE:
 		*val = atan2(velD, current->gSpeed) / M_PI * 180;
 		break;
+	case FS_CONFIG_MODE_BODY_PITCH:
+		if (config->enable_ahrs && FS_AHRS_IsValid())
+		{
+			*val = FS_AHRS_GetData()->pitch / 10;
+		}
+		break;
+	case FS_CONFIG_MODE_BODY_ROLL:
+		if (config->enable_ahrs && FS_AHRS_IsValid())
+		{
+			*val = FS_AHRS_GetData()->roll / 10;
+		}
+		break;
 	}
 }
 
@@ -409,51 +523,19 @@ static char *numberToSpeech(
 }
 
 static void speakValue(
-	FS_Config_Data_t *config,
-	FS_GNSS_Data_t *current)
+	const FS_Config_Data_t *config,
+	const FS_GNSS_Data_t *current)
 {
 	const int32_t velD = current->velD / 10;
+	const uint16_t speed_mul = (uint16_t) (((uint32_t) getSpeedMul(config, current->hMSL)
+			* program.speechUnitMul[cur_speech]) / 65536);
 
-	uint16_t speed_mul = 1024;
-	int32_t step_size, step;
+	int32_t decimals = config->speech[cur_speech].decimals;
+	int32_t step;
 
 	char *end_ptr;
 
-	int32_t tVal;
-
-	if (config->use_sas)
-	{
-		if (current->hMSL < 0)
-		{
-			speed_mul = sas_table[0];
-		}
-		else if (current->hMSL >= 11534336L)
-		{
-			speed_mul = sas_table[11];
-		}
-		else
-		{
-			int32_t h = current->hMSL / 1024;
-			uint16_t i = h / 1024;
-			uint16_t j = h % 1024;
-			uint16_t y1 = sas_table[i];
-			uint16_t y2 = sas_table[i + 1];
-			speed_mul = y1 + ((y2 - y1) * j) / 1024;
-		}
-	}
-
-	switch (config->speech[cur_speech].units)
-	{
-	case FS_CONFIG_UNITS_KMH:
-		speed_mul = (uint16_t) (((uint32_t) speed_mul * 18204) / 65536);
-		break;
-	case FS_CONFIG_UNITS_MPH:
-		speed_mul = (uint16_t) (((uint32_t) speed_mul * 29297) / 65536);
-		break;
-	case FS_CONFIG_UNITS_KNOTS:
-		speed_mul = (uint16_t) (((uint32_t) speed_mul * 33713) / 65536);
-		break;
-	}
+	int32_t tVal = 0;
 
 	// Step 0: Initialize speech pointers, leaving room at the end for one unit character
 
@@ -500,14 +582,22 @@ static void speakValue(
 			//check if above height tone should be silenced
 			if ((current->hMSL > (config->end_nav+config->dz_elev)) || (config->end_nav == 0))
 			{
-				config->speech[cur_speech].decimals = 0;
+				decimals = 0;
 				tVal = calcDirection(current->lat,current->lon,config->lat,config->lon,current->heading);
 				speech_ptr = writeInt32ToBuf(speech_ptr, ABS(tVal)*100, 2, 1, 0);
 			}
+			else
+			{
+				*(--speech_ptr) = '\0';
+			}
+		}
+		else
+		{
+			*(--speech_ptr) = '\0';
 		}
 		break;
 	case FS_CONFIG_MODE_DISTANCE_TO_DESTINATION:
-		config->speech[cur_speech].decimals = 1;
+		decimals = 1;
 		tVal = calcDistance(current->lat,current->lon,config->lat,config->lon);  // returns metres
 		switch (config->speech[cur_speech].units)
 		{
@@ -528,26 +618,23 @@ static void speakValue(
 		//check if above height tone should be silenced
 		if ((current->hMSL > (config->end_nav+config->dz_elev)) || (config->end_nav == 0))
 		{
-			config->speech[cur_speech].decimals = 0;
+			decimals = 0;
 			tVal = calcRelBearing(config->bearing,current->heading/100000);
 			speech_ptr = writeInt32ToBuf(speech_ptr, ABS(tVal)*100, 2, 1, 0);
 		}
+		else
+		{
+			*(--speech_ptr) = '\0';
+		}
 		break;
 	case FS_CONFIG_MODE_DIVE_ANGLE:
 		speech_ptr = writeInt32ToBuf(speech_ptr, 100 * atan2(velD, current->gSpeed) / M_PI * 180, 2, 1, 0);
 		break;
 	case FS_CONFIG_MODE_ALTITUDE:
-		if (config->speech[cur_speech].units == FS_CONFIG_UNITS_METERS)
-		{
-			step_size = 10000 * config->speech[cur_speech].decimals;
-		}
-		else
-		{
-			step_size = 3048 * config->speech[cur_speech].decimals;
-		}
-		step = ((current->hMSL - config->dz_elev) * 10 + step_size / 2) / step_size;
+		step = ((current->hMSL - config->dz_elev) * 10 + program.speechStepSize[cur_speech] / 2)
+				/ program.speechStepSize[cur_speech];
 		speech_ptr = speech_buf + 2;
-		speech_ptr = numberToSpeech(step * config->speech[cur_speech].decimals, speech_ptr);
+		speech_ptr = numberToSpeech(step * decimals, speech_ptr);
 		end_ptr = speech_ptr;
 		speech_ptr = speech_buf + 2;
 		break;
@@ -564,8 +651,8 @@ static void speakValue(
 
 	if (config->speech[cur_speech].mode != FS_CONFIG_MODE_ALTITUDE)
 	{
-		if (config->speech[cur_speech].decimals == 0) end_ptr -= 4;
-		else end_ptr -= 3 - config->speech[cur_speech].decimals;
+		if (decimals == 0) end_ptr -= 4;
+		else end_ptr -= 3 - decimals;
 	}
 
 	// Step 3: Add units if needed, e.g., *(end_ptr++) = 'k';
@@ -608,60 +695,235 @@ static void speakValue(
 	*(end_ptr++) = '\0';
 }
 
-static void updateAlarms(
-	FS_Config_Data_t *config,
-	FS_GNSS_Data_t *current)
+static uint8_t seekAlarm(int32_t elev)
 {
-	const int32_t velD = current->velD / 10;
+	// Altitude changes little between calls, so walk from the last position
+	while ((program.cursor > 0) &&
+	       (program.alarms[program.cursor - 1].elev >= elev))
+	{
+		--program.cursor;
+	}
 
-	uint8_t i, suppress_tone, suppress_alt;
-	int32_t step_size, step, step_elev;
+	while ((program.cursor < program.num_alarms) &&
+	       (program.alarms[program.cursor].elev < elev))
+	{
+		++program.cursor;
+	}
 
-	char filename[13];
+	return program.cursor;
+}
 
-	suppress_tone = 0;
-	suppress_alt = 0;
+static uint8_t checkAlarms(
+	const FS_Config_Data_t *config,
+	int32_t prev,
+	int32_t current,
+	int32_t velD,
+	int32_t gSpeed,
+	int32_t *cross)
+{
+	const int32_t min = MIN(prev, current);
+	const int32_t max = MAX(prev, current);
 
-	for (i = 0; i < config->num_alarms; ++i)
+	const FS_AudioControl_Alarm_t *alarm = NULL;
+	uint8_t i, end;
+	int32_t step, step_elev;
+
+	// Rearm the last crossing once altitude leaves the band around it
+	if (lastCrossValid && (ABS(current - lastCross) > ALARM_REARM))
 	{
-		const int32_t alarm_elev = config->alarms[i].elev + config->dz_elev;
+		lastCrossValid = 0;
+	}
+
+	// Alarms crossed lie in [min, max), first configured alarm wins
+	i = seekAlarm(min);
+	end = seekAlarm(max);
 
-		if ((current->hMSL <= alarm_elev + config->alarm_window_above) &&
-		    (current->hMSL >= alarm_elev - config->alarm_window_below))
+	for (; i < end; ++i)
+	{
+		if (lastCrossValid && (program.alarms[i].elev == lastCross))
 		{
-			suppress_tone = 1;
-			break;
+			continue;
+		}
+
+		if (!alarm || program.alarms[i].index < alarm->index)
+		{
+			alarm = &program.alarms[i];
 		}
 	}
 
-	for (i = 0; i < config->num_windows; ++i)
+	if (alarm)
 	{
-		if ((config->windows[i].bottom + config->dz_elev <= current->hMSL) &&
-		    (config->windows[i].top + config->dz_elev >= current->hMSL))
+		switch (alarm->type)
 		{
-			suppress_tone = 1;
-			suppress_alt = 1;
+		case 1:	// beep
+			FS_Audio_Beep(TONE_MAX_PITCH, TONE_MAX_PITCH, 125, program.volume);
+			break ;
+		case 2:	// chirp up
+			FS_Audio_Beep(TONE_MIN_PITCH, TONE_MAX_PITCH, 125, program.volume);
+			break ;
+		case 3:	// chirp down
+			FS_Audio_Beep(TONE_MAX_PITCH, TONE_MIN_PITCH, 125, program.volume);
+			break ;
+		case 4:	// play file
+			FS_Audio_Play(alarm->filename, program.spVolume);
 			break;
 		}
+
+		*speech_ptr = '\0';
+		*cross = alarm->elev;
+		lastCross = alarm->elev;
+		lastCrossValid = 1;
+		return 1;
 	}
 
-	if (config->alt_step > 0)
+	if ((program.altStepSize > 0) &&
+	    (prev >= program.altMin) &&
+	    (*speech_ptr == 0) &&
+	    !(flags & FLAG_SAY_ALTITUDE) &&
+	    !g_suppress_alt)
 	{
-		if (config->alt_units == FS_CONFIG_UNITS_METERS)
+		step = ((current - config->dz_elev) * 10 + program.altStepSize / 2) / program.altStepSize;
+		step_elev = step * program.altStepSize / 10 + config->dz_elev;
+
+		if ((step_elev >= min && step_elev < max) &&
+		    !(lastCrossValid && (step_elev == lastCross)) &&
+		    ABS(velD) >= config->threshold &&
+		    gSpeed >= config->hThreshold)
 		{
-			step_size = 10000 * config->alt_step;
+			speech_ptr = speech_buf;
+			speech_ptr = numberToSpeech(step * config->alt_step, speech_ptr);
+			*(speech_ptr++) = (config->alt_units == FS_CONFIG_UNITS_METERS) ? 'm' : 'f';
+			*(speech_ptr++) = '\0';
+			speech_ptr = speech_buf;
+
+			*cross = step_elev;
+			lastCross = step_elev;
+			lastCrossValid = 1;
+			return 1;
 		}
-		else
+	}
+
+	return 0;
+}
+
+static void addLatency(
+	FS_AudioControl_Latency_t *latency,
+	int32_t total)
+{
+	if (total < 0) return;
+
+	++latency->count;
+	latency->total += total;
+	latency->max = MAX(latency->max, (uint32_t) total);
+}
+
+static void recordLatency(
+	FS_AudioControl_Latency_t *latency,
+	int32_t prev,
+	int32_t current,
+	int32_t cross,
+	int32_t span,
+	int32_t age)
+{
+	// Interpolate crossing time between samples
+	const int32_t lag = (int64_t) span * (current - cross) / (current - prev);
+
+	addLatency(latency, age + lag);
+}
+
+static void logLatency(
+	const char *source,
+	const FS_AudioControl_Latency_t *latency)
+{
+	FS_Log_WriteEvent("%lu alarms from %s, mean latency %lu us, max %lu us",
+			latency->count, source,
+			latency->count ? (uint32_t) (latency->total / latency->count) : 0,
+			latency->max);
+}
+
+static void recordCycles(
+	FS_AudioControl_Cycles_t *cycles,
+	uint32_t start)
+{
+	const uint32_t elapsed = DWT->CYCCNT - start;
+
+	++cycles->count;
+	cycles->total += elapsed;
+	cycles->max = MAX(cycles->max, elapsed);
+}
+
+static void logCycles(
+	const char *task,
+	const FS_AudioControl_Cycles_t *cycles)
+{
+	FS_Log_WriteEvent("Audio control %s: %lu calls, mean %lu cycles, max %lu cycles",
+			task, cycles->count,
+			cycles->count ? (uint32_t) (cycles->total / cycles->count) : 0,
+			cycles->max);
+}
+
+static int32_t timeDiff(
+	uint32_t ms1, uint16_t us1,
+	uint32_t ms0, uint16_t us0)
+{
+	return (int32_t) (ms1 - ms0) * 1000 + ((int32_t) us1 - us0);
+}
+
+static void recordSince(
+	FS_AudioControl_Latency_t *latency,
+	uint32_t ms0, uint16_t us0)
+{
+	uint32_t ms;
+	uint16_t us;
+
+	FS_Timestamp_Get(&ms, &us);
+	addLatency(latency, timeDiff(ms, us, ms0, us0));
+}
+
+static void updateAlarms(
+	const FS_Config_Data_t *config,
+	const FS_GNSS_Data_t *current)
+{
+	const int32_t velD = current->velD / 10;
+
+	uint8_t i, suppress_tone, suppress_alt;
+	int32_t step, step_elev;
+	int32_t cross;
+
+	uint32_t ms, towMS;
+	uint16_t us, towUs, week;
+
+	suppress_tone = 0;
+	suppress_alt = 0;
+
+	// Nearest alarm at or above the bottom of the window
+	i = seekAlarm(current->hMSL - config->alarm_window_above);
+
+	if ((i < program.num_alarms) &&
+	    (program.alarms[i].elev <= current->hMSL + config->alarm_window_below))
+	{
+		suppress_tone = 1;
+	}
+
+	for (i = 0; i < config->num_windows; ++i)
+	{
+		if ((program.windowBottom[i] <= current->hMSL) &&
+		    (program.windowTop[i] >= current->hMSL))
 		{
-			step_size = 3048 * config->alt_step;
+			suppress_tone = 1;
+			suppress_alt = 1;
+			break;
 		}
+	}
 
-		step = ((current->hMSL - config->dz_elev) * 10 + step_size / 2) / step_size;
-		step_elev = step * step_size / 10 + config->dz_elev;
+	if (program.altStepSize > 0)
+	{
+		step = ((current->hMSL - config->dz_elev) * 10 + program.altStepSize / 2) / program.altStepSize;
+		step_elev = step * program.altStepSize / 10 + config->dz_elev;
 
 		if ((current->hMSL <= step_elev + config->alarm_window_above) &&
 		    (current->hMSL >= step_elev - config->alarm_window_below) &&
-		    (current->hMSL - config->dz_elev >= ALT_MIN * 1000))
+		    (current->hMSL >= program.altMin))
 		{
 			suppress_tone = 1;
 		}
@@ -675,66 +937,28 @@ static void updateAlarms(
 	}
 
 	g_suppress_tone = suppress_tone;
+	g_suppress_alt = suppress_alt;
 
-	if (prev_flags & FLAG_HAS_FIX)
+	// Crossings are detected at barometer rate when fused altitude is available
+	if ((prev_flags & FLAG_HAS_FIX) && !FS_Altitude_IsValid())
 	{
-		int32_t min = MIN(prevHMSL, current->hMSL);
-		int32_t max = MAX(prevHMSL, current->hMSL);
-
-		for (i = 0; i < config->num_alarms; ++i)
+		if (checkAlarms(config, prevHMSL, current->hMSL, velD, current->gSpeed, &cross))
 		{
-			const int32_t alarm_elev = config->alarms[i].elev + config->dz_elev;
-
-			if (alarm_elev >= min && alarm_elev < max)
-			{
-				switch (config->alarms[i].type)
-				{
-				case 1:	// beep
-					FS_Audio_Beep(TONE_MAX_PITCH, TONE_MAX_PITCH, 125, config->volume * 5);
-					break ;
-				case 2:	// chirp up
-					FS_Audio_Beep(TONE_MIN_PITCH, TONE_MAX_PITCH, 125, config->volume * 5);
-					break ;
-				case 3:	// chirp down
-					FS_Audio_Beep(TONE_MAX_PITCH, TONE_MIN_PITCH, 125, config->volume * 5);
-					break ;
-				case 4:	// play file
-					filename[0] = '\0';
-					strncat(filename, config->alarms[i].filename, sizeof(filename) - 1);
-					strncat(filename, ".wav", sizeof(filename) - 1);
-					FS_Audio_Play(filename, config->sp_volume * 5);
-					break;
-				}
-
-				*speech_ptr = '\0';
-				break;
-			}
-		}
+			FS_Timestamp_Get(&ms, &us);
 
-		if ((config->alt_step > 0) &&
-		    (i == config->num_alarms) &&
-		    (prevHMSL - config->dz_elev >= ALT_MIN * 1000) &&
-		    (*speech_ptr == 0) &&
-		    !(flags & FLAG_SAY_ALTITUDE) &&
-		    !suppress_alt)
-		{
-			if ((step_elev >= min && step_elev < max) &&
-			    ABS(velD) >= config->threshold &&
-			    current->gSpeed >= config->hThreshold)
+			if (FS_Timestamp_ToGNSS(ms, us, &week, &towMS, &towUs))
 			{
-				speech_ptr = speech_buf;
-				speech_ptr = numberToSpeech(step * config->alt_step, speech_ptr);
-				*(speech_ptr++) = (config->alt_units == FS_CONFIG_UNITS_METERS) ? 'm' : 'f';
-				*(speech_ptr++) = '\0';
-				speech_ptr = speech_buf;
+				recordLatency(&gnssLatency, prevHMSL, current->hMSL, cross,
+						(int32_t) (current->iTOW - prevITOW) * 1000,
+						(int32_t) (towMS - current->iTOW) * 1000 + towUs);
 			}
 		}
 	}
 }
 
 static void updateTones(
-	FS_Config_Data_t *config,
-	FS_GNSS_Data_t *current)
+	const FS_Config_Data_t *config,
+	const FS_GNSS_Data_t *current)
 {
 	const int32_t velD = current->velD / 10;
 
@@ -795,7 +1019,7 @@ static void updateTones(
 			x2 != INVALID_VALUE &&
 			max_1 != min_1)
 		{
-			val_2 = (int32_t) 1000 * (x2 - x0) / (int32_t) (2 * config->rate);
+			val_2 = (int32_t) 1000 * (x2 - x0) / (int32_t) (2 * epochPeriod);
 			val_2 = (int32_t) 10000 * ABS(val_2) / ABS(max_1 - min_1);
 		}
 	}
@@ -820,9 +1044,13 @@ static void updateTones(
 				for (i = 0; i < config->num_speech; ++i)
 				{
 					if ((config->speech[cur_speech].mode != FS_CONFIG_MODE_ALTITUDE) ||
-						(current->hMSL - config->dz_elev >= ALT_MIN * 1000))
+						(current->hMSL >= program.altMin))
 					{
 						speakValue(config, current);
+
+						speechMs = epochMs;
+						speechUs = epochUs;
+						speechPending = 1;
 						cur_speech = (cur_speech + 1) % config->num_speech;
 						break;
 					}
@@ -843,25 +1071,68 @@ static void updateTones(
 
 	if (sp_counter < config->sp_rate)
 	{
-		sp_counter += config->rate;
+		sp_counter += epochPeriod;
 	}
 }
 
 static void producerTask(void)
 {
-	FS_Config_Data_t config;
+	const uint32_t start = DWT->CYCCNT;
+	const FS_Config_Data_t *config = FS_Config_Get();
 	FS_GNSS_Data_t current;
 
+	uint32_t towMS;
+	uint16_t towUs, week;
+
 	// Copy to local variable
-	memcpy(&config, FS_Config_Get(), sizeof(FS_Config_Data_t));
 	memcpy(&current, FS_GNSS_GetData(), sizeof(FS_GNSS_Data_t));
 
+	if (epochKalman)
+	{
+		// Replace receiver solution with current filter estimate
+		FS_Kalman_Data_t kf;
+		memcpy(&kf, FS_Kalman_GetData(), sizeof(FS_Kalman_Data_t));
+
+		current.lat = kf.lat;
+		current.lon = kf.lon;
+		current.hMSL = kf.hMSL;
+		current.velN = kf.velN;
+		current.velE = kf.velE;
+		current.velD = kf.velD;
+		current.gSpeed = sqrtf((float) kf.velN * kf.velN + (float) kf.velE * kf.velE) / 10;
+		current.speed = sqrtf((float) current.gSpeed * current.gSpeed + (float) kf.velD * kf.velD / 100);
+
+		// Heading of motion (deg * 1e5)
+		current.heading = lroundf(atan2f(kf.velE, kf.velN) * (float) (180e5 / M_PI));
+		if (current.heading < 0)
+		{
+			current.heading += 36000000;
+		}
+
+		if (FS_Timestamp_ToGNSS(kf.time, kf.timeUs, &week, &towMS, &towUs))
+		{
+			current.iTOW = towMS;
+		}
+
+		// Outputs can arrive in bursts, so use the filter timeline
+		epochPeriod = kalmanValid ? MIN(MAX(kf.time - kalmanMs, 1), FS_GNSS_GetRate()) : FS_GNSS_GetRate();
+		kalmanMs = kf.time;
+		kalmanValid = 1;
+	}
+	else
+	{
+		epochPeriod = FS_GNSS_GetRate();
+		kalmanValid = 0;
+	}
+
 	if (current.gpsFix == 3)
 	{
 		flags |= FLAG_HAS_FIX;
+		lastGSpeed = current.gSpeed;
+		lastGSpeedMs = epochMs;
 
-		updateAlarms(&config, &current);
-		updateTones(&config, &current);
+		updateAlarms(config, &current);
+		updateTones(config, &current);
 
 		if (!(flags & FLAG_BEEP_DONE))
 		{
@@ -885,16 +1156,129 @@ static void producerTask(void)
 
 	prev_flags = flags;
 	prevHMSL = current.hMSL;
+	prevITOW = current.iTOW;
+
+	// Time from epoch arrival to tone and alarm decisions
+	recordSince(&decisionLatency, epochMs, epochUs);
+	recordCycles(&producerCycles, start);
+}
+
+static void baroTask(void)
+{
+	const FS_Config_Data_t *config = FS_Config_Get();
+	FS_Altitude_Data_t current;
+	int32_t cross;
+
+	uint32_t ms;
+	uint16_t us;
+
+	while (FS_Altitude_Read(&current))
+	{
+		if (!FS_Altitude_IsValid())
+		{
+			prevAltValid = 0;
+			continue;
+		}
+
+		// Horizontal speed comes from the last GNSS epoch
+		if ((flags & FLAG_HAS_FIX) && prevAltValid &&
+		    ((int32_t) (current.time - lastGSpeedMs) <= GSPEED_MAX_AGE * FS_GNSS_GetRate()))
+		{
+			if (checkAlarms(config, prevAlt.hMSL, current.hMSL, current.velD / 10, lastGSpeed, &cross))
+			{
+				FS_Timestamp_Get(&ms, &us);
+
+				recordLatency(&baroLatency, prevAlt.hMSL, current.hMSL, cross,
+						timeDiff(current.time, current.timeUs, prevAlt.time, prevAlt.timeUs),
+						timeDiff(ms, us, current.time, current.timeUs));
+			}
+		}
+
+		prevAlt = current;
+		prevAltValid = 1;
+	}
+}
+
+static void compileProgram(const FS_Config_Data_t *config)
+{
+	FS_AudioControl_Alarm_t alarm;
+	uint8_t i, j;
+
+	memset(&program, 0, sizeof(program));
+
+	// Insert alarms in order of elevation, keeping configured order for ties
+	for (i = 0; i < config->num_alarms; ++i)
+	{
+		alarm.elev = config->alarms[i].elev + config->dz_elev;
+		alarm.index = i;
+		alarm.type = config->alarms[i].type;
+
+		alarm.filename[0] = '\0';
+		strncat(alarm.filename, config->alarms[i].filename, sizeof(alarm.filename) - 1);
+		strncat(alarm.filename, ".wav", sizeof(alarm.filename) - strlen(alarm.filename) - 1);
+
+		for (j = i; (j > 0) && (program.alarms[j - 1].elev > alarm.elev); --j)
+		{
+			program.alarms[j] = program.alarms[j - 1];
+		}
+
+		program.alarms[j] = alarm;
+	}
+
+	program.num_alarms = config->num_alarms;
+
+	for (i = 0; i < config->num_windows; ++i)
+	{
+		program.windowTop[i] = config->windows[i].top + config->dz_elev;
+		program.windowBottom[i] = config->windows[i].bottom + config->dz_elev;
+	}
+
+	if (config->alt_step > 0)
+	{
+		program.altStepSize = ((config->alt_units == FS_CONFIG_UNITS_METERS) ? 10000 : 3048)
+				* config->alt_step;
+	}
+
+	program.altMin = config->dz_elev + ALT_MIN * 1000;
+
+	program.volume = config->volume * 5;
+	program.spVolume = config->sp_volume * 5;
+
+	for (i = 0; i < config->num_speech; ++i)
+	{
+		switch (config->speech[i].units)
+		{
+		case FS_CONFIG_UNITS_KMH:
+			program.speechUnitMul[i] = 18204;
+			break;
+		case FS_CONFIG_UNITS_MPH:
+			program.speechUnitMul[i] = 29297;
+			break;
+		case FS_CONFIG_UNITS_KNOTS:
+			program.speechUnitMul[i] = 33713;
+			break;
+		default:
+			program.speechUnitMul[i] = 65536;
+			break;
+		}
+
+		program.speechStepSize[i] = ((config->speech[i].units == FS_CONFIG_UNITS_METERS) ? 10000 : 3048)
+				* config->speech[i].decimals;
+	}
+
+	for (i = 0; i < SAS_TABLE_LEN - 1; ++i)
+	{
+		program.sasSlope[i] = sas_table[i + 1] - sas_table[i];
+	}
 }
 
 static void consumerTimer(void)
 {
 	static uint16_t tone_timer = 0;
-	const FS_Config_Data_t *config = FS_Config_Get();
 
 	if (FS_Audio_IsIdle() && !toneHold && toneRate > 0 && 0x10000 - tone_timer <= toneRate)
 	{
-		FS_Audio_Beep(tonePitch, tonePitch + toneChirp, 125, config->volume * 5);
+		FS_Audio_Beep(tonePitch, tonePitch + toneChirp, 125, program.volume);
 	}
 
 	tone_timer += toneRate;
@@ -905,7 +1289,7 @@ static void consumerTimer(void)
 
 static void consumerTask(void)
 {
-	const FS_Config_Data_t *config = FS_Config_Get();
+	const uint32_t start = DWT->CYCCNT;
 
 	if (*speech_ptr)
 	{
@@ -915,29 +1299,36 @@ static void consumerTask(void)
 
 			toneHold = 1;
 
+			if (speechPending)
+			{
+				// Time from epoch to first clip of a spoken value
+				recordSince(&speechLatency, speechMs, speechUs);
+				speechPending = 0;
+			}
+
 			if (*speech_ptr == '-')
 			{
-				FS_Audio_Play("minus.wav", config->sp_volume * 5);
+				FS_Audio_Play("minus.wav", program.spVolume);
 			}
 			else if (*speech_ptr == '.')
 			{
-				FS_Audio_Play("dot.wav", config->sp_volume * 5);
+				FS_Audio_Play("dot.wav", program.spVolume);
 			}
 			else if (*speech_ptr == 'h')
 			{
-				FS_Audio_Play("00.wav", config->sp_volume * 5);
+				FS_Audio_Play("00.wav", program.spVolume);
 			}
 			else if (*speech_ptr == 'k')
 			{
-				FS_Audio_Play("000.wav", config->sp_volume * 5);
+				FS_Audio_Play("000.wav", program.spVolume);
 			}
 			else if (*speech_ptr == 'm')
 			{
-				FS_Audio_Play("meters.wav", config->sp_volume * 5);
+				FS_Audio_Play("meters.wav", program.spVolume);
 			}
 			else if (*speech_ptr == 'f')
 			{
-				FS_Audio_Play("feet.wav", config->sp_volume * 5);
+				FS_Audio_Play("feet.wav", program.spVolume);
 			}
 			else if (*speech_ptr == 't')
 			{
@@ -950,7 +1341,7 @@ static void consumerTask(void)
 				filename[5] = 'v';
 				filename[6] = '\0';
 
-				FS_Audio_Play(filename, config->sp_volume * 5);
+				FS_Audio_Play(filename, program.spVolume);
 			}
 			else if (*speech_ptr == 'x')
 			{
@@ -963,7 +1354,7 @@ static void consumerTask(void)
 				filename[5] = 'v';
 				filename[6] = '\0';
 
-				FS_Audio_Play(filename, config->sp_volume * 5);
+				FS_Audio_Play(filename, program.spVolume);
 			}
 			else if (*speech_ptr == '>')
 			{
@@ -971,77 +1362,77 @@ static void consumerTask(void)
 				switch ((*speech_ptr) - 1)
 				{
 					case 0:
-						FS_Audio_Play("horz.wav", config->sp_volume * 5);
+						FS_Audio_Play("horz.wav", program.spVolume);
 						break;
 					case 1:
-						FS_Audio_Play("vert.wav", config->sp_volume * 5);
+						FS_Audio_Play("vert.wav", program.spVolume);
 						break;
 					case 2:
-						FS_Audio_Play("glide.wav", config->sp_volume * 5);
+						FS_Audio_Play("glide.wav", program.spVolume);
 						break;
 					case 3:
-						FS_Audio_Play("iglide.wav", config->sp_volume * 5);
+						FS_Audio_Play("iglide.wav", program.spVolume);
 						break;
 					case 4:
-						FS_Audio_Play("speed.wav", config->sp_volume * 5);
+						FS_Audio_Play("speed.wav", program.spVolume);
 						break;
 					case 5: // Direction to destination
-						FS_Audio_Play("directn.wav", config->sp_volume * 5);
+						FS_Audio_Play("directn.wav", program.spVolume);
 						break;
 					case 6: // Distance to destination
-						FS_Audio_Play("distance.wav", config->sp_volume * 5);
+						FS_Audio_Play("distance.wav", program.spVolume);
 						break;
 					case 7: // Direction to bearing
-						FS_Audio_Play("bearing.wav", config->sp_volume * 5);
+						FS_Audio_Play("bearing.wav", program.spVolume);
 						break;
 					case 11:
-						FS_Audio_Play("dive.wav", config->sp_volume * 5);
+						FS_Audio_Play("dive.wav", program.spVolume);
 						break;
 					case 12:
-						FS_Audio_Play("alt.wav", config->sp_volume * 5);
+						FS_Audio_Play("alt.wav", program.spVolume);
 						break;
 				}
 			}
 			else if (*speech_ptr == 'l')
 			{
-				FS_Audio_Play("left.wav", config->sp_volume * 5);
+				FS_Audio_Play("left.wav", program.spVolume);
 			}
 			else if (*speech_ptr == 'r')
 			{
-				FS_Audio_Play("right.wav", config->sp_volume * 5);
+				FS_Audio_Play("right.wav", program.spVolume);
 			}
 			else if (*speech_ptr == 'i')
 			{
-				FS_Audio_Play("miles.wav", config->sp_volume * 5);
+				FS_Audio_Play("miles.wav", program.spVolume);
 			}
 			else if (*speech_ptr == 'K')
 			{
-				FS_Audio_Play("km.wav", config->sp_volume * 5);
+				FS_Audio_Play("km.wav", program.spVolume);
 			}
 			else if (*speech_ptr == 'n')
 			{
-				FS_Audio_Play("knots.wav", config->sp_volume * 5);
+				FS_Audio_Play("knots.wav", program.spVolume);
 			}
 			else if (*speech_ptr == 'o')
 			{
-				FS_Audio_Play("oclock.wav", config->sp_volume * 5);
+				FS_Audio_Play("oclock.wav", program.spVolume);
 			}
 			else if (*speech_ptr == 'a')
 			{
-				FS_Audio_Play("10.wav", config->sp_volume * 5);
+				FS_Audio_Play("10.wav", program.spVolume);
 			}
 			else if (*speech_ptr == 'b')
 			{
-				FS_Audio_Play("11.wav", config->sp_volume * 5);
+				FS_Audio_Play("11.wav", program.spVolume);
 			}
 			else if (*speech_ptr == 'c')
 			{
-				FS_Audio_Play("12.wav", config->sp_volume * 5);
+				FS_Audio_Play("12.wav", program.spVolume);
 			}
 			else if (*speech_ptr == '/')
 			{
 				++speech_ptr;
-				FS_Audio_Play(speech_ptr, config->sp_volume * 5);
+				FS_Audio_Play(speech_ptr, program.spVolume);
 				speech_ptr += strlen(speech_ptr) - 1;
 			}
 			else
@@ -1053,7 +1444,7 @@ static void consumerTask(void)
 				filename[4] = 'v';
 				filename[5] = '\0';
 
-				FS_Audio_Play(filename, config->sp_volume * 5);
+				FS_Audio_Play(filename, program.spVolume);
 			}
 
 			++speech_ptr;
@@ -1064,11 +1455,12 @@ static void consumerTask(void)
 		const FS_Config_Data_t *config = FS_Config_Get();
 
 		toneHold = 0;
+		speechPending = 0;
 
 		if ((flags & FLAG_FIRST_FIX) && FS_Audio_IsIdle())
 		{
 			flags &= ~FLAG_FIRST_FIX;
-			FS_Audio_Beep(TONE_MAX_PITCH, TONE_MAX_PITCH, 125, config->volume * 5);
+			FS_Audio_Beep(TONE_MAX_PITCH, TONE_MAX_PITCH, 125, program.volume);
 			flags |= FLAG_BEEP_DONE;
 		}
 
@@ -1095,6 +1487,8 @@ static void consumerTask(void)
 			speech_ptr = speech_buf;
 		}
 	}
+
+	recordCycles(&consumerCycles, start);
 }
 
 void FS_AudioControl_Init(void)
@@ -1108,6 +1502,9 @@ void FS_AudioControl_Init(void)
 	flags = 0;
 	prev_flags = 0;
 	g_suppress_tone = 0;
+	g_suppress_alt = 0;
+	prevAltValid = 0;
+	lastCrossValid = 0;
 	speech_buf[0] = '\0';
 	speech_ptr = speech_buf;
 	tonePitch = 0;
@@ -1115,12 +1512,38 @@ void FS_AudioControl_Init(void)
 	toneRate = 0;
 	toneHold = 0;
 
+	// Initialize alarm latency statistics
+	memset(&baroLatency, 0, sizeof(baroLatency));
+	memset(&gnssLatency, 0, sizeof(gnssLatency));
+
+	// Initialize decision timing statistics
+	memset(&decisionLatency, 0, sizeof(decisionLatency));
+	memset(&speechLatency, 0, sizeof(speechLatency));
+	memset(&producerCycles, 0, sizeof(producerCycles));
+	memset(&consumerCycles, 0, sizeof(consumerCycles));
+	speechPending = 0;
+	epochMs = 0;
+	epochUs = 0;
+	epochKalman = 0;
+	epochPeriod = FS_GNSS_GetRate();
+	kalmanValid = 0;
+
+	// Enable cycle counter
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	// Precompute constants used every epoch
+	compileProgram(config);
+
 	// Initialize producer task
 	UTIL_SEQ_RegTask(1<<CFG_TASK_FS_AUDIO_CONTROL_PRODUCER_ID, UTIL_SEQ_RFU, producerTask);
 
 	// Initialize consumer task
 	UTIL_SEQ_RegTask(1<<CFG_TASK_FS_AUDIO_CONTROL_CONSUMER_ID, UTIL_SEQ_RFU, consumerTask);
 
+	// Initialize barometer task
+	UTIL_SEQ_RegTask(1<<CFG_TASK_FS_AUDIO_CONTROL_BARO_ID, UTIL_SEQ_RFU, baroTask);
+
 	// Initialize consumer timer
 	HW_TS_Create(CFG_TIM_PROC_ID_ISR, &timer_id, hw_ts_Repeated, consumerTimer);
 	HW_TS_Start(timer_id, CONSUMER_TIMER_TICKS);
@@ -1159,10 +1582,51 @@ void FS_AudioControl_DeInit(void)
 {
 	// Delete update timer
 	HW_TS_Delete(timer_id);
+
+	// Log alarm latency
+	logLatency("barometer", &baroLatency);
+	logLatency("GNSS", &gnssLatency);
+
+	// Log decision timing
+	FS_Log_WriteEvent("%lu GNSS epochs, mean decision latency %lu us, max %lu us",
+			decisionLatency.count,
+			decisionLatency.count ? (uint32_t) (decisionLatency.total / decisionLatency.count) : 0,
+			decisionLatency.max);
+	FS_Log_WriteEvent("%lu values spoken, mean latency from epoch %lu us, max %lu us",
+			speechLatency.count,
+			speechLatency.count ? (uint32_t) (speechLatency.total / speechLatency.count) : 0,
+			speechLatency.max);
+	logCycles("producer", &producerCycles);
+	logCycles("consumer", &consumerCycles);
 }
 
 void FS_AudioControl_UpdateGNSS(const FS_GNSS_Data_t *current)
 {
+	// Filter outputs drive audio while the filter is valid
+	if (FS_Config_Get()->enable_kf && FS_Kalman_IsValid()) return;
+
+	// Remember when the epoch arrived
+	FS_Timestamp_Get(&epochMs, &epochUs);
+	epochKalman = 0;
+
+	// Call update task
+	UTIL_SEQ_SetTask(1<<CFG_TASK_FS_AUDIO_CONTROL_PRODUCER_ID, CFG_SCH_PRIO_0);
+}
+
+void FS_AudioControl_UpdateKalman(void)
+{
+	if (!FS_Kalman_IsValid()) return;
+
+	// Remember when the estimate arrived
+	FS_Timestamp_Get(&epochMs, &epochUs);
+	epochKalman = 1;
+
 	// Call update task
 	UTIL_SEQ_SetTask(1<<CFG_TASK_FS_AUDIO_CONTROL_PRODUCER_ID, CFG_SCH_PRIO_0);
 }
+
+void FS_AudioControl_UpdateBaro(void)
+{
+	// Call barometer task
+	UTIL_SEQ_SetTask(1<<CFG_TASK_FS_AUDIO_CONTROL_BARO_ID, CFG_SCH_PRIO_0);
+}
@@ -29,5 +29,7 @@
 void FS_AudioControl_Init(void);
 void FS_AudioControl_DeInit(void);
 void FS_AudioControl_UpdateGNSS(const FS_GNSS_Data_t *current);
+void FS_AudioControl_UpdateBaro(void);
+void FS_AudioControl_UpdateKalman(void);
 
 #endif /* AUDIO_CONTROL_H_ */
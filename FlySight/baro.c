@@ -27,15 +27,23 @@
 #include "config.h"
 #include "log.h"
 #include "sensor.h"
+#include "sensor_init.h"
+#include "timestamp.h"
 
 #define BARO_ADDR             0xba
 #define BARO_REG_WHO_AM_I     0x0f
 #define BARO_REG_CTRL_REG1    0x10
 #define BARO_REG_CTRL_REG2    0x11
 #define BARO_REG_CTRL_REG3    0x12
+#define BARO_REG_FIFO_CTRL    0x13
+#define BARO_REG_FIFO_WTM     0x14
 #define BARO_REG_INT_SOURCE   0x24
 #define BARO_REG_PRESS_OUT_XL 0x28
 #define BARO_REG_TEMP_OUT_L   0x2b
+#define BARO_REG_FIFO_DATA    0x78
+
+#define BARO_SAMPLE_LEN       5
+#define BARO_FIFO_LEN         128
 
 #define BARO_INIT_TIMEOUT 1000
 
@@ -50,90 +58,208 @@ typedef enum {
 	BARO_ODR_200  = 7
 } FS_Baro_ODR_t;
 
-static uint8_t dataBuf[5];
+// Sample period in us for each ODR setting
+static const uint32_t baroPeriod[] =
+{
+	0, 1000000, 100000, 40000, 20000, 13333, 10000, 5000
+};
+
+static uint8_t dataBuf[BARO_SAMPLE_LEN * FS_CONFIG_MAX_BARO_FIFO];
 static FS_Baro_Data_t baroData;
 
+// FIFO mode
+static uint8_t  fifoLen;			// watermark in samples, zero if disabled
+static uint32_t fifoPeriod;			// sample period (us)
+static uint32_t fifoTime;			// time of newest sample (ms)
+static uint32_t fifoFrac;			// time of newest sample (us past fifoTime)
+static bool     fifoAnchored;		// true if read was started by interrupt
+
 typedef enum {
     BARO_STATE_UNINITIALIZED = 0,
+    BARO_STATE_INITIALIZING,
     BARO_STATE_INIT_FAILED,
     BARO_STATE_READY,
     BARO_STATE_ACTIVE
 } FS_Baro_State_t;
 
+typedef enum {
+	BARO_INIT_BOOT = 0,
+	BARO_INIT_RESET,
+	BARO_INIT_WAIT_RESET,
+	BARO_INIT_WHO_AM_I
+} FS_Baro_InitStep_t;
+
+typedef enum {
+	BARO_START_FIFO_WTM = 0,
+	BARO_START_FIFO_CTRL,
+	BARO_START_CTRL_REG1,
+	BARO_START_CTRL_REG3,
+	BARO_START_DONE
+} FS_Baro_StartStep_t;
+
 static FS_Baro_State_t baroState = BARO_STATE_UNINITIALIZED;
 static volatile bool sensor_is_busy;
 
-void FS_Baro_Init(void)
+// Initialization state
+static FS_Baro_InitStep_t initStep;
+static uint32_t initStart;
+static uint8_t  initBuf[1];
+static volatile bool initBusy;
+static volatile HAL_StatusTypeDef initResult;
+
+// Start state
+static FS_Baro_StartStep_t startStep;
+static uint8_t  startBuf[1];
+
+static void FS_Baro_Init_Callback(HAL_StatusTypeDef result)
 {
-	uint8_t buf[1];
-	HAL_StatusTypeDef result;
-	uint32_t timeout;
+	initResult = result;
+	initBusy = false;
+
+	// Advance initialization state machine
+	FS_SensorInit_Notify();
+}
+
+static void FS_Baro_InitRequest(void)
+{
+	HAL_StatusTypeDef result = HAL_ERROR;
+
+	initBusy = true;
 
-	// Wait for boot
-	timeout = HAL_GetTick() + BARO_INIT_TIMEOUT;
-	do
+	switch (initStep)
 	{
-		result = FS_Sensor_Read(BARO_ADDR, BARO_REG_INT_SOURCE, buf, 1);
-		if (HAL_GetTick() > timeout)
-		{
-			baroState = BARO_STATE_INIT_FAILED;
-			return;
-		}
+	case BARO_INIT_BOOT:
+		result = FS_Sensor_ReadAsync(BARO_ADDR, BARO_REG_INT_SOURCE, initBuf, 1, FS_Baro_Init_Callback);
+		break;
+	case BARO_INIT_RESET:
+		initBuf[0] = 0x04;
+		result = FS_Sensor_WriteAsync(BARO_ADDR, BARO_REG_CTRL_REG2, initBuf, 1, FS_Baro_Init_Callback);
+		break;
+	case BARO_INIT_WAIT_RESET:
+		result = FS_Sensor_ReadAsync(BARO_ADDR, BARO_REG_CTRL_REG2, initBuf, 1, FS_Baro_Init_Callback);
+		break;
+	case BARO_INIT_WHO_AM_I:
+		result = FS_Sensor_ReadAsync(BARO_ADDR, BARO_REG_WHO_AM_I, initBuf, 1, FS_Baro_Init_Callback);
+		break;
 	}
-	while ((result != HAL_OK) || (buf[0] & 0x80));
 
-	// Software reset
-	timeout = HAL_GetTick() + BARO_INIT_TIMEOUT;
-	do
+	if (result != HAL_OK)
 	{
-		buf[0] = 0x04;
-		result = FS_Sensor_Write(BARO_ADDR, BARO_REG_CTRL_REG2, buf, 1);
-		if (HAL_GetTick() > timeout)
-		{
-			baroState = BARO_STATE_INIT_FAILED;
-			return;
-		}
+		FS_Baro_Init_Callback(result);
 	}
-	while (result != HAL_OK);
+}
+
+void FS_Baro_Init(void)
+{
+	baroState = BARO_STATE_INITIALIZING;
 
-	// Wait for reset
-	timeout = HAL_GetTick() + BARO_INIT_TIMEOUT;
-	do
+	initStep = BARO_INIT_BOOT;
+	initStart = HAL_GetTick();
+
+	FS_Baro_InitRequest();
+}
+
+HAL_StatusTypeDef FS_Baro_InitUpdate(void)
+{
+	if (baroState != BARO_STATE_INITIALIZING)
 	{
-		result = FS_Sensor_Read(BARO_ADDR, BARO_REG_CTRL_REG2, buf, 1);
-		if (HAL_GetTick() > timeout)
-		{
-			baroState = BARO_STATE_INIT_FAILED;
-			return;
-		}
+		return (baroState == BARO_STATE_INIT_FAILED) ? HAL_ERROR : HAL_OK;
 	}
-	while ((result != HAL_OK) || (buf[0] & 0x04));
 
-	// Check WHO_AM_I register value
-	timeout = HAL_GetTick() + BARO_INIT_TIMEOUT;
-	do
+	if (initBusy)
 	{
-		result = FS_Sensor_Read(BARO_ADDR, BARO_REG_WHO_AM_I, buf, 1);
-		if (HAL_GetTick() > timeout)
+		return HAL_BUSY;
+	}
+
+	// Advance to the next step if this one succeeded
+	if (initResult == HAL_OK)
+	{
+		switch (initStep)
 		{
-			baroState = BARO_STATE_INIT_FAILED;
-			return;
+		case BARO_INIT_BOOT:
+			// Wait for boot
+			if (!(initBuf[0] & 0x80)) initStep = BARO_INIT_RESET;
+			break;
+		case BARO_INIT_RESET:
+			initStep = BARO_INIT_WAIT_RESET;
+			break;
+		case BARO_INIT_WAIT_RESET:
+			// Wait for reset
+			if (!(initBuf[0] & 0x04)) initStep = BARO_INIT_WHO_AM_I;
+			break;
+		case BARO_INIT_WHO_AM_I:
+			// Check WHO_AM_I register value
+			baroState = (initBuf[0] == 0xb3) ? BARO_STATE_READY : BARO_STATE_INIT_FAILED;
+			return (baroState == BARO_STATE_READY) ? HAL_OK : HAL_ERROR;
 		}
 	}
-	while (result != HAL_OK);
-	if (buf[0] != 0xb3)
+
+	if (HAL_GetTick() - initStart > BARO_INIT_TIMEOUT)
 	{
 		baroState = BARO_STATE_INIT_FAILED;
+		return HAL_ERROR;
+	}
+
+	FS_Baro_InitRequest();
+	return HAL_BUSY;
+}
+
+static void FS_Baro_Start_Callback(HAL_StatusTypeDef result);
+
+static HAL_StatusTypeDef FS_Baro_StartRequest(void)
+{
+	const FS_Config_Data_t *config = FS_Config_Get();
+
+	switch (startStep)
+	{
+	case BARO_START_FIFO_WTM:
+		// Set FIFO watermark
+		startBuf[0] = fifoLen;
+		return FS_Sensor_WriteAsync(BARO_ADDR, BARO_REG_FIFO_WTM, startBuf, 1, FS_Baro_Start_Callback);
+	case BARO_START_FIFO_CTRL:
+		// Continuous (stream) mode
+		startBuf[0] = 0x02;
+		return FS_Sensor_WriteAsync(BARO_ADDR, BARO_REG_FIFO_CTRL, startBuf, 1, FS_Baro_Start_Callback);
+	case BARO_START_CTRL_REG1:
+		// Output data rate 25 Hz; block data update
+		startBuf[0] = (config->baro_odr << 4) | 0x02;
+		return FS_Sensor_WriteAsync(BARO_ADDR, BARO_REG_CTRL_REG1, startBuf, 1, FS_Baro_Start_Callback);
+	case BARO_START_CTRL_REG3:
+		// Configure data ready or FIFO watermark on INT_DRDY pin
+		startBuf[0] = fifoLen ? 0x10 : 0x04;
+		return FS_Sensor_WriteAsync(BARO_ADDR, BARO_REG_CTRL_REG3, startBuf, 1, FS_Baro_Start_Callback);
+	case BARO_START_DONE:
+		break;
+	}
+
+	return HAL_OK;
+}
+
+static void FS_Baro_Start_Callback(HAL_StatusTypeDef result)
+{
+	// Ignore completions after the barometer was stopped
+	if (baroState != BARO_STATE_ACTIVE)
+	{
 		return;
 	}
 
-	baroState = BARO_STATE_READY;
+	if (result == HAL_OK)
+	{
+		++startStep;
+		result = FS_Baro_StartRequest();
+	}
+
+	if (result != HAL_OK)
+	{
+		FS_Log_WriteEventAsync("Couldn't start barometer");
+		LL_EXTI_DisableIT_0_31(LL_EXTI_LINE_13);
+		baroState = BARO_STATE_READY;
+	}
 }
 
 HAL_StatusTypeDef FS_Baro_Start(void)
 {
 	const FS_Config_Data_t *config = FS_Config_Get();
-	uint8_t buf[1];
 
 	if (baroState != BARO_STATE_READY)
 	{
@@ -143,28 +269,41 @@ HAL_StatusTypeDef FS_Baro_Start(void)
 	// Reset busy flag
 	sensor_is_busy = false;
 
-	// Enable EXTI pin
-	LL_EXTI_EnableIT_0_31(LL_EXTI_LINE_13);
+	// FIFO requires continuous conversion
+	fifoLen = config->baro_odr ? config->baro_fifo : 0;
+	fifoPeriod = baroPeriod[config->baro_odr];
+	fifoTime = HAL_GetTick();
+	fifoFrac = 0;
 
-	// Output data rate 25 Hz; block data update
-	buf[0] = (config->baro_odr << 4) | 0x02;
-	if (FS_Sensor_Write(BARO_ADDR, BARO_REG_CTRL_REG1, buf, 1) != HAL_OK)
+	// Data must be read before the FIFO or output register is overwritten
+	if (!config->baro_odr)
 	{
-		FS_Log_WriteEvent("Couldn't start barometer");
-		LL_EXTI_DisableIT_0_31(LL_EXTI_LINE_13);
-		return HAL_ERROR;
+		FS_Sensor_Register(BARO_ADDR, FS_SENSOR_PRIORITY_HIGH, 1000);
+	}
+	else if (fifoLen)
+	{
+		FS_Sensor_Register(BARO_ADDR, FS_SENSOR_PRIORITY_HIGH,
+				(BARO_FIFO_LEN - fifoLen) * fifoPeriod / 1000);
+	}
+	else
+	{
+		FS_Sensor_Register(BARO_ADDR, FS_SENSOR_PRIORITY_HIGH, fifoPeriod / 1000);
 	}
 
-	// Configure data ready on INT_DRDY pin
-	buf[0] = 0x04;
-	if (FS_Sensor_Write(BARO_ADDR, BARO_REG_CTRL_REG3, buf, 1) != HAL_OK)
+	// Enable EXTI pin
+	LL_EXTI_EnableIT_0_31(LL_EXTI_LINE_13);
+
+	// Queue configuration writes; data ready is enabled by the last one
+	baroState = BARO_STATE_ACTIVE;
+	startStep = fifoLen ? BARO_START_FIFO_WTM : BARO_START_CTRL_REG1;
+	if (FS_Baro_StartRequest() != HAL_OK)
 	{
 		FS_Log_WriteEvent("Couldn't start barometer");
 		LL_EXTI_DisableIT_0_31(LL_EXTI_LINE_13);
+		baroState = BARO_STATE_READY;
 		return HAL_ERROR;
 	}
 
-	baroState = BARO_STATE_ACTIVE;
 	return HAL_OK;
 }
 
@@ -175,6 +314,10 @@ void FS_Baro_Stop(void)
 	// Disable EXTI pin
     LL_EXTI_DisableIT_0_31(LL_EXTI_LINE_13);
 
+	// Drop configuration writes and reads not yet started
+	baroState = BARO_STATE_READY;
+	FS_Sensor_Cancel(BARO_ADDR);
+
 	// Software reset
 	buf[0] = 0x04;
 	if (FS_Sensor_Write(BARO_ADDR, BARO_REG_CTRL_REG2, buf, 1) != HAL_OK)
@@ -182,23 +325,77 @@ void FS_Baro_Stop(void)
 		FS_Log_WriteEvent("Couldn't stop barometer");
 	}
 
-	baroState = BARO_STATE_READY;
+	// Reset disables the FIFO
+	fifoLen = 0;
 }
 
-static void FS_Baro_Read_Callback(HAL_StatusTypeDef result)
+static void FS_Baro_Parse(const uint8_t *buf)
 {
 	uint32_t temp;
 
+	temp = (uint32_t) ((buf[2] << 16) | (buf[1] << 8) | buf[0]);
+	if (temp & 0x00800000)
+		temp |= 0xff000000;
+
+	baroData.pressure = (((int32_t) temp) * (625 / 2)) / (256 / 2);
+	baroData.temperature = (int16_t) ((buf[4] << 8) | buf[3]);
+}
+
+static void FS_Baro_Read_Callback(HAL_StatusTypeDef result)
+{
 	if (result == HAL_OK)
 	{
-		temp = (uint32_t) ((dataBuf[2] << 16) | (dataBuf[1] << 8) | dataBuf[0]);
-		if (temp & 0x00800000)
-			temp |= 0xff000000;
+		FS_Baro_Parse(dataBuf);
+		FS_Baro_DataReady_Callback();
+	}
+	else
+	{
+		FS_Log_WriteEventAsync("Error reading from barometer");
+	}
+
+	// This measurement cycle is now complete, reset the busy flag.
+	sensor_is_busy = false;
+}
 
-		baroData.pressure = (((int32_t) temp) * (625 / 2)) / (256 / 2);
-		baroData.temperature = (int16_t) ((dataBuf[4] << 8) | dataBuf[3]);
+static void FS_Baro_ReadFifo(void);
 
-		FS_Baro_DataReady_Callback();
+static void FS_Baro_ReadFifo_Callback(HAL_StatusTypeDef result)
+{
+	const uint32_t anchor = baroData.time;
+	const uint16_t anchorUs = baroData.timeUs;
+	uint8_t i;
+
+	if (result == HAL_OK)
+	{
+		for (i = 0; i < fifoLen; ++i)
+		{
+			if (fifoAnchored)
+			{
+				// Newest sample was taken at the watermark interrupt
+				baroData.time = anchor;
+				baroData.timeUs = anchorUs;
+				FS_Timestamp_Subtract(&baroData.time, &baroData.timeUs,
+						(fifoLen - 1 - i) * fifoPeriod);
+			}
+			else
+			{
+				// Continue on from the previous burst
+				fifoFrac += fifoPeriod;
+				fifoTime += fifoFrac / 1000;
+				fifoFrac %= 1000;
+				baroData.time = fifoTime;
+				baroData.timeUs = fifoFrac;
+			}
+
+			FS_Baro_Parse(&dataBuf[BARO_SAMPLE_LEN * i]);
+			FS_Baro_DataReady_Callback();
+		}
+
+		if (fifoAnchored)
+		{
+			fifoTime = anchor;
+			fifoFrac = anchorUs;
+		}
 	}
 	else
 	{
@@ -207,6 +404,33 @@ static void FS_Baro_Read_Callback(HAL_StatusTypeDef result)
 
 	// This measurement cycle is now complete, reset the busy flag.
 	sensor_is_busy = false;
+
+	// The watermark interrupt is a level, so keep draining while it is high
+	if ((result == HAL_OK) &&
+	    (HAL_GPIO_ReadPin(BARO_INT_GPIO_Port, BARO_INT_Pin) == GPIO_PIN_SET))
+	{
+		fifoAnchored = false;
+		FS_Baro_ReadFifo();
+	}
+}
+
+static void FS_Baro_ReadFifo(void)
+{
+	if (sensor_is_busy)
+	{
+		return;
+	}
+
+	sensor_is_busy = true;
+
+	// Burst read, address rolls back to FIFO_DATA_OUT_PRESS_XL after each sample
+	if (FS_Sensor_ReadAsync(BARO_ADDR, BARO_REG_FIFO_DATA, dataBuf,
+			BARO_SAMPLE_LEN * fifoLen, FS_Baro_ReadFifo_Callback) != HAL_OK)
+	{
+		// Abort this measurement cycle and reset the state to allow the next one.
+		FS_Log_WriteEventAsync("Error reading from barometer");
+		sensor_is_busy = false;
+	}
 }
 
 void FS_Baro_Read(void)
@@ -221,8 +445,17 @@ void FS_Baro_Read(void)
 		return;
 	}
 
+	if (fifoLen)
+	{
+		// At the rising edge the FIFO holds exactly one watermark
+		FS_Timestamp_Get(&baroData.time, &baroData.timeUs);
+		fifoAnchored = true;
+		FS_Baro_ReadFifo();
+		return;
+	}
+
 	sensor_is_busy = true;
-	baroData.time = HAL_GetTick();
+	FS_Timestamp_Get(&baroData.time, &baroData.timeUs);
 	if (FS_Sensor_ReadAsync(BARO_ADDR, BARO_REG_PRESS_OUT_XL, dataBuf, 5, FS_Baro_Read_Callback) != HAL_OK)
 	{
 		// Abort this measurement cycle and reset the state to allow the next one.
@@ -236,6 +469,12 @@ const FS_Baro_Data_t *FS_Baro_GetData(void)
 	return &baroData;
 }
 
+uint32_t FS_Baro_GetPeriod(void)
+{
+	// Sample period for the configured ODR, zero in one-shot mode
+	return baroPeriod[FS_Config_Get()->baro_odr];
+}
+
 __weak void FS_Baro_DataReady_Callback(void)
 {
   /* NOTE: This function should not be modified, when the callback is needed,
@@ -29,13 +29,16 @@ typedef struct
 	uint32_t time;			// ms
 	int32_t pressure;		// Pa * 100
 	int16_t temperature;	// degrees C * 100
+	uint16_t timeUs;		// us past time
 } FS_Baro_Data_t;
 
 void FS_Baro_Init(void);
+HAL_StatusTypeDef FS_Baro_InitUpdate(void);
 HAL_StatusTypeDef FS_Baro_Start(void);
 void FS_Baro_Stop(void);
 void FS_Baro_Read(void);
 const FS_Baro_Data_t *FS_Baro_GetData(void);
+uint32_t FS_Baro_GetPeriod(void);
 void FS_Baro_DataReady_Callback(void);
 
 #endif /* BARO_H_ */
@@ -0,0 +1,295 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2024 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "main.h"
+#include "app_common.h"
+#include "altitude.h"
+#include "capture.h"
+#include "config.h"
+#include "log.h"
+
+#define CAPTURE_IMU_COUNT  1024	// IMU samples held before trigger
+#define CAPTURE_BARO_COUNT 256	// barometer samples held before trigger
+
+static FS_IMU_Raw_t imuBuf[CAPTURE_IMU_COUNT];
+static uint32_t imuRdI;
+static uint32_t imuWrI;
+
+static FS_Baro_Data_t baroBuf[CAPTURE_BARO_COUNT];
+static uint32_t baroRdI;
+static uint32_t baroWrI;
+
+// Full-rate logging window
+static volatile uint32_t windowStart;	// ms
+static volatile uint32_t windowEnd;		// ms
+static volatile bool windowValid;
+
+static uint32_t preMs;				// pre-trigger length (ms)
+static uint32_t postMs;				// post-trigger length (ms)
+static float accelThresh;			// acceleration trigger (counts)
+static bool enabled;
+
+static FS_Capture_Stats_t stats;
+
+// Longest pre-trigger length each ring can hold at the configured ODR (ms)
+static uint32_t FS_Capture_RingMsec(uint32_t count, uint32_t period)
+{
+	return period ? (count - 1) * period / 1000 : UINT32_MAX;
+}
+
+static const char *const triggerNames[] =
+{
+	"acceleration", "vertical speed", "button"
+};
+
+static bool FS_Capture_InWindow(uint32_t time)
+{
+	return windowValid
+			&& ((int32_t) (time - windowStart) >= 0)
+			&& ((int32_t) (time - windowEnd) < 0);
+}
+
+void FS_Capture_Init(void)
+{
+	const FS_Config_Data_t *config = FS_Config_Get();
+	uint32_t maxMs;
+
+	imuRdI = 0;
+	imuWrI = 0;
+
+	baroRdI = 0;
+	baroWrI = 0;
+
+	windowValid = false;
+
+	preMs = config->cap_pre * 1000;
+	postMs = config->cap_post * 1000;
+	accelThresh = 0;
+	enabled = (config->cap_pre > 0);
+
+	memset(&stats, 0, sizeof(stats));
+
+	// Samples leave a full ring before they are old enough, so a longer
+	// window would start with a gap at the low rate
+	maxMs = MIN(
+			config->enable_imu ? FS_Capture_RingMsec(CAPTURE_IMU_COUNT, FS_IMU_GetPeriod()) : UINT32_MAX,
+			config->enable_baro ? FS_Capture_RingMsec(CAPTURE_BARO_COUNT, FS_Baro_GetPeriod()) : UINT32_MAX);
+
+	if (enabled && preMs > maxMs)
+	{
+		FS_Log_WriteEvent("Capture: Cap_Pre limited to %lu ms by sample rate", maxMs);
+		preMs = maxMs;
+	}
+}
+
+void FS_Capture_DeInit(void)
+{
+	if (!enabled) return;
+
+	// Log capture statistics
+	FS_Log_WriteEvent("Capture: %lu triggers, %lu IMU and %lu barometer samples at full rate",
+			stats.triggerCount, stats.imuCount, stats.baroCount);
+
+	enabled = false;
+}
+
+bool FS_Capture_IsEnabled(void)
+{
+	return enabled;
+}
+
+void FS_Capture_Trigger(FS_Capture_Trigger_t source, uint32_t time)
+{
+	const uint32_t start = time - preMs;
+	const uint32_t end = time + postMs;
+	uint32_t primask_bit;
+	bool started = false;
+
+	if (!enabled) return;
+
+	primask_bit = __get_PRIMASK();
+	__disable_irq();
+
+	if (windowValid && ((int32_t) (start - windowEnd) <= 0))
+	{
+		// Extend current window
+		if ((int32_t) (end - windowEnd) > 0)
+		{
+			windowEnd = end;
+		}
+	}
+	else
+	{
+		// Start a new window
+		windowStart = start;
+		windowEnd = end;
+		windowValid = true;
+		started = true;
+	}
+
+	__set_PRIMASK(primask_bit);
+
+	if (started)
+	{
+		++stats.triggerCount;
+		FS_Log_WriteEventAsync("Capture triggered by %s", triggerNames[source]);
+	}
+}
+
+void FS_Capture_PushIMU(const FS_IMU_Raw_t *data)
+{
+	const FS_Config_Data_t *config = FS_Config_Get();
+	const FS_IMU_Scale_t *scale;
+	float a2;
+
+	if (!enabled) return;
+
+	if (config->cap_accel > 0)
+	{
+		if (accelThresh == 0)
+		{
+			// Convert trigger from mg to accelerometer counts
+			scale = FS_IMU_GetScale();
+			accelThresh = config->cap_accel * 100.0f * 32768 / scale->accelFactor;
+		}
+
+		a2 = (float) data->ax * data->ax
+				+ (float) data->ay * data->ay
+				+ (float) data->az * data->az;
+
+		if (a2 > accelThresh * accelThresh)
+		{
+			FS_Capture_Trigger(FS_CAPTURE_TRIGGER_ACCEL, data->time);
+		}
+	}
+
+	// The caller pops the oldest sample before the ring fills
+	imuBuf[imuWrI % CAPTURE_IMU_COUNT] = *data;
+	++imuWrI;
+}
+
+bool FS_Capture_PopIMU(FS_IMU_Raw_t *data, bool *fullRate, bool flush)
+{
+	const FS_IMU_Raw_t *oldest, *newest;
+
+	if (imuRdI == imuWrI) return false;
+
+	oldest = &imuBuf[imuRdI % CAPTURE_IMU_COUNT];
+	newest = &imuBuf[(imuWrI - 1) % CAPTURE_IMU_COUNT];
+
+	// Hold samples until they are older than the pre-trigger length
+	if (!flush
+			&& (imuWrI - imuRdI < CAPTURE_IMU_COUNT)
+			&& (newest->time - oldest->time < preMs))
+	{
+		return false;
+	}
+
+	*data = *oldest;
+	++imuRdI;
+
+	*fullRate = FS_Capture_InWindow(data->time);
+	if (*fullRate)
+	{
+		++stats.imuCount;
+	}
+
+	return true;
+}
+
+void FS_Capture_PushBaro(const FS_Baro_Data_t *data)
+{
+	const FS_Config_Data_t *config = FS_Config_Get();
+	const int32_t thresh = config->cap_vel_d * 10;
+	int32_t velD;
+
+	if (!enabled) return;
+
+	if (thresh > 0 && FS_Altitude_IsValid())
+	{
+		velD = FS_Altitude_GetData()->velD;
+		if (velD > thresh || velD < -thresh)
+		{
+			FS_Capture_Trigger(FS_CAPTURE_TRIGGER_VEL_D, data->time);
+		}
+	}
+
+	// The caller pops the oldest sample before the ring fills
+	baroBuf[baroWrI % CAPTURE_BARO_COUNT] = *data;
+	++baroWrI;
+}
+
+bool FS_Capture_PopBaro(FS_Baro_Data_t *data, bool *fullRate, bool flush)
+{
+	const FS_Baro_Data_t *oldest, *newest;
+
+	if (baroRdI == baroWrI) return false;
+
+	oldest = &baroBuf[baroRdI % CAPTURE_BARO_COUNT];
+	newest = &baroBuf[(baroWrI - 1) % CAPTURE_BARO_COUNT];
+
+	// Hold samples until they are older than the pre-trigger length
+	if (!flush
+			&& (baroWrI - baroRdI < CAPTURE_BARO_COUNT)
+			&& (newest->time - oldest->time < preMs))
+	{
+		return false;
+	}
+
+	*data = *oldest;
+	++baroRdI;
+
+	*fullRate = FS_Capture_InWindow(data->time);
+	if (*fullRate)
+	{
+		++stats.baroCount;
+	}
+
+	return true;
+}
+
+void FS_Capture_UpdateGNSS(const FS_GNSS_Data_t *current)
+{
+	const FS_Config_Data_t *config = FS_Config_Get();
+	const int32_t thresh = config->cap_vel_d * 10;
+
+	if (!enabled) return;
+	if (thresh == 0) return;
+	if (current->gpsFix != 3) return;
+
+	// The fused estimate is used instead when it is available
+	if (FS_Altitude_IsValid()) return;
+
+	if (current->velD > thresh || current->velD < -thresh)
+	{
+		FS_Capture_Trigger(FS_CAPTURE_TRIGGER_VEL_D, HAL_GetTick());
+	}
+}
+
+const FS_Capture_Stats_t *FS_Capture_GetStats(void)
+{
+	return &stats;
+}
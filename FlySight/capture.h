@@ -0,0 +1,58 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2024 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+#include <stdbool.h>
+
+#include "baro.h"
+#include "gnss.h"
+#include "imu.h"
+
+typedef enum
+{
+	FS_CAPTURE_TRIGGER_ACCEL = 0,
+	FS_CAPTURE_TRIGGER_VEL_D,
+	FS_CAPTURE_TRIGGER_BUTTON
+} FS_Capture_Trigger_t;
+
+typedef struct
+{
+	uint32_t triggerCount;	// capture windows started
+	uint32_t imuCount;		// IMU samples logged at full rate
+	uint32_t baroCount;		// barometer samples logged at full rate
+} FS_Capture_Stats_t;
+
+void FS_Capture_Init(void);
+void FS_Capture_DeInit(void);
+bool FS_Capture_IsEnabled(void);
+void FS_Capture_Trigger(FS_Capture_Trigger_t source, uint32_t time);
+void FS_Capture_PushIMU(const FS_IMU_Raw_t *data);
+bool FS_Capture_PopIMU(FS_IMU_Raw_t *data, bool *fullRate, bool flush);
+void FS_Capture_PushBaro(const FS_Baro_Data_t *data);
+bool FS_Capture_PopBaro(FS_Baro_Data_t *data, bool *fullRate, bool flush);
+void FS_Capture_UpdateGNSS(const FS_GNSS_Data_t *current);
+const FS_Capture_Stats_t *FS_Capture_GetStats(void);
+
+#endif /* CAPTURE_H_ */
@@ -29,6 +29,8 @@
 #define CONFIG_FIRST_ALARM  0x01
 #define CONFIG_FIRST_WINDOW 0x02
 #define CONFIG_FIRST_SPEECH 0x04
+#define CONFIG_FIRST_RAW    0x08
+#define CONFIG_RAW_ACCEPTED 0x10
 
 static FS_Config_Data_t config;
 static FIL configFile;
@@ -58,14 +60,16 @@ static const char defaultConfig[] =
 		"                 ;   3 = Inverse glide ratio\n"
 		"                 ;   4 = Total speed\n"
 		"                 ;   11 = Dive angle\n"
+		"                 ;   13 = Body pitch\n"
+		"                 ;   14 = Body roll\n"
 		"Min:       0     ; Lowest pitch value\n"
 		"                 ;   cm/s        in Mode 0, 1, or 4\n"
 		"                 ;   ratio * 100 in Mode 2 or 3\n"
-		"                 ;   degrees     in Mode 11\n"
+		"                 ;   degrees     in Mode 11, 13, or 14\n"
 		"Max:       300   ; Highest pitch value\n"
 		"                 ;   cm/s        in Mode 0, 1, or 4\n"
 		"                 ;   ratio * 100 in Mode 2 or 3\n"
-		"                 ;   degrees     in Mode 11\n"
+		"                 ;   degrees     in Mode 11, 13, or 14\n"
 		"Limits:    1     ; Behaviour when outside bounds\n"
 		"                 ;   0 = No tone\n"
 		"                 ;   1 = Min/max tone\n"
@@ -84,16 +88,18 @@ static const char defaultConfig[] =
 		"                 ;   8 = Magnitude of Value 1\n"
 		"                 ;   9 = Change in Value 1\n"
 		"                 ;   11 = Dive angle\n"
+		"                 ;   13 = Body pitch\n"
+		"                 ;   14 = Body roll\n"
 		"Min_Val_2: 300   ; Lowest rate value\n"
 		"                 ;   cm/s          when Mode 2 = 0, 1, or 4\n"
 		"                 ;   ratio * 100   when Mode 2 = 2 or 3\n"
 		"                 ;   percent * 100 when Mode 2 = 9\n"
-		"                 ;   degrees       when Mode 2 = 11\n"
+		"                 ;   degrees       when Mode 2 = 11, 13, or 14\n"
 		"Max_Val_2: 1500  ; Highest rate value\n"
 		"                 ;   cm/s          when Mode 2 = 0, 1, or 4\n"
 		"                 ;   ratio * 100   when Mode 2 = 2 or 3\n"
 		"                 ;   percent * 100 when Mode 2 = 9\n"
-		"                 ;   degrees       when Mode 2 = 11\n"
+		"                 ;   degrees       when Mode 2 = 11, 13, or 14\n"
 		"Min_Rate:  100   ; Minimum rate (Hz * 100)\n"
 		"Max_Rate:  500   ; Maximum rate (Hz * 100)\n"
 		"Flatline:  0     ; Flatline at minimum rate\n"
@@ -200,7 +206,25 @@ static const char defaultConfig[] =
 		";          alarms will be audible.\n"
 		"\n"
 		"Win_Top:       0 ; Silence window top (m)\n"
-		"Win_Bottom:    0 ; Silence window bottom (m)\n";
+		"Win_Bottom:    0 ; Silence window bottom (m)\n"
+		"\n"
+		"; Flight phase profiles\n"
+		"\n"
+		"; NOTE:    Each Phase line starts a profile which applies\n"
+		";          while that flight phase is detected. A value of\n"
+		";          zero keeps the setting given above.\n"
+		"\n"
+		"Phase:         0 ; Flight phase\n"
+		"                 ;   0 = Ground\n"
+		"                 ;   1 = Climb\n"
+		"                 ;   2 = Exit\n"
+		"                 ;   3 = Freefall\n"
+		"                 ;   4 = Canopy\n"
+		"                 ;   5 = Landed\n"
+		"Ph_Rate:       0 ; GNSS measurement rate (ms)\n"
+		"Ph_Imu_Dec:    0 ; IMU log decimation\n"
+		"Ph_Baro_Dec:   0 ; Barometer log decimation\n"
+		"Ph_Sync:       0 ; Log updates between file syncs\n";
 
 void FS_Config_Init(void)
 {
@@ -257,14 +281,34 @@ void FS_Config_Init(void)
 	config.ble_tx_power   = 25;
 	config.enable_raw     = 1;
 	config.cold_start     = 0;
+	config.enable_kf      = 0;
+	config.enable_ahrs    = 0;
+
+	config.num_raw        = 0;
 
 	config.baro_odr       = 2;
+	config.baro_fifo      = 0;
+	config.baro_log_dec   = 1;
 	config.hum_odr        = 1;
 	config.mag_odr        = 0;
 	config.accel_odr      = 1;
 	config.accel_fs       = 1;
 	config.gyro_odr       = 1;
 	config.gyro_fs        = 3;
+	config.imu_fifo       = 0;
+	config.imu_log_dec    = 1;
+	config.ahrs_log_dec   = 1;
+	config.mag_off_x      = 0;
+	config.mag_off_y      = 0;
+	config.mag_off_z      = 0;
+
+	config.cap_pre        = 0;
+	config.cap_post       = 30;
+	config.cap_accel      = 0;
+	config.cap_vel_d      = 0;
+	config.cap_button     = 1;
+
+	memset(config.phases, 0, sizeof(config.phases));
 
 	config.lat            = 0;
 	config.lon            = 0;
@@ -284,6 +328,7 @@ FS_Config_Result_t FS_Config_Read(const char *filename)
 	int32_t val;
 
 	uint8_t flags = 0;
+	uint8_t phase = FS_CONFIG_MAX_PHASES;
 
 	if (f_open(&configFile, filename, FA_READ) != FR_OK)
 		return FS_CONFIG_ERR;
@@ -308,12 +353,12 @@ FS_Config_Result_t FS_Config_Read(const char *filename)
 
 		HANDLE_VALUE("Model",     config.model,        val, val >= 0 && val <= 8);
 		HANDLE_VALUE("Rate",      config.rate,         val, val >= 40 && val <= 1000);
-		HANDLE_VALUE("Mode",      config.mode,         val, (val >= 0 && val <= 7) || (val == 11));
+		HANDLE_VALUE("Mode",      config.mode,         val, (val >= 0 && val <= 7) || (val == 11) || (val == 13) || (val == 14));
 		HANDLE_VALUE("Min",       config.min,          val, TRUE);
 		HANDLE_VALUE("Max",       config.max,          val, TRUE);
 		HANDLE_VALUE("Limits",    config.limits,       val, val >= 0 && val <= 3);
 		HANDLE_VALUE("Volume",    config.volume,       8 - val, val >= 0 && val <= 8);
-		HANDLE_VALUE("Mode_2",    config.mode_2,       val, (val >= 0 && val <= 9) || (val == 11));
+		HANDLE_VALUE("Mode_2",    config.mode_2,       val, (val >= 0 && val <= 9) || (val == 11) || (val == 13) || (val == 14));
 		HANDLE_VALUE("Min_Val_2", config.min_2,        val, TRUE);
 		HANDLE_VALUE("Max_Val_2", config.max_2,        val, TRUE);
 		HANDLE_VALUE("Min_Rate",  config.min_rate,     val * FS_CONFIG_RATE_ONE_HZ / 100, val >= 0);
@@ -346,14 +391,30 @@ FS_Config_Result_t FS_Config_Read(const char *filename)
 		HANDLE_VALUE("Ble_Tx_Power",   config.ble_tx_power,   val, val >= 0 && val <= 31);
 		HANDLE_VALUE("Enable_Raw",     config.enable_raw,     val, val == 0 || val == 1);
 		HANDLE_VALUE("Cold_Start",     config.cold_start,     val, val == 0 || val == 1);
+		HANDLE_VALUE("Enable_Kf",      config.enable_kf,      val, val == 0 || val == 1);
+		HANDLE_VALUE("Enable_Ahrs",    config.enable_ahrs,    val, val == 0 || val == 1);
 
 		HANDLE_VALUE("Baro_ODR",  config.baro_odr,     val, val >= 0 && val <= 7);
+		HANDLE_VALUE("Baro_FIFO", config.baro_fifo,    val, val >= 0 && val <= FS_CONFIG_MAX_BARO_FIFO);
+		HANDLE_VALUE("Baro_Log_Dec", config.baro_log_dec, val, val >= 1 && val <= FS_CONFIG_MAX_LOG_DEC);
 		HANDLE_VALUE("Hum_ODR",   config.hum_odr,      val, val >= 0 && val <= 3);
 		HANDLE_VALUE("Mag_ODR",   config.mag_odr,      val, val >= 0 && val <= 3);
 		HANDLE_VALUE("Accel_ODR", config.accel_odr,    val, val >= 0 && val <= 11);
 		HANDLE_VALUE("Accel_FS",  config.accel_fs,     val, val >= 0 && val <= 3);
 		HANDLE_VALUE("Gyro_ODR",  config.gyro_odr,     val, val >= 0 && val <= 10);
 		HANDLE_VALUE("Gyro_FS",   config.gyro_fs,      val, val >= 0 && val <= 3);
+		HANDLE_VALUE("Imu_FIFO",  config.imu_fifo,     val, val >= 0 && val <= FS_CONFIG_MAX_IMU_FIFO);
+		HANDLE_VALUE("Imu_Log_Dec", config.imu_log_dec, val, val >= 1 && val <= FS_CONFIG_MAX_LOG_DEC);
+		HANDLE_VALUE("Ahrs_Log_Dec", config.ahrs_log_dec, val, val >= 1 && val <= FS_CONFIG_MAX_LOG_DEC);
+		HANDLE_VALUE("Mag_Off_X", config.mag_off_x,    val, val >= -16000 && val <= 16000);
+		HANDLE_VALUE("Mag_Off_Y", config.mag_off_y,    val, val >= -16000 && val <= 16000);
+		HANDLE_VALUE("Mag_Off_Z", config.mag_off_z,    val, val >= -16000 && val <= 16000);
+
+		HANDLE_VALUE("Cap_Pre",   config.cap_pre,      val, val >= 0 && val <= FS_CONFIG_MAX_CAP_PRE);
+		HANDLE_VALUE("Cap_Post",  config.cap_post,     val, val >= 1 && val <= 3600);
+		HANDLE_VALUE("Cap_Accel", config.cap_accel,    val, val >= 0 && val <= 16000);
+		HANDLE_VALUE("Cap_VelD",  config.cap_vel_d,    val, val >= 0 && val <= 10000);
+		HANDLE_VALUE("Cap_Button", config.cap_button,  val, val == 0 || val == 1);
 
 		HANDLE_VALUE("Lat",       config.lat,          val, val >= -900000000 && val <= 900000000);
 		HANDLE_VALUE("Lon",       config.lon,          val, val >= -1800000000 && val <= 1800000000);
@@ -362,6 +423,18 @@ FS_Config_Result_t FS_Config_Read(const char *filename)
 		HANDLE_VALUE("Max_Dist",  config.max_dist,     val, val >= 0 && val <= 10000);
 		HANDLE_VALUE("Min_Angle", config.min_angle,    val, val >= 0 && val <= 360);
 
+		if (!strcmp(name, "Phase"))
+		{
+			phase = (val >= 0 && val < FS_CONFIG_MAX_PHASES) ? val : FS_CONFIG_MAX_PHASES;
+		}
+		if (phase < FS_CONFIG_MAX_PHASES)
+		{
+			HANDLE_VALUE("Ph_Rate",     config.phases[phase].rate,         val, val == 0 || (val >= 40 && val <= 1000));
+			HANDLE_VALUE("Ph_Imu_Dec",  config.phases[phase].imu_log_dec,  val, val >= 0 && val <= FS_CONFIG_MAX_LOG_DEC);
+			HANDLE_VALUE("Ph_Baro_Dec", config.phases[phase].baro_log_dec, val, val >= 0 && val <= FS_CONFIG_MAX_LOG_DEC);
+			HANDLE_VALUE("Ph_Sync",     config.phases[phase].log_sync,     val, val >= 0 && val <= 100);
+		}
+
 		#undef HANDLE_VALUE
 
 		if (!strcmp(name, "Init_File"))
@@ -431,6 +504,38 @@ FS_Config_Result_t FS_Config_Read(const char *filename)
 		{
 			config.speech[config.num_speech - 1].decimals = val;
 		}
+
+		if (!strcmp(name, "Raw_Class"))
+		{
+			// Raw_ID and Raw_Rate apply only to an accepted Raw_Class
+			flags &= ~CONFIG_RAW_ACCEPTED;
+
+			if (!(flags & CONFIG_FIRST_RAW))
+			{
+				config.num_raw = 0;
+				flags |= CONFIG_FIRST_RAW;
+			}
+
+			if (config.num_raw < FS_CONFIG_MAX_RAW &&
+					val >= 0 && val <= UINT8_MAX)
+			{
+				++config.num_raw;
+				config.raw[config.num_raw - 1].msg_class = val;
+				config.raw[config.num_raw - 1].msg_id = 0;
+				config.raw[config.num_raw - 1].rate = 1;
+				flags |= CONFIG_RAW_ACCEPTED;
+			}
+		}
+		if (!strcmp(name, "Raw_ID") && (flags & CONFIG_RAW_ACCEPTED) &&
+				val >= 0 && val <= UINT8_MAX)
+		{
+			config.raw[config.num_raw - 1].msg_id = val;
+		}
+		if (!strcmp(name, "Raw_Rate") && (flags & CONFIG_RAW_ACCEPTED) &&
+				val >= 0 && val <= UINT8_MAX)
+		{
+			config.raw[config.num_raw - 1].rate = val;
+		}
 	}
 
 	f_close(&configFile);
@@ -29,6 +29,12 @@
 #define FS_CONFIG_MAX_ALARMS    20
 #define FS_CONFIG_MAX_WINDOWS   2
 #define FS_CONFIG_MAX_SPEECH    3
+#define FS_CONFIG_MAX_RAW       8
+#define FS_CONFIG_MAX_CAP_PRE   60
+#define FS_CONFIG_MAX_PHASES    6
+#define FS_CONFIG_MAX_LOG_DEC  64
+#define FS_CONFIG_MAX_IMU_FIFO  32
+#define FS_CONFIG_MAX_BARO_FIFO 32
 
 #define FS_CONFIG_MODEL_PORTABLE     0
 #define FS_CONFIG_MODEL_STATIONARY   2
@@ -52,6 +58,8 @@
 #define FS_CONFIG_MODE_LEFT_RIGHT                10
 #define FS_CONFIG_MODE_DIVE_ANGLE                11
 #define FS_CONFIG_MODE_ALTITUDE                  12
+#define FS_CONFIG_MODE_BODY_PITCH                13
+#define FS_CONFIG_MODE_BODY_ROLL                 14
 
 #define FS_CONFIG_UNITS_KMH     0
 #define FS_CONFIG_UNITS_MPH     1
@@ -84,6 +92,21 @@ typedef struct
 	int32_t decimals;
 } FS_Config_Speech_t;
 
+typedef struct
+{
+	uint8_t msg_class;
+	uint8_t msg_id;
+	uint8_t rate;
+} FS_Config_Raw_t;
+
+typedef struct
+{
+	uint16_t rate;			// GNSS measurement rate (ms), 0 = Rate
+	uint8_t  imu_log_dec;	// 0 = Imu_Log_Dec
+	uint8_t  baro_log_dec;	// 0 = Baro_Log_Dec
+	uint8_t  log_sync;		// log updates between syncs, 0 = default
+} FS_Config_Phase_t;
+
 typedef struct
 {
 	uint8_t  model;
@@ -142,14 +165,35 @@ typedef struct
 	uint8_t  ble_tx_power;
 	uint8_t  enable_raw;
 	uint8_t  cold_start;
+	uint8_t  enable_kf;
+	uint8_t  enable_ahrs;
+
+	FS_Config_Raw_t raw[FS_CONFIG_MAX_RAW];
+	uint8_t  num_raw;
 
 	uint8_t  baro_odr;
+	uint8_t  baro_fifo;
+	uint8_t  baro_log_dec;
 	uint8_t  hum_odr;
 	uint8_t  mag_odr;
 	uint8_t  accel_odr;
 	uint8_t  accel_fs;
 	uint8_t  gyro_odr;
 	uint8_t  gyro_fs;
+	uint8_t  imu_fifo;
+	uint8_t  imu_log_dec;
+	uint8_t  ahrs_log_dec;
+	int16_t  mag_off_x;		// hard-iron offset, magnetometer frame (gauss * 1000)
+	int16_t  mag_off_y;
+	int16_t  mag_off_z;
+
+	uint8_t  cap_pre;
+	uint16_t cap_post;
+	uint16_t cap_accel;
+	uint16_t cap_vel_d;
+	uint8_t  cap_button;
+
+	FS_Config_Phase_t phases[FS_CONFIG_MAX_PHASES];
 
 	int32_t  lat;
 	int32_t  lon;
@@ -43,6 +43,10 @@
 #define RX_TIMEOUT_MSEC  10000
 #define RX_TIMEOUT_TICKS (RX_TIMEOUT_MSEC*1000/CFG_TS_TICK_VAL)
 
+#define RTO_MIN_MSEC     40
+#define RTO_MAX_MSEC     2000
+#define RTO_TICKS(ms)    ((ms)*1000/CFG_TS_TICK_VAL)
+
 typedef enum
 {
 	FS_CRS_COMMAND_CREATE    = 0x00,
@@ -51,6 +55,7 @@ typedef enum
 	FS_CRS_COMMAND_WRITE     = 0x03,
 	FS_CRS_COMMAND_MK_DIR    = 0x04,
 	FS_CRS_COMMAND_READ_DIR  = 0x05,
+	FS_CRS_COMMAND_READ_SACK = 0x06,
 	FS_CRS_COMMAND_FILE_DATA = 0x10,
 	FS_CRS_COMMAND_FILE_INFO = 0x11,
 	FS_CRS_COMMAND_FILE_ACK  = 0x12,
@@ -100,9 +105,29 @@ static uint32_t next_packet;
 static uint32_t next_ack;
 static uint32_t last_packet;
 
+typedef struct
+{
+	uint32_t stamp;			// transmission order of last send
+	uint32_t time;			// time of last send (ms)
+	uint8_t  acked;
+	uint8_t  resend;
+	uint8_t  retries;
+} FS_CRS_Slot_t;
+
 static uint8_t ack_timer_id;
 static volatile uint8_t timeout_flag;
 
+// Selective repeat state
+static bool sack_mode;
+static FS_CRS_Slot_t slots[FS_CRS_WINDOW_MAX];
+static uint32_t tx_stamp;			// packets transmitted, including repeats
+static uint32_t window;				// packets allowed in flight
+static uint32_t window_credit;		// acknowledgements towards next increase
+static uint32_t srtt;				// smoothed round trip time (ms * 8)
+static uint32_t rttvar;				// round trip time variation (ms * 4)
+static uint32_t rtt_min;			// minimum round trip time (ms)
+static uint32_t rto;				// retransmission timeout (ms)
+
 static void FS_CRS_SendPacket(uint8_t command, uint8_t *payload, uint8_t length)
 {
 	Custom_CRS_Packet_t *tx_packet;
@@ -126,6 +151,229 @@ static void FS_CRS_SendAck(uint8_t command)
 	FS_CRS_SendPacket(FS_CRS_COMMAND_ACK, &command, sizeof(command));
 }
 
+static void FS_CRS_InitSack(bool enable)
+{
+	sack_mode = enable;
+
+	memset(slots, 0, sizeof(slots));
+	tx_stamp = 0;
+	window = FS_CRS_WINDOW_LENGTH;
+	window_credit = 0;
+	srtt = 0;
+	rttvar = 0;
+	rtt_min = 0;
+	rto = TX_TIMEOUT_MSEC;
+}
+
+static void FS_CRS_SampleRTT(uint32_t rtt)
+{
+	int32_t err;
+
+	// Smoothed estimate as in RFC 6298
+	if (srtt == 0)
+	{
+		srtt = rtt << 3;
+		rttvar = rtt << 1;
+		rtt_min = rtt;
+	}
+	else
+	{
+		err = (int32_t) rtt - (int32_t) (srtt >> 3);
+		srtt += err;
+		if (err < 0) err = -err;
+		rttvar += err - (rttvar >> 2);
+		rtt_min = MIN(rtt_min, rtt);
+	}
+
+	rto = MIN(MAX((srtt >> 3) + rttvar, RTO_MIN_MSEC), RTO_MAX_MSEC);
+}
+
+static void FS_CRS_GrowWindow(void)
+{
+	// Adjust by one packet for each window acknowledged
+	if (++window_credit < window) return;
+
+	window_credit = 0;
+
+	if ((srtt >> 3) <= 2 * rtt_min)
+	{
+		// Link is keeping up
+		window = MIN(window + 1, FS_CRS_WINDOW_MAX);
+	}
+	else
+	{
+		// Packets are queueing in the stack
+		window = MAX(window - 1, FS_CRS_WINDOW_MIN);
+	}
+}
+
+static void FS_CRS_AckSlot(uint32_t n, uint32_t *delivered)
+{
+	FS_CRS_Slot_t *slot = &slots[n % FS_CRS_WINDOW_MAX];
+
+	if (slot->acked) return;
+
+	slot->acked = 1;
+	slot->resend = 0;
+	*delivered = MAX(*delivered, slot->stamp);
+
+	// Only unambiguous samples are used
+	if (slot->retries == 0)
+	{
+		FS_CRS_SampleRTT(HAL_GetTick() - slot->time);
+	}
+
+	FS_CRS_GrowWindow();
+}
+
+static void FS_CRS_HandleSack(const uint8_t *data, uint8_t length)
+{
+	// First byte is the next packet expected, followed by a bitmap of
+	// packets received beyond it
+	const uint32_t cum = next_ack + (uint8_t) (data[0] - next_ack);
+	uint32_t bitmap = 0, delivered = 0, n;
+	uint8_t i;
+
+	if (cum > next_packet) return;
+
+	if (length >= 5)
+	{
+		memcpy(&bitmap, &data[1], sizeof(bitmap));
+	}
+
+	for (n = next_ack; n < cum; ++n)
+	{
+		FS_CRS_AckSlot(n, &delivered);
+	}
+
+	for (i = 0; i < FS_CRS_WINDOW_MAX; ++i)
+	{
+		n = cum + 1 + i;
+		if ((bitmap & (1UL << i)) && (n < next_packet))
+		{
+			FS_CRS_AckSlot(n, &delivered);
+		}
+	}
+
+	if (cum > next_ack)
+	{
+		next_ack = cum;
+
+		// Reset timeout timer
+		HW_TS_Start(ack_timer_id, RTO_TICKS(rto));
+	}
+
+	// Notifications arrive in order, so anything sent before a delivered
+	// packet and still missing was lost. The window is left alone, since
+	// these losses are not caused by queueing.
+	for (n = next_ack; n < next_packet; ++n)
+	{
+		FS_CRS_Slot_t *slot = &slots[n % FS_CRS_WINDOW_MAX];
+
+		if (!slot->acked && !slot->resend && (slot->stamp < delivered))
+		{
+			slot->resend = 1;
+		}
+	}
+}
+
+static void FS_CRS_SackTimeout(void)
+{
+	uint32_t n;
+
+	// Repeat everything outstanding
+	for (n = next_ack; n < next_packet; ++n)
+	{
+		FS_CRS_Slot_t *slot = &slots[n % FS_CRS_WINDOW_MAX];
+
+		if (!slot->acked)
+		{
+			slot->resend = 1;
+		}
+	}
+
+	// Back off
+	rto = MIN(rto * 2, RTO_MAX_MSEC);
+	window = FS_CRS_WINDOW_MIN;
+	window_credit = 0;
+
+	// Reset timeout timer
+	HW_TS_Start(ack_timer_id, RTO_TICKS(rto));
+}
+
+static bool FS_CRS_SendFrame(uint32_t n)
+{
+	const uint32_t pos = read_offset + n * read_stride;
+	FS_CRS_Slot_t *slot = &slots[n % FS_CRS_WINDOW_MAX];
+	UINT br;
+
+	if ((f_tell(&file) != pos) && (f_lseek(&file, pos) != FR_OK))
+	{
+		return false;
+	}
+
+	buffer[0] = (n & 0xff);
+
+	if (f_eof(&file))
+	{
+		// Send empty buffer to signal end of file
+		FS_CRS_SendPacket(FS_CRS_COMMAND_FILE_DATA, buffer, 1);
+		last_packet = n + 1;
+	}
+	else if (f_read(&file, &buffer[1], FRAME_LENGTH, &br) == FR_OK)
+	{
+		FS_CRS_SendPacket(FS_CRS_COMMAND_FILE_DATA, buffer, br + 1);
+	}
+	else
+	{
+		return false;
+	}
+
+	slot->stamp = ++tx_stamp;
+	slot->time = HAL_GetTick();
+
+	return true;
+}
+
+static bool FS_CRS_SackSend(void)
+{
+	FS_CRS_Slot_t *slot;
+	uint32_t n = next_ack;
+
+	while (Custom_CRS_GetNextTxPacket())
+	{
+		// Repeat lost packets first
+		while ((n < next_packet) && !slots[n % FS_CRS_WINDOW_MAX].resend)
+		{
+			++n;
+		}
+
+		if (n < next_packet)
+		{
+			slot = &slots[n % FS_CRS_WINDOW_MAX];
+			slot->resend = 0;
+			++slot->retries;
+
+			if (!FS_CRS_SendFrame(n)) return false;
+		}
+		else if ((next_packet < next_ack + window) &&
+				(next_packet < last_packet))
+		{
+			slot = &slots[next_packet % FS_CRS_WINDOW_MAX];
+			memset(slot, 0, sizeof(*slot));
+
+			if (!FS_CRS_SendFrame(next_packet)) return false;
+			++next_packet;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	return true;
+}
+
 static FS_CRS_State_t FS_CRS_State_Idle(void)
 {
 	FS_CRS_State_t next_state = FS_CRS_STATE_IDLE;
@@ -187,6 +435,7 @@ static FS_CRS_State_t FS_CRS_State_Idle(void)
 				}
 				break;
 			case FS_CRS_COMMAND_READ:
+			case FS_CRS_COMMAND_READ_SACK:
 				// Initialize disk
 				if (FS_ResourceManager_RequestResource(FS_RESOURCE_FATFS)
 						== FS_RESOURCE_MANAGER_SUCCESS)
@@ -206,6 +455,7 @@ static FS_CRS_State_t FS_CRS_State_Idle(void)
 						next_packet = 0;
 						next_ack = 0;
 						last_packet = -1;
+						FS_CRS_InitSack(packet->data[0] == FS_CRS_COMMAND_READ_SACK);
 
 						// Start timeout timer
 						HW_TS_Start(ack_timer_id, TX_TIMEOUT_TICKS);
@@ -213,7 +463,7 @@ static FS_CRS_State_t FS_CRS_State_Idle(void)
 
 						if (f_lseek(&file, read_pos) == FR_OK)
 						{
-							FS_CRS_SendAck(FS_CRS_COMMAND_READ);
+							FS_CRS_SendAck(packet->data[0]);
 
 							// Call update task
 							UTIL_SEQ_SetTask(1<<CFG_TASK_FS_CRS_UPDATE_ID, CFG_SCH_PRIO_1);
@@ -224,7 +474,7 @@ static FS_CRS_State_t FS_CRS_State_Idle(void)
 
 					if (next_state == FS_CRS_STATE_IDLE)
 					{
-						FS_CRS_SendNak(FS_CRS_COMMAND_READ);
+						FS_CRS_SendNak(packet->data[0]);
 
 						// De-initialize disk
 						FS_ResourceManager_ReleaseResource(FS_RESOURCE_FATFS);
@@ -232,7 +482,7 @@ static FS_CRS_State_t FS_CRS_State_Idle(void)
 				}
 				else
 				{
-					FS_CRS_SendNak(FS_CRS_COMMAND_READ);
+					FS_CRS_SendNak(packet->data[0]);
 				}
 				break;
 			case FS_CRS_COMMAND_WRITE:
@@ -413,7 +663,12 @@ static FS_CRS_State_t FS_CRS_State_Read(void)
 		next_state = FS_CRS_STATE_IDLE;
 	}
 
-	if (timeout_flag)
+	if (timeout_flag && sack_mode)
+	{
+		timeout_flag = 0;
+		FS_CRS_SackTimeout();
+	}
+	else if (timeout_flag)
 	{
 		next_packet = next_ack;
 		timeout_flag = 0;
@@ -436,7 +691,11 @@ static FS_CRS_State_t FS_CRS_State_Read(void)
 				next_state = FS_CRS_STATE_IDLE;
 				break;
 			case FS_CRS_COMMAND_FILE_ACK:
-				if (packet->length >= 2)
+				if ((packet->length >= 2) && sack_mode)
+				{
+					FS_CRS_HandleSack(&packet->data[1], packet->length - 1);
+				}
+				else if (packet->length >= 2)
 				{
 					if (packet->data[1] == (next_ack & 0xff))
 					{
@@ -451,7 +710,15 @@ static FS_CRS_State_t FS_CRS_State_Read(void)
 		}
 	}
 
-	while ((next_state == FS_CRS_STATE_READ) &&
+	if ((next_state == FS_CRS_STATE_READ) && sack_mode)
+	{
+		if (!FS_CRS_SackSend())
+		{
+			next_state = FS_CRS_STATE_IDLE;
+		}
+	}
+
+	while ((next_state == FS_CRS_STATE_READ) && !sack_mode &&
 			(packet = Custom_CRS_GetNextTxPacket()) &&
 			(next_packet < next_ack + FS_CRS_WINDOW_LENGTH) &&
 			(next_packet < last_packet))
@@ -25,6 +25,8 @@
 #define CRS_H_
 
 #define FS_CRS_WINDOW_LENGTH 8
+#define FS_CRS_WINDOW_MIN    2
+#define FS_CRS_WINDOW_MAX    32		// also length of SACK bitmap
 
 void FS_CRS_Init(void);
 
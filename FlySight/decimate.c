@@ -0,0 +1,108 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2024 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#include <string.h>
+
+#include "main.h"
+#include "decimate.h"
+#include "timestamp.h"
+
+void FS_Decimate_Init(FS_Decimate_t *dec, uint8_t channels, uint8_t rate)
+{
+	uint8_t i;
+
+	memset(dec, 0, sizeof(FS_Decimate_t));
+
+	dec->channels = channels;
+	dec->rate = rate;
+	dec->warmup = FS_DECIMATE_ORDER - 1;
+
+	dec->gain = 1;
+	for (i = 0; i < FS_DECIMATE_ORDER; ++i)
+	{
+		dec->gain *= rate;
+	}
+}
+
+bool FS_Decimate_Update(FS_Decimate_t *dec, const int32_t *in, int32_t *out,
+		uint32_t *ms, uint16_t *us)
+{
+	const int64_t half = dec->gain / 2;
+	uint64_t x, prev;
+	int64_t y;
+	int32_t span;
+	uint8_t c, i;
+
+	// Integrators run at the input rate and wrap modulo 2^64
+	for (c = 0; c < dec->channels; ++c)
+	{
+		x = (uint64_t) (int64_t) in[c];
+		for (i = 0; i < FS_DECIMATE_ORDER; ++i)
+		{
+			dec->integ[c][i] += x;
+			x = dec->integ[c][i];
+		}
+	}
+
+	if (dec->phase++ == 0)
+	{
+		dec->startMs = *ms;
+		dec->startUs = *us;
+	}
+
+	if (dec->phase < dec->rate)
+	{
+		return false;
+	}
+
+	dec->phase = 0;
+
+	// Combs run at the output rate
+	for (c = 0; c < dec->channels; ++c)
+	{
+		x = dec->integ[c][FS_DECIMATE_ORDER - 1];
+		for (i = 0; i < FS_DECIMATE_ORDER; ++i)
+		{
+			prev = dec->comb[c][i];
+			dec->comb[c][i] = x;
+			x -= prev;
+		}
+
+		// Normalize to unity DC gain, rounding half away from zero
+		y = (int64_t) x;
+		out[c] = (y >= 0) ? (y + half) / (int64_t) dec->gain : -((-y + half) / (int64_t) dec->gain);
+	}
+
+	// Move time back by the group delay, order * (rate - 1) / 2 input periods
+	span = (int32_t) (*ms - dec->startMs) * 1000 + ((int32_t) *us - dec->startUs);
+	FS_Timestamp_Subtract(ms, us, span * FS_DECIMATE_ORDER / 2);
+
+	// Discard outputs until the filter window is full
+	if (dec->warmup > 0)
+	{
+		--dec->warmup;
+		return false;
+	}
+
+	return true;
+}
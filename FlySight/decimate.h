@@ -0,0 +1,51 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2024 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#ifndef DECIMATE_H_
+#define DECIMATE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FS_DECIMATE_ORDER        3
+#define FS_DECIMATE_MAX_CHANNELS 7
+#define FS_DECIMATE_MAX_RATE     64
+
+typedef struct
+{
+	uint8_t  channels;
+	uint8_t  rate;			// decimation factor
+	uint8_t  phase;			// input samples in current output
+	uint8_t  warmup;		// outputs left before the filter has settled
+	uint32_t startMs;		// time of first input sample in current output
+	uint16_t startUs;
+	uint64_t gain;			// rate ^ order
+	uint64_t integ[FS_DECIMATE_MAX_CHANNELS][FS_DECIMATE_ORDER];
+	uint64_t comb[FS_DECIMATE_MAX_CHANNELS][FS_DECIMATE_ORDER];
+} FS_Decimate_t;
+
+void FS_Decimate_Init(FS_Decimate_t *dec, uint8_t channels, uint8_t rate);
+bool FS_Decimate_Update(FS_Decimate_t *dec, const int32_t *in, int32_t *out,
+		uint32_t *ms, uint16_t *us);
+
+#endif /* DECIMATE_H_ */
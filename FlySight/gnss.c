@@ -28,6 +28,7 @@
 #include "log.h"
 #include "state.h"
 #include "stm32_seq.h"
+#include "timestamp.h"
 
 #define GNSS_RATE           921600	// Baud rate
 #define GNSS_TIMEOUT        100		// ACK/NAK timeout (ms)
@@ -90,10 +91,6 @@
 #define UBX_SEC             0x27
 #define UBX_SEC_ECSIGN      0x04
 
-#define UBX_MSG_PVT         0x01
-#define UBX_MSG_VELNED      0x02
-#define UBX_MSG_ALL         (UBX_MSG_PVT | UBX_MSG_VELNED)
-
 #define UBX_CFG_SEC_ECCFGSESSIONID0 0x06, 0x00, 0xf6, 0x50
 #define UBX_CFG_SEC_ECCFGSESSIONID1 0x07, 0x00, 0xf6, 0x50
 #define UBX_CFG_SEC_ECCFGSESSIONID2 0x08, 0x00, 0xf6, 0x50
@@ -359,14 +356,14 @@ typedef struct
 }
 ubxAckNak_t;
 
-union
-{
-	uint8_t       whole[GNSS_RX_BUF_LEN];	// data buffer
-	FS_GNSS_Raw_t split[2];					// raw output buffers
-} gnssRxData;
-
+uint8_t  gnssRxData[GNSS_RX_BUF_LEN];	// data buffer
 uint32_t gnssRxIndex = 0;				// read index
-uint8_t  gnssRawIndex = 0;				// raw output index
+
+// Raw output
+static FS_GNSS_Raw_t gnssRaw;			// raw output buffer
+static uint32_t gnssRawLen;				// bytes used in raw output buffer
+static uint32_t gnssRawMark;			// read index of first byte not yet classified
+static uint8_t  gnssRawCount[FS_CONFIG_MAX_RAW];	// decimation counters
 
 // Current UBX message
 static uint8_t   gnssMsgClass;
@@ -379,7 +376,6 @@ static union
 	ubxAckNak_t     ackNak;
 	ubxNavPvt_t     navPvt;
 	ubxNavPosLlh_t  navPosLlh;
-	ubxNavVelNed_t  navVelNed;
 	ubxNavTimeUtc_t navTimeUtc;
 	ubxNavSat_t     navSat;
 	ubxTimTp_t      timTp;
@@ -387,16 +383,17 @@ static union
 } gnssPayload;
 
 // Saved GNSS messages
-static uint32_t gnssTimeOfWeek;
-static uint8_t  gnssMsgReceived;
 static bool validTime;
 
 static FS_GNSS_Data_t gnssData;
 static FS_GNSS_Time_t gnssTime;
+static uint16_t gnssTimeSubUs;		// Submillisecond part of gnssTime.towMS (us)
 static FS_GNSS_Int_t  gnssInt;
 
 static uint8_t timer_id;
 
+static uint16_t gnssRate;		// current measurement rate (ms)
+
 static enum
 {
 	st_sync_1,
@@ -416,6 +413,9 @@ static uint32_t updateMaxTime;
 static uint32_t updateLastCall;
 static uint32_t updateMaxInterval;
 static uint32_t bufferUsed;
+static uint32_t rawWritten;
+static uint32_t rawDropped;
+static uint32_t rawPassed;
 
 // Error logging
 static volatile bool gnss_is_initializing = 0;
@@ -448,7 +448,7 @@ void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
 	{
 		// These are non-fatal. We will try to recover.
 		// Immediately restart the DMA transfer to continue receiving data.
-		if (HAL_UART_Receive_DMA(&huart1, gnssRxData.whole, GNSS_RX_BUF_LEN) == HAL_OK)
+		if (HAL_UART_Receive_DMA(&huart1, gnssRxData, GNSS_RX_BUF_LEN) == HAL_OK)
 		{
 			// If restart was successful, log the error message.
 			FS_Log_WriteEventAsync("GNSS UART non-fatal error: 0x%lX", uart_error_code);
@@ -470,7 +470,7 @@ void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
 
 static uint8_t FS_GNSS_GetChar(void)
 {
-	uint8_t ch = gnssRxData.whole[gnssRxIndex];
+	uint8_t ch = gnssRxData[gnssRxIndex];
 	gnssRxIndex = (gnssRxIndex + 1) % GNSS_RX_BUF_LEN;
 	return ch;
 }
@@ -636,29 +636,41 @@ static void FS_GNSS_SendMessage(uint8_t msgClass, uint8_t msgId, uint16_t size,
 	FS_GNSS_PutChar(ckB);
 }
 
-static void FS_GNSS_ReceiveMessage(uint8_t msgReceived, uint32_t timeOfWeek)
+static uint32_t FS_GNSS_Sqrt(uint64_t val)
 {
-	if (timeOfWeek != gnssTimeOfWeek)
+	uint64_t res = 0;
+	uint64_t bit = (uint64_t) 1 << 62;
+
+	// Integer square root, rounded down
+	while (bit > val)
 	{
-		gnssTimeOfWeek = timeOfWeek;
-		gnssMsgReceived = 0;
+		bit >>= 2;
 	}
 
-	gnssMsgReceived |= msgReceived;
-
-	if (gnssMsgReceived == UBX_MSG_ALL)
+	while (bit != 0)
 	{
-		gnssData.iTOW = timeOfWeek;
-		if (data_ready_callback)
+		if (val >= res + bit)
 		{
-			data_ready_callback();
+			val -= res + bit;
+			res = (res >> 1) + bit;
 		}
-		gnssMsgReceived = 0;
+		else
+		{
+			res >>= 1;
+		}
+		bit >>= 2;
 	}
+
+	return (uint32_t) res;
 }
 
 static void FS_GNSS_HandlePvt(void)
 {
+	const int64_t velN = gnssPayload.navPvt.velN;
+	const int64_t velE = gnssPayload.navPvt.velE;
+	const int64_t velD = gnssPayload.navPvt.velD;
+
+	gnssData.iTOW = gnssPayload.navPvt.iTOW;
 	gnssData.year = gnssPayload.navPvt.year;
 	gnssData.month = gnssPayload.navPvt.month;
 	gnssData.day = gnssPayload.navPvt.day;
@@ -679,22 +691,23 @@ static void FS_GNSS_HandlePvt(void)
 	gnssData.velD = gnssPayload.navPvt.velD;
 	gnssData.sAcc = gnssPayload.navPvt.sAcc;
 
-	FS_GNSS_ReceiveMessage(UBX_MSG_PVT, gnssPayload.navPvt.iTOW);
-}
-
-static void FS_GNSS_HandleVelocity(void)
-{
-	gnssData.speed = gnssPayload.navVelNed.speed;
-	gnssData.gSpeed = gnssPayload.navVelNed.gSpeed;
-	gnssData.heading = gnssPayload.navVelNed.heading;
+	// Derive speed and heading in the units formerly reported by NAV-VELNED
+	gnssData.speed = (FS_GNSS_Sqrt(velN * velN + velE * velE + velD * velD) + 5) / 10;
+	gnssData.gSpeed = (gnssPayload.navPvt.gSpeed + 5) / 10;
+	gnssData.heading = gnssPayload.navPvt.headMot;
 
-	FS_GNSS_ReceiveMessage(UBX_MSG_VELNED, gnssPayload.navVelNed.iTOW);
+	// NAV-PVT completes the epoch
+	if (data_ready_callback)
+	{
+		data_ready_callback();
+	}
 }
 
 static void FS_GNSS_HandleTp(void)
 {
 	gnssTime.towMS = gnssPayload.timTp.towMS;
 	gnssTime.week = gnssPayload.timTp.week;
+	gnssTimeSubUs = ((uint64_t) gnssPayload.timTp.towSubMS * 1000) >> 32;
 	validTime = true;
 }
 
@@ -709,6 +722,71 @@ static void FS_GNSS_HandleTm2(void)
 	}
 }
 
+static bool FS_GNSS_FilterRaw(void)
+{
+	const FS_Config_Data_t *config = FS_Config_Get();
+	bool pass;
+	uint8_t i;
+
+	for (i = 0; i < config->num_raw; ++i)
+	{
+		if (config->raw[i].msg_class == gnssMsgClass &&
+		    config->raw[i].msg_id == gnssMsgId)
+		{
+			// Keep every Nth message, or none if rate is zero
+			pass = (config->raw[i].rate > 0) && (gnssRawCount[i] == 0);
+
+			if (++gnssRawCount[i] >= config->raw[i].rate)
+			{
+				gnssRawCount[i] = 0;
+			}
+
+			return pass;
+		}
+	}
+
+	// Messages without a filter entry are always kept
+	return true;
+}
+
+static void FS_GNSS_WriteRaw(uint32_t index, uint32_t len)
+{
+	uint32_t count;
+
+	while (len > 0)
+	{
+		count = MIN(len, GNSS_RAW_BUF_LEN - gnssRawLen);
+		count = MIN(count, GNSS_RX_BUF_LEN - index);
+
+		memcpy(&gnssRaw.buf[gnssRawLen], &gnssRxData[index], count);
+
+		gnssRawLen += count;
+		index = (index + count) % GNSS_RX_BUF_LEN;
+		len -= count;
+
+		if (gnssRawLen == GNSS_RAW_BUF_LEN)
+		{
+			gnssRaw.len = gnssRawLen;
+			if (raw_ready_callback)
+			{
+				raw_ready_callback();
+			}
+			gnssRawLen = 0;
+		}
+	}
+}
+
+static void FS_GNSS_PassRaw(uint32_t end)
+{
+	const uint32_t len = (end + GNSS_RX_BUF_LEN - gnssRawMark) % GNSS_RX_BUF_LEN;
+
+	// Bytes outside a validated frame are written unchanged
+	FS_GNSS_WriteRaw(gnssRawMark, len);
+	rawPassed += len;
+
+	gnssRawMark = end;
+}
+
 static void FS_GNSS_HandleMessage(void)
 {
 	switch (gnssMsgClass)
@@ -719,9 +797,6 @@ static void FS_GNSS_HandleMessage(void)
 		case UBX_NAV_PVT:
 			FS_GNSS_HandlePvt();
 			break;
-		case UBX_NAV_VELNED:
-			FS_GNSS_HandleVelocity();
-			break;
 		}
 		break;
 	case UBX_TIM:
@@ -751,7 +826,7 @@ static void FS_GNSS_InitMessages(void)
 		{UBX_NMEA, UBX_NMEA_GPGSV,  0},
 		{UBX_NMEA, UBX_NMEA_GPRMC,  0},
 		{UBX_NMEA, UBX_NMEA_GPVTG,  0},
-		{UBX_NAV,  UBX_NAV_VELNED,  1},
+		{UBX_NAV,  UBX_NAV_VELNED,  0},
 		{UBX_NAV,  UBX_NAV_PVT,     1},
 		{UBX_TIM,  UBX_TIM_TP,      1},
 		{UBX_TIM,  UBX_TIM_TM2,     1},
@@ -826,6 +901,7 @@ static void FS_GNSS_InitMessages(void)
 	}
 
 	SEND_MESSAGE(UBX_CFG, UBX_CFG_RATE, cfgRate);
+	gnssRate = config->rate;
 	SEND_MESSAGE(UBX_CFG, UBX_CFG_NAV5, cfgNav5);
 	SEND_MESSAGE(UBX_CFG, UBX_CFG_TP5,  cfgTp5);
 
@@ -861,9 +937,12 @@ void FS_GNSS_Init(void)
 	};
 
 	// Reset state
-	gnssTimeOfWeek = 0;
-	gnssMsgReceived = 0;
 	validTime = false;
+	FS_Timestamp_Init();
+
+	gnssRawLen = 0;
+	gnssRawMark = 0;
+	memset(gnssRawCount, 0, sizeof(gnssRawCount));
 
 	updateCount = 0;
 	updateTotalTime = 0;
@@ -871,6 +950,9 @@ void FS_GNSS_Init(void)
 	updateLastCall = 0;
 	updateMaxInterval = 0;
 	bufferUsed = 0;
+	rawWritten = 0;
+	rawDropped = 0;
+	rawPassed = 0;
 
 	// Set initialization flag
 	gnss_is_initializing = true;
@@ -904,13 +986,14 @@ void FS_GNSS_Init(void)
 		}
 
 		// Begin DMA transfer
-		if (HAL_UART_Receive_DMA(&huart1, gnssRxData.whole, GNSS_RX_BUF_LEN) != HAL_OK)
+		if (HAL_UART_Receive_DMA(&huart1, gnssRxData, GNSS_RX_BUF_LEN) != HAL_OK)
 		{
 			Error_Handler();
 		}
 
 		// Reset state machine
 		gnssRxIndex = 0;
+		gnssRawMark = 0;
 		gnssState = st_sync_1;
 
 		// Configure UBX baud rate
@@ -921,6 +1004,9 @@ void FS_GNSS_Init(void)
 	// Configure UBX messages
 	FS_GNSS_InitMessages();
 
+	// Raw output starts after the configuration replies
+	gnssRawMark = gnssRxIndex;
+
 	// Clear initialization flag
 	gnss_is_initializing = false;
 
@@ -943,10 +1029,23 @@ void FS_GNSS_DeInit(void)
 	// Add event log entries for timing info
 	FS_Log_WriteEvent("----------");
 	FS_Log_WriteEvent("%lu/%lu slots used in GNSS buffer", bufferUsed, GNSS_RX_BUF_LEN);
+	if (FS_Config_Get()->enable_raw)
+	{
+		FS_Log_WriteEvent("%lu/%lu raw UBX frames written", rawWritten, rawWritten + rawDropped);
+		FS_Log_WriteEvent("%lu raw bytes outside UBX frames written", rawPassed);
+	}
 	FS_Log_WriteEvent("%lu ms average time spent in GNSS update task",
 			(updateCount > 0) ? (updateTotalTime / updateCount) : 0);
 	FS_Log_WriteEvent("%lu ms maximum time spent in GNSS update task", updateMaxTime);
 	FS_Log_WriteEvent("%lu ms maximum time between calls to GNSS update task", updateMaxInterval);
+
+	if (FS_Timestamp_GetModel()->valid)
+	{
+		FS_Log_WriteEvent("%ld ppb local clock drift from %u time pulses",
+				FS_Timestamp_GetModel()->drift, FS_Timestamp_GetModel()->count);
+		FS_Log_WriteEvent("%lu ns RMS clock model residual, %ld ns last prediction error",
+				FS_Timestamp_GetModel()->residual, FS_Timestamp_GetModel()->error);
+	}
 }
 
 void FS_GNSS_Start(void)
@@ -985,6 +1084,39 @@ void FS_GNSS_Stop(void)
 	FS_GNSS_SendMessage(UBX_CFG, UBX_CFG_RST, sizeof(cfgRst), &cfgRst);
 }
 
+void FS_GNSS_SetRate(uint16_t rate)
+{
+	const ubxCfgRate_t cfgRate =
+	{
+		.measRate   = rate,         // Measurement rate (ms)
+		.navRate    = 1,            // Navigation rate (cycles)
+		.timeRef    = 0             // UTC time
+	};
+
+	const ubxCfgMsg_t cfgMsgSat =
+	{
+		UBX_NAV, UBX_NAV_SAT, MAX(1, 1000 / rate)
+	};
+
+	if (rate == gnssRate) return;
+
+	// Don't wait for the acknowledgement, since this may be called
+	// while measurements are streaming in
+	FS_GNSS_SendMessage(UBX_CFG, UBX_CFG_RATE, sizeof(cfgRate), &cfgRate);
+	gnssRate = rate;
+
+	if (FS_Config_Get()->enable_raw)
+	{
+		// Keep satellite info at about once per second
+		FS_GNSS_SendMessage(UBX_CFG, UBX_CFG_MSG, sizeof(cfgMsgSat), &cfgMsgSat);
+	}
+}
+
+uint16_t FS_GNSS_GetRate(void)
+{
+	return gnssRate;
+}
+
 static void FS_GNSS_Timer(void)
 {
 	// Call update task
@@ -995,6 +1127,7 @@ static void FS_GNSS_Update(void)
 {
 	uint32_t msStart, msEnd;
 	uint32_t writeIndex = GNSS_RX_BUF_LEN - huart1.hdmarx->Instance->CNDTR;
+	const bool enableRaw = FS_Config_Get()->enable_raw;
 
 	msStart = HAL_GetTick();
 
@@ -1009,24 +1142,43 @@ static void FS_GNSS_Update(void)
 
 	while (gnssRxIndex != writeIndex)
 	{
-		if (FS_GNSS_HandleByte(FS_GNSS_GetChar()))
+		if (enableRaw && (gnssState == st_sync_1) &&
+				(gnssRxData[gnssRxIndex] == UBX_SYNC_1))
 		{
-			FS_GNSS_HandleMessage();
+			// A frame may start here
+			FS_GNSS_PassRaw(gnssRxIndex);
 		}
-	}
 
-	if (FS_Config_Get()->enable_raw)
-	{
-		while (writeIndex / GNSS_RAW_BUF_LEN != gnssRawIndex)
+		if (FS_GNSS_HandleByte(FS_GNSS_GetChar()))
 		{
-			if (raw_ready_callback)
+			if (enableRaw)
 			{
-				raw_ready_callback();
+				// The validated frame ends at the read index
+				FS_GNSS_PassRaw((gnssRxIndex + GNSS_RX_BUF_LEN - gnssPayloadLen - 8) % GNSS_RX_BUF_LEN);
+
+				if (FS_GNSS_FilterRaw())
+				{
+					FS_GNSS_WriteRaw(gnssRawMark, gnssPayloadLen + 8);
+					++rawWritten;
+				}
+				else
+				{
+					++rawDropped;
+				}
+
+				gnssRawMark = gnssRxIndex;
 			}
-			gnssRawIndex = (gnssRawIndex + 1) % (GNSS_RX_BUF_LEN / GNSS_RAW_BUF_LEN);
+
+			FS_GNSS_HandleMessage();
 		}
 	}
 
+	if (enableRaw && (gnssState == st_sync_1))
+	{
+		// No frame in progress
+		FS_GNSS_PassRaw(gnssRxIndex);
+	}
+
 	++updateCount;
 
 	msEnd = HAL_GetTick();
@@ -1041,7 +1193,14 @@ const FS_GNSS_Data_t *FS_GNSS_GetData(void)
 
 void FS_GNSS_Timepulse(void)
 {
-	gnssTime.time = HAL_GetTick();
+	FS_Timestamp_Get(&gnssTime.time, &gnssTime.timeUs);
+
+	if (validTime)
+	{
+		// Discipline local clock to the time pulse
+		FS_Timestamp_Timepulse(gnssTime.time, gnssTime.timeUs,
+				gnssTime.week, gnssTime.towMS, gnssTimeSubUs);
+	}
 
 	if (time_ready_callback)
 	{
@@ -1058,7 +1217,7 @@ const FS_GNSS_Time_t *FS_GNSS_GetTime(void)
 
 const FS_GNSS_Raw_t *FS_GNSS_GetRaw(void)
 {
-	return &gnssRxData.split[gnssRawIndex];
+	return &gnssRaw;
 }
 
 const FS_GNSS_Int_t *FS_GNSS_GetInt(void)
@@ -1081,6 +1240,20 @@ void FS_GNSS_RawReady_SetCallback(void (*callback)(void))
 	raw_ready_callback = callback;
 }
 
+void FS_GNSS_FlushRaw(void)
+{
+	// Hand over the final partial buffer
+	if (gnssRawLen > 0)
+	{
+		gnssRaw.len = gnssRawLen;
+		if (raw_ready_callback)
+		{
+			raw_ready_callback();
+		}
+		gnssRawLen = 0;
+	}
+}
+
 void FS_GNSS_IntReady_SetCallback(void (*callback)(void))
 {
 	int_ready_callback = callback;
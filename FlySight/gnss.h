@@ -67,6 +67,7 @@ typedef struct
 	uint32_t time;		// ms
 	uint32_t towMS;     // Time pulse time of week     (ms)
 	uint16_t week;      // Time pulse week number
+	uint16_t timeUs;	// us past time
 } FS_GNSS_Time_t;
 
 typedef struct
@@ -78,6 +79,7 @@ typedef struct
 typedef struct
 {
 	unsigned char buf[GNSS_RAW_BUF_LEN];
+	uint32_t len;      // Bytes used in buf
 } FS_GNSS_Raw_t;
 
 void FS_GNSS_Init(void);
@@ -85,6 +87,8 @@ void FS_GNSS_DeInit(void);
 
 void FS_GNSS_Start(void);
 void FS_GNSS_Stop(void);
+void FS_GNSS_SetRate(uint16_t rate);
+uint16_t FS_GNSS_GetRate(void);
 
 const FS_GNSS_Data_t *FS_GNSS_GetData(void);
 void FS_GNSS_DataReady_SetCallback(void (*callback)(void));
@@ -95,6 +99,7 @@ void FS_GNSS_TimeReady_SetCallback(void (*callback)(bool));
 
 const FS_GNSS_Raw_t *FS_GNSS_GetRaw(void);
 void FS_GNSS_RawReady_SetCallback(void (*callback)(void));
+void FS_GNSS_FlushRaw(void);
 
 const FS_GNSS_Int_t *FS_GNSS_GetInt(void);
 void FS_GNSS_IntReady_SetCallback(void (*callback)(void));
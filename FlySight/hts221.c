@@ -28,6 +28,7 @@
 #include "hum.h"
 #include "log.h"
 #include "sensor.h"
+#include "sensor_init.h"
 
 #define HTS221_ADDR               0xbe
 #define HTS221_REG_WHO_AM_I       (0x0f | 0x80)
@@ -61,134 +62,247 @@ static uint16_t T1_degC_x8_u16;
 static int16_t T0_out;
 static int16_t T1_out;
 
+// Sample period in ms for each ODR setting
+static const uint32_t humPeriod[] = {1000, 1000, 143, 80};
+
 static uint8_t dataBuf[4];
 
 static FS_Hum_Data_t *humData;
 
 static volatile bool sensor_is_busy;
 
-HAL_StatusTypeDef FS_HTS221_Init(FS_Hum_Data_t *data)
+typedef enum {
+	HTS221_INIT_WHO_AM_I = 0,
+	HTS221_INIT_RESET,
+	HTS221_INIT_WAIT_RESET,
+	HTS221_INIT_H_RH,
+	HTS221_INIT_H0_T0_OUT,
+	HTS221_INIT_H1_T0_OUT,
+	HTS221_INIT_T_DEGC,
+	HTS221_INIT_T_MSB,
+	HTS221_INIT_T_OUT,
+	HTS221_INIT_FLUSH
+} FS_HTS221_InitStep_t;
+
+typedef enum {
+	HTS221_START_CTRL_REG3 = 0,
+	HTS221_START_CTRL_REG1,
+	HTS221_START_DONE
+} FS_HTS221_StartStep_t;
+
+// Initialization state
+static FS_HTS221_InitStep_t initStep;
+static uint8_t initBuf[4];
+static volatile bool initBusy;
+static volatile HAL_StatusTypeDef initResult;
+
+// Start state
+static FS_HTS221_StartStep_t startStep;
+static uint8_t startBuf[1];
+static volatile bool startActive;
+
+static void FS_HTS221_Init_Callback(HAL_StatusTypeDef result)
 {
-	uint8_t buf[4];
+	initResult = result;
+	initBusy = false;
 
-	uint8_t temp;
-	HAL_StatusTypeDef result;
+	// Advance initialization state machine
+	FS_SensorInit_Notify();
+}
 
-	// Keep local pointer to humidity data
-	humData = data;
+static void FS_HTS221_InitRequest(void)
+{
+	HAL_StatusTypeDef result = HAL_ERROR;
 
-	// Read WHO_AM_I register value
-	if (FS_Sensor_Read(HTS221_ADDR, HTS221_REG_WHO_AM_I, buf, 1) != HAL_OK)
-	{
-		return HAL_ERROR;
-	}
+	initBusy = true;
 
-	// Check WHO_AM_I register value
-	if (buf[0] != 0xbc)
+	switch (initStep)
 	{
-		return HAL_ERROR;
+	case HTS221_INIT_WHO_AM_I:
+		result = FS_Sensor_ReadAsync(HTS221_ADDR, HTS221_REG_WHO_AM_I, initBuf, 1, FS_HTS221_Init_Callback);
+		break;
+	case HTS221_INIT_RESET:
+		initBuf[0] = 0x80;
+		result = FS_Sensor_WriteAsync(HTS221_ADDR, HTS221_REG_CTRL_REG2, initBuf, 1, FS_HTS221_Init_Callback);
+		break;
+	case HTS221_INIT_WAIT_RESET:
+		result = FS_Sensor_ReadAsync(HTS221_ADDR, HTS221_REG_CTRL_REG2, initBuf, 1, FS_HTS221_Init_Callback);
+		break;
+	case HTS221_INIT_H_RH:
+		result = FS_Sensor_ReadAsync(HTS221_ADDR, HTS221_REG_H0_RH_X2, initBuf, 2, FS_HTS221_Init_Callback);
+		break;
+	case HTS221_INIT_H0_T0_OUT:
+		result = FS_Sensor_ReadAsync(HTS221_ADDR, HTS221_REG_H0_T0_OUT, initBuf, 2, FS_HTS221_Init_Callback);
+		break;
+	case HTS221_INIT_H1_T0_OUT:
+		result = FS_Sensor_ReadAsync(HTS221_ADDR, HTS221_REG_H1_T0_OUT, initBuf, 2, FS_HTS221_Init_Callback);
+		break;
+	case HTS221_INIT_T_DEGC:
+		result = FS_Sensor_ReadAsync(HTS221_ADDR, HTS221_REG_T0_DEGC_X8, initBuf, 2, FS_HTS221_Init_Callback);
+		break;
+	case HTS221_INIT_T_MSB:
+		result = FS_Sensor_ReadAsync(HTS221_ADDR, HTS221_REG_T0_T1_MSB, &initBuf[2], 1, FS_HTS221_Init_Callback);
+		break;
+	case HTS221_INIT_T_OUT:
+		result = FS_Sensor_ReadAsync(HTS221_ADDR, HTS221_REG_T0_OUT, initBuf, 4, FS_HTS221_Init_Callback);
+		break;
+	case HTS221_INIT_FLUSH:
+		result = FS_Sensor_ReadAsync(HTS221_ADDR, HTS221_REG_HUMIDITY_OUT_L, dataBuf, 4, FS_HTS221_Init_Callback);
+		break;
 	}
 
-	// Software reset
-	do
+	if (result != HAL_OK)
 	{
-		buf[0] = 0x80;
-		result = FS_Sensor_Write(HTS221_ADDR, HTS221_REG_CTRL_REG2, buf, 1);
+		FS_HTS221_Init_Callback(result);
 	}
-	while (result != HAL_OK);
+}
 
-	// Wait for reset
-	do
+void FS_HTS221_Init(FS_Hum_Data_t *data)
+{
+	// Keep local pointer to humidity data
+	humData = data;
+
+	initStep = HTS221_INIT_WHO_AM_I;
+	FS_HTS221_InitRequest();
+}
+
+HAL_StatusTypeDef FS_HTS221_InitUpdate(void)
+{
+	if (initBusy)
 	{
-		result = FS_Sensor_Read(HTS221_ADDR, HTS221_REG_CTRL_REG2, buf, 1);
+		return HAL_BUSY;
 	}
-	while ((result != HAL_OK) || (buf[0] & 0x80));
 
-	// Read humidity calibration coefficients
-	do
+	if (initResult != HAL_OK)
 	{
-		result = FS_Sensor_Read(HTS221_ADDR, HTS221_REG_H0_RH_X2, buf, 2);
+		// Device is not present
+		if (initStep == HTS221_INIT_WHO_AM_I)
+		{
+			return HAL_ERROR;
+		}
+
+		// Otherwise retry this step
+		FS_HTS221_InitRequest();
+		return HAL_BUSY;
 	}
-	while (result != HAL_OK);
-
-	H0_rH_x2 = buf[0];
-	H1_rH_x2 = buf[1];
 
-	do
+	switch (initStep)
 	{
-		result = FS_Sensor_Read(HTS221_ADDR, HTS221_REG_H0_T0_OUT, buf, 2);
+	case HTS221_INIT_WHO_AM_I:
+		// Check WHO_AM_I register value
+		if (initBuf[0] != 0xbc)
+		{
+			return HAL_ERROR;
+		}
+		initStep = HTS221_INIT_RESET;
+		break;
+	case HTS221_INIT_RESET:
+		initStep = HTS221_INIT_WAIT_RESET;
+		break;
+	case HTS221_INIT_WAIT_RESET:
+		// Wait for reset
+		if (!(initBuf[0] & 0x80)) initStep = HTS221_INIT_H_RH;
+		break;
+	case HTS221_INIT_H_RH:
+		// Read humidity calibration coefficients
+		H0_rH_x2 = initBuf[0];
+		H1_rH_x2 = initBuf[1];
+		initStep = HTS221_INIT_H0_T0_OUT;
+		break;
+	case HTS221_INIT_H0_T0_OUT:
+		H0_T0_out = (int16_t) ((initBuf[1] << 8) | initBuf[0]);
+		initStep = HTS221_INIT_H1_T0_OUT;
+		break;
+	case HTS221_INIT_H1_T0_OUT:
+		H1_T0_out = (int16_t) ((initBuf[1] << 8) | initBuf[0]);
+		initStep = HTS221_INIT_T_DEGC;
+		break;
+	case HTS221_INIT_T_DEGC:
+		// Read temperature calibration coefficients
+		initStep = HTS221_INIT_T_MSB;
+		break;
+	case HTS221_INIT_T_MSB:
+		T0_degC_x8_u16 = (uint16_t) (((initBuf[2] & 0x03) << 8) | initBuf[0]);
+		T1_degC_x8_u16 = (uint16_t) (((initBuf[2] & 0x0c) << 6) | initBuf[1]);
+		initStep = HTS221_INIT_T_OUT;
+		break;
+	case HTS221_INIT_T_OUT:
+		T0_out = (int16_t) ((initBuf[1] << 8) | initBuf[0]);
+		T1_out = (int16_t) ((initBuf[3] << 8) | initBuf[2]);
+		initStep = HTS221_INIT_FLUSH;
+		break;
+	case HTS221_INIT_FLUSH:
+		// Threw out first temperature measurement
+		return HAL_OK;
 	}
-	while (result != HAL_OK);
 
-	H0_T0_out = (int16_t) ((buf[1] << 8) | buf[0]);
+	FS_HTS221_InitRequest();
+	return HAL_BUSY;
+}
 
-	do
-	{
-		result = FS_Sensor_Read(HTS221_ADDR, HTS221_REG_H1_T0_OUT, buf, 2);
-	}
-	while (result != HAL_OK);
+static void FS_HTS221_Start_Callback(HAL_StatusTypeDef result);
 
-	H1_T0_out = (int16_t) ((buf[1] << 8) | buf[0]);
+static HAL_StatusTypeDef FS_HTS221_StartRequest(void)
+{
+	const FS_Config_Data_t *config = FS_Config_Get();
 
-	// Read temperature calibration coefficients
-	do
+	switch (startStep)
 	{
-		result = FS_Sensor_Read(HTS221_ADDR, HTS221_REG_T0_DEGC_X8, buf, 2);
+	case HTS221_START_CTRL_REG3:
+		// Configure data ready on DRDY pin
+		startBuf[0] = 0x04;
+		return FS_Sensor_WriteAsync(HTS221_ADDR, HTS221_REG_CTRL_REG3, startBuf, 1, FS_HTS221_Start_Callback);
+	case HTS221_START_CTRL_REG1:
+		// Active mode; Output data rate 12.5 Hz; block data update
+		startBuf[0] = 0x84 | config->hum_odr;
+		return FS_Sensor_WriteAsync(HTS221_ADDR, HTS221_REG_CTRL_REG1, startBuf, 1, FS_HTS221_Start_Callback);
+	case HTS221_START_DONE:
+		break;
 	}
-	while (result != HAL_OK);
 
-	do
+	return HAL_OK;
+}
+
+static void FS_HTS221_Start_Callback(HAL_StatusTypeDef result)
+{
+	// Ignore completions after the sensor was stopped
+	if (!startActive)
 	{
-		result = FS_Sensor_Read(HTS221_ADDR, HTS221_REG_T0_T1_MSB, &temp, 1);
+		return;
 	}
-	while (result != HAL_OK);
 
-	T0_degC_x8_u16 = (uint16_t) (((temp & 0x03) << 8) | buf[0]);
-	T1_degC_x8_u16 = (uint16_t) (((temp & 0x0c) << 6) | buf[1]);
-
-	do
+	if (result == HAL_OK)
 	{
-		result = FS_Sensor_Read(HTS221_ADDR, HTS221_REG_T0_OUT, buf, 4);
+		++startStep;
+		result = FS_HTS221_StartRequest();
 	}
-	while (result != HAL_OK);
-
-	T0_out = (int16_t) ((buf[1] << 8) | buf[0]);
-	T1_out = (int16_t) ((buf[3] << 8) | buf[2]);
 
-	// Throw out first temperature measurement
-	do
+	if (result != HAL_OK)
 	{
-		result = FS_Sensor_Read(HTS221_ADDR, HTS221_REG_HUMIDITY_OUT_L, dataBuf, 4);
+		FS_Log_WriteEventAsync("Couldn't start humidity sensor");
+		LL_EXTI_DisableIT_0_31(LL_EXTI_LINE_4);
+		startActive = false;
 	}
-	while (result != HAL_OK);
-
-	return HAL_OK;
 }
 
 HAL_StatusTypeDef FS_HTS221_Start(void)
 {
-	const FS_Config_Data_t *config = FS_Config_Get();
-	uint8_t buf[1];
-
 	// Reset busy flag
 	sensor_is_busy = false;
 
+	// Data must be read before the output registers are overwritten
+	FS_Sensor_Register(HTS221_ADDR, FS_SENSOR_PRIORITY_LOW, humPeriod[config->hum_odr]);
+
 	// Enable EXTI pin
 	LL_EXTI_EnableIT_0_31(LL_EXTI_LINE_4);
 
-	// Configure data ready on DRDY pin
-	buf[0] = 0x04;
-	if (FS_Sensor_Write(HTS221_ADDR, HTS221_REG_CTRL_REG3, buf, 1) != HAL_OK)
-	{
-		LL_EXTI_DisableIT_0_31(LL_EXTI_LINE_4);
-		return HAL_ERROR;
-	}
-
-	// Active mode; Output data rate 12.5 Hz; block data update
-	buf[0] = 0x84 | config->hum_odr;
-	if (FS_Sensor_Write(HTS221_ADDR, HTS221_REG_CTRL_REG1, buf, 1) != HAL_OK)
+	// Queue configuration writes
+	startActive = true;
+	startStep = HTS221_START_CTRL_REG3;
+	if (FS_HTS221_StartRequest() != HAL_OK)
 	{
 		LL_EXTI_DisableIT_0_31(LL_EXTI_LINE_4);
+		startActive = false;
 		return HAL_ERROR;
 	}
 
@@ -202,6 +316,10 @@ HAL_StatusTypeDef FS_HTS221_Stop(void)
 	// Disable EXTI pin
     LL_EXTI_DisableIT_0_31(LL_EXTI_LINE_4);
 
+	// Drop configuration writes and reads not yet started
+	startActive = false;
+	FS_Sensor_Cancel(HTS221_ADDR);
+
 	// Disable data ready on DRDY pin
 	buf[0] = 0x00;
 	if (FS_Sensor_Write(HTS221_ADDR, HTS221_REG_CTRL_REG3, buf, 1) != HAL_OK)
@@ -26,7 +26,8 @@
 
 #include "hum.h"
 
-HAL_StatusTypeDef FS_HTS221_Init(FS_Hum_Data_t *data);
+void FS_HTS221_Init(FS_Hum_Data_t *data);
+HAL_StatusTypeDef FS_HTS221_InitUpdate(void);
 HAL_StatusTypeDef FS_HTS221_Start(void);
 HAL_StatusTypeDef FS_HTS221_Stop(void);
 void FS_HTS221_Read(void);
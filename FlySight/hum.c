@@ -41,44 +41,74 @@ static FS_Hum_Data_t humData;
 
 typedef enum {
     HUM_STATE_UNINITIALIZED = 0,
+    HUM_STATE_INITIALIZING,
     HUM_STATE_INIT_FAILED,
     HUM_STATE_READY,
     HUM_STATE_ACTIVE
 } FS_Hum_State_t;
 
 static FS_Hum_State_t humState = HUM_STATE_UNINITIALIZED;
+static uint32_t initStart;
 
 void FS_Hum_Init(void)
 {
-	uint32_t timeout;
+	humState = HUM_STATE_INITIALIZING;
+	initStart = HAL_GetTick();
 
-	timeout = HAL_GetTick() + HUM_INIT_TIMEOUT;
-	while (1)
+	// Check for SHT4x first
+	humInterface.Start = &FS_SHT4X_Start;
+	humInterface.Stop = &FS_SHT4X_Stop;
+	FS_SHT4X_Init(&humData);
+}
+
+HAL_StatusTypeDef FS_Hum_InitUpdate(void)
+{
+	HAL_StatusTypeDef result;
+
+	if (humState != HUM_STATE_INITIALIZING)
 	{
-		if (HAL_GetTick() > timeout)
-		{
-			humState = HUM_STATE_INIT_FAILED;
-			return;
-		}
+		return (humState == HUM_STATE_INIT_FAILED) ? HAL_ERROR : HAL_OK;
+	}
 
-		// Check for SHT4x
-		if (FS_SHT4X_Init(&humData) == HAL_OK)
-		{
-			humInterface.Start = &FS_SHT4X_Start;
-			humInterface.Stop = &FS_SHT4X_Stop;
-			break;
-		}
+	if (humInterface.Start == &FS_SHT4X_Start)
+	{
+		result = FS_SHT4X_InitUpdate();
+	}
+	else
+	{
+		result = FS_HTS221_InitUpdate();
+	}
+
+	if (result == HAL_OK)
+	{
+		humState = HUM_STATE_READY;
+		return HAL_OK;
+	}
+
+	if (HAL_GetTick() - initStart > HUM_INIT_TIMEOUT)
+	{
+		humState = HUM_STATE_INIT_FAILED;
+		return HAL_ERROR;
+	}
 
-		// Check for HTS221
-		if (FS_HTS221_Init(&humData) == HAL_OK)
+	if (result == HAL_ERROR)
+	{
+		// Check for the other device
+		if (humInterface.Start == &FS_SHT4X_Start)
 		{
 			humInterface.Start = &FS_HTS221_Start;
 			humInterface.Stop = &FS_HTS221_Stop;
-			break;
+			FS_HTS221_Init(&humData);
+		}
+		else
+		{
+			humInterface.Start = &FS_SHT4X_Start;
+			humInterface.Stop = &FS_SHT4X_Stop;
+			FS_SHT4X_Init(&humData);
 		}
 	}
 
-	humState = HUM_STATE_READY;
+	return HAL_BUSY;
 }
 
 HAL_StatusTypeDef FS_Hum_Start(void)
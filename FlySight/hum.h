@@ -32,6 +32,7 @@ typedef struct
 } FS_Hum_Data_t;
 
 void FS_Hum_Init(void);
+HAL_StatusTypeDef FS_Hum_InitUpdate(void);
 HAL_StatusTypeDef FS_Hum_Start(void);
 void FS_Hum_Stop(void);
 void FS_Hum_Read(void);
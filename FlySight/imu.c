@@ -28,6 +28,7 @@
 #include "config.h"
 #include "imu.h"
 #include "log.h"
+#include "timestamp.h"
 #include "stm32_seq.h"
 
 #define IMU_OP_TIMEOUT   100
@@ -37,6 +38,10 @@
 #define CS_LOW()	{ HAL_GPIO_WritePin(IMU_NCS_GPIO_Port, IMU_NCS_Pin, GPIO_PIN_RESET); }
 
 #define LSM6DSO_REG_FUNC_CFG_ACCESS 0x01
+#define LSM6DSO_REG_FIFO_CTRL1      0x07
+#define LSM6DSO_REG_FIFO_CTRL2      0x08
+#define LSM6DSO_REG_FIFO_CTRL3      0x09
+#define LSM6DSO_REG_FIFO_CTRL4      0x0a
 #define LSM6DSO_REG_INT1_CTRL       0x0d
 #define LSM6DSO_REG_WHO_AM_I        0x0f
 #define LSM6DSO_REG_CTRL1_XL        0x10
@@ -46,6 +51,14 @@
 #define LSM6DSO_REG_CTRL9_XL        0x18
 #define LSM6DSO_REG_CTRL10_C        0x19
 #define LSM6DSO_OUT_TEMP_L_REG      0x20
+#define LSM6DSO_FIFO_DATA_OUT_TAG   0x78
+
+#define LSM6DSO_TAG_GYRO            0x01
+#define LSM6DSO_TAG_ACCEL           0x02
+#define LSM6DSO_TAG_TEMP            0x03
+
+#define IMU_FIFO_WORD_LEN  7	// Tag + 6 data bytes
+#define IMU_FIFO_MAX_WORDS (2 * FS_CONFIG_MAX_IMU_FIFO)
 
 typedef enum {
 	ACCEL_ODR_PD   = 0,
@@ -90,11 +103,32 @@ typedef enum {
 	GYRO_FS_2000 = 3
 } FS_IMU_GyroFS_t;
 
-static int32_t accelFactor;
-static int32_t gyroFactor;
+static FS_IMU_Scale_t imuScale;
 
-static uint8_t dataBuf[15];
-static FS_IMU_Data_t imuData;
+// Sample period in us for each accelerometer ODR setting
+static const uint32_t accelPeriod[] =
+{
+	0, 80000, 38462, 19231, 9615, 4808, 2404, 1200, 600, 300, 150, 625000
+};
+
+static uint8_t dataBuf[1 + IMU_FIFO_WORD_LEN * IMU_FIFO_MAX_WORDS];
+static FS_IMU_Raw_t imuRaw;
+
+// FIFO mode
+static uint16_t fifoWords;			// watermark in FIFO words, zero if disabled
+static uint8_t  fifoCtrl4;			// FIFO_CTRL4 value in continuous mode
+static uint32_t fifoPeriod;			// accelerometer sample period (us)
+static uint32_t fifoTime;			// time of newest sample (ms)
+static uint32_t fifoFrac;			// time of newest sample (us past fifoTime)
+static volatile uint32_t fifoAnchor;	// time of watermark interrupt (ms)
+static volatile uint16_t fifoAnchorUs;	// time of watermark interrupt (us past fifoAnchor)
+static volatile bool fifoAnchored;	// true if read was started by interrupt
+static volatile uint32_t edgeTime;		// time of latest watermark interrupt (ms)
+static volatile uint16_t edgeTimeUs;	// time of latest watermark interrupt (us past edgeTime)
+static volatile bool edgePending;	// watermark interrupt not yet used by a read
+
+static FS_IMU_Raw_t imuBatch[IMU_FIFO_MAX_WORDS];
+static uint32_t imuBatchCount;
 
 static volatile bool handleRead  = false;
 static volatile bool busy = false;
@@ -118,6 +152,7 @@ static HAL_StatusTypeDef FS_IMU_ClearInt1(void);
 static void FS_IMU_Int1Exti_DisableAndClear(void);
 static void FS_IMU_Int1Exti_Enable(void);
 static void FS_IMU_RecoverFromOverrun(void);
+static void FS_IMU_ParseFifo(void);
 
 void FS_IMU_TransferComplete(void)
 {
@@ -165,6 +200,19 @@ static HAL_StatusTypeDef FS_IMU_WriteRegister(uint8_t addr, uint8_t *data, uint1
 static HAL_StatusTypeDef FS_IMU_ClearInt1(void)
 {
 	uint8_t dummy[14];
+	HAL_StatusTypeDef result;
+
+	if (fifoWords)
+	{
+		// Flush FIFO by passing through bypass mode
+		dummy[0] = 0x00;
+		result = FS_IMU_WriteRegister(LSM6DSO_REG_FIFO_CTRL4, dummy, 1);
+		if (result == HAL_OK)
+		{
+			result = FS_IMU_WriteRegister(LSM6DSO_REG_FIFO_CTRL4, &fifoCtrl4, 1);
+		}
+		return result;
+	}
 
 	// Read all output registers (TEMP + GYRO + ACCEL) to clear INT1
 	return FS_IMU_ReadRegister(LSM6DSO_OUT_TEMP_L_REG, dummy, 14);
@@ -209,8 +257,8 @@ static void FS_IMU_RecoverFromOverrun(void)
 	/* Clear any latched DRDY/INT1 by reading all output registers once. */
 	(void)FS_IMU_ClearInt1();
 
-	/* Restore DRDY routing on INT1. */
-	buf = 0x01; /* INT1_DRDY_XL */
+	/* Restore DRDY or FIFO threshold routing on INT1. */
+	buf = fifoWords ? 0x08 : 0x01; /* INT1_FIFO_TH : INT1_DRDY_XL */
 	(void)FS_IMU_WriteRegister(LSM6DSO_REG_INT1_CTRL, &buf, 1);
 
 	/*
@@ -288,6 +336,9 @@ HAL_StatusTypeDef FS_IMU_Start(void)
 		return HAL_ERROR;
 	}
 
+	// Start from data-ready mode
+	fifoWords = 0;
+
 	// Clear any pending interrupt before enabling rising-edge EXTI
 	// This prevents lockup if INT1 is already HIGH from previous session
 	if (HAL_GPIO_ReadPin(IMU_INT1_GPIO_Port, IMU_INT1_Pin) == GPIO_PIN_SET)
@@ -296,11 +347,23 @@ HAL_StatusTypeDef FS_IMU_Start(void)
 	}
 	LL_EXTI_ClearFlag_0_31(LL_EXTI_LINE_9);
 
+	// FIFO watermark, counting the gyro words batched alongside each run of
+	// accelerometer words at their own output data rate
+	fifoWords = config->imu_fifo;
+	if (config->gyro_odr && accelPeriod[config->gyro_odr])
+	{
+		fifoWords += (config->imu_fifo * accelPeriod[config->accel_odr]
+				+ accelPeriod[config->gyro_odr] / 2) / accelPeriod[config->gyro_odr];
+	}
+	fifoWords = MIN(fifoWords, IMU_FIFO_MAX_WORDS);
+	fifoCtrl4 = 0x26;	// Temperature batched at 12.5 Hz, continuous mode
+	fifoPeriod = accelPeriod[config->accel_odr];
+
 	// Enable EXTI pin
 	LL_EXTI_EnableIT_0_31(LL_EXTI_LINE_9);
 
-	// Accelerometer Data Ready interrupt on INT1
-	buf[0] = 0x01;
+	// Accelerometer Data Ready or FIFO threshold interrupt on INT1
+	buf[0] = fifoWords ? 0x08 : 0x01;
 	if (FS_IMU_WriteRegister(LSM6DSO_REG_INT1_CTRL, buf, 1) != HAL_OK)
 	{
 		FS_Log_WriteEvent("Couldn't start IMU");
@@ -344,20 +407,57 @@ HAL_StatusTypeDef FS_IMU_Start(void)
 		return HAL_ERROR;
 	}
 
+	if (fifoWords)
+	{
+		// Set FIFO watermark
+		buf[0] = fifoWords & 0xff;
+		if (FS_IMU_WriteRegister(LSM6DSO_REG_FIFO_CTRL1, buf, 1) != HAL_OK)
+		{
+			FS_Log_WriteEvent("Couldn't start IMU");
+			LL_EXTI_DisableIT_0_31(LL_EXTI_LINE_9);
+			return HAL_ERROR;
+		}
+
+		buf[0] = (fifoWords >> 8) & 0x01;
+		if (FS_IMU_WriteRegister(LSM6DSO_REG_FIFO_CTRL2, buf, 1) != HAL_OK)
+		{
+			FS_Log_WriteEvent("Couldn't start IMU");
+			LL_EXTI_DisableIT_0_31(LL_EXTI_LINE_9);
+			return HAL_ERROR;
+		}
+
+		// Batch gyro and accelerometer at their output data rates
+		buf[0] = (config->gyro_odr << 4) | config->accel_odr;
+		if (FS_IMU_WriteRegister(LSM6DSO_REG_FIFO_CTRL3, buf, 1) != HAL_OK)
+		{
+			FS_Log_WriteEvent("Couldn't start IMU");
+			LL_EXTI_DisableIT_0_31(LL_EXTI_LINE_9);
+			return HAL_ERROR;
+		}
+
+		// Enable FIFO
+		if (FS_IMU_WriteRegister(LSM6DSO_REG_FIFO_CTRL4, &fifoCtrl4, 1) != HAL_OK)
+		{
+			FS_Log_WriteEvent("Couldn't start IMU");
+			LL_EXTI_DisableIT_0_31(LL_EXTI_LINE_9);
+			return HAL_ERROR;
+		}
+	}
+
 	switch (config->accel_fs)
 	{
-	case ACCEL_FS_2:  accelFactor = 2 * 100000; break;
-	case ACCEL_FS_4:  accelFactor = 4 * 100000; break;
-	case ACCEL_FS_8:  accelFactor = 8 * 100000; break;
-	case ACCEL_FS_16: accelFactor = 16 * 100000; break;
+	case ACCEL_FS_2:  imuScale.accelFactor = 2 * 100000; break;
+	case ACCEL_FS_4:  imuScale.accelFactor = 4 * 100000; break;
+	case ACCEL_FS_8:  imuScale.accelFactor = 8 * 100000; break;
+	case ACCEL_FS_16: imuScale.accelFactor = 16 * 100000; break;
 	}
 
 	switch (config->gyro_fs)
 	{
-	case GYRO_FS_250:  gyroFactor = 250 * 1000; break;
-	case GYRO_FS_500:  gyroFactor = 500 * 1000; break;
-	case GYRO_FS_1000: gyroFactor = 1000 * 1000; break;
-	case GYRO_FS_2000: gyroFactor = 2000 * 1000; break;
+	case GYRO_FS_250:  imuScale.gyroFactor = 250 * 1000; break;
+	case GYRO_FS_500:  imuScale.gyroFactor = 500 * 1000; break;
+	case GYRO_FS_1000: imuScale.gyroFactor = 1000 * 1000; break;
+	case GYRO_FS_2000: imuScale.gyroFactor = 2000 * 1000; break;
 	}
 
 	imuState = IMU_STATE_ACTIVE;
@@ -365,7 +465,15 @@ HAL_StatusTypeDef FS_IMU_Start(void)
 	// Enable asynchronous reads
 	handleRead = true;
 
-	FS_IMU_BeginRead(false);
+	fifoTime = HAL_GetTick();
+	fifoFrac = 0;
+	fifoAnchored = false;
+	edgePending = false;
+
+	if (!fifoWords)
+	{
+		FS_IMU_BeginRead(false);
+	}
 
 	return HAL_OK;
 }
@@ -383,6 +491,9 @@ void FS_IMU_Stop(void)
 	// Wait for any in-flight DMA to complete
 	while (busy);
 
+	// FIFO is disabled by reset
+	fifoWords = 0;
+
 	// Software reset
 	buf[0] = 0x01;
 	FS_IMU_WriteRegister(LSM6DSO_REG_CTRL3_C, buf, 1);
@@ -398,12 +509,27 @@ void FS_IMU_Stop(void)
 
 void FS_IMU_Read(void)
 {
+	uint32_t ms;
+	uint16_t us;
+
 	if (imuState != IMU_STATE_ACTIVE)
 	{
 		return;
 	}
 
-	imuData.time = HAL_GetTick();
+	if (fifoWords)
+	{
+		// At the rising edge the FIFO holds exactly one watermark. The
+		// anchor is latched when a read actually starts.
+		FS_Timestamp_Get(&ms, &us);
+		edgeTime = ms;
+		edgeTimeUs = us;
+		edgePending = true;
+	}
+	else
+	{
+		FS_Timestamp_Get(&imuRaw.time, &imuRaw.timeUs);
+	}
 
 	if (handleRead)
 	{
@@ -415,13 +541,21 @@ static void FS_IMU_BeginRead(bool enableLogging)
 {
 	HAL_StatusTypeDef res;
 	uint32_t primask_bit;
-
-	/* Address with read flag */
-	dataBuf[0] = LSM6DSO_OUT_TEMP_L_REG | 0x80;
+	uint16_t size;
 
 	primask_bit = __get_PRIMASK();
 	__disable_irq();
 
+	if (busy && fifoWords)
+	{
+		/*
+		 * In FIFO mode INT1 is a level signal, and the in-flight read checks
+		 * it again on completion, so there is nothing to recover from.
+		 */
+		__set_PRIMASK(primask_bit);
+		return;
+	}
+
 	if (busy)
 	{
 		overrunPending = true;
@@ -440,10 +574,29 @@ static void FS_IMU_BeginRead(bool enableLogging)
 	busy = true;
 	enableLoggingCb = enableLogging;
 
+	// Anchor this read to the watermark interrupt that started it
+	fifoAnchored = edgePending;
+	fifoAnchor = edgeTime;
+	fifoAnchorUs = edgeTimeUs;
+	edgePending = false;
+
 	__set_PRIMASK(primask_bit);
 
+	if (fifoWords)
+	{
+		/* Burst read one watermark, address wraps within FIFO output */
+		dataBuf[0] = LSM6DSO_FIFO_DATA_OUT_TAG | 0x80;
+		size = 1 + IMU_FIFO_WORD_LEN * fifoWords;
+	}
+	else
+	{
+		/* Address with read flag */
+		dataBuf[0] = LSM6DSO_OUT_TEMP_L_REG | 0x80;
+		size = 15;
+	}
+
 	CS_LOW();
-	res = HAL_SPI_TransmitReceive_DMA(&hspi1, dataBuf, dataBuf, 15);
+	res = HAL_SPI_TransmitReceive_DMA(&hspi1, dataBuf, dataBuf, size);
 
 	if (res != HAL_OK)
 		FS_IMU_Read_Callback(res);
@@ -470,17 +623,22 @@ static void FS_IMU_Read_Callback(HAL_StatusTypeDef result)
 	 * Parse the buffer first while 'busy' is still TRUE, so no new DMA read can
 	 * reuse dataBuf until we've copied out the data we need.
 	 */
-	if (shouldLog)
+	if (shouldLog && fifoWords)
 	{
-		imuData.temperature = (((int16_t) ((dataBuf[2] << 8) | dataBuf[1])) * 100) / 256 + 2500;
+		FS_IMU_ParseFifo();
+	}
+	else if (shouldLog)
+	{
+		// Keep raw counts; conversion is done by the consumer
+		imuRaw.temperature = (int16_t) ((dataBuf[2] << 8) | dataBuf[1]);
 
-		imuData.wy = (((int64_t) (int16_t) ((dataBuf[4] << 8) | dataBuf[3])) * gyroFactor) / 32768;
-		imuData.wx = -(((int64_t) (int16_t) ((dataBuf[6] << 8) | dataBuf[5])) * gyroFactor) / 32768;
-		imuData.wz = (((int64_t) (int16_t) ((dataBuf[8] << 8) | dataBuf[7])) * gyroFactor) / 32768;
+		imuRaw.gx = (int16_t) ((dataBuf[4] << 8) | dataBuf[3]);
+		imuRaw.gy = (int16_t) ((dataBuf[6] << 8) | dataBuf[5]);
+		imuRaw.gz = (int16_t) ((dataBuf[8] << 8) | dataBuf[7]);
 
-		imuData.ay = (((int64_t) (int16_t) ((dataBuf[10] << 8) | dataBuf[9])) * accelFactor) / 32768;
-		imuData.ax = -(((int64_t) (int16_t) ((dataBuf[12] << 8) | dataBuf[11])) * accelFactor) / 32768;
-		imuData.az = (((int64_t) (int16_t) ((dataBuf[14] << 8) | dataBuf[13])) * accelFactor) / 32768;
+		imuRaw.ax = (int16_t) ((dataBuf[10] << 8) | dataBuf[9]);
+		imuRaw.ay = (int16_t) ((dataBuf[12] << 8) | dataBuf[11]);
+		imuRaw.az = (int16_t) ((dataBuf[14] << 8) | dataBuf[13]);
 	}
 
 	/*
@@ -514,15 +672,140 @@ static void FS_IMU_Read_Callback(HAL_StatusTypeDef result)
 		FS_IMU_Int1Exti_Enable();
 	}
 
-	if (shouldLog)
+	if (shouldLog && fifoWords)
+	{
+		if (imuBatchCount > 0)
+		{
+			FS_IMU_BatchReady_Callback();
+		}
+
+		/*
+		 * INT1 stays HIGH while the FIFO is above the watermark, so there
+		 * will be no rising edge. Keep draining until it drops.
+		 */
+		if (handleRead &&
+		    (HAL_GPIO_ReadPin(IMU_INT1_GPIO_Port, IMU_INT1_Pin) == GPIO_PIN_SET))
+		{
+			FS_IMU_BeginRead(true);
+		}
+	}
+	else if (shouldLog)
 	{
 		FS_IMU_DataReady_Callback();
 	}
 }
 
-const FS_IMU_Data_t *FS_IMU_GetData(void)
+static void FS_IMU_ParseFifo(void)
+{
+	const uint8_t *word;
+	uint16_t i;
+
+	imuBatchCount = 0;
+
+	for (i = 0; i < fifoWords; ++i)
+	{
+		word = &dataBuf[1 + IMU_FIFO_WORD_LEN * i];
+
+		switch (word[0] >> 3)
+		{
+		case LSM6DSO_TAG_GYRO:
+			imuRaw.gx = (int16_t) ((word[2] << 8) | word[1]);
+			imuRaw.gy = (int16_t) ((word[4] << 8) | word[3]);
+			imuRaw.gz = (int16_t) ((word[6] << 8) | word[5]);
+			break;
+		case LSM6DSO_TAG_ACCEL:
+			imuRaw.ax = (int16_t) ((word[2] << 8) | word[1]);
+			imuRaw.ay = (int16_t) ((word[4] << 8) | word[3]);
+			imuRaw.az = (int16_t) ((word[6] << 8) | word[5]);
+
+			// Each accelerometer word completes a sample
+			imuBatch[imuBatchCount++] = imuRaw;
+			break;
+		case LSM6DSO_TAG_TEMP:
+			imuRaw.temperature = (int16_t) ((word[2] << 8) | word[1]);
+			break;
+		}
+	}
+
+	// Reconstruct sample times from the accelerometer ODR
+	for (i = 0; i < imuBatchCount; ++i)
+	{
+		if (fifoAnchored)
+		{
+			// Newest sample was taken at the watermark interrupt
+			imuBatch[i].time = fifoAnchor;
+			imuBatch[i].timeUs = fifoAnchorUs;
+			FS_Timestamp_Subtract(&imuBatch[i].time, &imuBatch[i].timeUs,
+					(imuBatchCount - 1 - i) * fifoPeriod);
+		}
+		else
+		{
+			// Continue on from the previous burst
+			fifoFrac += fifoPeriod;
+			fifoTime += fifoFrac / 1000;
+			fifoFrac %= 1000;
+			imuBatch[i].time = fifoTime;
+			imuBatch[i].timeUs = fifoFrac;
+		}
+	}
+
+	if (fifoAnchored)
+	{
+		fifoTime = fifoAnchor;
+		fifoFrac = fifoAnchorUs;
+	}
+
+	if (imuBatchCount > 0)
+	{
+		imuRaw.time = imuBatch[imuBatchCount - 1].time;
+		imuRaw.timeUs = imuBatch[imuBatchCount - 1].timeUs;
+	}
+}
+
+void FS_IMU_Convert(const FS_IMU_Scale_t *scale, const FS_IMU_Raw_t *raw,
+		FS_IMU_Data_t *data, uint32_t count)
+{
+	const int32_t gyroFactor = scale->gyroFactor;
+	const int32_t accelFactor = scale->accelFactor;
+	uint32_t i;
+
+	for (i = 0; i < count; ++i)
+	{
+		data[i].time = raw[i].time;
+		data[i].timeUs = raw[i].timeUs;
+
+		data[i].wy = (((int64_t) raw[i].gx) * gyroFactor) / 32768;
+		data[i].wx = -(((int64_t) raw[i].gy) * gyroFactor) / 32768;
+		data[i].wz = (((int64_t) raw[i].gz) * gyroFactor) / 32768;
+
+		data[i].ay = (((int64_t) raw[i].ax) * accelFactor) / 32768;
+		data[i].ax = -(((int64_t) raw[i].ay) * accelFactor) / 32768;
+		data[i].az = (((int64_t) raw[i].az) * accelFactor) / 32768;
+
+		data[i].temperature = (raw[i].temperature * 100) / 256 + 2500;
+	}
+}
+
+const FS_IMU_Scale_t *FS_IMU_GetScale(void)
+{
+	return &imuScale;
+}
+
+uint32_t FS_IMU_GetPeriod(void)
 {
-	return &imuData;
+	// Sample period for the configured ODR, zero if powered down
+	return accelPeriod[FS_Config_Get()->accel_odr];
+}
+
+const FS_IMU_Raw_t *FS_IMU_GetRaw(void)
+{
+	return &imuRaw;
+}
+
+const FS_IMU_Raw_t *FS_IMU_GetBatch(uint32_t *count)
+{
+	*count = imuBatchCount;
+	return imuBatch;
 }
 
 __weak void FS_IMU_DataReady_Callback(void)
@@ -531,3 +814,10 @@ __weak void FS_IMU_DataReady_Callback(void)
 	           the FS_IMU_DataReady_Callback could be implemented in the user file
 	   */
 }
+
+__weak void FS_IMU_BatchReady_Callback(void)
+{
+	  /* NOTE: This function should not be modified, when the callback is needed,
+	           the FS_IMU_BatchReady_Callback could be implemented in the user file
+	   */
+}
@@ -34,8 +34,28 @@ typedef struct
 	int32_t ay;				// g * 100000
 	int32_t az;				// g * 100000
 	int16_t temperature;	// degrees C * 100
+	uint16_t timeUs;		// us past time
 } FS_IMU_Data_t;
 
+typedef struct
+{
+	uint32_t time;			// ms
+	uint16_t timeUs;		// us past time
+	int16_t gx;				// gyro counts, sensor frame
+	int16_t gy;				// gyro counts, sensor frame
+	int16_t gz;				// gyro counts, sensor frame
+	int16_t ax;				// accel counts, sensor frame
+	int16_t ay;				// accel counts, sensor frame
+	int16_t az;				// accel counts, sensor frame
+	int16_t temperature;	// temperature counts
+} FS_IMU_Raw_t;
+
+typedef struct
+{
+	int32_t gyroFactor;		// deg/s * 1000 at full scale
+	int32_t accelFactor;	// g * 100000 at full scale
+} FS_IMU_Scale_t;
+
 void FS_IMU_TransferComplete(void);
 void FS_IMU_TransferError(void);
 
@@ -43,7 +63,13 @@ void FS_IMU_Init(void);
 HAL_StatusTypeDef FS_IMU_Start(void);
 void FS_IMU_Stop(void);
 void FS_IMU_Read(void);
-const FS_IMU_Data_t *FS_IMU_GetData(void);
+const FS_IMU_Raw_t *FS_IMU_GetRaw(void);
+const FS_IMU_Raw_t *FS_IMU_GetBatch(uint32_t *count);
+const FS_IMU_Scale_t *FS_IMU_GetScale(void);
+uint32_t FS_IMU_GetPeriod(void);
+void FS_IMU_Convert(const FS_IMU_Scale_t *scale, const FS_IMU_Raw_t *raw,
+		FS_IMU_Data_t *data, uint32_t count);
 void FS_IMU_DataReady_Callback(void);
+void FS_IMU_BatchReady_Callback(void);
 
 #endif /* IMU_H_ */
@@ -0,0 +1,629 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2024 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "main.h"
+#include "app_common.h"
+#include "config.h"
+#include "kalman.h"
+#include "log.h"
+#include "stm32_seq.h"
+#include "timestamp.h"
+
+#define KF_STATES          3		// maximum states per axis
+#define KF_CONVERT_COUNT   16		// IMU samples converted at a time
+#define KF_IMU_COUNT       (4 * FS_CONFIG_MAX_IMU_FIFO)		// IMU samples queued for the filter task
+#define KF_BARO_COUNT      (2 * FS_CONFIG_MAX_BARO_FIFO)	// barometer samples queued for the filter task
+
+#define KF_PREDICT_MSEC    10		// minimum time between prediction steps
+#define KF_OUTPUT_MSEC     40		// time between output samples
+#define KF_TIMEOUT_MSEC    10000	// maximum time since last GNSS update
+#define KF_MAX_DT          1.0f		// maximum prediction step (s)
+
+#define KF_ACCEL_NOISE_H   2.0f		// horizontal acceleration noise (m/s^2)
+#define KF_ACCEL_NOISE_V   0.5f		// vertical acceleration noise with IMU (m/s^2)
+#define KF_BARO_DRIFT      0.1f		// barometer offset random walk (m/s^0.5)
+#define KF_BARO_NOISE      0.5f		// barometer altitude noise (m)
+#define KF_GATE            25.0f	// innovation gate (sigma^2)
+#define KF_MAX_REJECTS     5		// consecutive GNSS rejections before reset
+
+#define KF_GRAVITY_TAU     5.0f		// time constant of gravity direction estimate (s)
+#define KF_GRAVITY_MIN     0.2f		// minimum filtered specific force (g)
+#define KF_GRAVITY         9.80665f	// m/s^2
+
+#define KF_DEG_PER_M       89.9322f	// deg * 1e7 per metre of latitude
+
+typedef struct
+{
+	uint8_t n;
+	float x[KF_STATES];
+	float P[KF_STATES][KF_STATES];
+} FS_Kalman_Axis_t;
+
+// North and east states: position (m), velocity (m/s)
+static FS_Kalman_Axis_t axisN;
+static FS_Kalman_Axis_t axisE;
+
+// Vertical states: height (m), rate of climb (m/s), barometer offset (m)
+static FS_Kalman_Axis_t axisU;
+
+static bool initialized;
+static int32_t originLat;		// deg * 1e7
+static int32_t originLon;		// deg * 1e7
+static float cosLat;
+
+static uint32_t filterMs;		// filter time (ms)
+static uint16_t filterUs;		// filter time (us past filterMs)
+static uint32_t outputMs;		// time of last scheduled output (ms)
+static uint16_t outputUs;		// time of last scheduled output (us past outputMs)
+static uint32_t gnssTime;		// time of last GNSS update (ms)
+static uint8_t gnssRejects;
+
+// Vertical acceleration from IMU
+static float gravity[3];		// filtered specific force (g)
+static bool gravityValid;
+static uint32_t imuMs;			// time of last IMU sample (ms)
+static uint16_t imuUs;			// time of last IMU sample (us past imuMs)
+static float accelSum;			// sum of vertical acceleration (m/s^2)
+static uint32_t accelCount;
+static bool imuActive;
+
+// Barometer
+static float baroAlt;			// last pressure altitude (m)
+static bool baroValid;
+
+static FS_IMU_Data_t imuConv[KF_CONVERT_COUNT];
+
+// Measurements waiting for the filter task
+static FS_IMU_Raw_t imuBuf[KF_IMU_COUNT];
+static volatile uint32_t imuRdI;
+static volatile uint32_t imuWrI;
+static FS_Baro_Data_t baroBuf[KF_BARO_COUNT];
+static volatile uint32_t baroRdI;
+static volatile uint32_t baroWrI;
+static FS_GNSS_Data_t gnssBuf;
+static volatile bool gnssPending;
+static volatile bool kfActive;
+
+static FS_Kalman_Data_t kfData;
+static FS_Kalman_Stats_t stats;
+
+static void updateTask(void);
+
+static int32_t FS_Kalman_TimeDiff(uint32_t ms1, uint16_t us1, uint32_t ms0, uint16_t us0)
+{
+	return (int32_t) (ms1 - ms0) * 1000 + ((int32_t) us1 - us0);
+}
+
+static void FS_Kalman_InitAxis(FS_Kalman_Axis_t *axis, uint8_t n)
+{
+	uint8_t i, j;
+
+	axis->n = n;
+
+	for (i = 0; i < KF_STATES; ++i)
+	{
+		axis->x[i] = 0;
+
+		for (j = 0; j < KF_STATES; ++j)
+		{
+			axis->P[i][j] = 0;
+		}
+	}
+}
+
+static void FS_Kalman_Predict(FS_Kalman_Axis_t *axis, float dt, float a, float q)
+{
+	float (*P)[KF_STATES] = axis->P;
+	const float dt2 = dt * dt;
+
+	axis->x[0] += axis->x[1] * dt + 0.5f * a * dt2;
+	axis->x[1] += a * dt;
+
+	// P = F P F' + Q for constant acceleration noise
+	P[0][0] += dt * (P[0][1] + P[1][0]) + dt2 * P[1][1] + q * dt2 * dt / 3;
+	P[0][1] += dt * P[1][1] + q * dt2 / 2;
+	P[1][0] = P[0][1];
+	P[1][1] += q * dt;
+
+	if (axis->n > 2)
+	{
+		P[0][2] += dt * P[1][2];
+		P[2][0] = P[0][2];
+		P[2][2] += KF_BARO_DRIFT * KF_BARO_DRIFT * dt;
+	}
+}
+
+static bool FS_Kalman_Update(FS_Kalman_Axis_t *axis, const float *H, float z, float r)
+{
+	const uint32_t start = DWT->CYCCNT;
+	const uint8_t n = axis->n;
+	float PH[KF_STATES];
+	float s = r, y = z, k;
+	uint8_t i, j;
+
+	for (i = 0; i < n; ++i)
+	{
+		PH[i] = 0;
+		for (j = 0; j < n; ++j)
+		{
+			PH[i] += axis->P[i][j] * H[j];
+		}
+		y -= H[i] * axis->x[i];
+	}
+
+	for (i = 0; i < n; ++i)
+	{
+		s += H[i] * PH[i];
+	}
+
+	if (y * y > KF_GATE * s)
+	{
+		++stats.rejectCount;
+		return false;
+	}
+
+	for (i = 0; i < n; ++i)
+	{
+		k = PH[i] / s;
+		axis->x[i] += k * y;
+
+		for (j = 0; j < n; ++j)
+		{
+			axis->P[i][j] -= k * PH[j];
+		}
+	}
+
+	++stats.updateCount;
+	stats.updateMax = MAX(stats.updateMax, DWT->CYCCNT - start);
+
+	return true;
+}
+
+static void FS_Kalman_Output(void)
+{
+	kfData.time = filterMs;
+	kfData.timeUs = filterUs;
+	kfData.lat = originLat + lroundf(axisN.x[0] * KF_DEG_PER_M);
+	kfData.lon = originLon + lroundf(axisE.x[0] * KF_DEG_PER_M / cosLat);
+	kfData.hMSL = lroundf(axisU.x[0] * 1000);
+	kfData.velN = lroundf(axisN.x[1] * 1000);
+	kfData.velE = lroundf(axisE.x[1] * 1000);
+	kfData.velD = lroundf(-axisU.x[1] * 1000);
+
+	// Keep outputs on a fixed grid so prediction steps do not stretch the
+	// period, and start over from filter time after a gap
+	outputMs += KF_OUTPUT_MSEC;
+	if (FS_Kalman_TimeDiff(filterMs, filterUs, outputMs, outputUs) >= KF_OUTPUT_MSEC * 1000)
+	{
+		outputMs = filterMs;
+		outputUs = filterUs;
+	}
+}
+
+static bool FS_Kalman_Advance(uint32_t ms, uint16_t us)
+{
+	const uint32_t start = DWT->CYCCNT;
+	const float qH = KF_ACCEL_NOISE_H * KF_ACCEL_NOISE_H;
+	const float qV = imuActive ? KF_ACCEL_NOISE_V * KF_ACCEL_NOISE_V : qH;
+	float dt, a;
+
+	dt = FS_Kalman_TimeDiff(ms, us, filterMs, filterUs) * 1e-6f;
+	if (dt <= 0) return false;
+
+	// Mean vertical acceleration since last step
+	a = accelCount ? accelSum / accelCount : 0;
+	accelSum = 0;
+	accelCount = 0;
+
+	dt = MIN(dt, KF_MAX_DT);
+
+	FS_Kalman_Predict(&axisN, dt, 0, qH);
+	FS_Kalman_Predict(&axisE, dt, 0, qH);
+	FS_Kalman_Predict(&axisU, dt, a, qV);
+
+	filterMs = ms;
+	filterUs = us;
+
+	++stats.predictCount;
+	stats.predictMax = MAX(stats.predictMax, DWT->CYCCNT - start);
+
+	// Output at a fixed rate on the filter timeline
+	return FS_Kalman_TimeDiff(filterMs, filterUs, outputMs, outputUs) >= KF_OUTPUT_MSEC * 1000;
+}
+
+static void FS_Kalman_Start(const FS_GNSS_Data_t *gnss, uint32_t ms, uint16_t us)
+{
+	const float hAcc = gnss->hAcc / 1000.0f;
+	const float vAcc = gnss->vAcc / 1000.0f;
+	const float sAcc = gnss->sAcc / 1000.0f;
+
+	originLat = gnss->lat;
+	originLon = gnss->lon;
+	cosLat = MAX(cosf(gnss->lat * (float) (M_PI / 180e7)), 0.01f);
+
+	FS_Kalman_InitAxis(&axisN, 2);
+	FS_Kalman_InitAxis(&axisE, 2);
+	FS_Kalman_InitAxis(&axisU, 3);
+
+	axisN.x[1] = gnss->velN / 1000.0f;
+	axisE.x[1] = gnss->velE / 1000.0f;
+	axisU.x[0] = gnss->hMSL / 1000.0f;
+	axisU.x[1] = -gnss->velD / 1000.0f;
+	axisU.x[2] = baroValid ? baroAlt - axisU.x[0] : 0;
+
+	axisN.P[0][0] = axisE.P[0][0] = hAcc * hAcc;
+	axisN.P[1][1] = axisE.P[1][1] = sAcc * sAcc;
+	axisU.P[0][0] = vAcc * vAcc;
+	axisU.P[1][1] = sAcc * sAcc;
+	axisU.P[2][2] = baroValid ? vAcc * vAcc : 1e6f;
+
+	filterMs = outputMs = ms;
+	filterUs = outputUs = us;
+
+	accelSum = 0;
+	accelCount = 0;
+	gnssRejects = 0;
+
+	initialized = true;
+}
+
+void FS_Kalman_Init(void)
+{
+	// Enable cycle counter
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	initialized = false;
+	gravityValid = false;
+	imuActive = false;
+	baroValid = false;
+
+	memset(&kfData, 0, sizeof(kfData));
+	memset(&stats, 0, sizeof(stats));
+
+	// Initialize measurement queues
+	imuRdI = 0;
+	imuWrI = 0;
+	baroRdI = 0;
+	baroWrI = 0;
+	gnssPending = false;
+
+	// Initialize update task
+	UTIL_SEQ_RegTask(1<<CFG_TASK_FS_KALMAN_UPDATE_ID, UTIL_SEQ_RFU, updateTask);
+
+	kfActive = true;
+}
+
+void FS_Kalman_DeInit(void)
+{
+	kfActive = false;
+	initialized = false;
+
+	// Log filter statistics
+	FS_Log_WriteEvent("Kalman filter: %lu predictions, max %lu cycles",
+			stats.predictCount, stats.predictMax);
+	FS_Log_WriteEvent("Kalman filter: %lu updates, max %lu cycles, %lu rejected",
+			stats.updateCount, stats.updateMax, stats.rejectCount);
+
+	if (stats.dropCount)
+	{
+		FS_Log_WriteEvent("Kalman filter: %lu samples dropped", stats.dropCount);
+	}
+}
+
+static void FS_Kalman_ProcessIMU(const FS_IMU_Raw_t *raw, uint32_t count)
+{
+	const FS_IMU_Scale_t *scale = FS_IMU_GetScale();
+	uint32_t i, j, n;
+	float f[3], norm, dt, alpha, a;
+	bool valid, output;
+
+	for (i = 0; i < count; i += n)
+	{
+		n = MIN(count - i, KF_CONVERT_COUNT);
+
+		FS_IMU_Convert(scale, &raw[i], imuConv, n);
+
+		for (j = 0; j < n; ++j)
+		{
+			f[0] = imuConv[j].ax * 1e-5f;
+			f[1] = imuConv[j].ay * 1e-5f;
+			f[2] = imuConv[j].az * 1e-5f;
+
+			// Gravity estimate is only used by this path
+			if (!gravityValid)
+			{
+				gravity[0] = f[0];
+				gravity[1] = f[1];
+				gravity[2] = f[2];
+				gravityValid = true;
+			}
+			else
+			{
+				// Low-pass specific force to find the vertical
+				dt = FS_Kalman_TimeDiff(imuConv[j].time, imuConv[j].timeUs, imuMs, imuUs) * 1e-6f;
+				alpha = MIN(MAX(dt, 0) / KF_GRAVITY_TAU, 1.0f);
+
+				gravity[0] += alpha * (f[0] - gravity[0]);
+				gravity[1] += alpha * (f[1] - gravity[1]);
+				gravity[2] += alpha * (f[2] - gravity[2]);
+			}
+
+			// Specific force along the vertical, less gravity
+			norm = sqrtf(gravity[0] * gravity[0] + gravity[1] * gravity[1] + gravity[2] * gravity[2]);
+			valid = (norm >= KF_GRAVITY_MIN);
+			a = valid ? ((f[0] * gravity[0] + f[1] * gravity[1] + f[2] * gravity[2]) / norm - 1.0f) * KF_GRAVITY : 0;
+
+			output = false;
+
+			imuMs = imuConv[j].time;
+			imuUs = imuConv[j].timeUs;
+			imuActive = true;
+
+			if (initialized)
+			{
+				if (valid)
+				{
+					accelSum += a;
+					++accelCount;
+				}
+
+				if ((FS_Kalman_TimeDiff(imuMs, imuUs, filterMs, filterUs) >= KF_PREDICT_MSEC * 1000) &&
+				    FS_Kalman_Advance(imuMs, imuUs))
+				{
+					FS_Kalman_Output();
+					output = true;
+				}
+			}
+
+			if (output)
+			{
+				FS_Kalman_DataReady_Callback();
+			}
+		}
+	}
+}
+
+static void FS_Kalman_ProcessBaro(const FS_Baro_Data_t *baro)
+{
+	static const float H[KF_STATES] = {1, 0, 1};
+	float z, lag;
+	bool output = false;
+
+	// Standard atmosphere pressure altitude
+	z = 44330.8f * (1.0f - powf(baro->pressure / (100.0f * 101325.0f), 0.190263f));
+
+	baroAlt = z;
+	baroValid = true;
+
+	if (initialized)
+	{
+		if (!imuActive && FS_Kalman_Advance(baro->time, baro->timeUs))
+		{
+			output = true;
+		}
+
+		// Move measurement forward to filter time
+		lag = FS_Kalman_TimeDiff(filterMs, filterUs, baro->time, baro->timeUs) * 1e-6f;
+		if (lag > 0 && lag < KF_MAX_DT)
+		{
+			z += axisU.x[1] * lag;
+		}
+
+		FS_Kalman_Update(&axisU, H, z, KF_BARO_NOISE * KF_BARO_NOISE);
+
+		if (output)
+		{
+			FS_Kalman_Output();
+		}
+	}
+
+	if (output)
+	{
+		FS_Kalman_DataReady_Callback();
+	}
+}
+
+static void FS_Kalman_ProcessGNSS(const FS_GNSS_Data_t *gnss)
+{
+	static const float Hp[KF_STATES] = {1, 0, 0};
+	static const float Hv[KF_STATES] = {0, 1, 0};
+	uint32_t ms, towMS;
+	uint16_t us, towUs, week;
+	float age = 0, rp, rv, rh;
+	bool ok, output = false;
+
+	rp = gnss->hAcc / 1000.0f;
+	rh = gnss->vAcc / 1000.0f;
+	rv = gnss->sAcc / 1000.0f;
+
+	if (!initialized || HAL_GetTick() - gnssTime >= KF_TIMEOUT_MSEC
+			|| gnssRejects >= KF_MAX_REJECTS)
+	{
+		// Start from current time if there is no sensor timeline yet
+		if (imuActive)
+		{
+			ms = imuMs;
+			us = imuUs;
+		}
+		else
+		{
+			FS_Timestamp_Get(&ms, &us);
+		}
+
+		FS_Kalman_Start(gnss, ms, us);
+	}
+	else
+	{
+		if (!imuActive && !baroValid)
+		{
+			FS_Timestamp_Get(&ms, &us);
+			output = FS_Kalman_Advance(ms, us);
+		}
+
+		// Age of the GNSS solution at filter time
+		if (FS_Timestamp_ToGNSS(filterMs, filterUs, &week, &towMS, &towUs))
+		{
+			age = FS_Kalman_TimeDiff(towMS, towUs, gnss->iTOW, 0) * 1e-6f;
+			age = MIN(MAX(age, 0), KF_MAX_DT);
+		}
+
+		ok = FS_Kalman_Update(&axisN, Hp, (gnss->lat - originLat) / KF_DEG_PER_M + axisN.x[1] * age, rp * rp);
+		ok = FS_Kalman_Update(&axisE, Hp, (gnss->lon - originLon) * cosLat / KF_DEG_PER_M + axisE.x[1] * age, rp * rp) && ok;
+		ok = FS_Kalman_Update(&axisU, Hp, gnss->hMSL / 1000.0f + axisU.x[1] * age, rh * rh) && ok;
+		ok = FS_Kalman_Update(&axisN, Hv, gnss->velN / 1000.0f, rv * rv) && ok;
+		ok = FS_Kalman_Update(&axisE, Hv, gnss->velE / 1000.0f, rv * rv) && ok;
+		ok = FS_Kalman_Update(&axisU, Hv, -gnss->velD / 1000.0f, rv * rv) && ok;
+
+		gnssRejects = ok ? 0 : gnssRejects + 1;
+
+		if (output)
+		{
+			FS_Kalman_Output();
+		}
+	}
+
+	gnssTime = HAL_GetTick();
+
+	if (output)
+	{
+		FS_Kalman_DataReady_Callback();
+	}
+}
+
+static void updateTask(void)
+{
+	const FS_IMU_Raw_t *imu;
+	const FS_Baro_Data_t *baro;
+	uint32_t i, n;
+
+	// Apply queued samples in time order, IMU samples a batch at a time
+	while (imuRdI != imuWrI)
+	{
+		i = imuRdI % KF_IMU_COUNT;
+		n = MIN(MIN(imuWrI - imuRdI, KF_IMU_COUNT - i), KF_CONVERT_COUNT);
+		imu = &imuBuf[i];
+
+		while (baroRdI != baroWrI)
+		{
+			baro = &baroBuf[baroRdI % KF_BARO_COUNT];
+			if (FS_Kalman_TimeDiff(imu->time, imu->timeUs, baro->time, baro->timeUs) < 0) break;
+
+			FS_Kalman_ProcessBaro(baro);
+			++baroRdI;
+		}
+
+		FS_Kalman_ProcessIMU(imu, n);
+		imuRdI += n;
+	}
+
+	while (baroRdI != baroWrI)
+	{
+		FS_Kalman_ProcessBaro(&baroBuf[baroRdI % KF_BARO_COUNT]);
+		++baroRdI;
+	}
+
+	if (gnssPending)
+	{
+		gnssPending = false;
+		FS_Kalman_ProcessGNSS(&gnssBuf);
+	}
+}
+
+void FS_Kalman_UpdateIMU(const FS_IMU_Raw_t *raw, uint32_t count)
+{
+	uint32_t i;
+
+	if (!kfActive) return;
+
+	// Queue samples and leave filter steps to the update task
+	for (i = 0; i < count; ++i)
+	{
+		if (imuWrI < imuRdI + KF_IMU_COUNT)
+		{
+			imuBuf[imuWrI % KF_IMU_COUNT] = raw[i];
+			++imuWrI;
+		}
+		else
+		{
+			++stats.dropCount;
+		}
+	}
+
+	UTIL_SEQ_SetTask(1<<CFG_TASK_FS_KALMAN_UPDATE_ID, CFG_SCH_PRIO_1);
+}
+
+void FS_Kalman_UpdateBaro(const FS_Baro_Data_t *baro)
+{
+	if (!kfActive) return;
+
+	if (baroWrI < baroRdI + KF_BARO_COUNT)
+	{
+		baroBuf[baroWrI % KF_BARO_COUNT] = *baro;
+		++baroWrI;
+	}
+	else
+	{
+		++stats.dropCount;
+	}
+
+	UTIL_SEQ_SetTask(1<<CFG_TASK_FS_KALMAN_UPDATE_ID, CFG_SCH_PRIO_1);
+}
+
+void FS_Kalman_UpdateGNSS(const FS_GNSS_Data_t *gnss)
+{
+	if (!kfActive) return;
+	if (gnss->gpsFix != 3) return;
+
+	// Latest solution replaces one not yet applied
+	gnssBuf = *gnss;
+	gnssPending = true;
+
+	UTIL_SEQ_SetTask(1<<CFG_TASK_FS_KALMAN_UPDATE_ID, CFG_SCH_PRIO_1);
+}
+
+bool FS_Kalman_IsValid(void)
+{
+	return initialized && (HAL_GetTick() - gnssTime < KF_TIMEOUT_MSEC);
+}
+
+const FS_Kalman_Data_t *FS_Kalman_GetData(void)
+{
+	return &kfData;
+}
+
+const FS_Kalman_Stats_t *FS_Kalman_GetStats(void)
+{
+	return &stats;
+}
+
+__weak void FS_Kalman_DataReady_Callback(void)
+{
+  /* NOTE: This function should not be modified, when the callback is needed,
+           the FS_Kalman_DataReady_Callback could be implemented in the user file
+   */
+}
@@ -0,0 +1,65 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2024 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#ifndef KALMAN_H_
+#define KALMAN_H_
+
+#include <stdbool.h>
+
+#include "baro.h"
+#include "gnss.h"
+#include "imu.h"
+
+typedef struct
+{
+	uint32_t time;		// ms
+	int32_t  lon;		// Longitude                    (deg * 1e7)
+	int32_t  lat;		// Latitude                     (deg * 1e7)
+	int32_t  hMSL;		// Height above mean sea level  (mm)
+	int32_t  velN;		// North velocity               (mm/s)
+	int32_t  velE;		// East velocity                (mm/s)
+	int32_t  velD;		// Down velocity                (mm/s)
+	uint16_t timeUs;	// us past time
+} FS_Kalman_Data_t;
+
+typedef struct
+{
+	uint32_t predictMax;	// maximum cycles per prediction step
+	uint32_t updateMax;		// maximum cycles per measurement update
+	uint32_t predictCount;	// prediction steps
+	uint32_t updateCount;	// measurement updates
+	uint32_t rejectCount;	// measurements rejected by innovation gate
+	uint32_t dropCount;		// samples dropped with the queue full
+} FS_Kalman_Stats_t;
+
+void FS_Kalman_Init(void);
+void FS_Kalman_DeInit(void);
+void FS_Kalman_UpdateIMU(const FS_IMU_Raw_t *raw, uint32_t count);
+void FS_Kalman_UpdateBaro(const FS_Baro_Data_t *baro);
+void FS_Kalman_UpdateGNSS(const FS_GNSS_Data_t *gnss);
+bool FS_Kalman_IsValid(void);
+const FS_Kalman_Data_t *FS_Kalman_GetData(void);
+const FS_Kalman_Stats_t *FS_Kalman_GetStats(void);
+void FS_Kalman_DataReady_Callback(void);
+
+#endif /* KALMAN_H_ */
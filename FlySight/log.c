@@ -40,6 +40,14 @@
 #define LOG_UPDATE_MSEC 50
 #define LOG_UPDATE_RATE (LOG_UPDATE_MSEC*1000/CFG_TS_TICK_VAL)
 
+#define LOG_SYNC_INTERVAL 5		// default log updates between syncs
+
+#define LOG_SHED_LEVELS 4		// load shedding levels, including none
+#define LOG_SHED_HIGH   50		// ring fill which raises shedding level (%)
+#define LOG_SHED_LOW    20		// ring fill which allows shedding to ease (%)
+#define LOG_SHED_CALM   20		// quiet updates before shedding level drops
+#define LOG_SHED_STALL  (4*LOG_UPDATE_MSEC)	// update interval treated as a stall (ms)
+
 #define BARO_COUNT  30
 #define HUM_COUNT   3
 #define MAG_COUNT   15
@@ -48,6 +56,11 @@
 #define RAW_COUNT   5
 #define IMU_COUNT   667
 #define VBAT_COUNT  2
+#define MIC_COUNT   2
+#define KF_COUNT    30
+#define ATT_COUNT   50
+
+#define IMU_CONVERT_COUNT 16	// IMU samples converted at a time
 
 #define EVENT_MESSAGE_MAX_LEN 80
 #define EVENT_COUNT 2
@@ -88,16 +101,35 @@ static          uint32_t       rawRdI;              // read index
 static volatile uint32_t       rawWrI;              // write index
 static          uint32_t       rawUsed;             // buffer used
 
-static          FS_IMU_Data_t  imuBuf[IMU_COUNT];   // data buffer
+static          FS_IMU_Raw_t   imuBuf[IMU_COUNT];   // data buffer (raw counts)
 static          uint32_t       imuRdI;              // read index
 static volatile uint32_t       imuWrI;              // write index
 static          uint32_t       imuUsed;             // buffer used
 
+static FS_IMU_Data_t imuConv[IMU_CONVERT_COUNT];    // converted data
+static uint32_t      imuConvI;                      // read index of imuConv[0]
+static uint32_t      imuConvN;                      // converted samples
+
 static          FS_VBAT_Data_t vbatBuf[VBAT_COUNT]; // data buffer
 static          uint32_t       vbatRdI;             // read index
 static volatile uint32_t       vbatWrI;             // write index
 static          uint32_t       vbatUsed;            // buffer used
 
+static          FS_Mic_Data_t  micBuf[MIC_COUNT];   // data buffer
+static          uint32_t       micRdI;              // read index
+static volatile uint32_t       micWrI;              // write index
+static          uint32_t       micUsed;             // buffer used
+
+static          FS_Kalman_Data_t kfBuf[KF_COUNT];   // data buffer
+static          uint32_t       kfRdI;               // read index
+static volatile uint32_t       kfWrI;               // write index
+static          uint32_t       kfUsed;              // buffer used
+
+static          FS_AHRS_Data_t attBuf[ATT_COUNT];   // data buffer
+static          uint32_t       attRdI;              // read index
+static volatile uint32_t       attWrI;              // write index
+static          uint32_t       attUsed;             // buffer used
+
 static          FS_Log_Event_t eventBuf[EVENT_COUNT]; // data buffer
 static          uint32_t       eventRdI;              // read index
 static volatile uint32_t       eventWrI;              // write index
@@ -114,6 +146,7 @@ static bool validDateTime;
 static FS_GNSS_Data_t saved_data;
 
 static uint32_t updateCount;
+static uint32_t syncInterval;		// log updates between syncs
 static uint32_t updateTotalTime;
 static uint32_t updateMaxTime;
 static uint32_t updateLastCall;
@@ -135,9 +168,39 @@ typedef enum
 	FS_LOG_SENSOR_MAG,
 	FS_LOG_SENSOR_TIME,
 	FS_LOG_SENSOR_IMU,
-	FS_LOG_SENSOR_VBAT
+	FS_LOG_SENSOR_VBAT,
+	FS_LOG_SENSOR_MIC,
+	FS_LOG_SENSOR_KF,
+	FS_LOG_SENSOR_ATT,
+	FS_LOG_SENSOR_COUNT
 } FS_Log_SensorType_t ;
 
+// Keep one in N samples of each stream at each shedding level. GNSS,
+// raw GNSS, time and event output are never shed.
+static const uint8_t shedRate[LOG_SHED_LEVELS][FS_LOG_SENSOR_COUNT] =
+{
+	{ 0 },
+	{ [FS_LOG_SENSOR_IMU] = 4,  [FS_LOG_SENSOR_ATT] = 4 },
+	{ [FS_LOG_SENSOR_IMU] = 16, [FS_LOG_SENSOR_ATT] = 16,
+	  [FS_LOG_SENSOR_BARO] = 4, [FS_LOG_SENSOR_MAG] = 4, [FS_LOG_SENSOR_KF] = 4 },
+	{ [FS_LOG_SENSOR_IMU] = 64, [FS_LOG_SENSOR_ATT] = 64,
+	  [FS_LOG_SENSOR_BARO] = 16, [FS_LOG_SENSOR_MAG] = 16, [FS_LOG_SENSOR_KF] = 16,
+	  [FS_LOG_SENSOR_HUM] = 4, [FS_LOG_SENSOR_MIC] = 4 }
+};
+
+static const char *const sensorNames[FS_LOG_SENSOR_COUNT] =
+{
+	"", "$BARO", "$HUM", "$MAG", "$TIME", "$IMU", "$VBAT", "$MIC", "$KF", "$ATT"
+};
+
+static volatile uint8_t shedLevel;				// current shedding level
+static uint32_t shedPhase[FS_LOG_SENSOR_COUNT];	// samples seen while shedding
+static uint32_t shedCount[FS_LOG_SENSOR_COUNT];	// samples shed
+static uint32_t shedCalm;						// quiet updates at this level
+static uint32_t shedStart;						// time shedding started (ms)
+static uint32_t shedTotalTime;					// time spent shedding (ms)
+static uint32_t shedMaxLevel;					// highest level reached
+
 static uint8_t enable_flags;
 
 typedef enum
@@ -174,6 +237,15 @@ static void FS_Log_WriteSensorBatch(const char *data, uint32_t len)
 	sensorBatchLen += len;
 }
 
+static char *FS_Log_WriteTimeUs(char *ptr, uint32_t ms, uint16_t us, char delimiter)
+{
+	// Write time in seconds with microsecond resolution
+	ptr = writeInt32ToBuf(ptr, (ms % 1000) * 1000 + us, 6, 0, delimiter);
+	ptr = writeInt32ToBuf(ptr, ms / 1000, 0, 0, '.');
+
+	return ptr;
+}
+
 static void FS_Log_Timer(void)
 {
 	// Call update task
@@ -200,6 +272,9 @@ static FS_Log_SensorType_t FS_Log_GetNextSensor(void)
 	HANDLE_SENSOR(timeRdI, timeWrI, timeBuf, TIME_COUNT, FS_LOG_SENSOR_TIME);
 	HANDLE_SENSOR(imuRdI,  imuWrI,  imuBuf,  IMU_COUNT,  FS_LOG_SENSOR_IMU);
 	HANDLE_SENSOR(vbatRdI, vbatWrI, vbatBuf, VBAT_COUNT, FS_LOG_SENSOR_VBAT);
+	HANDLE_SENSOR(micRdI,  micWrI,  micBuf,  MIC_COUNT,  FS_LOG_SENSOR_MIC);
+	HANDLE_SENSOR(kfRdI,   kfWrI,   kfBuf,   KF_COUNT,   FS_LOG_SENSOR_KF);
+	HANDLE_SENSOR(attRdI,  attWrI,  attBuf,  ATT_COUNT,  FS_LOG_SENSOR_ATT);
 
 	return nextType;
 }
@@ -253,7 +328,7 @@ void FS_Log_UpdateBaro(void)
 	*(--ptr) = '\n';
 	ptr = writeInt32ToBuf(ptr, data->temperature, 2, 1, '\r');
 	ptr = writeInt32ToBuf(ptr, data->pressure,    2, 1, ',');
-	ptr = writeInt32ToBuf(ptr, data->time,        3, 1, ',');
+	ptr = FS_Log_WriteTimeUs(ptr, data->time, data->timeUs, ',');
 	*(--ptr) = ',';
 	*(--ptr) = 'O';
 	*(--ptr) = 'R';
@@ -366,7 +441,7 @@ void FS_Log_UpdateTime(void)
 	*(--ptr) = '\n';
 	ptr = writeInt32ToBuf(ptr, time->week,        0, 0, '\r');
 	ptr = writeInt32ToBuf(ptr, time->towMS,       3, 1, ',');
-	ptr = writeInt32ToBuf(ptr, time->time,        3, 1, ',');
+	ptr = FS_Log_WriteTimeUs(ptr, time->time, time->timeUs, ',');
 	*(--ptr) = ',';
 	*(--ptr) = 'E';
 	*(--ptr) = 'M';
@@ -393,7 +468,7 @@ void FS_Log_UpdateRaw(void)
 	FS_GNSS_Raw_t *data = &rawBuf[rawRdI % RAW_COUNT];
 
 	// Write to disk
-	f_write(&rawFile, data, sizeof(FS_GNSS_Raw_t), &bw);
+	f_write(&rawFile, data->buf, data->len, &bw);
 
 	// Increment read index
 	++rawRdI;
@@ -408,8 +483,17 @@ void FS_Log_UpdateIMU(void)
 		Error_Handler();
 	}
 
+	// Convert the next run of raw samples
+	if (imuRdI - imuConvI >= imuConvN)
+	{
+		imuConvI = imuRdI;
+		imuConvN = MIN(imuWrI - imuRdI, IMU_CONVERT_COUNT);
+		imuConvN = MIN(imuConvN, IMU_COUNT - imuRdI % IMU_COUNT);
+		FS_IMU_Convert(FS_IMU_GetScale(), &imuBuf[imuRdI % IMU_COUNT], imuConv, imuConvN);
+	}
+
 	// Get current data point
-	FS_IMU_Data_t *data = &imuBuf[imuRdI % IMU_COUNT];
+	FS_IMU_Data_t *data = &imuConv[imuRdI - imuConvI];
 
 	// Write to disk
 	char *ptr = row + sizeof(row);
@@ -422,7 +506,7 @@ void FS_Log_UpdateIMU(void)
 	ptr = writeInt32ToBuf(ptr, data->wz,          3, 1, ',');
 	ptr = writeInt32ToBuf(ptr, data->wy,          3, 1, ',');
 	ptr = writeInt32ToBuf(ptr, data->wx,          3, 1, ',');
-	ptr = writeInt32ToBuf(ptr, data->time,        3, 1, ',');
+	ptr = FS_Log_WriteTimeUs(ptr, data->time, data->timeUs, ',');
 	*(--ptr) = ',';
 	*(--ptr) = 'U';
 	*(--ptr) = 'M';
@@ -466,6 +550,109 @@ void FS_Log_UpdateVBAT(void)
 	++vbatRdI;
 }
 
+void FS_Log_UpdateMic(void)
+{
+	char row[150];
+
+	if (!(enable_flags & FS_LOG_ENABLE_SENSOR))
+	{
+		Error_Handler();
+	}
+
+	// Get current data point
+	FS_Mic_Data_t *data = &micBuf[micRdI % MIC_COUNT];
+
+	// Write to disk
+	char *ptr = row + sizeof(row);
+
+	*(--ptr) = '\n';
+	ptr = writeInt32ToBuf(ptr, data->high,    3, 1, '\r');
+	ptr = writeInt32ToBuf(ptr, data->low,     3, 1, ',');
+	ptr = writeInt32ToBuf(ptr, data->peak,    3, 1, ',');
+	ptr = writeInt32ToBuf(ptr, data->rms,     3, 1, ',');
+	ptr = writeInt32ToBuf(ptr, data->time,    3, 1, ',');
+	*(--ptr) = ',';
+	*(--ptr) = 'C';
+	*(--ptr) = 'I';
+	*(--ptr) = 'M';
+	*(--ptr) = '$';
+
+	FS_Log_WriteSensorBatch(ptr, row + sizeof(row) - ptr);
+
+	// Increment read index
+	++micRdI;
+}
+
+void FS_Log_UpdateKalman(void)
+{
+	char row[150];
+
+	if (!(enable_flags & FS_LOG_ENABLE_SENSOR))
+	{
+		Error_Handler();
+	}
+
+	// Get current data point
+	FS_Kalman_Data_t *data = &kfBuf[kfRdI % KF_COUNT];
+
+	// Write to disk
+	char *ptr = row + sizeof(row);
+
+	*(--ptr) = '\n';
+	ptr = writeInt32ToBuf(ptr, data->velD,    3, 1, '\r');
+	ptr = writeInt32ToBuf(ptr, data->velE,    3, 1, ',');
+	ptr = writeInt32ToBuf(ptr, data->velN,    3, 1, ',');
+	ptr = writeInt32ToBuf(ptr, data->hMSL,    3, 1, ',');
+	ptr = writeInt32ToBuf(ptr, data->lon,     7, 1, ',');
+	ptr = writeInt32ToBuf(ptr, data->lat,     7, 1, ',');
+	ptr = FS_Log_WriteTimeUs(ptr, data->time, data->timeUs, ',');
+	*(--ptr) = ',';
+	*(--ptr) = 'F';
+	*(--ptr) = 'K';
+	*(--ptr) = '$';
+
+	FS_Log_WriteSensorBatch(ptr, row + sizeof(row) - ptr);
+
+	// Increment read index
+	++kfRdI;
+}
+
+void FS_Log_UpdateAHRS(void)
+{
+	char row[150];
+
+	if (!(enable_flags & FS_LOG_ENABLE_SENSOR))
+	{
+		Error_Handler();
+	}
+
+	// Get current data point
+	FS_AHRS_Data_t *data = &attBuf[attRdI % ATT_COUNT];
+
+	// Write to disk
+	char *ptr = row + sizeof(row);
+
+	*(--ptr) = '\n';
+	ptr = writeInt32ToBuf(ptr, data->roll,    1, 1, '\r');
+	ptr = writeInt32ToBuf(ptr, data->pitch,   1, 1, ',');
+	ptr = writeInt32ToBuf(ptr, data->heading, 1, 1, ',');
+	ptr = writeInt32ToBuf(ptr, data->q3,      4, 1, ',');
+	ptr = writeInt32ToBuf(ptr, data->q2,      4, 1, ',');
+	ptr = writeInt32ToBuf(ptr, data->q1,      4, 1, ',');
+	ptr = writeInt32ToBuf(ptr, data->q0,      4, 1, ',');
+	ptr = FS_Log_WriteTimeUs(ptr, data->time, data->timeUs, ',');
+	*(--ptr) = ',';
+	*(--ptr) = 'T';
+	*(--ptr) = 'T';
+	*(--ptr) = 'A';
+	*(--ptr) = '$';
+
+	FS_Log_WriteSensorBatch(ptr, row + sizeof(row) - ptr);
+
+	// Increment read index
+	++attRdI;
+}
+
 void FS_Log_WriteEventEntry(const FS_Log_Event_t *entry)
 {
 	char row[100];
@@ -488,6 +675,105 @@ void FS_Log_WriteEventEntry(const FS_Log_Event_t *entry)
 	f_puts("\"\n", &eventFile);
 }
 
+static bool FS_Log_Shed(FS_Log_SensorType_t type)
+{
+	const uint8_t rate = shedRate[shedLevel][type];
+
+	if (rate <= 1) return false;
+
+	// Keep the first sample of every group
+	if (shedPhase[type]++ % rate == 0) return false;
+
+	++shedCount[type];
+	return true;
+}
+
+static void FS_Log_Govern(uint32_t fill, bool stalled)
+{
+	const uint32_t prevLevel = shedLevel;
+	const uint32_t now = HAL_GetTick();
+
+	if (fill >= LOG_SHED_HIGH || stalled)
+	{
+		// Shed more, one level per update
+		if (shedLevel < LOG_SHED_LEVELS - 1)
+		{
+			++shedLevel;
+		}
+		shedCalm = 0;
+	}
+	else if (fill <= LOG_SHED_LOW && shedLevel > 0)
+	{
+		// Shed less once rings have stayed low for a while
+		if (++shedCalm >= LOG_SHED_CALM)
+		{
+			--shedLevel;
+			shedCalm = 0;
+		}
+	}
+	else
+	{
+		shedCalm = 0;
+	}
+
+	if (shedLevel == prevLevel) return;
+
+	shedMaxLevel = MAX(shedMaxLevel, shedLevel);
+
+	if (prevLevel == 0)
+	{
+		shedStart = now;
+		FS_Log_WriteEvent("Log shedding started at level %lu (%lu%% ring fill%s)",
+				(uint32_t) shedLevel, fill, stalled ? ", stalled" : "");
+	}
+	else if (shedLevel == 0)
+	{
+		shedTotalTime += now - shedStart;
+		FS_Log_WriteEvent("Log shedding ended after %lu ms", now - shedStart);
+	}
+	else
+	{
+		FS_Log_WriteEvent("Log shedding changed to level %lu", (uint32_t) shedLevel);
+	}
+}
+
+static void FS_Log_UpdateSensor(FS_Log_SensorType_t next)
+{
+	switch (next)
+	{
+	case FS_LOG_SENSOR_BARO:
+		FS_Log_UpdateBaro();
+		break;
+	case FS_LOG_SENSOR_HUM:
+		FS_Log_UpdateHum();
+		break;
+	case FS_LOG_SENSOR_MAG:
+		FS_Log_UpdateMag();
+		break;
+	case FS_LOG_SENSOR_TIME:
+		FS_Log_UpdateTime();
+		break;
+	case FS_LOG_SENSOR_IMU:
+		FS_Log_UpdateIMU();
+		break;
+	case FS_LOG_SENSOR_VBAT:
+		FS_Log_UpdateVBAT();
+		break;
+	case FS_LOG_SENSOR_MIC:
+		FS_Log_UpdateMic();
+		break;
+	case FS_LOG_SENSOR_KF:
+		FS_Log_UpdateKalman();
+		break;
+	case FS_LOG_SENSOR_ATT:
+		FS_Log_UpdateAHRS();
+		break;
+	case FS_LOG_SENSOR_NONE:
+	case FS_LOG_SENSOR_COUNT:
+		break;		// should never be called
+	}
+}
+
 static void FS_Log_Update(void)
 {
 	uint32_t msStart, msEnd;
@@ -495,15 +781,31 @@ static void FS_Log_Update(void)
 	const uint32_t gnssIndex = gnssWrI;
 	const uint32_t rawIndex = rawWrI;
 	FS_Log_SensorType_t next;
+	uint32_t fill = 0;
+	bool stalled = false;
 
 	msStart = HAL_GetTick();
 
 	if (updateLastCall != 0)
 	{
 		updateMaxInterval = MAX(updateMaxInterval, msStart - updateLastCall);
+		stalled = (msStart - updateLastCall > LOG_SHED_STALL);
 	}
 	updateLastCall = msStart;
 
+	// Find the fullest ring before writing
+	#define RING_FILL(rdI, wrI, len)	\
+		fill = MAX(fill, ((wrI) - (rdI)) * 100 / (len))
+
+	RING_FILL(baroRdI, baroWrI, BARO_COUNT);
+	RING_FILL(magRdI,  magWrI,  MAG_COUNT);
+	RING_FILL(gnssRdI, gnssWrI, GNSS_COUNT);
+	RING_FILL(imuRdI,  imuWrI,  IMU_COUNT);
+	RING_FILL(kfRdI,   kfWrI,   KF_COUNT);
+	RING_FILL(attRdI,  attWrI,  ATT_COUNT);
+
+	#undef RING_FILL
+
 	// Write event log entries
 	while ((HAL_GetTick() < msStart + LOG_TIMEOUT) &&
 			(eventRdI != eventIndex))
@@ -530,34 +832,25 @@ static void FS_Log_Update(void)
 	while ((HAL_GetTick() < msStart + LOG_TIMEOUT) &&
 			((next = FS_Log_GetNextSensor()) != FS_LOG_SENSOR_NONE))
 	{
-		switch (next)
-		{
-		case FS_LOG_SENSOR_BARO:
-			FS_Log_UpdateBaro();
-			break;
-		case FS_LOG_SENSOR_HUM:
-			FS_Log_UpdateHum();
-			break;
-		case FS_LOG_SENSOR_MAG:
-			FS_Log_UpdateMag();
-			break;
-		case FS_LOG_SENSOR_TIME:
-			FS_Log_UpdateTime();
-			break;
-		case FS_LOG_SENSOR_IMU:
-			FS_Log_UpdateIMU();
-			break;
-		case FS_LOG_SENSOR_VBAT:
-			FS_Log_UpdateVBAT();
-			break;
-		case FS_LOG_SENSOR_NONE:
-			break;		// should never be called
-		}
+		FS_Log_UpdateSensor(next);
 	}
 
+	// Writing stopped with entries still waiting
+	if ((HAL_GetTick() >= msStart + LOG_TIMEOUT) &&
+			((eventRdI != eventIndex) ||
+			 (rawRdI != rawIndex) ||
+			 (gnssRdI != gnssIndex) ||
+			 (FS_Log_GetNextSensor() != FS_LOG_SENSOR_NONE)))
+	{
+		stalled = true;
+	}
+
+	// Adjust load shedding
+	FS_Log_Govern(fill, stalled);
+
 	++updateCount;
 
-	if (updateCount % 5 == 0)
+	if (updateCount % syncInterval == 0)
 	{
 		// Call sync task
 		UTIL_SEQ_SetTask(1<<CFG_TASK_FS_LOG_SYNC_ID, CFG_SCH_PRIO_1);
@@ -722,13 +1015,29 @@ HAL_StatusTypeDef FS_Log_Init(uint32_t temp_folder, uint8_t flags)
 	imuWrI = 0;
 	imuUsed = 0;
 
+	imuConvI = 0;
+	imuConvN = 0;
+
 	vbatRdI = 0;
 	vbatWrI = 0;
 	vbatUsed = 0;
 
+	micRdI = 0;
+	micWrI = 0;
+	micUsed = 0;
+
+	kfRdI = 0;
+	kfWrI = 0;
+	kfUsed = 0;
+
+	attRdI = 0;
+	attWrI = 0;
+	attUsed = 0;
+
 	validDateTime = false;
 
 	updateCount = 0;
+	syncInterval = LOG_SYNC_INTERVAL;
 	updateTotalTime = 0;
 	updateMaxTime = 0;
 	updateLastCall = 0;
@@ -740,6 +1049,13 @@ HAL_StatusTypeDef FS_Log_Init(uint32_t temp_folder, uint8_t flags)
 	syncLastCall = 0;
 	syncMaxInterval = 0;
 
+	shedLevel = 0;
+	memset(shedPhase, 0, sizeof(shedPhase));
+	memset(shedCount, 0, sizeof(shedCount));
+	shedCalm = 0;
+	shedTotalTime = 0;
+	shedMaxLevel = 0;
+
 	// Create temporary folder
 	f_mkdir("/temp");
 	sprintf(path, "/temp/%04lu", temp_folder);
@@ -802,6 +1118,12 @@ HAL_StatusTypeDef FS_Log_Init(uint32_t temp_folder, uint8_t flags)
 		f_printf(&sensorFile, "$UNIT,TIME,s,s,\n");
 		f_printf(&sensorFile, "$COL,VBAT,time,voltage\n");
 		f_printf(&sensorFile, "$UNIT,VBAT,s,volt\n");
+		f_printf(&sensorFile, "$COL,MIC,time,rms,peak,low,high\n");
+		f_printf(&sensorFile, "$UNIT,MIC,s,mV,mV,mV,mV\n");
+		f_printf(&sensorFile, "$COL,KF,time,lat,lon,hMSL,velN,velE,velD\n");
+		f_printf(&sensorFile, "$UNIT,KF,s,deg,deg,m,m/s,m/s,m/s\n");
+		f_printf(&sensorFile, "$COL,ATT,time,q0,q1,q2,q3,heading,pitch,roll\n");
+		f_printf(&sensorFile, "$UNIT,ATT,s,,,,,deg,deg,deg\n");
 		f_printf(&sensorFile, "$DATA\n");
 		f_sync(&sensorFile);
 		sensorBatchLen = 0;
@@ -859,6 +1181,7 @@ void FS_Log_DeInit(uint32_t temp_folder)
 	char date[15], time[15];
 	char oldPath[50];
     FILINFO fno;
+	uint32_t i;
 
 	if (logState == LOG_STATE_ACTIVE)
 	{
@@ -878,6 +1201,9 @@ void FS_Log_DeInit(uint32_t temp_folder)
 		FS_Log_WriteEvent("%lu/%lu slots used in $RAW message buffer",  rawUsed, RAW_COUNT);
 		FS_Log_WriteEvent("%lu/%lu slots used in $IMU message buffer",  imuUsed, IMU_COUNT);
 		FS_Log_WriteEvent("%lu/%lu slots used in $VBAT message buffer", vbatUsed, VBAT_COUNT);
+		FS_Log_WriteEvent("%lu/%lu slots used in $MIC message buffer",  micUsed, MIC_COUNT);
+		FS_Log_WriteEvent("%lu/%lu slots used in $KF message buffer",   kfUsed, KF_COUNT);
+		FS_Log_WriteEvent("%lu/%lu slots used in $ATT message buffer",  attUsed, ATT_COUNT);
 		FS_Log_WriteEvent("%lu/%lu slots used in $EVNT message buffer", eventUsed, EVENT_COUNT);
 
 		// Add event log entries for timing info
@@ -892,11 +1218,35 @@ void FS_Log_DeInit(uint32_t temp_folder)
 				(syncCount > 0) ? (syncTotalTime / syncCount) : 0);
 		FS_Log_WriteEvent("%lu ms maximum time spent in log sync task", syncMaxTime);
 		FS_Log_WriteEvent("%lu ms maximum time between calls to log sync task", syncMaxInterval);
+
+		// Add event log entries for load shedding
+		if (shedLevel > 0)
+		{
+			shedTotalTime += HAL_GetTick() - shedStart;
+		}
+
+		FS_Log_WriteEvent("----------");
+		FS_Log_WriteEvent("%lu ms spent shedding log load, maximum level %lu",
+				shedTotalTime, shedMaxLevel);
+		for (i = 0; i < FS_LOG_SENSOR_COUNT; ++i)
+		{
+			if (shedCount[i] > 0)
+			{
+				FS_Log_WriteEvent("%lu samples shed from %s message buffer",
+						shedCount[i], sensorNames[i]);
+			}
+		}
 	}
 
 	// Close files
 	if (enable_flags & FS_LOG_ENABLE_RAW)
 	{
+		// Write remaining raw GNSS output
+		while (rawRdI != rawWrI)
+		{
+			FS_Log_UpdateRaw();
+		}
+
 		f_close(&rawFile);
 	}
 	if (enable_flags & FS_LOG_ENABLE_GNSS)
@@ -956,6 +1306,7 @@ void FS_Log_WriteBaroData(const FS_Baro_Data_t *current)
 {
 	if (logState != LOG_STATE_ACTIVE) return;
 	if (!(enable_flags & FS_LOG_ENABLE_SENSOR)) return;
+	if (FS_Log_Shed(FS_LOG_SENSOR_BARO)) return;
 
 	if (baroWrI < baroRdI + BARO_COUNT)
 	{
@@ -980,6 +1331,7 @@ void FS_Log_WriteHumData(const FS_Hum_Data_t *current)
 {
 	if (logState != LOG_STATE_ACTIVE) return;
 	if (!(enable_flags & FS_LOG_ENABLE_SENSOR)) return;
+	if (FS_Log_Shed(FS_LOG_SENSOR_HUM)) return;
 
 	if (humWrI < humRdI + HUM_COUNT)
 	{
@@ -1004,6 +1356,7 @@ void FS_Log_WriteMagData(const FS_Mag_Data_t *current)
 {
 	if (logState != LOG_STATE_ACTIVE) return;
 	if (!(enable_flags & FS_LOG_ENABLE_SENSOR)) return;
+	if (FS_Log_Shed(FS_LOG_SENSOR_MAG)) return;
 
 	if (magWrI < magRdI + MAG_COUNT)
 	{
@@ -1051,6 +1404,35 @@ void FS_Log_WriteGNSSData(const FS_GNSS_Data_t *current)
 	}
 }
 
+void FS_Log_SetSyncInterval(uint32_t interval)
+{
+	syncInterval = interval ? interval : LOG_SYNC_INTERVAL;
+}
+
+void FS_Log_FlushSensors(void)
+{
+	FS_Log_SensorType_t next;
+
+	if (logState != LOG_STATE_ACTIVE) return;
+	if (!(enable_flags & FS_LOG_ENABLE_SENSOR)) return;
+
+	// Write all pending sensor log entries
+	while ((next = FS_Log_GetNextSensor()) != FS_LOG_SENSOR_NONE)
+	{
+		FS_Log_UpdateSensor(next);
+	}
+}
+
+uint32_t FS_Log_GetBaroSpace(void)
+{
+	return BARO_COUNT - (baroWrI - baroRdI);
+}
+
+uint32_t FS_Log_GetIMUSpace(void)
+{
+	return IMU_COUNT - (imuWrI - imuRdI);
+}
+
 void FS_Log_UpdatePath(const FS_GNSS_Data_t *current)
 {
 	if ((current->gpsFix == 3) && (!validDateTime))
@@ -1112,16 +1494,17 @@ void FS_Log_WriteGNSSRaw(const FS_GNSS_Raw_t *current)
 	}
 }
 
-void FS_Log_WriteIMUData(const FS_IMU_Data_t *current)
+void FS_Log_WriteIMUData(const FS_IMU_Raw_t *current)
 {
 	if (logState != LOG_STATE_ACTIVE) return;
 	if (!(enable_flags & FS_LOG_ENABLE_SENSOR)) return;
+	if (FS_Log_Shed(FS_LOG_SENSOR_IMU)) return;
 
 	if (imuWrI < imuRdI + IMU_COUNT)
 	{
 		// Copy to circular buffer
-		FS_IMU_Data_t *saved = &imuBuf[imuWrI % IMU_COUNT];
-		memcpy(saved, current, sizeof(FS_IMU_Data_t));
+		FS_IMU_Raw_t *saved = &imuBuf[imuWrI % IMU_COUNT];
+		memcpy(saved, current, sizeof(FS_IMU_Raw_t));
 
 		// Increment write index
 		++imuWrI;
@@ -1136,6 +1519,38 @@ void FS_Log_WriteIMUData(const FS_IMU_Data_t *current)
 	}
 }
 
+void FS_Log_WriteIMUBatch(const FS_IMU_Raw_t *data, uint32_t count)
+{
+	const uint32_t wrI = imuWrI;
+	uint32_t i, n;
+
+	if (logState != LOG_STATE_ACTIVE) return;
+	if (!(enable_flags & FS_LOG_ENABLE_SENSOR)) return;
+
+	if (shedRate[shedLevel][FS_LOG_SENSOR_IMU] > 1)
+	{
+		// Shed samples one at a time
+		for (i = 0; i < count; ++i)
+		{
+			FS_Log_WriteIMUData(&data[i]);
+		}
+		return;
+	}
+
+	// Copy as many samples as will fit
+	n = MIN(count, imuRdI + IMU_COUNT - wrI);
+	for (i = 0; i < n; ++i)
+	{
+		memcpy(&imuBuf[(wrI + i) % IMU_COUNT], &data[i], sizeof(FS_IMU_Raw_t));
+	}
+
+	// Increment write index
+	imuWrI = wrI + n;
+
+	// Update buffer statistics
+	imuUsed = (n < count) ? IMU_COUNT : MAX(imuUsed, imuWrI - imuRdI);
+}
+
 void FS_Log_WriteVBATData(const FS_VBAT_Data_t *current)
 {
 	if (logState != LOG_STATE_ACTIVE) return;
@@ -1160,6 +1575,81 @@ void FS_Log_WriteVBATData(const FS_VBAT_Data_t *current)
 	}
 }
 
+void FS_Log_WriteMicData(const FS_Mic_Data_t *current)
+{
+	if (logState != LOG_STATE_ACTIVE) return;
+	if (!(enable_flags & FS_LOG_ENABLE_SENSOR)) return;
+	if (FS_Log_Shed(FS_LOG_SENSOR_MIC)) return;
+
+	if (micWrI < micRdI + MIC_COUNT)
+	{
+		// Copy to circular buffer
+		FS_Mic_Data_t *saved = &micBuf[micWrI % MIC_COUNT];
+		memcpy(saved, current, sizeof(FS_Mic_Data_t));
+
+		// Increment write index
+		++micWrI;
+
+		// Update buffer statistics
+		micUsed = MAX(micUsed, micWrI - micRdI);
+	}
+	else
+	{
+		// Update buffer statistics
+		micUsed = MIC_COUNT;
+	}
+}
+
+void FS_Log_WriteKalmanData(const FS_Kalman_Data_t *current)
+{
+	if (logState != LOG_STATE_ACTIVE) return;
+	if (!(enable_flags & FS_LOG_ENABLE_SENSOR)) return;
+	if (FS_Log_Shed(FS_LOG_SENSOR_KF)) return;
+
+	if (kfWrI < kfRdI + KF_COUNT)
+	{
+		// Copy to circular buffer
+		FS_Kalman_Data_t *saved = &kfBuf[kfWrI % KF_COUNT];
+		memcpy(saved, current, sizeof(FS_Kalman_Data_t));
+
+		// Increment write index
+		++kfWrI;
+
+		// Update buffer statistics
+		kfUsed = MAX(kfUsed, kfWrI - kfRdI);
+	}
+	else
+	{
+		// Update buffer statistics
+		kfUsed = KF_COUNT;
+	}
+}
+
+void FS_Log_WriteAHRSData(const FS_AHRS_Data_t *current)
+{
+	if (logState != LOG_STATE_ACTIVE) return;
+	if (!(enable_flags & FS_LOG_ENABLE_SENSOR)) return;
+	if (FS_Log_Shed(FS_LOG_SENSOR_ATT)) return;
+
+	if (attWrI < attRdI + ATT_COUNT)
+	{
+		// Copy to circular buffer
+		FS_AHRS_Data_t *saved = &attBuf[attWrI % ATT_COUNT];
+		memcpy(saved, current, sizeof(FS_AHRS_Data_t));
+
+		// Increment write index
+		++attWrI;
+
+		// Update buffer statistics
+		attUsed = MAX(attUsed, attWrI - attRdI);
+	}
+	else
+	{
+		// Update buffer statistics
+		attUsed = ATT_COUNT;
+	}
+}
+
 void FS_Log_WriteEvent(const char *format, ...)
 {
 	FS_Log_Event_t entry;
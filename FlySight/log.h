@@ -30,6 +30,9 @@
 #include "imu.h"
 #include "led.h"
 #include "mag.h"
+#include "ahrs.h"
+#include "kalman.h"
+#include "mic.h"
 #include "vbat.h"
 
 #define FS_LOG_ENABLE_GNSS   0x01
@@ -47,11 +50,20 @@ void FS_Log_WriteMagData(const FS_Mag_Data_t *current);
 void FS_Log_WriteGNSSData(const FS_GNSS_Data_t *current);
 void FS_Log_WriteGNSSTime(const FS_GNSS_Time_t *current);
 void FS_Log_WriteGNSSRaw(const FS_GNSS_Raw_t *current);
-void FS_Log_WriteIMUData(const FS_IMU_Data_t *current);
+void FS_Log_WriteIMUData(const FS_IMU_Raw_t *current);
+void FS_Log_WriteIMUBatch(const FS_IMU_Raw_t *data, uint32_t count);
 void FS_Log_WriteVBATData(const FS_VBAT_Data_t *current);
+void FS_Log_WriteMicData(const FS_Mic_Data_t *current);
+void FS_Log_WriteKalmanData(const FS_Kalman_Data_t *current);
+void FS_Log_WriteAHRSData(const FS_AHRS_Data_t *current);
 void FS_Log_WriteEvent(const char *format, ...);
 void FS_Log_WriteEventAsync(const char *format, ...);
 
+void FS_Log_FlushSensors(void);
+uint32_t FS_Log_GetBaroSpace(void);
+uint32_t FS_Log_GetIMUSpace(void);
+
 void FS_Log_UpdatePath(const FS_GNSS_Data_t *current);
+void FS_Log_SetSyncInterval(uint32_t interval);
 
 #endif /* LOG_H_ */
@@ -29,6 +29,7 @@
 #include "log.h"
 #include "mag.h"
 #include "sensor.h"
+#include "sensor_init.h"
 
 #define MAG_ADDR              0x3c
 #define MAG_REG_WHO_AM_I      (0x4f | 0x80)
@@ -46,91 +47,194 @@ typedef enum {
 	MAG_ODR_100 = 3
 } FS_Mag_ODR_t;
 
+// Sample period in ms for each ODR setting
+static const uint32_t magPeriod[] = {100, 50, 20, 10};
+
 static uint8_t dataBuf[8];
 static bool magDataGood;
 static FS_Mag_Data_t magData;
 
 typedef enum {
     MAG_STATE_UNINITIALIZED = 0,
+    MAG_STATE_INITIALIZING,
     MAG_STATE_INIT_FAILED,
     MAG_STATE_READY,
     MAG_STATE_ACTIVE
 } FS_Mag_State_t;
 
+typedef enum {
+	MAG_INIT_RESET = 0,
+	MAG_INIT_WAIT_RESET,
+	MAG_INIT_WHO_AM_I,
+	MAG_INIT_FLUSH
+} FS_Mag_InitStep_t;
+
+typedef enum {
+	MAG_START_CFG_REG_A = 0,
+	MAG_START_CFG_REG_C,
+	MAG_START_DONE
+} FS_Mag_StartStep_t;
+
 static FS_Mag_State_t magState = MAG_STATE_UNINITIALIZED;
 static volatile bool sensor_is_busy;
 
+// Initialization state
+static FS_Mag_InitStep_t initStep;
+static uint32_t initStart;
+static uint8_t  initBuf[1];
+static volatile bool initBusy;
+static volatile HAL_StatusTypeDef initResult;
+
+// Start state
+static FS_Mag_StartStep_t startStep;
+static uint8_t  startBuf[1];
+
+static void FS_Mag_Init_Callback(HAL_StatusTypeDef result)
+{
+	initResult = result;
+	initBusy = false;
+
+	// Advance initialization state machine
+	FS_SensorInit_Notify();
+}
+
+static void FS_Mag_InitRequest(void)
+{
+	HAL_StatusTypeDef result = HAL_ERROR;
+
+	initBusy = true;
+
+	switch (initStep)
+	{
+	case MAG_INIT_RESET:
+		initBuf[0] = 0x20;
+		result = FS_Sensor_WriteAsync(MAG_ADDR, MAG_REG_CFG_REG_A, initBuf, 1, FS_Mag_Init_Callback);
+		break;
+	case MAG_INIT_WAIT_RESET:
+		result = FS_Sensor_ReadAsync(MAG_ADDR, MAG_REG_CFG_REG_A, initBuf, 1, FS_Mag_Init_Callback);
+		break;
+	case MAG_INIT_WHO_AM_I:
+		result = FS_Sensor_ReadAsync(MAG_ADDR, MAG_REG_WHO_AM_I, initBuf, 1, FS_Mag_Init_Callback);
+		break;
+	case MAG_INIT_FLUSH:
+		result = FS_Sensor_ReadAsync(MAG_ADDR, MAG_REG_OUTX_L_REG, dataBuf, 8, FS_Mag_Init_Callback);
+		break;
+	}
+
+	if (result != HAL_OK)
+	{
+		FS_Mag_Init_Callback(result);
+	}
+}
+
 void FS_Mag_Init(void)
 {
-	uint8_t buf[1];
-	HAL_StatusTypeDef result;
-	uint32_t timeout;
+	magState = MAG_STATE_INITIALIZING;
 
-	// Software reset
-	timeout = HAL_GetTick() + MAG_INIT_TIMEOUT;
-	do
+	initStep = MAG_INIT_RESET;
+	initStart = HAL_GetTick();
+
+	FS_Mag_InitRequest();
+}
+
+HAL_StatusTypeDef FS_Mag_InitUpdate(void)
+{
+	if (magState != MAG_STATE_INITIALIZING)
 	{
-		buf[0] = 0x20;
-		result = FS_Sensor_Write(MAG_ADDR, MAG_REG_CFG_REG_A, buf, 1);
-		if (HAL_GetTick() > timeout)
-		{
-			magState = MAG_STATE_INIT_FAILED;
-			return;
-		}
+		return (magState == MAG_STATE_INIT_FAILED) ? HAL_ERROR : HAL_OK;
 	}
-	while (result != HAL_OK);
 
-	// Wait for reset
-	timeout = HAL_GetTick() + MAG_INIT_TIMEOUT;
-	do
+	if (initBusy)
 	{
-		result = FS_Sensor_Read(MAG_ADDR, MAG_REG_CFG_REG_A, buf, 1);
-		if (HAL_GetTick() > timeout)
-		{
-			magState = MAG_STATE_INIT_FAILED;
-			return;
-		}
+		return HAL_BUSY;
 	}
-	while ((result != HAL_OK) || (buf[0] & 0x20));
 
-	// Check WHO_AM_I register value
-	timeout = HAL_GetTick() + MAG_INIT_TIMEOUT;
-	do
+	// Advance to the next step if this one succeeded
+	if (initResult == HAL_OK)
 	{
-		result = FS_Sensor_Read(MAG_ADDR, MAG_REG_WHO_AM_I, buf, 1);
-		if (HAL_GetTick() > timeout)
+		switch (initStep)
 		{
-			magState = MAG_STATE_INIT_FAILED;
-			return;
+		case MAG_INIT_RESET:
+			initStep = MAG_INIT_WAIT_RESET;
+			break;
+		case MAG_INIT_WAIT_RESET:
+			// Wait for reset
+			if (!(initBuf[0] & 0x20)) initStep = MAG_INIT_WHO_AM_I;
+			break;
+		case MAG_INIT_WHO_AM_I:
+			// Check WHO_AM_I register value
+			if (initBuf[0] != 0x40)
+			{
+				magState = MAG_STATE_INIT_FAILED;
+				return HAL_ERROR;
+			}
+			initStep = MAG_INIT_FLUSH;
+			break;
+		case MAG_INIT_FLUSH:
+			// Threw out first temperature measurement
+			magState = MAG_STATE_READY;
+			return HAL_OK;
 		}
 	}
-	while (result != HAL_OK);
-	if (buf[0] != 0x40)
+
+	if (HAL_GetTick() - initStart > MAG_INIT_TIMEOUT)
 	{
 		magState = MAG_STATE_INIT_FAILED;
+		return HAL_ERROR;
+	}
+
+	FS_Mag_InitRequest();
+	return HAL_BUSY;
+}
+
+static void FS_Mag_Start_Callback(HAL_StatusTypeDef result);
+
+static HAL_StatusTypeDef FS_Mag_StartRequest(void)
+{
+	const FS_Config_Data_t *config = FS_Config_Get();
+
+	switch (startStep)
+	{
+	case MAG_START_CFG_REG_A:
+		// Temperature compensation; output data rate 10 Hz; continuous mode
+		startBuf[0] = (config->mag_odr << 2) | 0x80;
+		return FS_Sensor_WriteAsync(MAG_ADDR, MAG_REG_CFG_REG_A, startBuf, 1, FS_Mag_Start_Callback);
+	case MAG_START_CFG_REG_C:
+		// Configure block data update and data ready on INT_DRDY pin
+		startBuf[0] = 0x11;
+		return FS_Sensor_WriteAsync(MAG_ADDR, MAG_REG_CFG_REG_C, startBuf, 1, FS_Mag_Start_Callback);
+	case MAG_START_DONE:
+		break;
+	}
+
+	return HAL_OK;
+}
+
+static void FS_Mag_Start_Callback(HAL_StatusTypeDef result)
+{
+	// Ignore completions after the magnetometer was stopped
+	if (magState != MAG_STATE_ACTIVE)
+	{
 		return;
 	}
 
-	// Throw out first temperature measurement
-	timeout = HAL_GetTick() + MAG_INIT_TIMEOUT;
-	do
+	if (result == HAL_OK)
 	{
-		result = FS_Sensor_Read(MAG_ADDR, MAG_REG_OUTX_L_REG, dataBuf, 8);
-		if (HAL_GetTick() > timeout)
-		{
-			magState = MAG_STATE_INIT_FAILED;
-			return;
-		}
+		++startStep;
+		result = FS_Mag_StartRequest();
 	}
-	while (result != HAL_OK);
 
-	magState = MAG_STATE_READY;
+	if (result != HAL_OK)
+	{
+		FS_Log_WriteEventAsync("Couldn't start magnetometer");
+		LL_EXTI_DisableIT_0_31(LL_EXTI_LINE_6);
+		magState = MAG_STATE_READY;
+	}
 }
 
 HAL_StatusTypeDef FS_Mag_Start(void)
 {
 	const FS_Config_Data_t *config = FS_Config_Get();
-	uint8_t buf[1];
 
 	if (magState != MAG_STATE_READY)
 	{
@@ -140,28 +244,23 @@ HAL_StatusTypeDef FS_Mag_Start(void)
 	// Reset busy flag
 	sensor_is_busy = false;
 
+	// Data must be read before the output registers are overwritten
+	FS_Sensor_Register(MAG_ADDR, FS_SENSOR_PRIORITY_NORMAL, magPeriod[config->mag_odr]);
+
 	// Enable EXTI pin
 	LL_EXTI_EnableIT_0_31(LL_EXTI_LINE_6);
 
-	// Temperature compensation; output data rate 10 Hz; continuous mode
-	buf[0] = (config->mag_odr << 2) | 0x80;
-	if (FS_Sensor_Write(MAG_ADDR, MAG_REG_CFG_REG_A, buf, 1) != HAL_OK)
-	{
-		FS_Log_WriteEvent("Couldn't start magnetometer");
-		LL_EXTI_DisableIT_0_31(LL_EXTI_LINE_6);
-		return HAL_ERROR;
-	}
-
-	// Configure block data update and data ready on INT_DRDY pin
-	buf[0] = 0x11;
-	if (FS_Sensor_Write(MAG_ADDR, MAG_REG_CFG_REG_C, buf, 1) != HAL_OK)
+	// Queue configuration writes; data ready is enabled by the last one
+	magState = MAG_STATE_ACTIVE;
+	startStep = MAG_START_CFG_REG_A;
+	if (FS_Mag_StartRequest() != HAL_OK)
 	{
 		FS_Log_WriteEvent("Couldn't start magnetometer");
 		LL_EXTI_DisableIT_0_31(LL_EXTI_LINE_6);
+		magState = MAG_STATE_READY;
 		return HAL_ERROR;
 	}
 
-	magState = MAG_STATE_ACTIVE;
 	return HAL_OK;
 }
 
@@ -172,14 +271,16 @@ void FS_Mag_Stop(void)
 	// Disable EXTI pin
     LL_EXTI_DisableIT_0_31(LL_EXTI_LINE_6);
 
+	// Drop configuration writes and reads not yet started
+	magState = MAG_STATE_READY;
+	FS_Sensor_Cancel(MAG_ADDR);
+
 	// Software reset
 	buf[0] = 0x20;
 	if (FS_Sensor_Write(MAG_ADDR, MAG_REG_CFG_REG_A, buf, 1) != HAL_OK)
 	{
 		FS_Log_WriteEvent("Couldn't stop magnetometer");
 	}
-
-	magState = MAG_STATE_READY;
 }
 
 static void FS_Mag_Read_Callback_1(HAL_StatusTypeDef result)
@@ -201,7 +302,7 @@ static void FS_Mag_Read_Callback_2(HAL_StatusTypeDef result)
 {
 	if ((result == HAL_OK) && magDataGood)
 	{
-		magData.temperature = (((int16_t) ((dataBuf[1] << 8) | dataBuf[0])) * (int32_t) 10) / 8 + 250;
+		magData.temperature = (((int16_t) ((dataBuf[7] << 8) | dataBuf[6])) * (int32_t) 10) / 8 + 250;
 
 		FS_Mag_DataReady_Callback();
 	}
@@ -237,7 +338,8 @@ void FS_Mag_Read(void)
 		sensor_is_busy = false;
 	}
 
-	if (FS_Sensor_ReadAsync(MAG_ADDR, MAG_TEMP_OUT_L_REG, dataBuf, 2, FS_Mag_Read_Callback_2) != HAL_OK)
+	// Temperature follows XYZ, so the scheduler can merge both reads
+	if (FS_Sensor_ReadAsync(MAG_ADDR, MAG_TEMP_OUT_L_REG, &dataBuf[6], 2, FS_Mag_Read_Callback_2) != HAL_OK)
 	{
 		// Abort this measurement cycle and reset the state to allow the next one.
 		FS_Log_WriteEventAsync("Error reading from humidity sensor");
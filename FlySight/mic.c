@@ -0,0 +1,160 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2024 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#include <math.h>
+#include <stdbool.h>
+
+#include "main.h"
+#include "app_common.h"
+#include "adc.h"
+#include "mic.h"
+
+#define MIC_OUTPUT_MSEC  1000	// feature output period
+
+#define MIC_LP_SHIFT     3		// low band corner at FS_ADC_RATE / (2 * pi * 2^MIC_LP_SHIFT)
+#define MIC_LP_FRAC      4		// fractional bits in low-pass state
+#define MIC_DC_SHIFT     10		// DC tracker corner at FS_ADC_RATE / (2 * pi * 2^MIC_DC_SHIFT)
+#define MIC_DC_FRAC      12		// fractional bits in DC tracker state
+
+#define VDDA_APPLI       ((uint32_t) 3300)	// mV
+#define DIGITAL_SCALE_12BITS ((uint32_t) 0xFFF)
+
+static volatile bool micActive = false;
+
+// Filter state
+static int32_t micMean;			// DC level (counts << MIC_DC_FRAC)
+static int32_t micLowPass;		// low band state (counts << MIC_LP_FRAC)
+
+// Accumulated features
+static uint64_t micSum2;
+static uint64_t micLow2;
+static uint64_t micHigh2;
+static int32_t  micPeak;
+static uint32_t micCount;
+static uint32_t micStart;
+
+static FS_Mic_Data_t micData;
+
+static int32_t FS_Mic_ToMicrovolts(float counts)
+{
+	return lroundf(counts * (VDDA_APPLI * 1000.0f / DIGITAL_SCALE_12BITS));
+}
+
+void FS_Mic_Init(void)
+{
+	micMean = -1;
+	micLowPass = 0;
+
+	micSum2 = 0;
+	micLow2 = 0;
+	micHigh2 = 0;
+	micPeak = 0;
+	micCount = 0;
+	micStart = HAL_GetTick();
+
+	// Enable microphone
+	HAL_GPIO_WritePin(MIC_EN_GPIO_Port, MIC_EN_Pin, GPIO_PIN_SET);
+
+	micActive = true;
+}
+
+void FS_Mic_DeInit(void)
+{
+	micActive = false;
+
+	// Disable microphone
+	HAL_GPIO_WritePin(MIC_EN_GPIO_Port, MIC_EN_Pin, GPIO_PIN_RESET);
+}
+
+void FS_Mic_ProcessBlock(const uint16_t *buf, uint32_t count)
+{
+	uint32_t i, sum = 0;
+	int32_t x, lp, hp;
+	uint32_t now;
+
+	if (!micActive) return;
+
+	// Use the first block to settle the DC estimate
+	if (micMean < 0)
+	{
+		for (i = 0; i < count; ++i)
+		{
+			sum += buf[i * FS_ADC_CHANNELS + FS_ADC_RANK_MIC];
+		}
+		micMean = (sum / count) << MIC_DC_FRAC;
+		return;
+	}
+
+	for (i = 0; i < count; ++i)
+	{
+		const uint16_t sample = buf[i * FS_ADC_CHANNELS + FS_ADC_RANK_MIC];
+
+		// Track DC well below the low band so that low-frequency
+		// signal is not removed with it
+		micMean += (((int32_t) sample << MIC_DC_FRAC) - micMean) >> MIC_DC_SHIFT;
+		x = (int32_t) sample - (micMean >> MIC_DC_FRAC);
+
+		// Split into low and high bands with a one-pole low-pass
+		micLowPass += ((x << MIC_LP_FRAC) - micLowPass) >> MIC_LP_SHIFT;
+		lp = micLowPass >> MIC_LP_FRAC;
+		hp = x - lp;
+
+		micSum2 += x * x;
+		micLow2 += lp * lp;
+		micHigh2 += hp * hp;
+		micPeak = MAX(micPeak, (x >= 0) ? x : -x);
+	}
+
+	micCount += count;
+
+	now = HAL_GetTick();
+	if (now - micStart >= MIC_OUTPUT_MSEC)
+	{
+		micData.time = now;
+		micData.rms = FS_Mic_ToMicrovolts(sqrtf((float) micSum2 / micCount));
+		micData.peak = FS_Mic_ToMicrovolts(micPeak);
+		micData.low = FS_Mic_ToMicrovolts(sqrtf((float) micLow2 / micCount));
+		micData.high = FS_Mic_ToMicrovolts(sqrtf((float) micHigh2 / micCount));
+
+		micSum2 = 0;
+		micLow2 = 0;
+		micHigh2 = 0;
+		micPeak = 0;
+		micCount = 0;
+		micStart = now;
+
+		FS_Mic_DataReady_Callback();
+	}
+}
+
+const FS_Mic_Data_t *FS_Mic_GetData(void)
+{
+	return &micData;
+}
+
+__weak void FS_Mic_DataReady_Callback(void)
+{
+  /* NOTE: This function should not be modified, when the callback is needed,
+           the FS_Mic_DataReady_Callback could be implemented in the user file
+   */
+}
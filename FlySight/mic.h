@@ -0,0 +1,44 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2024 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#ifndef MIC_H_
+#define MIC_H_
+
+typedef struct
+{
+	uint32_t time;			// ms
+	int32_t  rms;			// uV
+	int32_t  peak;			// uV
+	int32_t  low;			// RMS below ~160 Hz (uV)
+	int32_t  high;			// RMS above ~160 Hz (uV)
+} FS_Mic_Data_t;
+
+void FS_Mic_Init(void);
+void FS_Mic_DeInit(void);
+
+void FS_Mic_ProcessBlock(const uint16_t *buf, uint32_t count);
+
+const FS_Mic_Data_t *FS_Mic_GetData(void);
+void FS_Mic_DataReady_Callback(void);
+
+#endif /* MIC_H_ */
@@ -28,6 +28,8 @@
 #include "app_ble.h"
 #include "app_common.h"
 #include "button.h"
+#include "capture.h"
+#include "config.h"
 #include "config_mode.h"
 #include "log.h"
 #include "mode.h"
@@ -229,6 +231,12 @@ static FS_Mode_State_t FS_Mode_State_Active(FS_Mode_Event_t event)
 
 	if (event == FS_MODE_EVENT_BUTTON_PRESSED)
 	{
+		if (FS_Config_Get()->cap_button)
+		{
+			// Log high-rate data around button press
+			FS_Capture_Trigger(FS_CAPTURE_TRIGGER_BUTTON, HAL_GetTick());
+		}
+
 		HW_TS_Start(timer_id, HOLD_TIMEOUT);
 	}
 	else if (event == FS_MODE_EVENT_BUTTON_RELEASED)
@@ -0,0 +1,292 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2024 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#include <stdbool.h>
+
+#include "main.h"
+#include "altitude.h"
+#include "config.h"
+#include "gnss.h"
+#include "log.h"
+#include "phase.h"
+#include "stm32_seq.h"
+
+#define PHASE_CLIMB_RATE      1500	// minimum climb rate in aircraft (mm/s)
+#define PHASE_CLIMB_SPEED    25000	// minimum ground speed in aircraft (mm/s)
+#define PHASE_EXIT_SPEED     10000	// minimum descent rate after exit (mm/s)
+#define PHASE_FREEFALL_SPEED 25000	// minimum descent rate in freefall (mm/s)
+#define PHASE_DEPLOY_SPEED   15000	// maximum descent rate after deployment (mm/s)
+#define PHASE_STOP_VEL_D       500	// maximum vertical speed when stationary (mm/s)
+#define PHASE_STOP_SPEED      1500	// maximum ground speed when stationary (mm/s)
+
+#define PHASE_CLIMB_MSEC      5000	// time to confirm climb (ms)
+#define PHASE_EXIT_MSEC        500	// time to confirm exit (ms)
+#define PHASE_DEPLOY_MSEC     2000	// time to confirm deployment (ms)
+#define PHASE_OPEN_MSEC       3000	// time to confirm deployment from exit (ms)
+#define PHASE_LANDED_MSEC    10000	// time to confirm landing (ms)
+#define PHASE_GROUND_MSEC    30000	// time to confirm aircraft has landed (ms)
+
+static const char *const phaseNames[FS_PHASE_COUNT] =
+{
+	"ground", "climb", "exit", "freefall", "canopy", "landed"
+};
+
+static FS_Phase_t phase;			// current phase
+static FS_Phase_t candidate;		// phase waiting to be confirmed
+static uint32_t candidateTime;		// time candidate was first seen (ms)
+static uint32_t phaseTime;			// time current phase was entered (ms)
+static uint32_t phaseTotal[FS_PHASE_COUNT];	// time spent in each phase (ms)
+static bool hasExited;				// exit seen since last landing
+static volatile bool phaseActive;	// between init and de-init
+
+// Latest GNSS solution
+static int32_t gnssVelD;			// mm/s
+static int32_t gnssSpeed;			// mm/s
+static bool hasFix;
+
+static void FS_Phase_Apply(void)
+{
+	const FS_Config_Data_t *config = FS_Config_Get();
+	const FS_Config_Phase_t *profile = &config->phases[phase];
+
+	// Change GNSS measurement rate
+	FS_GNSS_SetRate(profile->rate ? profile->rate : config->rate);
+
+	// Change log file sync interval
+	FS_Log_SetSyncInterval(profile->log_sync);
+}
+
+static void FS_Phase_Set(FS_Phase_t next)
+{
+	const uint32_t now = HAL_GetTick();
+
+	phaseTotal[phase] += now - phaseTime;
+	phaseTime = now;
+
+	FS_Log_WriteEvent("Phase changed from %s to %s",
+			phaseNames[phase], phaseNames[next]);
+
+	if (next == FS_PHASE_EXIT)
+	{
+		hasExited = true;
+	}
+	else if (next == FS_PHASE_GROUND || next == FS_PHASE_LANDED)
+	{
+		hasExited = false;
+	}
+
+	phase = next;
+	FS_Phase_Apply();
+}
+
+static FS_Phase_t FS_Phase_Classify(int32_t velD, int32_t gSpeed, uint32_t *dwell)
+{
+	const bool stopped = (velD > -PHASE_STOP_VEL_D) && (velD < PHASE_STOP_VEL_D)
+			&& (gSpeed < PHASE_STOP_SPEED);
+
+	switch (phase)
+	{
+	case FS_PHASE_GROUND:
+	case FS_PHASE_LANDED:
+		if (-velD > PHASE_CLIMB_RATE || gSpeed > PHASE_CLIMB_SPEED)
+		{
+			*dwell = PHASE_CLIMB_MSEC;
+			return FS_PHASE_CLIMB;
+		}
+		break;
+	case FS_PHASE_CLIMB:
+		if (velD > PHASE_EXIT_SPEED)
+		{
+			*dwell = PHASE_EXIT_MSEC;
+			return FS_PHASE_EXIT;
+		}
+		if (stopped)
+		{
+			*dwell = PHASE_GROUND_MSEC;
+			return hasExited ? FS_PHASE_LANDED : FS_PHASE_GROUND;
+		}
+		break;
+	case FS_PHASE_EXIT:
+		if (velD > PHASE_FREEFALL_SPEED)
+		{
+			*dwell = 0;
+			return FS_PHASE_FREEFALL;
+		}
+		if (velD < PHASE_EXIT_SPEED)
+		{
+			*dwell = PHASE_OPEN_MSEC;
+			return FS_PHASE_CANOPY;
+		}
+		break;
+	case FS_PHASE_FREEFALL:
+		if (velD < PHASE_DEPLOY_SPEED)
+		{
+			*dwell = PHASE_DEPLOY_MSEC;
+			return FS_PHASE_CANOPY;
+		}
+		break;
+	case FS_PHASE_CANOPY:
+		if (stopped)
+		{
+			*dwell = PHASE_LANDED_MSEC;
+			return FS_PHASE_LANDED;
+		}
+		break;
+	default:
+		break;
+	}
+
+	return phase;
+}
+
+static void updateTask(void)
+{
+	const uint32_t now = HAL_GetTick();
+	uint32_t primask_bit;
+	uint32_t dwell = 0;
+	int32_t gSpeed;
+	int32_t velD;
+	FS_Phase_t next;
+	bool fix;
+
+	// Ignore updates queued before de-initialization
+	if (!phaseActive) return;
+
+	primask_bit = __get_PRIMASK();
+	__disable_irq();
+
+	velD = gnssVelD;
+	gSpeed = gnssSpeed;
+	fix = hasFix;
+
+	__set_PRIMASK(primask_bit);
+
+	if (!fix) return;
+
+	// Use fused vertical speed when it is available
+	if (FS_Altitude_IsValid())
+	{
+		velD = FS_Altitude_GetData()->velD;
+	}
+
+	next = FS_Phase_Classify(velD, gSpeed, &dwell);
+
+	if (next == phase)
+	{
+		candidate = phase;
+		return;
+	}
+
+	if (next != candidate)
+	{
+		candidate = next;
+		candidateTime = now;
+	}
+
+	if (now - candidateTime >= dwell)
+	{
+		FS_Phase_Set(next);
+	}
+}
+
+void FS_Phase_Init(void)
+{
+	uint32_t i;
+
+	phase = FS_PHASE_GROUND;
+	candidate = FS_PHASE_GROUND;
+	phaseTime = HAL_GetTick();
+	hasExited = false;
+	hasFix = false;
+
+	for (i = 0; i < FS_PHASE_COUNT; ++i)
+	{
+		phaseTotal[i] = 0;
+	}
+
+	// Initialize update task
+	UTIL_SEQ_RegTask(1<<CFG_TASK_FS_PHASE_UPDATE_ID, UTIL_SEQ_RFU, updateTask);
+
+	FS_Phase_Apply();
+
+	phaseActive = true;
+}
+
+void FS_Phase_DeInit(void)
+{
+	uint32_t i;
+
+	phaseActive = false;
+
+	phaseTotal[phase] += HAL_GetTick() - phaseTime;
+
+	// Log time spent in each phase
+	for (i = 0; i < FS_PHASE_COUNT; ++i)
+	{
+		FS_Log_WriteEvent("Phase %s: %lu ms", phaseNames[i], phaseTotal[i]);
+	}
+}
+
+void FS_Phase_UpdateGNSS(const FS_GNSS_Data_t *current)
+{
+	uint32_t primask_bit;
+
+	primask_bit = __get_PRIMASK();
+	__disable_irq();
+
+	gnssVelD = current->velD;
+	gnssSpeed = current->gSpeed * 10;
+	hasFix = (current->gpsFix == 3);
+
+	__set_PRIMASK(primask_bit);
+
+	// Call update task
+	UTIL_SEQ_SetTask(1<<CFG_TASK_FS_PHASE_UPDATE_ID, CFG_SCH_PRIO_1);
+}
+
+void FS_Phase_UpdateBaro(void)
+{
+	// Call update task
+	UTIL_SEQ_SetTask(1<<CFG_TASK_FS_PHASE_UPDATE_ID, CFG_SCH_PRIO_1);
+}
+
+FS_Phase_t FS_Phase_Get(void)
+{
+	return phase;
+}
+
+uint8_t FS_Phase_GetIMULogDec(void)
+{
+	const FS_Config_Data_t *config = FS_Config_Get();
+	const uint8_t dec = config->phases[phase].imu_log_dec;
+
+	return dec ? dec : config->imu_log_dec;
+}
+
+uint8_t FS_Phase_GetBaroLogDec(void)
+{
+	const FS_Config_Data_t *config = FS_Config_Get();
+	const uint8_t dec = config->phases[phase].baro_log_dec;
+
+	return dec ? dec : config->baro_log_dec;
+}
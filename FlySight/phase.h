@@ -0,0 +1,48 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2024 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#ifndef PHASE_H_
+#define PHASE_H_
+
+#include "gnss.h"
+
+typedef enum
+{
+	FS_PHASE_GROUND = 0,
+	FS_PHASE_CLIMB,
+	FS_PHASE_EXIT,
+	FS_PHASE_FREEFALL,
+	FS_PHASE_CANOPY,
+	FS_PHASE_LANDED,
+	FS_PHASE_COUNT
+} FS_Phase_t;
+
+void FS_Phase_Init(void);
+void FS_Phase_DeInit(void);
+void FS_Phase_UpdateGNSS(const FS_GNSS_Data_t *current);
+void FS_Phase_UpdateBaro(void);
+FS_Phase_t FS_Phase_Get(void);
+uint8_t FS_Phase_GetIMULogDec(void);
+uint8_t FS_Phase_GetBaroLogDec(void);
+
+#endif /* PHASE_H_ */
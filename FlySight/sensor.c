@@ -26,10 +26,14 @@
 #include "main.h"
 #include "app_common.h"
 #include "log.h"
+#include "sensor.h"
 #include "stm32_seq.h"
 
-#define HANDLER_COUNT 4
-#define TIMEOUT       100
+#define HANDLER_COUNT  8
+#define DEVICE_COUNT   4
+#define MERGE_COUNT    4
+#define TIMEOUT        100
+#define DEFAULT_PERIOD 1000	// Deadline for unregistered devices (ms)
 
 typedef enum
 {
@@ -48,6 +52,27 @@ typedef enum
 	Operation_Transmit
 } Operation_t;
 
+typedef enum
+{
+	Handler_Free,
+	Handler_Pending,
+	Handler_Active
+} HandlerState_t;
+
+typedef struct
+{
+	uint8_t  addr;
+	uint8_t  priority;
+	uint32_t period;			// on-chip data lifetime (ms)
+
+	uint32_t count;				// completed requests
+	uint32_t merged;			// requests merged into a preceding read
+	uint32_t late;				// requests completed after their deadline
+	uint32_t overrun;			// requests rejected or evicted
+	uint32_t latencyTotal;		// ms
+	uint32_t latencyMax;		// ms
+} Device_t;
+
 typedef struct
 {
 	Operation_t op;
@@ -56,11 +81,24 @@ typedef struct
 	uint8_t *pData;
 	uint16_t size;
 	void (*Callback)(HAL_StatusTypeDef);
+
+	HandlerState_t state;
+	uint32_t seq;				// enqueue order
+	uint32_t time;				// enqueue time (ms)
+	uint32_t deadline;			// ms
+	Device_t *dev;
 } Handler_t;
 
-static          Handler_t handlerBuf[HANDLER_COUNT];	// handler buffer
-static volatile uint32_t  handlerRdI = 0;				// read index
-static volatile uint32_t  handlerWrI = 0;				// write index
+static Handler_t handlerBuf[HANDLER_COUNT];		// handler pool
+static uint32_t  handlerSeq = 0;				// next sequence number
+
+static Device_t  deviceBuf[DEVICE_COUNT];		// known devices
+static uint8_t   deviceCount = 0;
+static Device_t  deviceDefault = { .period = DEFAULT_PERIOD };
+
+static Handler_t *activeBuf[MERGE_COUNT];		// handlers in current transfer
+static uint8_t    activeCount = 0;
+static uint16_t   activeSize = 0;				// total size of current transfer
 
 extern I2C_HandleTypeDef hi2c3;
 
@@ -77,11 +115,161 @@ void FS_Sensor_TransferError(void)
 	NextHandler(HAL_ERROR);
 }
 
-void FS_Sensor_Start(void)
+static Device_t *GetDevice(uint8_t addr)
+{
+	uint8_t i;
+
+	for (i = 0; i < deviceCount; ++i)
+	{
+		if (deviceBuf[i].addr == addr)
+		{
+			return &deviceBuf[i];
+		}
+	}
+
+	if (deviceCount < DEVICE_COUNT)
+	{
+		deviceBuf[deviceCount].addr = addr;
+		deviceBuf[deviceCount].priority = FS_SENSOR_PRIORITY_LOW;
+		deviceBuf[deviceCount].period = DEFAULT_PERIOD;
+		return &deviceBuf[deviceCount++];
+	}
+
+	return &deviceDefault;
+}
+
+void FS_Sensor_Register(uint8_t addr, uint8_t priority, uint32_t period)
+{
+	uint32_t primask_bit = __get_PRIMASK();
+	__disable_irq();
+
+	Device_t *dev = GetDevice(addr);
+	dev->priority = priority;
+	dev->period = period;
+
+	__set_PRIMASK(primask_bit);
+}
+
+static Handler_t *NextForDevice(const Device_t *dev)
+{
+	Handler_t *next = NULL;
+	uint32_t i;
+
+	// Requests to one device are always issued in order
+	for (i = 0; i < HANDLER_COUNT; ++i)
+	{
+		Handler_t *h = &handlerBuf[i];
+		if ((h->state == Handler_Pending) && (h->dev == dev) &&
+				(!next || ((int32_t) (h->seq - next->seq) < 0)))
+		{
+			next = h;
+		}
+	}
+
+	return next;
+}
+
+static bool IsBefore(const Handler_t *a, const Handler_t *b)
+{
+	// Earliest deadline first, then priority, then arrival
+	if (a->deadline != b->deadline)
+	{
+		return (int32_t) (a->deadline - b->deadline) < 0;
+	}
+	if (a->dev->priority != b->dev->priority)
+	{
+		return a->dev->priority > b->dev->priority;
+	}
+	return (int32_t) (a->seq - b->seq) < 0;
+}
+
+static bool Dispatch(void)
+{
+	Handler_t *best = NULL;
+	Handler_t *h;
+	uint32_t i;
+
+	// Must be called with interrupts disabled
+	for (i = 0; i < HANDLER_COUNT; ++i)
+	{
+		h = &handlerBuf[i];
+		if ((h->state == Handler_Pending) && (h == NextForDevice(h->dev)) &&
+				(!best || IsBefore(h, best)))
+		{
+			best = h;
+		}
+	}
+
+	if (!best)
+	{
+		return false;
+	}
+
+	best->state = Handler_Active;
+	activeBuf[0] = best;
+	activeCount = 1;
+	activeSize = best->size;
+
+	// Merge reads of consecutive registers into contiguous memory
+	while ((best->op == Operation_Read) && (activeCount < MERGE_COUNT))
+	{
+		h = NextForDevice(best->dev);
+		if (!h || (h->op != Operation_Read) ||
+				(h->reg != best->reg + activeSize) ||
+				(h->pData != best->pData + activeSize))
+		{
+			break;
+		}
+
+		h->state = Handler_Active;
+		activeBuf[activeCount++] = h;
+		activeSize += h->size;
+		++h->dev->merged;
+	}
+
+	return true;
+}
+
+void FS_Sensor_ResetStats(void)
+{
+	uint32_t primask_bit;
+	uint8_t i;
+
+	primask_bit = __get_PRIMASK();
+	__disable_irq();
+
+	for (i = 0; i < deviceCount; ++i)
+	{
+		deviceBuf[i].count = 0;
+		deviceBuf[i].merged = 0;
+		deviceBuf[i].late = 0;
+		deviceBuf[i].overrun = 0;
+		deviceBuf[i].latencyTotal = 0;
+		deviceBuf[i].latencyMax = 0;
+	}
+
+	__set_PRIMASK(primask_bit);
+}
+
+void FS_Sensor_Resume(void)
 {
+	uint32_t primask_bit;
+	bool start_now;
+
+	primask_bit = __get_PRIMASK();
+	__disable_irq();
+
 	mode = MODE_ACTIVE;
 
-	if (handlerRdI != handlerWrI)
+	start_now = !busy && Dispatch();
+	if (start_now)
+	{
+		busy = true;
+	}
+
+	__set_PRIMASK(primask_bit);
+
+	if (start_now)
 	{
 		BeginRead();
 	}
@@ -89,32 +277,76 @@ void FS_Sensor_Start(void)
 
 void FS_Sensor_Stop(void)
 {
+	uint8_t i;
+
+	FS_Sensor_Suspend();
+
+	// Add event log entries for scheduler statistics
+	FS_Log_WriteEvent("----------");
+	for (i = 0; i < deviceCount; ++i)
+	{
+		const Device_t *dev = &deviceBuf[i];
+
+		FS_Log_WriteEvent("%lu I2C requests to 0x%02x (%lu merged, %lu late, %lu overruns)",
+				dev->count, dev->addr, dev->merged, dev->late, dev->overrun);
+		FS_Log_WriteEvent("%lu ms average latency for I2C requests to 0x%02x",
+				(dev->count > 0) ? (dev->latencyTotal / dev->count) : 0, dev->addr);
+		FS_Log_WriteEvent("%lu ms maximum latency for I2C requests to 0x%02x",
+				dev->latencyMax, dev->addr);
+	}
+}
+
+void FS_Sensor_Suspend(void)
+{
+	// Queued requests wait until the engine is resumed. A transfer
+	// already on the bus completes, and blocking access retries until
+	// the bus is free.
 	mode = MODE_INACTIVE;
-	while (busy);
+}
+
+void FS_Sensor_Cancel(uint8_t addr)
+{
+	uint32_t primask_bit;
+	uint32_t i;
+
+	primask_bit = __get_PRIMASK();
+	__disable_irq();
+
+	// Discard requests to this device still waiting for the bus
+	for (i = 0; i < HANDLER_COUNT; ++i)
+	{
+		if ((handlerBuf[i].state == Handler_Pending) &&
+				(handlerBuf[i].addr == addr))
+		{
+			handlerBuf[i].state = Handler_Free;
+		}
+	}
+
+	__set_PRIMASK(primask_bit);
 }
 
 static void BeginRead(void)
 {
-	Handler_t *h = &handlerBuf[handlerRdI % HANDLER_COUNT];
+	Handler_t *h = activeBuf[0];
 	HAL_StatusTypeDef result = HAL_ERROR;
 
 	busy = true;
 
 	if (h->op == Operation_Read)
 	{
-		result = HAL_I2C_Mem_Read_DMA(&hi2c3, h->addr, h->reg, 1, h->pData, h->size);
+		result = HAL_I2C_Mem_Read_DMA(&hi2c3, h->addr, h->reg, 1, h->pData, activeSize);
 	}
 	else if (h->op == Operation_Write)
 	{
-		result = HAL_I2C_Mem_Write_DMA(&hi2c3, h->addr, h->reg, 1, h->pData, h->size);
+		result = HAL_I2C_Mem_Write_DMA(&hi2c3, h->addr, h->reg, 1, h->pData, activeSize);
 	}
 	else if (h->op == Operation_Recieve)
 	{
-		result = HAL_I2C_Master_Receive_DMA(&hi2c3, h->addr, h->pData, h->size);
+		result = HAL_I2C_Master_Receive_DMA(&hi2c3, h->addr, h->pData, activeSize);
 	}
 	else if (h->op == Operation_Transmit)
 	{
-		result = HAL_I2C_Master_Transmit_DMA(&hi2c3, h->addr, h->pData, h->size);
+		result = HAL_I2C_Master_Transmit_DMA(&hi2c3, h->addr, h->pData, activeSize);
 	}
 	else
 	{
@@ -129,19 +361,48 @@ static void BeginRead(void)
 
 static void NextHandler(HAL_StatusTypeDef result)
 {
-	Handler_t *h = &handlerBuf[handlerRdI % HANDLER_COUNT];
+	void (*callback[MERGE_COUNT])(HAL_StatusTypeDef);
+	const uint32_t ms = HAL_GetTick();
 	uint32_t primask_bit;
+	uint8_t i, n;
+
+	primask_bit = __get_PRIMASK();
+	__disable_irq();
+
+	// Release handlers before calling back, so callbacks can enqueue
+	n = activeCount;
+	for (i = 0; i < n; ++i)
+	{
+		Handler_t *h = activeBuf[i];
+		Device_t *dev = h->dev;
 
-	if (h->Callback)
+		++dev->count;
+		dev->latencyTotal += ms - h->time;
+		dev->latencyMax = MAX(dev->latencyMax, ms - h->time);
+		if ((int32_t) (ms - h->deadline) > 0)
+		{
+			++dev->late;
+		}
+
+		callback[i] = h->Callback;
+		h->state = Handler_Free;
+	}
+	activeCount = 0;
+
+	__set_PRIMASK(primask_bit);
+
+	for (i = 0; i < n; ++i)
 	{
-		h->Callback(result);
+		if (callback[i])
+		{
+			callback[i](result);
+		}
 	}
 
 	primask_bit = __get_PRIMASK();
 	__disable_irq();
 
-	++handlerRdI;
-	busy = (mode == MODE_ACTIVE) && (handlerRdI != handlerWrI);
+	busy = (mode == MODE_ACTIVE) && Dispatch();
 
 	__set_PRIMASK(primask_bit);
 
@@ -159,40 +420,83 @@ static HAL_StatusTypeDef FS_Sensor_Enqueue(
 		uint16_t size,
 		void (*Callback)(HAL_StatusTypeDef))
 {
-    uint32_t primask = __get_PRIMASK();
-    __disable_irq();
-
-    // Check full *inside* the critical section
-    if ((handlerWrI - handlerRdI) >= HANDLER_COUNT) {
-        __set_PRIMASK(primask);
-        FS_Log_WriteEventAsync("Sensor data overrun");
-        return HAL_ERROR;
-    }
-
-    // Reserve slot and fill it atomically
-    uint32_t idx = handlerWrI % HANDLER_COUNT;
-    handlerBuf[idx].op       = op;
-    handlerBuf[idx].addr     = addr;
-    handlerBuf[idx].reg      = reg;
-    handlerBuf[idx].pData    = pData;
-    handlerBuf[idx].size     = size;
-    handlerBuf[idx].Callback = Callback;
-
-    handlerWrI++;
-
-    // Decide whether to kick the engine now and reserve the bus
-    bool start_now = (mode == MODE_ACTIVE) && !busy;
-    if (start_now) {
-        busy = true;  // reserve bus so no second producer calls BeginRead()
-    }
-
-    __set_PRIMASK(primask);
-
-    if (start_now) {
-        BeginRead();  // OK if BeginRead() sets busy again; harmless
-    }
-
-    return HAL_OK;
+	void (*evicted)(HAL_StatusTypeDef) = NULL;
+	Handler_t *h = NULL;
+	Handler_t *victim = NULL;
+	Device_t *dev;
+	bool start_now;
+	uint32_t i;
+
+	uint32_t primask_bit = __get_PRIMASK();
+	__disable_irq();
+
+	dev = GetDevice(addr);
+
+	// Find a free slot, noting the least important pending request
+	for (i = 0; i < HANDLER_COUNT; ++i)
+	{
+		if (handlerBuf[i].state == Handler_Free)
+		{
+			h = &handlerBuf[i];
+			break;
+		}
+		else if ((handlerBuf[i].state == Handler_Pending) &&
+				(handlerBuf[i].dev->priority < dev->priority) &&
+				(!victim || IsBefore(victim, &handlerBuf[i])))
+		{
+			victim = &handlerBuf[i];
+		}
+	}
+
+	// When full, displace a request from a lower priority device
+	if (!h && victim)
+	{
+		++victim->dev->overrun;
+		evicted = victim->Callback;
+		h = victim;
+	}
+
+	if (!h)
+	{
+		++dev->overrun;
+		__set_PRIMASK(primask_bit);
+		FS_Log_WriteEventAsync("Sensor data overrun");
+		return HAL_ERROR;
+	}
+
+	h->op       = op;
+	h->addr     = addr;
+	h->reg      = reg;
+	h->pData    = pData;
+	h->size     = size;
+	h->Callback = Callback;
+	h->state    = Handler_Pending;
+	h->seq      = handlerSeq++;
+	h->time     = HAL_GetTick();
+	h->deadline = h->time + dev->period;
+	h->dev      = dev;
+
+	// Decide whether to kick the engine now and reserve the bus
+	start_now = (mode == MODE_ACTIVE) && !busy && Dispatch();
+	if (start_now)
+	{
+		busy = true;
+	}
+
+	__set_PRIMASK(primask_bit);
+
+	if (evicted)
+	{
+		FS_Log_WriteEventAsync("Sensor data overrun");
+		evicted(HAL_ERROR);
+	}
+
+	if (start_now)
+	{
+		BeginRead();
+	}
+
+	return HAL_OK;
 }
 
 HAL_StatusTypeDef FS_Sensor_TransmitAsync(
@@ -24,8 +24,17 @@
 #ifndef SENSOR_H_
 #define SENSOR_H_
 
-void FS_Sensor_Start(void);
+#define FS_SENSOR_PRIORITY_LOW    0
+#define FS_SENSOR_PRIORITY_NORMAL 1
+#define FS_SENSOR_PRIORITY_HIGH   2
+
+void FS_Sensor_ResetStats(void);
 void FS_Sensor_Stop(void);
+void FS_Sensor_Resume(void);
+void FS_Sensor_Suspend(void);
+void FS_Sensor_Cancel(uint8_t addr);
+
+void FS_Sensor_Register(uint8_t addr, uint8_t priority, uint32_t period);
 
 HAL_StatusTypeDef FS_Sensor_TransmitAsync(uint8_t addr, uint8_t *pData, uint16_t size, void (*Callback)(HAL_StatusTypeDef));
 HAL_StatusTypeDef FS_Sensor_ReceiveAsync(uint8_t addr, uint8_t *pData, uint16_t size, void (*Callback)(HAL_StatusTypeDef));
@@ -0,0 +1,161 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2024 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#include <stdbool.h>
+
+#include "main.h"
+#include "app_common.h"
+#include "baro.h"
+#include "hum.h"
+#include "log.h"
+#include "mag.h"
+#include "sensor.h"
+#include "sensor_init.h"
+#include "stm32_seq.h"
+
+typedef struct
+{
+	const char *name;
+	void (*Init)(void);
+	HAL_StatusTypeDef (*Update)(void);
+	HAL_StatusTypeDef result;
+	uint32_t time;			// ms from start of initialization
+	bool ready;				// ready callback has been called
+} Probe_t;
+
+static Probe_t probes[] =
+{
+	[FS_SENSOR_INIT_BARO] = {.name = "barometer",       .Init = FS_Baro_Init, .Update = FS_Baro_InitUpdate},
+	[FS_SENSOR_INIT_MAG]  = {.name = "magnetometer",    .Init = FS_Mag_Init,  .Update = FS_Mag_InitUpdate},
+	[FS_SENSOR_INIT_HUM]  = {.name = "humidity sensor", .Init = FS_Hum_Init,  .Update = FS_Hum_InitUpdate}
+};
+
+#define PROBE_COUNT (sizeof(probes) / sizeof(probes[0]))
+
+static uint32_t initStart;
+static bool initDone = false;
+
+static void FS_SensorInit_Update(void);
+
+void FS_SensorInit_Begin(void)
+{
+	uint32_t i;
+
+	// Initialize sensor init task
+	UTIL_SEQ_RegTask(1<<CFG_TASK_FS_SENSOR_INIT_ID, UTIL_SEQ_RFU, FS_SensorInit_Update);
+
+	initStart = HAL_GetTick();
+	initDone = false;
+
+	// Run all probes through the queued transfer engine
+	FS_Sensor_Resume();
+
+	for (i = 0; i < PROBE_COUNT; ++i)
+	{
+		probes[i].result = HAL_BUSY;
+		probes[i].ready = false;
+		probes[i].Init();
+	}
+
+	FS_SensorInit_Notify();
+}
+
+bool FS_SensorInit_IsDone(void)
+{
+	return initDone;
+}
+
+void FS_SensorInit_Notify(void)
+{
+	// Call update task
+	UTIL_SEQ_SetTask(1<<CFG_TASK_FS_SENSOR_INIT_ID, CFG_SCH_PRIO_1);
+}
+
+static void FS_SensorInit_Update(void)
+{
+	bool done = true;
+	uint32_t i;
+
+	if (initDone) return;
+
+	for (i = 0; i < PROBE_COUNT; ++i)
+	{
+		if (probes[i].result == HAL_BUSY)
+		{
+			probes[i].result = probes[i].Update();
+			probes[i].time = HAL_GetTick() - initStart;
+		}
+
+		if ((probes[i].result == HAL_OK) && !probes[i].ready)
+		{
+			// Sensor can be started while the others are probed
+			probes[i].ready = true;
+			FS_SensorInit_Ready_Callback(i);
+		}
+
+		done = done && (probes[i].result != HAL_BUSY);
+	}
+
+	if (done)
+	{
+		// Blocking access is allowed again
+		FS_Sensor_Suspend();
+
+		initDone = true;
+		FS_SensorInit_Done_Callback();
+	}
+}
+
+void FS_SensorInit_LogTimes(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < PROBE_COUNT; ++i)
+	{
+		if (probes[i].result == HAL_OK)
+		{
+			FS_Log_WriteEvent("%lu ms to initialize %s", probes[i].time, probes[i].name);
+		}
+		else if (probes[i].result == HAL_ERROR)
+		{
+			FS_Log_WriteEvent("Couldn't initialize %s after %lu ms", probes[i].name, probes[i].time);
+		}
+	}
+}
+
+__weak void FS_SensorInit_Ready_Callback(FS_SensorInit_Sensor_t sensor)
+{
+  /* Prevent unused argument(s) compilation warning */
+  UNUSED(sensor);
+
+  /* NOTE: This function should not be modified, when the callback is needed,
+           the FS_SensorInit_Ready_Callback could be implemented in the user file
+   */
+}
+
+__weak void FS_SensorInit_Done_Callback(void)
+{
+  /* NOTE: This function should not be modified, when the callback is needed,
+           the FS_SensorInit_Done_Callback could be implemented in the user file
+   */
+}
@@ -0,0 +1,43 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2024 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#ifndef SENSOR_INIT_H_
+#define SENSOR_INIT_H_
+
+#include <stdbool.h>
+
+typedef enum
+{
+	FS_SENSOR_INIT_BARO,
+	FS_SENSOR_INIT_MAG,
+	FS_SENSOR_INIT_HUM
+} FS_SensorInit_Sensor_t;
+
+void FS_SensorInit_Begin(void);
+bool FS_SensorInit_IsDone(void);
+void FS_SensorInit_Notify(void);
+void FS_SensorInit_LogTimes(void);
+void FS_SensorInit_Ready_Callback(FS_SensorInit_Sensor_t sensor);
+void FS_SensorInit_Done_Callback(void);
+
+#endif /* SENSOR_INIT_H_ */
@@ -27,6 +27,7 @@
 #include "hum.h"
 #include "log.h"
 #include "sensor.h"
+#include "sensor_init.h"
 #include "sht4x.h"
 
 #define READ_TIMER_MSEC    10
@@ -47,6 +48,9 @@
 #define SHT4X_HEATER_20_MW_1000_MS   0x1e
 #define SHT4X_HEATER_20_MW_100_MS    0x15
 
+// Measurement period in ms for each ODR setting
+static const uint32_t humPeriod[] = {1000, 1000, 143, 80};
+
 static uint8_t buf[6];
 
 static FS_Hum_Data_t *humData;
@@ -56,6 +60,17 @@ static uint8_t read_timer_id;
 
 static volatile bool sensor_is_busy;
 
+typedef enum {
+	SHT4X_INIT_SERIAL = 0,
+	SHT4X_INIT_READ_SERIAL,
+	SHT4X_INIT_RESET
+} FS_SHT4X_InitStep_t;
+
+// Initialization state
+static FS_SHT4X_InitStep_t initStep;
+static volatile bool initBusy;
+static volatile HAL_StatusTypeDef initResult;
+
 static void FS_SHT4X_Measure(void);
 static void FS_SHT4X_Measure_Callback(HAL_StatusTypeDef result);
 static void FS_SHT4X_Read(void);
@@ -82,42 +97,91 @@ static uint8_t CRC8(const uint8_t *data, int length)
     return crc; // Final remainder is the CRC result
 }
 
-HAL_StatusTypeDef FS_SHT4X_Init(FS_Hum_Data_t *data)
+static void FS_SHT4X_Init_Callback(HAL_StatusTypeDef result)
 {
-	HAL_StatusTypeDef result;
+	initResult = result;
+	initBusy = false;
 
-	// Keep local pointer to humidity data
-	humData = data;
+	// Advance initialization state machine
+	FS_SensorInit_Notify();
+}
+
+static void FS_SHT4X_InitRequest(void)
+{
+	HAL_StatusTypeDef result = HAL_ERROR;
+
+	initBusy = true;
 
-	// Set up serial number read
-	buf[0] = SHT4X_READ_SERIAL_NUMBER;
-	if (FS_Sensor_Transmit(SHT4X_ADDR, buf, 1) != HAL_OK)
+	switch (initStep)
 	{
-		return HAL_ERROR;
+	case SHT4X_INIT_SERIAL:
+		buf[0] = SHT4X_READ_SERIAL_NUMBER;
+		result = FS_Sensor_TransmitAsync(SHT4X_ADDR, buf, 1, FS_SHT4X_Init_Callback);
+		break;
+	case SHT4X_INIT_READ_SERIAL:
+		result = FS_Sensor_ReceiveAsync(SHT4X_ADDR, buf, 6, FS_SHT4X_Init_Callback);
+		break;
+	case SHT4X_INIT_RESET:
+		buf[0] = SHT4X_SOFT_RESET;
+		result = FS_Sensor_TransmitAsync(SHT4X_ADDR, buf, 1, FS_SHT4X_Init_Callback);
+		break;
 	}
 
-	// Read serial number
-	if (FS_Sensor_Receive(SHT4X_ADDR, buf, 6) != HAL_OK)
+	if (result != HAL_OK)
 	{
-		return HAL_ERROR;
+		FS_SHT4X_Init_Callback(result);
 	}
+}
+
+void FS_SHT4X_Init(FS_Hum_Data_t *data)
+{
+	// Keep local pointer to humidity data
+	humData = data;
 
-	// Check serial number CRC
-	if ((CRC8(&buf[0], 2) != buf[2])
-			|| (CRC8(&buf[3], 2) != buf[5]))
+	initStep = SHT4X_INIT_SERIAL;
+	FS_SHT4X_InitRequest();
+}
+
+HAL_StatusTypeDef FS_SHT4X_InitUpdate(void)
+{
+	if (initBusy)
 	{
-		return HAL_ERROR;
+		return HAL_BUSY;
 	}
 
-	// Software reset
-	buf[0] = SHT4X_SOFT_RESET;
-	do
+	if (initResult != HAL_OK)
 	{
-		result = FS_Sensor_Transmit(SHT4X_ADDR, buf, 1);
+		// Device is not present
+		if (initStep != SHT4X_INIT_RESET)
+		{
+			return HAL_ERROR;
+		}
+
+		// Otherwise retry software reset
+		FS_SHT4X_InitRequest();
+		return HAL_BUSY;
 	}
-	while (result != HAL_OK);
 
-	return HAL_OK;
+	switch (initStep)
+	{
+	case SHT4X_INIT_SERIAL:
+		initStep = SHT4X_INIT_READ_SERIAL;
+		break;
+	case SHT4X_INIT_READ_SERIAL:
+		// Check serial number CRC
+		if ((CRC8(&buf[0], 2) != buf[2])
+				|| (CRC8(&buf[3], 2) != buf[5]))
+		{
+			return HAL_ERROR;
+		}
+		initStep = SHT4X_INIT_RESET;
+		break;
+	case SHT4X_INIT_RESET:
+		return HAL_OK;
+	}
+
+	FS_SHT4X_InitRequest();
+	return HAL_BUSY;
 }
 
 HAL_StatusTypeDef FS_SHT4X_Start(void)
@@ -127,6 +191,9 @@ HAL_StatusTypeDef FS_SHT4X_Start(void)
 	// Reset busy flag
 	sensor_is_busy = false;
 
+	// Each measurement must complete before the next one starts
+	FS_Sensor_Register(SHT4X_ADDR, FS_SENSOR_PRIORITY_LOW, humPeriod[config->hum_odr]);
+
 	// Create measurement timers
 	HW_TS_Create(CFG_TIM_PROC_ID_ISR, &measure_timer_id, hw_ts_Repeated, FS_SHT4X_Measure);
 	HW_TS_Create(CFG_TIM_PROC_ID_ISR, &read_timer_id, hw_ts_SingleShot, FS_SHT4X_Read);
@@ -158,6 +225,9 @@ HAL_StatusTypeDef FS_SHT4X_Stop(void)
 	HW_TS_Delete(measure_timer_id);
 	HW_TS_Delete(read_timer_id);
 
+	// Drop transfers not yet started
+	FS_Sensor_Cancel(SHT4X_ADDR);
+
 	return HAL_OK;
 }
 
@@ -26,7 +26,8 @@
 
 #include "hum.h"
 
-HAL_StatusTypeDef FS_SHT4X_Init(FS_Hum_Data_t *data);
+void FS_SHT4X_Init(FS_Hum_Data_t *data);
+HAL_StatusTypeDef FS_SHT4X_InitUpdate(void);
 HAL_StatusTypeDef FS_SHT4X_Start(void);
 HAL_StatusTypeDef FS_SHT4X_Stop(void);
 
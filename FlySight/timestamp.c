@@ -0,0 +1,252 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2024 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "main.h"
+#include "app_common.h"
+#include "stm32_seq.h"
+#include "timestamp.h"
+
+#define TS_FIT_COUNT  16		// time pulses in clock model
+#define TS_MAX_ERROR  1000		// maximum prediction error before model is reset (us)
+#define TS_HOLDOVER   600000	// maximum time since last pulse for conversion (ms)
+
+#define TS_WEEK_US    604800000000LL
+
+typedef struct
+{
+	uint32_t ms;			// local time (ms)
+	uint16_t us;			// local time (us past ms)
+	int64_t  gnss;			// GNSS time (us since start of week 0)
+} FS_Timestamp_Pulse_t;
+
+static FS_Timestamp_Pulse_t pulses[TS_FIT_COUNT];
+static uint32_t pulseCount;
+
+// Clock model relative to most recent pulse
+static FS_Timestamp_Pulse_t modelRef;
+static float modelOffset;		// us
+static float modelDrift;		// us/us
+
+static FS_Timestamp_Model_t model;
+
+void FS_Timestamp_Get(uint32_t *ms, uint16_t *us)
+{
+	uint32_t primask_bit;
+	uint32_t tick, load, val;
+
+	primask_bit = __get_PRIMASK();
+	__disable_irq();
+
+	tick = HAL_GetTick();
+	load = SysTick->LOAD;
+	val = SysTick->VAL;
+
+	// SysTick has wrapped but the tick has not been incremented yet
+	if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk)
+	{
+		val = SysTick->VAL;
+		++tick;
+	}
+
+	__set_PRIMASK(primask_bit);
+
+	*ms = tick;
+	*us = ((load - val) * 1000) / (load + 1);
+}
+
+void FS_Timestamp_Subtract(uint32_t *ms, uint16_t *us, uint32_t delta)
+{
+	// Borrow whole milliseconds as needed
+	const uint32_t borrow = (delta > *us) ? (delta - *us + 999) / 1000 : 0;
+
+	*ms -= borrow;
+	*us = *us + borrow * 1000 - delta;
+}
+
+static int32_t FS_Timestamp_Delta(uint32_t ms, uint16_t us, const FS_Timestamp_Pulse_t *ref)
+{
+	return (int32_t) (ms - ref->ms) * 1000 + ((int32_t) us - ref->us);
+}
+
+static void FS_Timestamp_Fit(void)
+{
+	FS_Timestamp_Pulse_t p[TS_FIT_COUNT], ref;
+	uint32_t count, n, i;
+	int32_t x[TS_FIT_COUNT], y[TS_FIT_COUNT], xm;
+	int64_t sx = 0, sy = 0, sxx = 0, sxy = 0, den;
+	float drift, offset, r, srr = 0;
+	uint32_t primask_bit;
+
+	// Take a snapshot of the time pulses
+	primask_bit = __get_PRIMASK();
+	__disable_irq();
+
+	count = pulseCount;
+	memcpy(p, pulses, sizeof(p));
+
+	__set_PRIMASK(primask_bit);
+
+	if (count == 0) return;
+
+	ref = p[(count - 1) % TS_FIT_COUNT];
+	n = MIN(count, TS_FIT_COUNT);
+
+	// Fit GNSS time minus local time against local time. Sums are
+	// taken over local time in ms so that pulses on either side of a
+	// holdover gap don't overflow them.
+	for (i = 0; i < n; ++i)
+	{
+		x[i] = FS_Timestamp_Delta(p[i].ms, p[i].us, &ref);
+		y[i] = (int32_t) (p[i].gnss - ref.gnss) - x[i];
+
+		xm = x[i] / 1000;
+		sx += xm;
+		sy += y[i];
+		sxx += (int64_t) xm * xm;
+		sxy += (int64_t) xm * y[i];
+	}
+
+	den = n * sxx - sx * sx;
+	drift = (den != 0) ? (float) (n * sxy - sx * sy) / den : 0;
+	offset = ((float) sy - drift * sx) / n;
+	drift /= 1000;
+
+	for (i = 0; i < n; ++i)
+	{
+		r = y[i] - (offset + drift * x[i]);
+		srr += r * r;
+	}
+
+	primask_bit = __get_PRIMASK();
+	__disable_irq();
+
+	// Discard the fit if pulses were added or reset in the meantime
+	if (count == pulseCount)
+	{
+		modelRef = ref;
+		modelOffset = offset;
+		modelDrift = drift;
+
+		model.valid = true;
+		model.count = n;
+		model.drift = lroundf(-drift * 1e9f);
+		model.residual = lroundf(sqrtf(srr / n) * 1000);
+	}
+
+	__set_PRIMASK(primask_bit);
+}
+
+static int64_t FS_Timestamp_Predict(uint32_t ms, uint16_t us)
+{
+	const int32_t dx = FS_Timestamp_Delta(ms, us, &modelRef);
+	return modelRef.gnss + dx + lroundf(modelOffset + modelDrift * dx);
+}
+
+void FS_Timestamp_Init(void)
+{
+	UTIL_SEQ_RegTask(1<<CFG_TASK_FS_TIMESTAMP_FIT_ID, UTIL_SEQ_RFU, FS_Timestamp_Fit);
+
+	FS_Timestamp_Reset();
+}
+
+void FS_Timestamp_Reset(void)
+{
+	uint32_t primask_bit;
+
+	primask_bit = __get_PRIMASK();
+	__disable_irq();
+
+	pulseCount = 0;
+	model.valid = false;
+	model.count = 0;
+
+	__set_PRIMASK(primask_bit);
+}
+
+void FS_Timestamp_Timepulse(uint32_t ms, uint16_t us, uint16_t week, uint32_t towMS, uint16_t towUs)
+{
+	FS_Timestamp_Pulse_t *pulse;
+	int64_t gnss, error;
+
+	gnss = week * TS_WEEK_US + towMS * 1000LL + towUs;
+
+	if (model.valid)
+	{
+		// Check prediction against the new pulse
+		error = gnss - FS_Timestamp_Predict(ms, us);
+		model.error = MAX(INT32_MIN, MIN(INT32_MAX, error * 1000));
+
+		if ((error > TS_MAX_ERROR) || (error < -TS_MAX_ERROR))
+		{
+			// Start over after a time step
+			FS_Timestamp_Reset();
+		}
+	}
+
+	pulse = &pulses[pulseCount % TS_FIT_COUNT];
+	pulse->ms = ms;
+	pulse->us = us;
+	pulse->gnss = gnss;
+	++pulseCount;
+
+	// Update the clock model outside of the interrupt
+	UTIL_SEQ_SetTask(1<<CFG_TASK_FS_TIMESTAMP_FIT_ID, CFG_SCH_PRIO_1);
+}
+
+bool FS_Timestamp_ToGNSS(uint32_t ms, uint16_t us, uint16_t *week, uint32_t *towMS, uint16_t *towUs)
+{
+	uint32_t primask_bit;
+	int64_t gnss;
+	bool valid;
+
+	primask_bit = __get_PRIMASK();
+	__disable_irq();
+
+	valid = model.valid &&
+			((int32_t) (ms - modelRef.ms) < TS_HOLDOVER) &&
+			((int32_t) (modelRef.ms - ms) < TS_HOLDOVER);
+	if (valid)
+	{
+		gnss = FS_Timestamp_Predict(ms, us);
+	}
+
+	__set_PRIMASK(primask_bit);
+
+	if (!valid) return false;
+
+	*week = gnss / TS_WEEK_US;
+	gnss %= TS_WEEK_US;
+	*towMS = gnss / 1000;
+	*towUs = gnss % 1000;
+
+	return true;
+}
+
+const FS_Timestamp_Model_t *FS_Timestamp_GetModel(void)
+{
+	return &model;
+}
@@ -0,0 +1,48 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2024 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#ifndef TIMESTAMP_H_
+#define TIMESTAMP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct
+{
+	bool     valid;			// true if model is fitted to time pulses
+	uint8_t  count;			// time pulses in fit
+	int32_t  drift;			// local clock rate error (ppb)
+	uint32_t residual;		// RMS fit residual (ns)
+	int32_t  error;			// last time pulse prediction error (ns)
+} FS_Timestamp_Model_t;
+
+void FS_Timestamp_Get(uint32_t *ms, uint16_t *us);
+void FS_Timestamp_Subtract(uint32_t *ms, uint16_t *us, uint32_t delta);
+
+void FS_Timestamp_Init(void);
+void FS_Timestamp_Reset(void);
+void FS_Timestamp_Timepulse(uint32_t ms, uint16_t us, uint16_t week, uint32_t towMS, uint16_t towUs);
+bool FS_Timestamp_ToGNSS(uint32_t ms, uint16_t us, uint16_t *week, uint32_t *towMS, uint16_t *towUs);
+const FS_Timestamp_Model_t *FS_Timestamp_GetModel(void);
+
+#endif /* TIMESTAMP_H_ */
@@ -21,14 +21,15 @@
 **  Website: http://flysight.ca/                                          **
 ****************************************************************************/
 
+#include <stdbool.h>
+
 #include "main.h"
 #include "app_common.h"
-#include "log.h"
-#include "stm32_seq.h"
+#include "adc.h"
 #include "vbat.h"
 
-#define VBAT_TIMER_MSEC     1000
-#define VBAT_TIMER_TICKS    (VBAT_TIMER_MSEC*1000/CFG_TS_TICK_VAL)
+#define VBAT_OUTPUT_MSEC     1000	// output period
+#define VBAT_SETTLE_BLOCKS   1		// ADC blocks discarded after enabling divider
 
 /* Value of analog reference voltage (Vref+), connected to analog voltage   */
 /* supply Vdda (unit: mV).                                                  */
@@ -55,67 +56,87 @@
 #define __ADC_CALC_DATA_VOLTAGE(__VREFANALOG_VOLTAGE__, __ADC_DATA__)       \
   ((__ADC_DATA__) * (__VREFANALOG_VOLTAGE__) / DIGITAL_SCALE_12BITS)
 
-static uint8_t vbat_timer_id;
-
-extern ADC_HandleTypeDef hadc1;
-
-static FS_VBAT_Data_t vbatData;
-
-// Error logging
-static volatile uint32_t vbat_error_code;
-
-void HAL_ADC_ErrorCallback(ADC_HandleTypeDef *hadc)
+typedef enum
 {
-	vbat_error_code = hadc->ErrorCode;
+	VBAT_IDLE,
+	VBAT_SETTLE,
+	VBAT_MEASURE
+} FS_VBAT_State_t;
 
-	// Check for a recoverable overrun error.
-	if (vbat_error_code & HAL_ADC_ERROR_OVR)
-	{
-		// This is non-fatal. We will log it and the timer will attempt another conversion.
-		FS_Log_WriteEventAsync("ADC non-fatal error: 0x%lX", vbat_error_code);
-	}
-	else
-	{
-		// Any other error (especially DMA or Internal) is critical and unrecoverable.
-		Error_Handler();
-	}
-}
+static volatile bool vbatActive = false;
 
-static void FS_VBAT_Timer(void)
-{
-	// Enable battery measurement
-	HAL_GPIO_WritePin(VBAT_EN_GPIO_Port, VBAT_EN_Pin, GPIO_PIN_SET);
+static FS_VBAT_State_t vbatState;
+static uint32_t vbatBlocks;
+static uint32_t vbatStart;
 
-	// Start ADC conversion
-    HAL_ADC_Start_IT(&hadc1);
-}
+static FS_VBAT_Data_t vbatData;
 
 void FS_VBAT_Init(void)
 {
-	// Initialize measurement timer
-	HW_TS_Create(CFG_TIM_PROC_ID_ISR, &vbat_timer_id, hw_ts_Repeated, FS_VBAT_Timer);
-	HW_TS_Start(vbat_timer_id, VBAT_TIMER_TICKS);
+	vbatState = VBAT_IDLE;
+	vbatStart = HAL_GetTick();
+
+	vbatActive = true;
 }
 
 void FS_VBAT_DeInit(void)
 {
-	// Delete timer
-	HW_TS_Delete(vbat_timer_id);
-}
-
+	vbatActive = false;
 
-void FS_VBAT_ConversionComplete(void)
-{
 	// Disable battery measurement
 	HAL_GPIO_WritePin(VBAT_EN_GPIO_Port, VBAT_EN_Pin, GPIO_PIN_RESET);
+}
+
+void FS_VBAT_ProcessBlock(const uint16_t *buf, uint32_t count)
+{
+	uint32_t i, now, sum;
 
-	// Get battery voltage
-	vbatData.time = HAL_GetTick();
-	uint16_t temp = HAL_ADC_GetValue(&hadc1);
-	vbatData.voltage = __ADC_CALC_DATA_VOLTAGE(VDDA_APPLI, temp * 2);
+	if (!vbatActive) return;
 
-	// Process this data
-	FS_VBAT_ValueReady_Callback();
+	now = HAL_GetTick();
+
+	switch (vbatState)
+	{
+	case VBAT_IDLE:
+		if (now - vbatStart >= VBAT_OUTPUT_MSEC)
+		{
+			// Enable battery measurement
+			HAL_GPIO_WritePin(VBAT_EN_GPIO_Port, VBAT_EN_Pin, GPIO_PIN_SET);
+
+			vbatStart = now;
+			vbatBlocks = 0;
+			vbatState = VBAT_SETTLE;
+		}
+		break;
+	case VBAT_SETTLE:
+		// Discard samples taken while the divider settles
+		if (++vbatBlocks >= VBAT_SETTLE_BLOCKS)
+		{
+			vbatState = VBAT_MEASURE;
+		}
+		break;
+	case VBAT_MEASURE:
+		// Average over one block
+		sum = 0;
+		for (i = 0; i < count; ++i)
+		{
+			sum += buf[i * FS_ADC_CHANNELS + FS_ADC_RANK_VBAT];
+		}
+
+		// Disable battery measurement
+		HAL_GPIO_WritePin(VBAT_EN_GPIO_Port, VBAT_EN_Pin, GPIO_PIN_RESET);
+
+		// Get battery voltage
+		vbatData.time = now;
+		vbatData.voltage = __ADC_CALC_DATA_VOLTAGE(VDDA_APPLI,
+				(sum * 2 + count / 2) / count);
+
+		vbatState = VBAT_IDLE;
+
+		// Process this data
+		FS_VBAT_ValueReady_Callback();
+		break;
+	}
 }
 
 const FS_VBAT_Data_t *FS_VBAT_GetData(void)
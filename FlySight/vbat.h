@@ -33,7 +33,7 @@ typedef struct
 void FS_VBAT_Init(void);
 void FS_VBAT_DeInit(void);
 
-void FS_VBAT_ConversionComplete(void);
+void FS_VBAT_ProcessBlock(const uint16_t *buf, uint32_t count);
 
 const FS_VBAT_Data_t *FS_VBAT_GetData(void);
 void FS_VBAT_ValueReady_Callback(void);
@@ -0,0 +1,326 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2024 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "main.h"
+#include "app_common.h"
+#include "wav.h"
+
+#define WAV_MIN_RATE  4000		// lowest supported sample rate (Hz)
+#define WAV_FMT_LEN   20		// bytes of fmt chunk used
+
+static const int8_t imaIndexTable[8] =
+{
+	-1, -1, -1, -1, 2, 4, 6, 8
+};
+
+static const int16_t imaStepTable[89] =
+{
+	    7,     8,     9,    10,    11,    12,    13,    14,
+	   16,    17,    19,    21,    23,    25,    28,    31,
+	   34,    37,    41,    45,    50,    55,    60,    66,
+	   73,    80,    88,    97,   107,   118,   130,   143,
+	  157,   173,   190,   209,   230,   253,   279,   307,
+	  337,   371,   408,   449,   494,   544,   598,   658,
+	  724,   796,   876,   963,  1060,  1166,  1282,  1411,
+	 1552,  1707,  1878,  2066,  2272,  2499,  2749,  3024,
+	 3327,  3660,  4026,  4428,  4871,  5358,  5894,  6484,
+	 7132,  7845,  8630,  9493, 10442, 11487, 12635, 13899,
+	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+	32767
+};
+
+static uint16_t FS_WAV_GetU16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t FS_WAV_GetU32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static bool FS_WAV_IsDirect(const FS_WAV_Decoder_t *dec)
+{
+	// Samples can be copied straight to the output
+	return (dec->format.formatTag == WAV_FORMAT_PCM)
+			&& (dec->format.sampleRate == WAV_OUTPUT_RATE);
+}
+
+static bool FS_WAV_ReadByte(FS_WAV_Decoder_t *dec, uint8_t *b)
+{
+	UINT br;
+
+	if (dec->bufPos == dec->bufLen)
+	{
+		if (dec->remaining == 0) return false;
+
+		if ((f_read(dec->file, dec->buf, MIN(dec->remaining, WAV_BUF_LEN), &br) != FR_OK)
+				|| (br == 0))
+		{
+			dec->remaining = 0;
+			return false;
+		}
+
+		dec->remaining -= br;
+		dec->bufLen = br;
+		dec->bufPos = 0;
+	}
+
+	*b = dec->buf[dec->bufPos++];
+	return true;
+}
+
+static int16_t FS_WAV_DecodeNibble(FS_WAV_Decoder_t *dec, uint8_t nibble)
+{
+	const int32_t step = imaStepTable[dec->stepIndex];
+	int32_t diff = step >> 3;
+
+	if (nibble & 4) diff += step;
+	if (nibble & 2) diff += step >> 1;
+	if (nibble & 1) diff += step >> 2;
+
+	if (nibble & 8) dec->predictor -= diff;
+	else            dec->predictor += diff;
+
+	dec->predictor = MAX(-32768, MIN(32767, dec->predictor));
+
+	dec->stepIndex += imaIndexTable[nibble & 7];
+	dec->stepIndex = MAX(0, MIN(88, dec->stepIndex));
+
+	return dec->predictor;
+}
+
+static bool FS_WAV_NextSample(FS_WAV_Decoder_t *dec, int16_t *sample)
+{
+	uint8_t b[4];
+	uint32_t i;
+
+	if (dec->framesLeft == 0) return false;
+
+	if (dec->format.formatTag == WAV_FORMAT_PCM)
+	{
+		if (!FS_WAV_ReadByte(dec, &b[0]) || !FS_WAV_ReadByte(dec, &b[1]))
+			return false;
+
+		*sample = (int16_t) FS_WAV_GetU16(b);
+	}
+	else if (dec->hasNibble)
+	{
+		// High nibble of previous byte
+		*sample = FS_WAV_DecodeNibble(dec, dec->nibbles >> 4);
+		dec->hasNibble = false;
+	}
+	else if (dec->blockLeft == 0)
+	{
+		// Block header holds the first sample
+		for (i = 0; i < 4; ++i)
+		{
+			if (!FS_WAV_ReadByte(dec, &b[i])) return false;
+		}
+
+		dec->predictor = (int16_t) FS_WAV_GetU16(b);
+		dec->stepIndex = MIN(b[2], 88);
+		dec->blockLeft = dec->format.blockAlign - 4;
+
+		*sample = dec->predictor;
+	}
+	else
+	{
+		// Low nibble first
+		if (!FS_WAV_ReadByte(dec, &dec->nibbles)) return false;
+		--dec->blockLeft;
+
+		*sample = FS_WAV_DecodeNibble(dec, dec->nibbles & 0x0f);
+		dec->hasNibble = true;
+	}
+
+	--dec->framesLeft;
+	return true;
+}
+
+static bool FS_WAV_Validate(FS_WAV_Format_t *fmt)
+{
+	if (fmt->channels != 1) return false;
+	if (fmt->sampleRate < WAV_MIN_RATE || fmt->sampleRate > WAV_OUTPUT_RATE) return false;
+
+	switch (fmt->formatTag)
+	{
+	case WAV_FORMAT_PCM:
+		return (fmt->bitsPerSample == 16) && (fmt->blockAlign == 2);
+	case WAV_FORMAT_IMA:
+		if ((fmt->bitsPerSample != 4) || (fmt->blockAlign <= 4)) return false;
+		if (fmt->samplesPerBlock == 0)
+		{
+			fmt->samplesPerBlock = (fmt->blockAlign - 4) * 2 + 1;
+		}
+		return fmt->samplesPerBlock == (fmt->blockAlign - 4) * 2 + 1;
+	default:
+		return false;
+	}
+}
+
+bool FS_WAV_Open(FS_WAV_Decoder_t *dec, FIL *file)
+{
+	FS_WAV_Format_t *fmt = &dec->format;
+	uint8_t hdr[WAV_FMT_LEN];
+	FSIZE_t pos = f_tell(file), end;
+	uint32_t size, len, rem;
+	uint32_t factFrames = 0;
+	bool hasFmt = false;
+	UINT br;
+
+	memset(fmt, 0, sizeof(*fmt));
+	dec->file = file;
+
+	// RIFF header
+	if ((f_read(file, hdr, 12, &br) != FR_OK) || (br != 12)) return false;
+	if (memcmp(hdr, "RIFF", 4) || memcmp(hdr + 8, "WAVE", 4)) return false;
+
+	end = pos + 8 + FS_WAV_GetU32(hdr + 4);
+	pos += 12;
+
+	// Walk chunks until the data chunk
+	while (pos + 8 <= end)
+	{
+		if (f_lseek(file, pos) != FR_OK) return false;
+		if ((f_read(file, hdr, 8, &br) != FR_OK) || (br != 8)) return false;
+
+		size = FS_WAV_GetU32(hdr + 4);
+
+		if (!memcmp(hdr, "fmt ", 4))
+		{
+			len = MIN(size, WAV_FMT_LEN);
+			if (len < 16) return false;
+			if ((f_read(file, hdr, len, &br) != FR_OK) || (br != len)) return false;
+
+			fmt->formatTag = FS_WAV_GetU16(hdr);
+			fmt->channels = FS_WAV_GetU16(hdr + 2);
+			fmt->sampleRate = FS_WAV_GetU32(hdr + 4);
+			fmt->blockAlign = FS_WAV_GetU16(hdr + 12);
+			fmt->bitsPerSample = FS_WAV_GetU16(hdr + 14);
+			if (len >= 20)
+			{
+				fmt->samplesPerBlock = FS_WAV_GetU16(hdr + 18);
+			}
+
+			hasFmt = true;
+		}
+		else if (!memcmp(hdr, "fact", 4) && (size >= 4))
+		{
+			if ((f_read(file, hdr, 4, &br) != FR_OK) || (br != 4)) return false;
+			factFrames = FS_WAV_GetU32(hdr);
+		}
+		else if (!memcmp(hdr, "data", 4))
+		{
+			if (!hasFmt || !FS_WAV_Validate(fmt)) return false;
+
+			// Tolerate a data chunk running past the RIFF size
+			fmt->dataLength = MIN(size, end - pos - 8);
+
+			if (fmt->formatTag == WAV_FORMAT_PCM)
+			{
+				fmt->frames = fmt->dataLength / 2;
+			}
+			else
+			{
+				rem = fmt->dataLength % fmt->blockAlign;
+				fmt->frames = (fmt->dataLength / fmt->blockAlign) * fmt->samplesPerBlock
+						+ ((rem >= 4) ? (rem - 4) * 2 + 1 : 0);
+				if (factFrames > 0)
+				{
+					fmt->frames = MIN(fmt->frames, factFrames);
+				}
+			}
+
+			// Initialize decoder at start of samples
+			dec->bufPos = 0;
+			dec->bufLen = 0;
+			dec->remaining = fmt->dataLength;
+			dec->framesLeft = fmt->frames;
+			dec->blockLeft = 0;
+			dec->hasNibble = false;
+
+			dec->step = ((uint64_t) fmt->sampleRate << 16) / WAV_OUTPUT_RATE;
+			dec->phase = 0;
+
+			if (!FS_WAV_IsDirect(dec))
+			{
+				// Prime resampler
+				if (!FS_WAV_NextSample(dec, &dec->s0)) dec->s0 = 0;
+				if (!FS_WAV_NextSample(dec, &dec->s1)) dec->s1 = dec->s0;
+			}
+
+			return true;
+		}
+
+		// Chunks are padded to an even length
+		pos += 8 + size + (size & 1);
+	}
+
+	return false;
+}
+
+uint32_t FS_WAV_GetLength(const FS_WAV_Decoder_t *dec)
+{
+	const FS_WAV_Format_t *fmt = &dec->format;
+
+	// Output samples at WAV_OUTPUT_RATE
+	return ((uint64_t) fmt->frames * WAV_OUTPUT_RATE + fmt->sampleRate - 1) / fmt->sampleRate;
+}
+
+uint32_t FS_WAV_Read(FS_WAV_Decoder_t *dec, int16_t *dst, uint32_t count)
+{
+	uint32_t i;
+	UINT br;
+
+	if (FS_WAV_IsDirect(dec))
+	{
+		// Read samples straight into output
+		if (f_read(dec->file, dst, MIN(count * sizeof(int16_t), dec->remaining), &br) != FR_OK)
+			return 0;
+
+		dec->remaining -= br;
+		return br / sizeof(int16_t);
+	}
+
+	for (i = 0; i < count; ++i)
+	{
+		// Interpolate between neighbouring source samples
+		dst[i] = dec->s0 + (((int32_t) (dec->s1 - dec->s0) * (int32_t) (dec->phase >> 1)) >> 15);
+
+		dec->phase += dec->step;
+		while (dec->phase >= 0x10000)
+		{
+			dec->phase -= 0x10000;
+			dec->s0 = dec->s1;
+
+			// Hold the last sample at the end of the clip
+			FS_WAV_NextSample(dec, &dec->s1);
+		}
+	}
+
+	return count;
+}
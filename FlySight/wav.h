@@ -0,0 +1,79 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2024 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#ifndef WAV_H_
+#define WAV_H_
+
+#include <stdbool.h>
+
+#include "ff.h"
+
+#define WAV_OUTPUT_RATE 24000	// output sample rate (Hz)
+#define WAV_BUF_LEN     256		// bytes read from file at a time
+
+#define WAV_FORMAT_PCM     0x0001
+#define WAV_FORMAT_IMA     0x0011
+
+typedef struct
+{
+	uint16_t formatTag;			// WAV_FORMAT_PCM or WAV_FORMAT_IMA
+	uint16_t channels;
+	uint32_t sampleRate;		// Hz
+	uint16_t blockAlign;		// bytes per block
+	uint16_t bitsPerSample;
+	uint16_t samplesPerBlock;	// IMA-ADPCM only
+	uint32_t dataLength;		// bytes
+	uint32_t frames;			// source samples
+} FS_WAV_Format_t;
+
+typedef struct
+{
+	FIL     *file;
+	FS_WAV_Format_t format;
+
+	// Source data
+	uint8_t  buf[WAV_BUF_LEN];
+	uint32_t bufPos;
+	uint32_t bufLen;
+	uint32_t remaining;			// bytes of data not yet read from file
+	uint32_t framesLeft;		// source samples not yet decoded
+
+	// IMA-ADPCM state
+	int32_t  predictor;
+	int32_t  stepIndex;
+	uint32_t blockLeft;			// bytes left in current block
+	uint8_t  nibbles;			// byte holding the next high nibble
+	bool     hasNibble;
+
+	// Linear resampler
+	uint32_t step;				// source samples per output sample (16.16)
+	uint32_t phase;				// position between s0 and s1 (16.16)
+	int16_t  s0;
+	int16_t  s1;
+} FS_WAV_Decoder_t;
+
+bool FS_WAV_Open(FS_WAV_Decoder_t *dec, FIL *file);
+uint32_t FS_WAV_GetLength(const FS_WAV_Decoder_t *dec);
+uint32_t FS_WAV_Read(FS_WAV_Decoder_t *dec, int16_t *dst, uint32_t count);
+
+#endif /* WAV_H_ */
@@ -511,7 +511,8 @@ SVCCTL_UserEvtFlowStatus_t SVCCTL_App_Notification(void *p_Pckt)
 #endif /* CFG_DEBUG_APP_TRACE != 0 */
 
           /* USER CODE BEGIN EVT_LE_CONN_UPDATE_COMPLETE */
-
+          Custom_APP_ConnIntervalNotification(
+              ((hci_le_connection_update_complete_event_rp0 *) p_meta_evt->data)->Conn_Interval);
           /* USER CODE END EVT_LE_CONN_UPDATE_COMPLETE */
           break;
 
@@ -554,6 +555,8 @@ SVCCTL_UserEvtFlowStatus_t SVCCTL_App_Notification(void *p_Pckt)
           HandleNotification.ConnectionHandle = BleApplicationContext.BleApplicationContext_legacy.connectionHandle;
           Custom_APP_Notification(&HandleNotification);
           /* USER CODE BEGIN HCI_LE_ENHANCED_CONNECTION_COMPLETE_SUBEVT_CODE */
+          Custom_APP_ConnIntervalNotification(p_enhanced_connection_complete_event->Conn_Interval);
+
           /* Stop the timer */
           HW_TS_Stop(BleApplicationContext.Advertising_mgr_timer_Id);
 
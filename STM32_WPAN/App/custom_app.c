@@ -30,6 +30,7 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include "crs.h"
+#include "log.h"
 #include "start_control.h"
 /* USER CODE END Includes */
 
@@ -56,7 +57,7 @@ typedef struct
 
 /* Private defines ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
-
+#define CRS_TX_QUEUE_LENGTH FS_CRS_WINDOW_MAX
 /* USER CODE END PD */
 
 /* Private macros -------------------------------------------------------------*/
@@ -80,9 +81,12 @@ uint8_t UpdateCharData[247];
 uint8_t NotifyCharData[247];
 
 /* USER CODE BEGIN PV */
-static Custom_CRS_Packet_t tx_buffer[FS_CRS_WINDOW_LENGTH+1];
+static Custom_CRS_Packet_t tx_buffer[CRS_TX_QUEUE_LENGTH+1];
 static uint32_t tx_read_index, tx_write_index;
 
+static Custom_CRS_Stats_t crs_stats;
+static uint32_t crs_first_tick;
+
 static Custom_CRS_Packet_t rx_buffer[FS_CRS_WINDOW_LENGTH+1];
 static uint32_t rx_read_index, rx_write_index;
 
@@ -123,6 +127,7 @@ static void Custom_GNSS_Transmit(void);
 static void Custom_Start_OnControlWrite(Custom_STM_App_Notification_evt_t *pNotification);
 static void Custom_Start_Transmit(void);
 static void Custom_App_Timeout(void);
+static void Custom_CRS_LogStats(void);
 /* USER CODE END PFP */
 
 /* Functions Definition ------------------------------------------------------*/
@@ -305,6 +310,11 @@ void Custom_APP_TxPoolAvailableNotification(void)
   UTIL_SEQ_SetTask(1<<CFG_TASK_CUSTOM_CRS_TRANSMIT_ID, CFG_SCH_PRIO_1);
 }
 
+void Custom_APP_ConnIntervalNotification(uint16_t interval)
+{
+  crs_stats.conn_interval = interval;
+}
+
 uint8_t Custom_APP_IsConnected(void)
 {
   return connected_flag;
@@ -489,6 +499,9 @@ static void Custom_CRS_OnConnect(Custom_App_ConnHandle_Not_evt_t *pNotification)
   start_read_index = 0;
   start_write_index = 0;
 
+  // Reset statistics, keeping the interval reported with the connection
+  crs_stats = (Custom_CRS_Stats_t) { .conn_interval = crs_stats.conn_interval };
+
   // Update state
   connected_flag = 1;
 
@@ -507,6 +520,8 @@ static void Custom_CRS_OnDisconnect(void)
   // Update state
   connected_flag = 0;
 
+  Custom_CRS_LogStats();
+
   // Call update task
   UTIL_SEQ_SetTask(1<<CFG_TASK_FS_CRS_UPDATE_ID, CFG_SCH_PRIO_1);
 }
@@ -538,42 +553,72 @@ static void Custom_CRS_Transmit(void)
   static uint8_t tx_busy = 0;
   Custom_CRS_Packet_t *packet;
   tBleStatus status;
+  uint32_t start = tx_read_index;
+  uint32_t burst = 0;
+  uint32_t now;
+
+  if (tx_busy) return;
+
+  tx_busy = 1;
 
-  if (!tx_busy
-      && (tx_read_index < tx_write_index)
+  // Fill the stack's TX pool until it reports full
+  while ((tx_read_index < tx_write_index)
       && Custom_App_Context.Crs_tx_Notification_Status
       && Custom_App_Context.Crs_tx_Flow_Status)
   {
-    tx_busy = 1;
-
-	packet = &tx_buffer[tx_read_index % FS_CRS_WINDOW_LENGTH];
+	packet = &tx_buffer[tx_read_index % CRS_TX_QUEUE_LENGTH];
 	SizeCrs_Tx = packet->length;
 
 	status = Custom_STM_App_Update_Char(CUSTOM_STM_CRS_TX, packet->data);
 	if (status == BLE_STATUS_INSUFFICIENT_RESOURCES)
 	{
+      // Resume on ACI_GATT_TX_POOL_AVAILABLE_VSEVT_CODE
       Custom_App_Context.Crs_tx_Flow_Status = 0;
+      ++crs_stats.pool_full;
 	}
 	else
 	{
-      ++tx_read_index;
+      if (status == BLE_STATUS_SUCCESS)
+      {
+        crs_stats.bytes += packet->length;
+        ++burst;
+      }
 
-      // Call update task and transmit next packet
-      UTIL_SEQ_SetTask(1<<CFG_TASK_FS_CRS_UPDATE_ID, CFG_SCH_PRIO_1);
-      UTIL_SEQ_SetTask(1<<CFG_TASK_CUSTOM_CRS_TRANSMIT_ID, CFG_SCH_PRIO_1);
+      ++tx_read_index;
 	}
+  }
+
+  if (burst)
+  {
+    now = HAL_GetTick();
+
+    if (crs_stats.notifications == 0)
+    {
+      crs_first_tick = now;
+    }
 
-    tx_busy = 0;
+    crs_stats.notifications += burst;
+    crs_stats.elapsed = now - crs_first_tick;
+    crs_stats.max_burst = MAX(crs_stats.max_burst, burst);
+    ++crs_stats.bursts;
+  }
+
+  if (tx_read_index != start)
+  {
+    // Call update task to refill the queue
+    UTIL_SEQ_SetTask(1<<CFG_TASK_FS_CRS_UPDATE_ID, CFG_SCH_PRIO_1);
   }
+
+  tx_busy = 0;
 }
 
 Custom_CRS_Packet_t *Custom_CRS_GetNextTxPacket(void)
 {
   Custom_CRS_Packet_t *ret = 0;
 
-  if (tx_write_index < tx_read_index + FS_CRS_WINDOW_LENGTH)
+  if (tx_write_index < tx_read_index + CRS_TX_QUEUE_LENGTH)
   {
-	ret = &tx_buffer[tx_write_index % FS_CRS_WINDOW_LENGTH];
+	ret = &tx_buffer[tx_write_index % CRS_TX_QUEUE_LENGTH];
   }
 
   return ret;
@@ -581,7 +626,7 @@ Custom_CRS_Packet_t *Custom_CRS_GetNextTxPacket(void)
 
 void Custom_CRS_SendNextTxPacket(void)
 {
-  if (tx_write_index < tx_read_index + FS_CRS_WINDOW_LENGTH)
+  if (tx_write_index < tx_read_index + CRS_TX_QUEUE_LENGTH)
   {
     ++tx_write_index;
     UTIL_SEQ_SetTask(1<<CFG_TASK_CUSTOM_CRS_TRANSMIT_ID, CFG_SCH_PRIO_1);
@@ -604,6 +649,31 @@ Custom_CRS_Packet_t *Custom_CRS_GetNextRxPacket(void)
   return ret;
 }
 
+void Custom_CRS_GetStats(Custom_CRS_Stats_t *stats)
+{
+  *stats = crs_stats;
+}
+
+static void Custom_CRS_LogStats(void)
+{
+  uint32_t per_event = 0, rate = 0;
+
+  if (crs_stats.notifications == 0) return;
+
+  if (crs_stats.elapsed)
+  {
+    // Notifications per connection event (x100) and bytes per second
+    per_event = (uint64_t) crs_stats.notifications * crs_stats.conn_interval * 125 / crs_stats.elapsed;
+    rate = (uint64_t) crs_stats.bytes * 1000 / crs_stats.elapsed;
+  }
+
+  FS_Log_WriteEvent("CRS: %lu notifications, %lu bytes in %lu ms",
+      crs_stats.notifications, crs_stats.bytes, crs_stats.elapsed);
+  FS_Log_WriteEvent("CRS: %lu.%02lu per connection event, %lu B/s, %lu bursts (max %lu), pool full %lu",
+      per_event / 100, per_event % 100, rate,
+      crs_stats.bursts, crs_stats.max_burst, crs_stats.pool_full);
+}
+
 static void Custom_GNSS_Transmit(void)
 {
   Custom_STM_App_Update_Char(CUSTOM_STM_GNSS_PV, gnss_pv_packet);
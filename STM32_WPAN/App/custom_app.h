@@ -57,6 +57,17 @@ typedef struct
   uint8_t data[1];
   uint8_t length;
 } Custom_Start_Packet_t;
+
+typedef struct
+{
+  uint32_t notifications;  // CRS notifications accepted by the stack
+  uint32_t bytes;          // bytes in those notifications
+  uint32_t bursts;         // transmit passes sending at least one notification
+  uint32_t max_burst;      // most notifications sent in one pass
+  uint32_t pool_full;      // times the stack TX pool was exhausted
+  uint32_t elapsed;        // ms from first to last notification
+  uint16_t conn_interval;  // connection interval (1.25 ms units)
+} Custom_CRS_Stats_t;
 /* USER CODE END ET */
 
 /* Exported constants --------------------------------------------------------*/
@@ -79,11 +90,13 @@ void Custom_APP_Init(void);
 void Custom_APP_Notification(Custom_App_ConnHandle_Not_evt_t *pNotification);
 /* USER CODE BEGIN EF */
 void Custom_APP_TxPoolAvailableNotification(void);
+void Custom_APP_ConnIntervalNotification(uint16_t interval);
 uint8_t Custom_APP_IsConnected(void);
 
 Custom_CRS_Packet_t *Custom_CRS_GetNextTxPacket(void);
 void Custom_CRS_SendNextTxPacket(void);
 Custom_CRS_Packet_t *Custom_CRS_GetNextRxPacket(void);
+void Custom_CRS_GetStats(Custom_CRS_Stats_t *stats);
 
 void Custom_GNSS_Update(const FS_GNSS_Data_t *current);
 
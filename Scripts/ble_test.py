@@ -27,6 +27,7 @@ ble_adapter = None
 
 # Flow control parameters
 WINDOW_LENGTH = 8
+SACK_LENGTH = 32        # Must match FS_CRS_WINDOW_MAX in crs.h
 FRAME_LENGTH = 242
 TX_TIMEOUT = 1
 RX_TIMEOUT = 1
@@ -139,6 +140,78 @@ async def read_file(address, offset, stride, remote_filename, local_filename, te
             with open(local_filename, "wb") as f:
                 f.write(file_data)
 
+async def read_file_sack(address, offset, stride, remote_filename, local_filename, test_mode=False):
+    with tqdm(desc="Receiving Bytes", unit="B", unit_scale=True) as pbar:
+        async with BleakClient(address, adapter=ble_adapter) as client:
+            file_data = bytearray()
+            transfer_complete = asyncio.Event()
+            packet_received = asyncio.Event()
+            fallback = asyncio.Event()
+            next_packet_num = 0
+            last_packet_num = -1
+            pending = {}  # Packets received beyond a gap, by full packet number
+
+            async def file_notification_handler(sender, data):
+                nonlocal file_data, next_packet_num, last_packet_num
+                if data[0] == 0xf0 and data[1:2] == b'\x06':
+                    # Selective repeat not supported, or file not found
+                    fallback.set()
+                    packet_received.set()
+                elif data[0] == 0x10:
+                    if test_mode and random.random() < 0.3:
+                        return
+
+                    # Recover full packet number
+                    delta = (data[1] - next_packet_num) & 0xff
+                    if delta < SACK_LENGTH + 1:
+                        packet_num = next_packet_num + delta
+                        pending[packet_num] = bytes(data[2:])
+                        if len(data) == 2:
+                            last_packet_num = packet_num + 1
+
+                    # Deliver in order
+                    while next_packet_num in pending:
+                        chunk = pending.pop(next_packet_num)
+                        file_data.extend(chunk)
+                        pbar.update(len(chunk))
+                        next_packet_num += 1
+
+                    # Acknowledge next expected packet and those received beyond it
+                    bitmap = 0
+                    for packet_num in pending:
+                        bitmap |= 1 << (packet_num - next_packet_num - 1)
+                    ack_packet = b'\x12' + (next_packet_num & 0xff).to_bytes(1, byteorder='little') + bitmap.to_bytes(4, byteorder='little')
+                    await client.write_gatt_char(CRS_RX_UUID, ack_packet, response=False)
+                    packet_received.set()
+
+                    if next_packet_num == last_packet_num:
+                        transfer_complete.set()
+
+            await client.pair(protection_level=2)
+            await client.start_notify(CRS_TX_UUID, file_notification_handler)
+            offset_bytes = offset.to_bytes(4, byteorder='little')
+            stride_bytes = stride.to_bytes(4, byteorder='little')
+            await client.write_gatt_char(CRS_RX_UUID, b'\x06' + offset_bytes + stride_bytes + remote_filename.encode(), response=False)
+
+            try:
+                while not transfer_complete.is_set():
+                    packet_received.clear()
+                    await asyncio.wait_for(packet_received.wait(), RX_TIMEOUT)  # timeout for each packet
+                    if fallback.is_set():
+                        await client.stop_notify(CRS_TX_UUID)
+                        return False
+            except asyncio.TimeoutError:
+                print(f"Timeout: No data received for {RX_TIMEOUT} seconds.")
+                return True
+
+            await client.stop_notify(CRS_TX_UUID)
+
+            # Process or save the file data
+            with open(local_filename, "wb") as f:
+                f.write(file_data)
+
+            return True
+
 def get_attrib_text(fattrib):
     descriptions = []
     for bit in attrib_description:
@@ -231,6 +304,7 @@ def main():
     parser.add_argument('--create', type=str, metavar='FILE_NAME', help='Create a new file on the device with the specified name.')
     parser.add_argument('--delete', type=str, metavar='FILE_NAME', help='Delete the specified file from the device.')
     parser.add_argument('--mkdir', type=str, metavar='DIRECTORY_NAME', help='Create a new directory on the device with the specified name.')
+    parser.add_argument('--sack', action='store_true', help='Read using selective repeat, falling back to go-back-N if unsupported')
     parser.add_argument('--test-mode', action='store_true', help='Enable test mode with packet dropping')
     parser.add_argument('--gnss', action='store_true', help='Display live GNSS data')
     args = parser.parse_args()
@@ -242,7 +316,8 @@ def main():
     elif args.address and args.read:
         offset, stride, remote_filename, *local_filename = args.read
         local_filename = local_filename[0] if local_filename else os.path.basename(remote_filename)
-        asyncio.run(read_file(args.address, int(offset), int(stride), remote_filename, local_filename, args.test_mode))
+        if not (args.sack and asyncio.run(read_file_sack(args.address, int(offset), int(stride), remote_filename, local_filename, args.test_mode))):
+            asyncio.run(read_file(args.address, int(offset), int(stride), remote_filename, local_filename, args.test_mode))
     elif args.address and args.write:
         local_filename, remote_filename = args.write
         asyncio.run(write_file(args.address, local_filename, remote_filename))
@@ -0,0 +1,84 @@
+import os
+import argparse
+from struct import pack, unpack_from
+
+# Speech pack format
+PACK_MAGIC = b'FSPK'
+PACK_VERSION = 2
+PACK_MAX = 128          # Must match AUDIO_PACK_MAX in audio.c
+NAME_LENGTH = 12        # 8.3 file name
+
+# Audio formats accepted by the firmware (see wav.c)
+FORMAT_PCM = 0x0001
+FORMAT_IMA = 0x0011
+MIN_RATE = 4000
+MAX_RATE = 24000
+
+HEADER_SIZE = 8
+ENTRY_SIZE = NAME_LENGTH + 8
+
+def read_clip(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    if data[0:4] != b'RIFF' or data[8:12] != b'WAVE':
+        raise ValueError(f'{path}: not a WAV file')
+
+    # Walk chunks looking for the format
+    pos = 12
+    while pos + 8 <= len(data):
+        chunk_id, size = data[pos:pos + 4], unpack_from('<I', data, pos + 4)[0]
+        if chunk_id == b'fmt ':
+            tag, channels, rate = unpack_from('<HHI', data, pos + 8)
+            bits = unpack_from('<H', data, pos + 22)[0]
+            if (channels != 1 or not MIN_RATE <= rate <= MAX_RATE or
+                    (tag, bits) not in ((FORMAT_PCM, 16), (FORMAT_IMA, 4))):
+                raise ValueError(f'{path}: expected 16-bit PCM or 4-bit IMA-ADPCM mono, {MIN_RATE}-{MAX_RATE} Hz')
+            return data
+        pos += 8 + size + (size & 1)
+
+    raise ValueError(f'{path}: no format chunk')
+
+def build_pack(input_dir, output_file):
+    names = sorted((name for name in os.listdir(input_dir)
+                    if name.lower().endswith('.wav')), key=str.lower)
+
+    if len(names) > PACK_MAX:
+        raise ValueError(f'{len(names)} clips found, at most {PACK_MAX} allowed')
+
+    clips = []
+    for name in names:
+        stem, ext = os.path.splitext(name)
+        if len(stem) > 8 or len(ext) > 4:
+            raise ValueError(f'{name}: not an 8.3 file name')
+        clips.append((name.lower(), read_clip(os.path.join(input_dir, name))))
+
+    # WAV files are stored verbatim after the header and index
+    offset = HEADER_SIZE + ENTRY_SIZE * len(clips)
+
+    with open(output_file, 'wb') as f:
+        f.write(PACK_MAGIC + pack('<HH', PACK_VERSION, len(clips)))
+
+        for name, data in clips:
+            f.write(name.encode('ascii').ljust(NAME_LENGTH, b'\0'))
+            f.write(pack('<II', offset, len(data)))
+            offset += len(data)
+
+        for name, data in clips:
+            f.write(data)
+
+    for name, data in clips:
+        print(f'{name:12} {len(data)} bytes')
+    print(f'{len(clips)} clips written to {output_file}')
+
+def main():
+    parser = argparse.ArgumentParser(description="Build a FlySight speech pack from WAV files")
+
+    parser.add_argument('input_dir', metavar='AUDIO_DIR', help='Directory containing the WAV files (e.g. the SD card /audio folder).')
+    parser.add_argument('output_file', nargs='?', default='speech.pak', metavar='PACK_FILE', help='Output pack file, copied to /audio/speech.pak on the SD card.')
+    args = parser.parse_args()
+
+    build_pack(args.input_dir, args.output_file)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,414 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "main.h"
+#include "host.h"
+#include "log.h"
+#include "stm32_seq.h"
+
+#define HOST_TASK_COUNT   32
+#define HOST_TIMER_COUNT  CFG_HW_TS_MAX_NBR_CONCURRENT_TIMER
+#define HOST_EVENT_LEN    256
+#define HOST_EVENT_COUNT  64
+
+DWT_Type       host_dwt;
+CoreDebug_Type host_core_debug;
+SysTick_Type   host_systick = {63999, 63999};
+SCB_Type       host_scb;
+
+GPIO_TypeDef   host_gpioa, host_gpiob, host_gpioc, host_gpiod;
+
+RNG_HandleTypeDef hrng;
+
+static uint32_t checkCount;
+static uint32_t failCount;
+
+static uint64_t timeUs;
+static uint32_t tickStep;
+
+static void (*taskBuf[HOST_TASK_COUNT])(void);
+static uint32_t taskPending;
+static uint32_t taskPaused;
+
+static struct
+{
+	bool             used;
+	bool             running;
+	HW_TS_Mode_t     mode;
+	HW_TS_pTimerCb_t callback;
+	uint32_t         period;
+	uint64_t         deadline;
+} timerBuf[HOST_TIMER_COUNT];
+
+static bool     verbose;
+static char     eventBuf[HOST_EVENT_COUNT][HOST_EVENT_LEN];
+static uint32_t eventCount;
+
+void Host_Check(bool cond, const char *file, int line, const char *format, ...)
+{
+	va_list args;
+
+	++checkCount;
+	if (cond) return;
+
+	++failCount;
+	fprintf(stderr, "%s:%d: FAIL: ", file, line);
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fputc('\n', stderr);
+}
+
+int Host_Finish(const char *name)
+{
+	printf("%s: %u/%u checks passed\n", name,
+			(unsigned) (checkCount - failCount), (unsigned) checkCount);
+	return (failCount == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void Host_SetClock(uint64_t us)
+{
+	// SysTick counts down once per millisecond at 64 MHz
+	timeUs = us;
+	host_systick.VAL = host_systick.LOAD -
+			(uint32_t) ((timeUs % 1000) * (host_systick.LOAD + 1) / 1000);
+}
+
+void Host_SetTime(uint64_t us)
+{
+	Host_SetClock(us);
+}
+
+uint64_t Host_GetTime(void)
+{
+	return timeUs;
+}
+
+void Host_Advance(uint64_t us)
+{
+	const uint64_t end = timeUs + us;
+	uint64_t next;
+	uint32_t i, n;
+
+	for (;;)
+	{
+		// Find the next timer to expire
+		next = end;
+		n = HOST_TIMER_COUNT;
+		for (i = 0; i < HOST_TIMER_COUNT; ++i)
+		{
+			if (timerBuf[i].running && (timerBuf[i].deadline <= next))
+			{
+				next = timerBuf[i].deadline;
+				n = i;
+			}
+		}
+
+		if (n == HOST_TIMER_COUNT) break;
+
+		Host_SetClock(MAX(timeUs, next));
+		if (timerBuf[n].mode == hw_ts_Repeated)
+		{
+			timerBuf[n].deadline += timerBuf[n].period;
+		}
+		else
+		{
+			timerBuf[n].running = false;
+		}
+		timerBuf[n].callback();
+		Host_RunTasks();
+	}
+
+	Host_SetClock(end);
+	Host_RunTasks();
+}
+
+void Host_RunTasks(void)
+{
+	uint32_t ready, i;
+
+	while ((ready = taskPending & ~taskPaused) != 0)
+	{
+		for (i = 0; i < HOST_TASK_COUNT; ++i)
+		{
+			if (ready & (1UL << i))
+			{
+				taskPending &= ~(1UL << i);
+				if (taskBuf[i]) taskBuf[i]();
+			}
+		}
+	}
+}
+
+bool Host_TaskPending(uint32_t id)
+{
+	return (taskPending & (1UL << id)) != 0;
+}
+
+void Host_SetVerbose(bool enable)
+{
+	verbose = enable;
+}
+
+uint32_t Host_EventCount(void)
+{
+	return eventCount;
+}
+
+const char *Host_LastEvent(void)
+{
+	return eventCount ? eventBuf[(eventCount - 1) % HOST_EVENT_COUNT] : "";
+}
+
+const char *Host_MatchEvent(const char *text)
+{
+	uint32_t i;
+
+	for (i = 0; i < MIN(eventCount, HOST_EVENT_COUNT); ++i)
+	{
+		if (strstr(eventBuf[i], text)) return eventBuf[i];
+	}
+
+	return NULL;
+}
+
+bool Host_FindEvent(const char *text)
+{
+	return Host_MatchEvent(text) != NULL;
+}
+
+void Host_ClearEvents(void)
+{
+	eventCount = 0;
+}
+
+uint64_t Host_Nanoseconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+DWT_Type *Host_DWT(void)
+{
+	host_dwt.CYCCNT = (uint32_t) (Host_Nanoseconds() * 64 / 1000);
+	return &host_dwt;
+}
+
+static void Host_WriteEvent(const char *format, va_list args)
+{
+	char *buf = eventBuf[eventCount++ % HOST_EVENT_COUNT];
+
+	vsnprintf(buf, HOST_EVENT_LEN, format, args);
+	if (verbose)
+	{
+		printf("  event: %s\n", buf);
+	}
+}
+
+void FS_Log_WriteEvent(const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	Host_WriteEvent(format, args);
+	va_end(args);
+}
+
+void FS_Log_WriteEventAsync(const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	Host_WriteEvent(format, args);
+	va_end(args);
+}
+
+void Host_SetTickStep(uint32_t us)
+{
+	tickStep = us;
+}
+
+uint32_t HAL_GetTick(void)
+{
+	if (tickStep)
+	{
+		Host_SetClock(timeUs + tickStep);
+	}
+
+	return (uint32_t) (timeUs / 1000);
+}
+
+void HAL_Delay(uint32_t Delay)
+{
+	Host_Advance((uint64_t) Delay * 1000);
+}
+
+void Error_Handler(void)
+{
+	fprintf(stderr, "Error_Handler called\n");
+	abort();
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+	return (GPIOx->IDR & GPIO_Pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+	if (PinState == GPIO_PIN_SET) GPIOx->ODR |= GPIO_Pin;
+	else                          GPIOx->ODR &= ~GPIO_Pin;
+}
+
+void LL_EXTI_EnableIT_0_31(uint32_t ExtiLine)
+{
+	UNUSED(ExtiLine);
+}
+
+void LL_EXTI_DisableIT_0_31(uint32_t ExtiLine)
+{
+	UNUSED(ExtiLine);
+}
+
+void LL_EXTI_ClearFlag_0_31(uint32_t ExtiLine)
+{
+	UNUSED(ExtiLine);
+}
+
+void MX_RNG_Init(void)
+{
+}
+
+HAL_StatusTypeDef HAL_RNG_GenerateRandomNumber(RNG_HandleTypeDef *hrng, uint32_t *random32bit)
+{
+	UNUSED(hrng);
+	*random32bit = ((uint32_t) rand() << 16) ^ (uint32_t) rand();
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RNG_DeInit(RNG_HandleTypeDef *hrng)
+{
+	UNUSED(hrng);
+	return HAL_OK;
+}
+
+void LL_RCC_SetRNGClockSource(uint32_t RNGxSource)
+{
+	UNUSED(RNGxSource);
+}
+
+void LL_HSEM_1StepLock(void *HSEMx, uint32_t Semaphore)
+{
+	UNUSED(HSEMx);
+	UNUSED(Semaphore);
+}
+
+void LL_HSEM_ReleaseLock(void *HSEMx, uint32_t Semaphore, uint32_t process)
+{
+	UNUSED(HSEMx);
+	UNUSED(Semaphore);
+	UNUSED(process);
+}
+
+void UTIL_SEQ_RegTask(UTIL_SEQ_bm_t TaskId_bm, uint32_t Flags, void (*Task)(void))
+{
+	UNUSED(Flags);
+	taskBuf[__builtin_ctz(TaskId_bm)] = Task;
+}
+
+void UTIL_SEQ_SetTask(UTIL_SEQ_bm_t TaskId_bm, uint32_t Task_Prio)
+{
+	UNUSED(Task_Prio);
+	taskPending |= TaskId_bm;
+}
+
+void UTIL_SEQ_PauseTask(UTIL_SEQ_bm_t TaskId_bm)
+{
+	taskPaused |= TaskId_bm;
+}
+
+void UTIL_SEQ_ResumeTask(UTIL_SEQ_bm_t TaskId_bm)
+{
+	taskPaused &= ~TaskId_bm;
+}
+
+HW_TS_ReturnStatus_t HW_TS_Create(uint32_t TimerProcessID, uint8_t *pTimerId,
+		HW_TS_Mode_t TimerMode, HW_TS_pTimerCb_t pTimerCallBack)
+{
+	uint8_t i;
+
+	UNUSED(TimerProcessID);
+
+	for (i = 0; i < HOST_TIMER_COUNT; ++i)
+	{
+		if (!timerBuf[i].used)
+		{
+			timerBuf[i].used = true;
+			timerBuf[i].running = false;
+			timerBuf[i].mode = TimerMode;
+			timerBuf[i].callback = pTimerCallBack;
+			*pTimerId = i;
+			return hw_ts_Successful;
+		}
+	}
+
+	return hw_ts_Failed;
+}
+
+void HW_TS_Stop(uint8_t TimerID)
+{
+	timerBuf[TimerID].running = false;
+}
+
+void HW_TS_Start(uint8_t TimerID, uint32_t timeout_ticks)
+{
+	timerBuf[TimerID].running = true;
+	timerBuf[TimerID].period = timeout_ticks * CFG_TS_TICK_VAL;
+	timerBuf[TimerID].deadline = timeUs + timerBuf[TimerID].period;
+}
+
+void HW_TS_Delete(uint8_t TimerID)
+{
+	timerBuf[TimerID].used = false;
+	timerBuf[TimerID].running = false;
+}
+
+uint8_t HW_TS_CountUsed(void)
+{
+	uint8_t i, n = 0;
+
+	for (i = 0; i < HOST_TIMER_COUNT; ++i)
+	{
+		n += timerBuf[i].used;
+	}
+
+	return n;
+}
@@ -0,0 +1,69 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#ifndef HOST_H_
+#define HOST_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "state.h"
+
+// Configuration and state returned by FS_Config_Get and FS_State_Get
+extern FS_Config_Data_t hostConfig;
+extern FS_State_Data_t  hostState;
+
+// Test result reporting
+#define HOST_CHECK(cond, ...) \
+	Host_Check((cond), __FILE__, __LINE__, __VA_ARGS__)
+
+void Host_Check(bool cond, const char *file, int line, const char *format, ...)
+	__attribute__((format(printf, 4, 5)));
+int  Host_Finish(const char *name);
+
+// Simulated time. HAL_GetTick follows the microsecond clock.
+void     Host_SetTime(uint64_t us);
+uint64_t Host_GetTime(void);
+void     Host_Advance(uint64_t us);
+
+// Moves the clock on by us at each HAL_GetTick call, without running
+// timers, so that polling loops see time pass. 0 turns this off.
+void     Host_SetTickStep(uint32_t us);
+
+// Sequencer and timer server
+void Host_RunTasks(void);
+bool Host_TaskPending(uint32_t id);
+
+// Event log captured from FS_Log_WriteEvent
+void        Host_SetVerbose(bool verbose);
+uint32_t    Host_EventCount(void);
+const char *Host_LastEvent(void);
+bool        Host_FindEvent(const char *text);
+const char *Host_MatchEvent(const char *text);
+void        Host_ClearEvents(void);
+
+// Host CPU time for cost measurements
+uint64_t Host_Nanoseconds(void);
+
+#endif /* HOST_H_ */
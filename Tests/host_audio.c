@@ -0,0 +1,126 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "audio.h"
+#include "host.h"
+#include "host_audio.h"
+
+#define HOST_AUDIO_COUNT  65536
+
+static Host_Audio_Event_t eventBuf[HOST_AUDIO_COUNT];
+static uint32_t eventCount;
+static uint64_t busyUntil;		// us
+static uint32_t clipLength;		// ms
+
+static void Host_Audio_Add(Host_Audio_Kind_t kind, uint32_t f0, uint32_t f1,
+		uint32_t duration, uint8_t volume, const char *filename)
+{
+	Host_Audio_Event_t *e;
+
+	if (eventCount >= HOST_AUDIO_COUNT) return;
+
+	e = &eventBuf[eventCount++];
+	memset(e, 0, sizeof(*e));
+	e->time = Host_GetTime();
+	e->kind = kind;
+	e->startFrequency = f0;
+	e->endFrequency = f1;
+	e->duration = duration;
+	e->volume = volume;
+	if (filename)
+	{
+		strncpy(e->filename, filename, sizeof(e->filename) - 1);
+	}
+}
+
+void Host_Audio_Reset(uint32_t clipMs)
+{
+	eventCount = 0;
+	busyUntil = 0;
+	clipLength = clipMs;
+}
+
+uint32_t Host_Audio_Count(void)
+{
+	return eventCount;
+}
+
+const Host_Audio_Event_t *Host_Audio_Get(uint32_t i)
+{
+	return &eventBuf[i];
+}
+
+uint32_t Host_Audio_FindBeep(uint64_t time, uint32_t startFrequency, uint32_t endFrequency)
+{
+	uint32_t i;
+
+	for (i = 0; i < eventCount; ++i)
+	{
+		if (eventBuf[i].time >= time && eventBuf[i].kind == HOST_AUDIO_BEEP &&
+		    eventBuf[i].startFrequency == startFrequency &&
+		    eventBuf[i].endFrequency == endFrequency) break;
+	}
+
+	return i;
+}
+
+uint32_t Host_Audio_FindPlay(uint64_t time, const char *filename)
+{
+	uint32_t i;
+
+	for (i = 0; i < eventCount; ++i)
+	{
+		if (eventBuf[i].time >= time && eventBuf[i].kind == HOST_AUDIO_PLAY &&
+		    !strcmp(eventBuf[i].filename, filename)) break;
+	}
+
+	return i;
+}
+
+void FS_Audio_Beep(uint32_t startFrequency, uint32_t endFrequency, uint32_t duration, uint8_t volume)
+{
+	Host_Audio_Add(HOST_AUDIO_BEEP, startFrequency, endFrequency, duration, volume, NULL);
+	busyUntil = Host_GetTime() + (uint64_t) duration * 1000;
+}
+
+void FS_Audio_Play(const char *filename, uint8_t volume)
+{
+	Host_Audio_Add(HOST_AUDIO_PLAY, 0, 0, 0, volume, filename);
+	busyUntil = Host_GetTime() + (uint64_t) clipLength * 1000;
+}
+
+void FS_Audio_Stop(void)
+{
+	Host_Audio_Add(HOST_AUDIO_STOP, 0, 0, 0, 0, NULL);
+	busyUntil = 0;
+}
+
+bool FS_Audio_IsIdle(void)
+{
+	return Host_GetTime() >= busyUntil;
+}
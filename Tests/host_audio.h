@@ -0,0 +1,61 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+// Records calls into the audio driver as a timeline of actions. Beeps
+// keep the driver busy for their duration and clips for a fixed length,
+// so that FS_Audio_IsIdle paces the caller as on the device.
+
+#ifndef HOST_AUDIO_H_
+#define HOST_AUDIO_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum
+{
+	HOST_AUDIO_BEEP = 0,
+	HOST_AUDIO_PLAY,
+	HOST_AUDIO_STOP
+} Host_Audio_Kind_t;
+
+typedef struct
+{
+	uint64_t          time;		// Simulated time of the call       (us)
+	Host_Audio_Kind_t kind;
+	uint32_t          startFrequency;
+	uint32_t          endFrequency;
+	uint32_t          duration;	// ms
+	uint8_t           volume;
+	char              filename[16];
+} Host_Audio_Event_t;
+
+void     Host_Audio_Reset(uint32_t clipMs);
+uint32_t Host_Audio_Count(void);
+const Host_Audio_Event_t *Host_Audio_Get(uint32_t i);
+
+// Index of the first beep or clip at or after time matching the given
+// frequencies or filename, or Host_Audio_Count() if there is none
+uint32_t Host_Audio_FindBeep(uint64_t time, uint32_t startFrequency, uint32_t endFrequency);
+uint32_t Host_Audio_FindPlay(uint64_t time, const char *filename);
+
+#endif /* HOST_AUDIO_H_ */
@@ -0,0 +1,266 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "ble.h"
+#include "custom_app.h"
+#include "custom_stm.h"
+#include "host.h"
+#include "host_ble.h"
+
+#define HOST_BLE_CONN_HANDLE  0x0801
+#define HOST_BLE_CRS_HANDLE   0x000c
+#define HOST_BLE_CRS_TX       0x000e
+
+#define HOST_BLE_PACKET_LEN   247
+#define HOST_BLE_POOL_MAX     64
+#define HOST_BLE_WRITES_MAX   64
+
+typedef struct
+{
+	uint8_t data[HOST_BLE_PACKET_LEN];
+	uint8_t length;
+} Host_BLE_Packet_t;
+
+uint8_t SizeCrs_Tx = HOST_BLE_PACKET_LEN - 3;
+uint8_t SizeCrs_Rx = HOST_BLE_PACKET_LEN - 3;
+
+static Host_BLE_Link_t linkConfig;
+static Host_BLE_Receiver_t *receiver;
+static bool connected;
+static uint64_t nextEvent;
+
+static Host_BLE_Packet_t poolBuf[HOST_BLE_POOL_MAX];
+static uint32_t poolRead, poolWrite;
+static bool     poolWaiting;		// a notification was refused
+
+static Host_BLE_Packet_t writeBuf[HOST_BLE_WRITES_MAX];
+static uint32_t writeRead, writeWrite;
+
+static uint32_t sentCount;
+static uint32_t droppedCount;
+static uint32_t poolFullCount;
+static uint32_t poolPeak;
+static uint32_t poolAvailableCount;
+static uint32_t terminateCount;
+
+tBleStatus aci_gatt_update_char_value(uint16_t Service_Handle, uint16_t Char_Handle,
+		uint8_t Val_Offset, uint8_t Char_Value_Length, const uint8_t *Char_Value)
+{
+	Host_BLE_Packet_t *packet;
+
+	if ((Service_Handle != HOST_BLE_CRS_HANDLE) || (Char_Handle != HOST_BLE_CRS_TX))
+	{
+		// Other characteristics are not simulated
+		return BLE_STATUS_SUCCESS;
+	}
+
+	if ((Val_Offset != 0) || (Char_Value_Length > HOST_BLE_PACKET_LEN - 3))
+	{
+		return BLE_STATUS_INVALID_PARAMS;
+	}
+
+	if (poolWrite == poolRead + linkConfig.pool)
+	{
+		// Stack raises ACI_GATT_TX_POOL_AVAILABLE once space frees up
+		poolWaiting = true;
+		++poolFullCount;
+		return BLE_STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	packet = &poolBuf[(poolWrite++) % HOST_BLE_POOL_MAX];
+	memcpy(packet->data, Char_Value, Char_Value_Length);
+	packet->length = Char_Value_Length;
+
+	poolPeak = MAX(poolPeak, poolWrite - poolRead);
+
+	return BLE_STATUS_SUCCESS;
+}
+
+tBleStatus aci_gap_terminate(uint16_t Connection_Handle, uint8_t Reason)
+{
+	UNUSED(Connection_Handle);
+	UNUSED(Reason);
+
+	++terminateCount;
+
+	return BLE_STATUS_SUCCESS;
+}
+
+// Host replacement for the CRS TX case of custom_stm.c
+tBleStatus Custom_STM_App_Update_Char(Custom_STM_Char_Opcode_t CharOpcode, uint8_t *pPayload)
+{
+	switch (CharOpcode)
+	{
+	case CUSTOM_STM_CRS_TX:
+		return aci_gatt_update_char_value(HOST_BLE_CRS_HANDLE, HOST_BLE_CRS_TX,
+				0, SizeCrs_Tx, pPayload);
+	default:
+		return aci_gatt_update_char_value(0, 0, 0, 0, pPayload);
+	}
+}
+
+void Host_BLE_Connect(const Host_BLE_Link_t *link, Host_BLE_Receiver_t *callback)
+{
+	Custom_App_ConnHandle_Not_evt_t conn = {CUSTOM_CONN_HANDLE_EVT, HOST_BLE_CONN_HANDLE};
+	Custom_STM_App_Notification_evt_t notify = {CUSTOM_STM_CRS_TX_NOTIFY_ENABLED_EVT};
+
+	linkConfig = *link;
+	linkConfig.pool = MIN(linkConfig.pool, HOST_BLE_POOL_MAX);
+	receiver = callback;
+	connected = true;
+	nextEvent = Host_GetTime() + linkConfig.interval;
+
+	poolRead = poolWrite = 0;
+	poolWaiting = false;
+	writeRead = writeWrite = 0;
+
+	sentCount = 0;
+	droppedCount = 0;
+	poolFullCount = 0;
+	poolPeak = 0;
+	poolAvailableCount = 0;
+	terminateCount = 0;
+
+	// Reported after the connection, as in app_ble.c
+	Custom_APP_Notification(&conn);
+	Custom_APP_ConnIntervalNotification(linkConfig.interval / 1250);
+
+	notify.ConnectionHandle = HOST_BLE_CONN_HANDLE;
+	Custom_STM_App_Notification(&notify);
+
+	Host_RunTasks();
+}
+
+void Host_BLE_Disconnect(void)
+{
+	Custom_App_ConnHandle_Not_evt_t conn = {CUSTOM_DISCON_HANDLE_EVT, HOST_BLE_CONN_HANDLE};
+
+	connected = false;
+	poolRead = poolWrite = 0;
+	writeRead = writeWrite = 0;
+
+	Custom_APP_Notification(&conn);
+	Host_RunTasks();
+}
+
+void Host_BLE_Write(const uint8_t *data, uint8_t length)
+{
+	Host_BLE_Packet_t *packet;
+
+	if (writeWrite == writeRead + HOST_BLE_WRITES_MAX) return;
+
+	packet = &writeBuf[(writeWrite++) % HOST_BLE_WRITES_MAX];
+	memcpy(packet->data, data, length);
+	packet->length = length;
+}
+
+static void Host_BLE_Event(void)
+{
+	Custom_STM_App_Notification_evt_t write = {CUSTOM_STM_CRS_RX_WRITE_NO_RESP_EVT};
+	Host_BLE_Packet_t *packet;
+	uint32_t i;
+
+	// Writes queued by the client before this event
+	while (writeRead < writeWrite)
+	{
+		packet = &writeBuf[(writeRead++) % HOST_BLE_WRITES_MAX];
+		write.DataTransfered.pPayload = packet->data;
+		write.DataTransfered.Length = packet->length;
+		write.ConnectionHandle = HOST_BLE_CONN_HANDLE;
+		Custom_STM_App_Notification(&write);
+	}
+
+	// Notifications leave the pool in order. Those dropped by the client
+	// have still been acknowledged by the link layer.
+	for (i = 0; (i < linkConfig.per_event) && (poolRead < poolWrite); ++i)
+	{
+		packet = &poolBuf[(poolRead++) % HOST_BLE_POOL_MAX];
+		++sentCount;
+
+		if ((uint32_t) (rand() % 1000) < linkConfig.loss)
+		{
+			++droppedCount;
+		}
+		else if (receiver)
+		{
+			receiver(packet->data, packet->length);
+		}
+	}
+
+	if (poolWaiting && (i > 0))
+	{
+		poolWaiting = false;
+		++poolAvailableCount;
+		Custom_APP_TxPoolAvailableNotification();
+	}
+
+	Host_RunTasks();
+}
+
+void Host_BLE_Advance(uint64_t us)
+{
+	const uint64_t end = Host_GetTime() + us;
+
+	while (connected && (nextEvent <= end))
+	{
+		Host_Advance(nextEvent - Host_GetTime());
+		Host_BLE_Event();
+		nextEvent += linkConfig.interval;
+	}
+
+	Host_Advance(end - Host_GetTime());
+}
+
+uint32_t Host_BLE_Sent(void)
+{
+	return sentCount;
+}
+
+uint32_t Host_BLE_Dropped(void)
+{
+	return droppedCount;
+}
+
+uint32_t Host_BLE_PoolFull(void)
+{
+	return poolFullCount;
+}
+
+uint32_t Host_BLE_PoolPeak(void)
+{
+	return poolPeak;
+}
+
+uint32_t Host_BLE_PoolAvailable(void)
+{
+	return poolAvailableCount;
+}
+
+uint32_t Host_BLE_Terminations(void)
+{
+	return terminateCount;
+}
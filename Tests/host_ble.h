@@ -0,0 +1,63 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+// Stands in for the BLE stack behind custom_app.c. CRS notifications go
+// into a TX pool of fixed capacity through aci_gatt_update_char_value,
+// which refuses them with BLE_STATUS_INSUFFICIENT_RESOURCES while the
+// pool is full, and leave it over the air at each connection event.
+// Writes from the client reach the application at the next event.
+
+#ifndef HOST_BLE_H_
+#define HOST_BLE_H_
+
+#include <stdint.h>
+
+typedef struct
+{
+	uint32_t interval;		// connection interval (us)
+	uint32_t per_event;		// notifications sent per connection event
+	uint32_t pool;			// notifications held by the stack TX pool
+	uint32_t loss;			// notifications dropped by the client (per mille)
+} Host_BLE_Link_t;
+
+// Called for each notification that reaches the client
+typedef void Host_BLE_Receiver_t(const uint8_t *data, uint8_t length);
+
+void Host_BLE_Connect(const Host_BLE_Link_t *link, Host_BLE_Receiver_t *receiver);
+void Host_BLE_Disconnect(void);
+
+// Queues a write without response to CRS RX
+void Host_BLE_Write(const uint8_t *data, uint8_t length);
+
+// Advances simulated time, running connection events, timers and tasks
+void Host_BLE_Advance(uint64_t us);
+
+// Counters since Host_BLE_Connect
+uint32_t Host_BLE_Sent(void);			// notifications sent over the air
+uint32_t Host_BLE_Dropped(void);		// of those, dropped by the client
+uint32_t Host_BLE_PoolFull(void);		// notifications refused by a full pool
+uint32_t Host_BLE_PoolPeak(void);		// most notifications held in the pool
+uint32_t Host_BLE_PoolAvailable(void);	// TX pool available events raised
+uint32_t Host_BLE_Terminations(void);	// aci_gap_terminate calls
+
+#endif /* HOST_BLE_H_ */
@@ -0,0 +1,186 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ff.h"
+#include "host_ff.h"
+
+#define HOST_FF_PATH_LEN 256
+
+static char rootDir[HOST_FF_PATH_LEN] = ".";
+static char workDir[HOST_FF_PATH_LEN] = "/";
+static uint32_t openCount;
+static uint32_t readCount;
+
+void Host_FF_SetRoot(const char *dir)
+{
+	snprintf(rootDir, sizeof(rootDir), "%s", dir);
+	strcpy(workDir, "/");
+	openCount = 0;
+	readCount = 0;
+}
+
+uint32_t Host_FF_Opens(void)
+{
+	return openCount;
+}
+
+uint32_t Host_FF_Reads(void)
+{
+	return readCount;
+}
+
+static void Host_FF_Resolve(char *buf, size_t len, const char *path)
+{
+	if (path[0] == '/')
+	{
+		snprintf(buf, len, "%s%s", rootDir, path);
+	}
+	else
+	{
+		snprintf(buf, len, "%s%s/%s", rootDir, strcmp(workDir, "/") ? workDir : "", path);
+	}
+}
+
+FRESULT f_open(FIL *fp, const char *path, BYTE mode)
+{
+	char buf[2 * HOST_FF_PATH_LEN];
+
+	if (mode != FA_READ) return FR_DENIED;
+
+	++openCount;
+	Host_FF_Resolve(buf, sizeof(buf), path);
+	fp->fp = fopen(buf, "rb");
+	fp->fptr = 0;
+	fp->fsize = 0;
+
+	if (!fp->fp) return FR_NO_FILE;
+
+	fseek(fp->fp, 0, SEEK_END);
+	fp->fsize = ftell(fp->fp);
+	fseek(fp->fp, 0, SEEK_SET);
+
+	return FR_OK;
+}
+
+FRESULT f_close(FIL *fp)
+{
+	if (!fp->fp) return FR_INVALID_OBJECT;
+
+	fclose(fp->fp);
+	fp->fp = NULL;
+
+	return FR_OK;
+}
+
+FRESULT f_read(FIL *fp, void *buff, UINT btr, UINT *br)
+{
+	if (!fp->fp) return FR_INVALID_OBJECT;
+
+	++readCount;
+	*br = fread(buff, 1, btr, fp->fp);
+	fp->fptr += *br;
+
+	return ferror(fp->fp) ? FR_DISK_ERR : FR_OK;
+}
+
+FRESULT f_lseek(FIL *fp, FSIZE_t ofs)
+{
+	if (!fp->fp) return FR_INVALID_OBJECT;
+
+	// FatFs stops at the end of a file opened for reading
+	ofs = (ofs < fp->fsize) ? ofs : fp->fsize;
+	if (fseek(fp->fp, ofs, SEEK_SET) != 0) return FR_DISK_ERR;
+
+	fp->fptr = ofs;
+
+	return FR_OK;
+}
+
+FRESULT f_chdir(const char *path)
+{
+	char buf[2 * HOST_FF_PATH_LEN];
+
+	if (path[0] == '/')
+	{
+		snprintf(workDir, sizeof(workDir), "%s", path);
+	}
+	else
+	{
+		snprintf(buf, sizeof(buf), "%s/%s", strcmp(workDir, "/") ? workDir : "", path);
+		snprintf(workDir, sizeof(workDir), "%s", buf);
+	}
+
+	return FR_OK;
+}
+
+FRESULT f_write(FIL *fp, const void *buff, UINT btw, UINT *bw)
+{
+	(void) fp;
+	(void) buff;
+	(void) btw;
+
+	*bw = 0;
+
+	return FR_DENIED;
+}
+
+FRESULT f_unlink(const TCHAR *path)
+{
+	(void) path;
+
+	return FR_DENIED;
+}
+
+FRESULT f_mkdir(const TCHAR *path)
+{
+	(void) path;
+
+	return FR_DENIED;
+}
+
+FRESULT f_opendir(DIR *dp, const TCHAR *path)
+{
+	(void) path;
+
+	dp->fp = NULL;
+
+	return FR_NO_PATH;
+}
+
+FRESULT f_readdir(DIR *dp, FILINFO *fno)
+{
+	(void) dp;
+	(void) fno;
+
+	return FR_INVALID_OBJECT;
+}
+
+FRESULT f_closedir(DIR *dp)
+{
+	(void) dp;
+
+	return FR_INVALID_OBJECT;
+}
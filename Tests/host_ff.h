@@ -0,0 +1,38 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+// Reads files for stubs/ff.h from a host directory standing in for the
+// root of the SD card.
+
+#ifndef HOST_FF_H_
+#define HOST_FF_H_
+
+#include <stdint.h>
+
+void Host_FF_SetRoot(const char *dir);
+
+// Number of f_open and f_read calls since Host_FF_SetRoot
+uint32_t Host_FF_Opens(void);
+uint32_t Host_FF_Reads(void);
+
+#endif /* HOST_FF_H_ */
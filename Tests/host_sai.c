@@ -0,0 +1,281 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "main.h"
+#include "audio.h"
+#include "host.h"
+#include "host_sai.h"
+#include "wav.h"
+
+#define HOST_SAI_CAPACITY  (120 * WAV_OUTPUT_RATE)
+#define HOST_SAI_STREAMS   1024
+
+I2C_HandleTypeDef hi2c1;
+
+static DMA_Channel_TypeDef dmaChannel;
+static DMA_HandleTypeDef   dmaHandle = {&dmaChannel};
+SAI_HandleTypeDef          hsai_BlockA1 = {&dmaHandle};
+
+static const int16_t *dmaData;
+static uint32_t dmaLen;
+static uint32_t dmaPos;
+static bool     dmaRunning;
+
+static int16_t  sampleBuf[HOST_SAI_CAPACITY];
+static uint32_t sampleCount;	// samples played since reset
+static uint64_t sampleStart;	// time of first sample (us)
+
+static Host_SAI_Stream_t streamBuf[HOST_SAI_STREAMS];
+static uint32_t streamCount;
+static bool     streamOpen;
+
+static uint8_t  codecRegs[256];
+static uint32_t codecWrites;
+static Host_SAI_CodecFault_t codecFault;
+static bool     codecPending;	// write started and not completed
+static uint32_t codecAborts;
+static bool     codecReleasedBusy;
+
+void Host_SAI_Reset(void)
+{
+	dmaData = NULL;
+	dmaLen = dmaPos = 0;
+	dmaRunning = false;
+	dmaChannel.CNDTR = 0;
+
+	sampleCount = 0;
+	sampleStart = Host_GetTime();
+
+	streamCount = 0;
+	streamOpen = false;
+
+	memset(codecRegs, 0, sizeof(codecRegs));
+	codecWrites = 0;
+	codecFault = HOST_SAI_CODEC_OK;
+	codecPending = false;
+	codecAborts = 0;
+	codecReleasedBusy = false;
+}
+
+static void Host_SAI_EndStream(void)
+{
+	if (streamOpen)
+	{
+		streamBuf[streamCount - 1].end = sampleCount;
+		streamOpen = false;
+	}
+}
+
+static void Host_SAI_Play(void)
+{
+	int16_t val = 0;
+
+	if (dmaRunning)
+	{
+		val = dmaData[dmaPos++];
+		dmaChannel.CNDTR = dmaLen - dmaPos;
+	}
+
+	if (sampleCount < HOST_SAI_CAPACITY)
+	{
+		sampleBuf[sampleCount] = val;
+	}
+	++sampleCount;
+
+	if (dmaRunning && (dmaPos == dmaLen))
+	{
+		// Transfer complete interrupt, which may start the next frame
+		dmaRunning = false;
+		HAL_SAI_TxCpltCallback(&hsai_BlockA1);
+		if (!dmaRunning)
+		{
+			Host_SAI_EndStream();
+		}
+		Host_RunTasks();
+	}
+}
+
+void Host_SAI_Advance(uint64_t us)
+{
+	const uint64_t end = Host_GetTime() + us;
+	uint64_t next;
+
+	for (;;)
+	{
+		next = sampleStart + ((uint64_t) sampleCount * 1000000 + WAV_OUTPUT_RATE - 1) / WAV_OUTPUT_RATE;
+		if (next > end) break;
+
+		Host_Advance(next - Host_GetTime());
+		Host_SAI_Play();
+	}
+
+	Host_Advance(end - Host_GetTime());
+}
+
+uint32_t Host_SAI_Count(void)
+{
+	return MIN(sampleCount, HOST_SAI_CAPACITY);
+}
+
+const int16_t *Host_SAI_Samples(void)
+{
+	return sampleBuf;
+}
+
+uint32_t Host_SAI_StreamCount(void)
+{
+	return streamCount;
+}
+
+const Host_SAI_Stream_t *Host_SAI_GetStream(uint32_t i)
+{
+	return &streamBuf[i];
+}
+
+uint8_t Host_SAI_CodecReg(uint8_t reg)
+{
+	return codecRegs[reg];
+}
+
+uint32_t Host_SAI_CodecWrites(void)
+{
+	return codecWrites;
+}
+
+void Host_SAI_SetCodecFault(Host_SAI_CodecFault_t fault)
+{
+	codecFault = fault;
+}
+
+uint32_t Host_SAI_CodecAborts(void)
+{
+	return codecAborts;
+}
+
+bool Host_SAI_CodecReleasedBusy(void)
+{
+	return codecReleasedBusy;
+}
+
+void MX_I2C1_Init(void)
+{
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Write_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress,
+		uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size)
+{
+	UNUSED(hi2c);
+	UNUSED(DevAddress);
+	UNUSED(MemAddSize);
+
+	if (codecPending || (codecFault == HOST_SAI_CODEC_BUSY))
+	{
+		return HAL_BUSY;
+	}
+
+	++codecWrites;
+
+	if (codecFault == HOST_SAI_CODEC_HANG)
+	{
+		codecPending = true;
+		return HAL_OK;
+	}
+
+	if (Size > 0)
+	{
+		codecRegs[MemAddress & 0xff] = pData[Size - 1];
+	}
+
+	// Completion interrupt
+	FS_Audio_CodecComplete();
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Master_Abort_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress)
+{
+	UNUSED(hi2c);
+	UNUSED(DevAddress);
+
+	++codecAborts;
+
+	if (!codecPending) return HAL_ERROR;
+
+	// Completes with HAL_I2C_AbortCpltCallback, which audio.c ignores
+	codecPending = false;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_DeInit(I2C_HandleTypeDef *hi2c)
+{
+	UNUSED(hi2c);
+
+	codecReleasedBusy |= codecPending;
+	codecPending = false;
+	return HAL_OK;
+}
+
+void MX_SAI1_Init(void)
+{
+}
+
+HAL_StatusTypeDef HAL_SAI_Transmit_DMA(SAI_HandleTypeDef *hsai, uint8_t *pData, uint16_t Size)
+{
+	UNUSED(hsai);
+
+	if (dmaRunning) return HAL_BUSY;
+
+	dmaData = (const int16_t *) pData;
+	dmaLen = Size;
+	dmaPos = 0;
+	dmaRunning = (Size > 0);
+	dmaChannel.CNDTR = Size;
+
+	if (dmaRunning && !streamOpen && (streamCount < HOST_SAI_STREAMS))
+	{
+		streamBuf[streamCount].start = streamBuf[streamCount].end = sampleCount;
+		++streamCount;
+		streamOpen = true;
+	}
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SAI_DMAStop(SAI_HandleTypeDef *hsai)
+{
+	UNUSED(hsai);
+
+	dmaRunning = false;
+	dmaChannel.CNDTR = 0;
+	Host_SAI_EndStream();
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SAI_DeInit(SAI_HandleTypeDef *hsai)
+{
+	return HAL_SAI_DMAStop(hsai);
+}
@@ -0,0 +1,71 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+// Stands in for the audio hardware behind audio.c. The SAI DMA stream is
+// played out at WAV_OUTPUT_RATE into a capture buffer as simulated time
+// advances, and MAX9850 register writes on I2C1 complete in the call
+// unless a fault is set.
+
+#ifndef HOST_SAI_H_
+#define HOST_SAI_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum
+{
+	HOST_SAI_CODEC_OK = 0,		// writes complete in the call
+	HOST_SAI_CODEC_HANG,		// writes start but never complete
+	HOST_SAI_CODEC_BUSY			// writes are refused
+} Host_SAI_CodecFault_t;
+
+// Samples played between a DMA start from idle and the end of the stream
+typedef struct
+{
+	uint32_t start;		// first sample
+	uint32_t end;		// one past the last sample
+} Host_SAI_Stream_t;
+
+void Host_SAI_Reset(void);
+
+// Advances simulated time, running timers and tasks between samples
+void Host_SAI_Advance(uint64_t us);
+
+// Output since Host_SAI_Reset, with silence while no stream plays
+uint32_t       Host_SAI_Count(void);
+const int16_t *Host_SAI_Samples(void);
+
+uint32_t Host_SAI_StreamCount(void);
+const Host_SAI_Stream_t *Host_SAI_GetStream(uint32_t i);
+
+// Codec registers as last written
+uint8_t  Host_SAI_CodecReg(uint8_t reg);
+uint32_t Host_SAI_CodecWrites(void);
+
+// I2C1 faults, transfers aborted, and whether I2C1 was de-initialized
+// with a write still on the bus
+void     Host_SAI_SetCodecFault(Host_SAI_CodecFault_t fault);
+uint32_t Host_SAI_CodecAborts(void);
+bool     Host_SAI_CodecReleasedBusy(void);
+
+#endif /* HOST_SAI_H_ */
@@ -0,0 +1,112 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+// Host replacement for Core/Inc/app_common.h and app_conf.h. Task IDs
+// only need to be distinct on the host.
+
+#ifndef APP_COMMON_H
+#define APP_COMMON_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#ifndef MAX
+#define MAX( x, y )          (((x)>(y))?(x):(y))
+#endif
+
+#ifndef MIN
+#define MIN( x, y )          (((x)<(y))?(x):(y))
+#endif
+
+typedef enum
+{
+	CFG_TASK_ADV_CANCEL_ID,
+	CFG_TASK_HCI_ASYNCH_EVT_ID,
+	CFG_TASK_LINK_CONFIG_ID,
+	CFG_TASK_ADV_UPDATE_ID,
+	CFG_TASK_CUSTOM_CRS_TRANSMIT_ID,
+	CFG_TASK_CUSTOM_GNSS_TRANSMIT_ID,
+	CFG_TASK_CUSTOM_START_TRANSMIT_ID,
+	CFG_TASK_FS_CRS_UPDATE_ID,
+	CFG_TASK_FS_START_UPDATE_ID,
+	CFG_TASK_SYSTEM_HCI_ASYNCH_EVT_ID,
+	CFG_TASK_FS_MODE_UPDATE_ID,
+	CFG_TASK_FS_AUDIO_UPDATE_ID,
+	CFG_TASK_FS_GNSS_UPDATE_ID,
+	CFG_TASK_FS_LOG_UPDATE_ID,
+	CFG_TASK_FS_LOG_SYNC_ID,
+	CFG_TASK_FS_AUDIO_CONTROL_PRODUCER_ID,
+	CFG_TASK_FS_AUDIO_CONTROL_CONSUMER_ID,
+	CFG_TASK_FS_AUDIO_CONTROL_BARO_ID,
+	CFG_TASK_FS_ACTIVE_CONTROL_BARO_ID,
+	CFG_TASK_FS_KALMAN_UPDATE_ID,
+	CFG_TASK_FS_PHASE_UPDATE_ID,
+	CFG_TASK_FS_CONFIG_UPDATE_ID,
+	CFG_TASK_FS_WATCHDOG_UPDATE_ID,
+	CFG_TASK_FS_SENSOR_INIT_ID,
+	CFG_TASK_FS_TIMESTAMP_FIT_ID,
+	CFG_TASK_NBR
+} CFG_Task_Id_t;
+
+typedef enum
+{
+	CFG_SCH_PRIO_0,
+	CFG_SCH_PRIO_1
+} CFG_SCH_Prio_Id_t;
+
+// Timer server
+typedef enum
+{
+	CFG_TIM_PROC_ID_ISR
+} CFG_TimProcID_t;
+
+typedef enum
+{
+	hw_ts_SingleShot,
+	hw_ts_Repeated
+} HW_TS_Mode_t;
+
+typedef enum
+{
+	hw_ts_Successful,
+	hw_ts_Failed
+} HW_TS_ReturnStatus_t;
+
+typedef void (*HW_TS_pTimerCb_t)(void);
+
+#define CFG_TS_TICK_VAL             1   // One tick per microsecond on the host
+#define CFG_HW_TS_MAX_NBR_CONCURRENT_TIMER 6
+
+#define CFG_HW_RNG_SEMID            0
+
+HW_TS_ReturnStatus_t HW_TS_Create(uint32_t TimerProcessID, uint8_t *pTimerId,
+		HW_TS_Mode_t TimerMode, HW_TS_pTimerCb_t pTimerCallBack);
+void HW_TS_Stop(uint8_t TimerID);
+void HW_TS_Start(uint8_t TimerID, uint32_t timeout_ticks);
+void HW_TS_Delete(uint8_t TimerID);
+uint8_t HW_TS_CountUsed(void);
+
+#endif /* APP_COMMON_H */
@@ -0,0 +1,47 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+// Host replacement for STM32_WPAN/App/ble.h. The ACI commands used by
+// custom_app.c are simulated in host_ble.c.
+
+#ifndef BLE_H
+#define BLE_H
+
+#include <stdint.h>
+
+#define CONFIG_DATA_IR_LEN 16
+#define CONFIG_DATA_ER_LEN 16
+
+typedef uint8_t tBleStatus;
+
+#define BLE_STATUS_SUCCESS                 ((tBleStatus) 0x00)
+#define BLE_STATUS_INSUFFICIENT_RESOURCES  ((tBleStatus) 0x64)
+#define BLE_STATUS_INVALID_PARAMS          ((tBleStatus) 0x92)
+
+#define HCI_REMOTE_USER_TERMINATED_CONNECTION_ERR_CODE 0x13
+
+tBleStatus aci_gatt_update_char_value(uint16_t Service_Handle, uint16_t Char_Handle,
+		uint8_t Val_Offset, uint8_t Char_Value_Length, const uint8_t *Char_Value);
+tBleStatus aci_gap_terminate(uint16_t Connection_Handle, uint8_t Reason);
+
+#endif /* BLE_H */
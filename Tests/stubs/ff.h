@@ -0,0 +1,96 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+// Host replacement for FatFs ff.h. Files are read through stdio from a
+// directory set with Host_FF_SetRoot; only reading is supported, and
+// calls that would modify the card or list directories fail.
+
+#ifndef FF_DEFINED
+#define FF_DEFINED
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef unsigned int UINT;
+typedef uint8_t      BYTE;
+typedef uint32_t     DWORD;
+typedef uint32_t     FSIZE_t;
+typedef uint16_t     WORD;
+typedef char         TCHAR;
+
+typedef struct
+{
+	FILE   *fp;
+	FSIZE_t fptr;		// read/write pointer, as in FatFs
+	FSIZE_t fsize;		// file size
+} FIL;
+
+typedef struct
+{
+	FILE   *fp;
+} DIR;
+
+typedef struct
+{
+	FSIZE_t fsize;
+	WORD    fdate;
+	WORD    ftime;
+	BYTE    fattrib;
+	TCHAR   fname[13];
+} FILINFO;
+
+typedef enum
+{
+	FR_OK = 0,
+	FR_DISK_ERR,
+	FR_INT_ERR,
+	FR_NOT_READY,
+	FR_NO_FILE,
+	FR_NO_PATH,
+	FR_INVALID_NAME,
+	FR_DENIED,
+	FR_EXIST,
+	FR_INVALID_OBJECT
+} FRESULT;
+
+#define FA_READ          0x01
+#define FA_WRITE         0x02
+#define FA_CREATE_NEW    0x04
+#define FA_CREATE_ALWAYS 0x08
+
+#define f_tell(fp) ((fp)->fptr)
+#define f_eof(fp)  ((int) ((fp)->fptr == (fp)->fsize))
+
+FRESULT f_open(FIL *fp, const char *path, BYTE mode);
+FRESULT f_close(FIL *fp);
+FRESULT f_read(FIL *fp, void *buff, UINT btr, UINT *br);
+FRESULT f_lseek(FIL *fp, FSIZE_t ofs);
+FRESULT f_chdir(const char *path);
+FRESULT f_write(FIL *fp, const void *buff, UINT btw, UINT *bw);
+FRESULT f_unlink(const TCHAR *path);
+FRESULT f_mkdir(const TCHAR *path);
+FRESULT f_opendir(DIR *dp, const TCHAR *path);
+FRESULT f_readdir(DIR *dp, FILINFO *fno);
+FRESULT f_closedir(DIR *dp);
+
+#endif /* FF_DEFINED */
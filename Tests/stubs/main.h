@@ -0,0 +1,256 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+// Host replacement for Core/Inc/main.h. Declares the subset of HAL, LL
+// and CMSIS used by the modules built in Tests/. Peripherals are plain
+// structures that the test drivers read and write.
+
+#ifndef __MAIN_H
+#define __MAIN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "app_common.h"
+
+#define __weak __attribute__((weak))
+
+#define UNUSED(X) (void)X
+
+typedef enum
+{
+	HAL_OK       = 0x00,
+	HAL_ERROR    = 0x01,
+	HAL_BUSY     = 0x02,
+	HAL_TIMEOUT  = 0x03
+} HAL_StatusTypeDef;
+
+#define HAL_MAX_DELAY 0xFFFFFFFFU
+
+// Interrupts are never nested on the host
+#define __get_PRIMASK()   0
+#define __set_PRIMASK(x)  ((void) (x))
+#define __disable_irq()
+#define __enable_irq()
+
+// Cycle counter, following host CPU time at the 64 MHz core clock rate
+typedef struct
+{
+	uint32_t CTRL;
+	uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct
+{
+	uint32_t DEMCR;
+} CoreDebug_Type;
+
+typedef struct
+{
+	uint32_t LOAD;
+	uint32_t VAL;
+} SysTick_Type;
+
+typedef struct
+{
+	uint32_t ICSR;
+} SCB_Type;
+
+extern DWT_Type       host_dwt;
+extern CoreDebug_Type host_core_debug;
+extern SysTick_Type   host_systick;
+extern SCB_Type       host_scb;
+
+DWT_Type *Host_DWT(void);
+
+#define DWT       (Host_DWT())
+#define CoreDebug (&host_core_debug)
+#define SysTick   (&host_systick)
+#define SCB       (&host_scb)
+
+#define DWT_CTRL_CYCCNTENA_Msk       (1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk   (1UL << 24)
+#define SCB_ICSR_PENDSTSET_Msk       (1UL << 26)
+
+// UART
+typedef struct
+{
+	uint32_t CNDTR;
+} DMA_Channel_TypeDef;
+
+typedef struct
+{
+	DMA_Channel_TypeDef *Instance;
+} DMA_HandleTypeDef;
+
+typedef struct
+{
+	uint32_t BaudRate;
+} UART_InitTypeDef;
+
+typedef enum
+{
+	HAL_UART_STATE_READY   = 0x20U,
+	HAL_UART_STATE_BUSY_TX = 0x21U
+} HAL_UART_StateTypeDef;
+
+typedef struct
+{
+	UART_InitTypeDef      Init;
+	DMA_HandleTypeDef    *hdmarx;
+	HAL_UART_StateTypeDef gState;
+	uint32_t              ErrorCode;
+} UART_HandleTypeDef;
+
+#define HAL_UART_ERROR_NE   (0x00000002U)
+#define HAL_UART_ERROR_FE   (0x00000004U)
+#define HAL_UART_ERROR_ORE  (0x00000008U)
+#define HAL_UART_ERROR_DMA  (0x00000010U)
+
+HAL_StatusTypeDef HAL_UART_Init(UART_HandleTypeDef *huart);
+HAL_StatusTypeDef HAL_UART_Abort(UART_HandleTypeDef *huart);
+HAL_StatusTypeDef HAL_UART_DMAStop(UART_HandleTypeDef *huart);
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart,
+		const uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_UART_Receive_DMA(UART_HandleTypeDef *huart,
+		uint8_t *pData, uint16_t Size);
+
+// GPIO
+typedef struct
+{
+	uint32_t IDR;
+	uint32_t ODR;
+} GPIO_TypeDef;
+
+typedef enum
+{
+	GPIO_PIN_RESET = 0U,
+	GPIO_PIN_SET
+} GPIO_PinState;
+
+extern GPIO_TypeDef host_gpioa, host_gpiob, host_gpioc, host_gpiod;
+
+#define GPIOA (&host_gpioa)
+#define GPIOB (&host_gpiob)
+#define GPIOC (&host_gpioc)
+#define GPIOD (&host_gpiod)
+
+#define GPIO_PIN_9          ((uint16_t) 0x0200)
+#define GPIO_PIN_13         ((uint16_t) 0x2000)
+#define GPIO_PIN_15         ((uint16_t) 0x8000)
+
+#define IMU_NCS_Pin         GPIO_PIN_15
+#define IMU_NCS_GPIO_Port   GPIOA
+#define IMU_INT1_Pin        GPIO_PIN_9
+#define IMU_INT1_GPIO_Port  GPIOC
+#define MIC_EN_Pin          GPIO_PIN_13
+#define MIC_EN_GPIO_Port    GPIOD
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+
+// SPI
+typedef struct
+{
+	uint32_t ErrorCode;
+} SPI_HandleTypeDef;
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData,
+		uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *pData,
+		uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef *hspi,
+		uint8_t *pTxData, uint8_t *pRxData, uint16_t Size);
+
+// EXTI
+#define LL_EXTI_LINE_3   (1UL << 3)
+#define LL_EXTI_LINE_4   (1UL << 4)
+#define LL_EXTI_LINE_6   (1UL << 6)
+#define LL_EXTI_LINE_9   (1UL << 9)
+#define LL_EXTI_LINE_13  (1UL << 13)
+
+void LL_EXTI_EnableIT_0_31(uint32_t ExtiLine);
+void LL_EXTI_DisableIT_0_31(uint32_t ExtiLine);
+void LL_EXTI_ClearFlag_0_31(uint32_t ExtiLine);
+
+// I2C, completing memory writes in the call (see host_sai.c)
+typedef struct
+{
+	uint32_t ErrorCode;
+} I2C_HandleTypeDef;
+
+void MX_I2C1_Init(void);
+HAL_StatusTypeDef HAL_I2C_Mem_Write_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress,
+		uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_I2C_Master_Abort_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress);
+HAL_StatusTypeDef HAL_I2C_DeInit(I2C_HandleTypeDef *hi2c);
+
+// SAI, played out at the audio sample rate by Host_SAI_Advance
+typedef struct
+{
+	DMA_HandleTypeDef *hdmatx;
+} SAI_HandleTypeDef;
+
+#define __HAL_SAI_ENABLE(__HANDLE__)  ((void) (__HANDLE__))
+
+void MX_SAI1_Init(void);
+HAL_StatusTypeDef HAL_SAI_Transmit_DMA(SAI_HandleTypeDef *hsai, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_SAI_DMAStop(SAI_HandleTypeDef *hsai);
+HAL_StatusTypeDef HAL_SAI_DeInit(SAI_HandleTypeDef *hsai);
+void HAL_SAI_TxCpltCallback(SAI_HandleTypeDef *hsai);
+
+// RCC
+#define __HAL_RCC_PLLSAI1_ENABLE()
+#define LL_RCC_PLLSAI1_IsReady()      (1U)
+
+// Dual signed 16-bit multiply with 32-bit accumulate, as in CMSIS
+static inline uint32_t __SMLAD(uint32_t op1, uint32_t op2, uint32_t op3)
+{
+	return (uint32_t) ((int32_t) (int16_t) op1 * (int16_t) op2
+			+ (int32_t) (int16_t) (op1 >> 16) * (int16_t) (op2 >> 16)
+			+ (int32_t) op3);
+}
+
+// RNG, returning rand() on the host
+typedef struct
+{
+	uint32_t ErrorCode;
+} RNG_HandleTypeDef;
+
+#define HSEM                      NULL
+#define RCC_RNGCLKSOURCE_CLK48    0
+
+void MX_RNG_Init(void);
+HAL_StatusTypeDef HAL_RNG_GenerateRandomNumber(RNG_HandleTypeDef *hrng, uint32_t *random32bit);
+HAL_StatusTypeDef HAL_RNG_DeInit(RNG_HandleTypeDef *hrng);
+void LL_RCC_SetRNGClockSource(uint32_t RNGxSource);
+void LL_HSEM_1StepLock(void *HSEMx, uint32_t Semaphore);
+void LL_HSEM_ReleaseLock(void *HSEMx, uint32_t Semaphore, uint32_t process);
+
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t Delay);
+void Error_Handler(void);
+
+#endif /* __MAIN_H */
@@ -0,0 +1,41 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+// Host replacement for Utilities/sequencer/stm32_seq.h. Tasks run when
+// the test driver calls Host_RunTasks.
+
+#ifndef STM32_SEQ_H
+#define STM32_SEQ_H
+
+#include <stdint.h>
+
+typedef uint32_t UTIL_SEQ_bm_t;
+
+#define UTIL_SEQ_RFU 0
+
+void UTIL_SEQ_RegTask(UTIL_SEQ_bm_t TaskId_bm, uint32_t Flags, void (*Task)(void));
+void UTIL_SEQ_SetTask(UTIL_SEQ_bm_t TaskId_bm, uint32_t Task_Prio);
+void UTIL_SEQ_PauseTask(UTIL_SEQ_bm_t TaskId_bm);
+void UTIL_SEQ_ResumeTask(UTIL_SEQ_bm_t TaskId_bm);
+
+#endif /* STM32_SEQ_H */
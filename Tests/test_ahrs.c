@@ -0,0 +1,491 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+// Drives the attitude estimator with IMU and magnetometer samples
+// synthesized in the sensor frames from known orientations and body
+// rates, so the axis mapping from each sensor to body axes is exercised
+// along with the filter. Checks heading, pitch and roll against truth
+// for static orientations, steady rotation, gyro bias and hard-iron
+// offset, and measures the cost of an update.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "main.h"
+#include "host.h"
+#include "ahrs.h"
+
+#define IMU_RATE       104		// Hz
+#define MAG_RATE       10		// Hz
+#define ACCEL_FS       400000	// accel full scale (g * 100000)
+#define GYRO_FS        2000000	// gyro full scale (deg/s * 1000)
+#define FIELD          500		// earth field (gauss * 1000)
+#define INCLINATION    65		// deg, field pointing down
+#define BENCH_UPDATES  1000000
+
+#define DEG_TO_RAD     (M_PI / 180)
+#define RAD_TO_DEG     (180 / M_PI)
+
+typedef struct
+{
+	double w, x, y, z;
+} Quat_t;
+
+typedef struct
+{
+	double heading;			// deg
+	double pitch;
+	double roll;
+	double angle;			// total attitude error (deg)
+} Error_t;
+
+typedef struct
+{
+	double gyroBias[3];		// body frame (deg/s)
+	double gyroNoise;		// deg/s
+	double accelNoise;		// g
+	double magNoise;		// gauss * 1000
+	double hardIron[3];		// magnetometer frame (gauss * 1000)
+} Sensor_t;
+
+static const FS_IMU_Scale_t imuScale = {GYRO_FS, ACCEL_FS};
+static uint32_t outputs;
+
+// IMU driver, as imu.c
+const FS_IMU_Scale_t *FS_IMU_GetScale(void)
+{
+	return &imuScale;
+}
+
+void FS_IMU_Convert(const FS_IMU_Scale_t *scale, const FS_IMU_Raw_t *raw,
+		FS_IMU_Data_t *data, uint32_t count)
+{
+	uint32_t i;
+
+	for (i = 0; i < count; ++i)
+	{
+		data[i].time = raw[i].time;
+		data[i].timeUs = raw[i].timeUs;
+
+		data[i].wy = (((int64_t) raw[i].gx) * scale->gyroFactor) / 32768;
+		data[i].wx = -(((int64_t) raw[i].gy) * scale->gyroFactor) / 32768;
+		data[i].wz = (((int64_t) raw[i].gz) * scale->gyroFactor) / 32768;
+
+		data[i].ay = (((int64_t) raw[i].ax) * scale->accelFactor) / 32768;
+		data[i].ax = -(((int64_t) raw[i].ay) * scale->accelFactor) / 32768;
+		data[i].az = (((int64_t) raw[i].az) * scale->accelFactor) / 32768;
+
+		data[i].temperature = (raw[i].temperature * 100) / 256 + 2500;
+	}
+}
+
+void FS_AHRS_DataReady_Callback(void)
+{
+	++outputs;
+}
+
+static double Gaussian(double sigma)
+{
+	const double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+	const double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+	return sigma * sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static Quat_t Quat_Mul(Quat_t a, Quat_t b)
+{
+	Quat_t q;
+
+	q.w = a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z;
+	q.x = a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y;
+	q.y = a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x;
+	q.z = a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w;
+
+	return q;
+}
+
+static Quat_t Quat_Axis(double x, double y, double z, double angle)
+{
+	const double s = sin(angle / 2);
+	Quat_t q = {cos(angle / 2), x * s, y * s, z * s};
+
+	return q;
+}
+
+// Body to local level (x north, y west, z up), from heading clockwise
+// from north, pitch nose up and roll right side down
+static Quat_t Quat_Euler(double heading, double pitch, double roll)
+{
+	Quat_t q = Quat_Axis(0, 0, 1, -heading * DEG_TO_RAD);
+
+	q = Quat_Mul(q, Quat_Axis(0, 1, 0, -pitch * DEG_TO_RAD));
+	return Quat_Mul(q, Quat_Axis(1, 0, 0, roll * DEG_TO_RAD));
+}
+
+// Local level vector in body axes
+static void Quat_ToBody(Quat_t q, const double *v, double *b)
+{
+	Quat_t p = {0, v[0], v[1], v[2]};
+	Quat_t c = {q.w, -q.x, -q.y, -q.z};
+
+	p = Quat_Mul(Quat_Mul(c, p), q);
+	b[0] = p.x;
+	b[1] = p.y;
+	b[2] = p.z;
+}
+
+static void Quat_Angles(Quat_t q, double *heading, double *pitch, double *roll)
+{
+	const double r00 = 1 - 2 * (q.y * q.y + q.z * q.z);
+	const double r10 = 2 * (q.x * q.y + q.w * q.z);
+	const double r20 = 2 * (q.x * q.z - q.w * q.y);
+	const double r21 = 2 * (q.y * q.z + q.w * q.x);
+	const double r22 = 1 - 2 * (q.x * q.x + q.y * q.y);
+
+	// Body x projected on the horizontal, and body y above the horizontal
+	*heading = fmod(atan2(-r10, r00) * RAD_TO_DEG + 360, 360);
+	*pitch = asin(fmax(fmin(r20, 1), -1)) * RAD_TO_DEG;
+	*roll = atan2(r21, r22) * RAD_TO_DEG;
+}
+
+static double Wrap(double deg)
+{
+	return fabs(remainder(deg, 360));
+}
+
+static Error_t Compare(Quat_t truth)
+{
+	const FS_AHRS_Data_t *data = FS_AHRS_GetData();
+	Quat_t q = {data->q0 * 1e-4, data->q1 * 1e-4, data->q2 * 1e-4, data->q3 * 1e-4};
+	double heading, pitch, roll, dot;
+	Error_t e;
+
+	Quat_Angles(truth, &heading, &pitch, &roll);
+
+	e.heading = Wrap(data->heading * 0.1 - heading);
+	e.pitch = fabs(data->pitch * 0.1 - pitch);
+	e.roll = Wrap(data->roll * 0.1 - roll);
+
+	dot = fabs(q.w * truth.w + q.x * truth.x + q.y * truth.y + q.z * truth.z);
+	dot /= sqrt(q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z);
+	e.angle = 2 * acos(fmin(dot, 1)) * RAD_TO_DEG;
+
+	return e;
+}
+
+static int16_t Counts(double value, double fullScale)
+{
+	return lround(fmax(fmin(value * 32768 / fullScale, 32767), -32768));
+}
+
+// Samples in each sensor's own frame. The IMU frame is rotated from body
+// axes as undone by FS_IMU_Convert, and the magnetometer frame matches
+// the IMU frame once FS_Mag_Read has negated z.
+static void Sensor_IMU(Quat_t q, const double *w, const Sensor_t *s,
+		uint64_t us, FS_IMU_Raw_t *raw)
+{
+	static const double up[3] = {0, 0, 1};
+	double a[3], g[3];
+	int i;
+
+	Quat_ToBody(q, up, a);
+	for (i = 0; i < 3; ++i)
+	{
+		a[i] += Gaussian(s->accelNoise);
+		g[i] = w[i] * RAD_TO_DEG + s->gyroBias[i] + Gaussian(s->gyroNoise);
+	}
+
+	memset(raw, 0, sizeof(*raw));
+	raw->time = us / 1000;
+	raw->timeUs = us % 1000;
+	raw->gx = Counts(g[1] * 1000, GYRO_FS);
+	raw->gy = Counts(-g[0] * 1000, GYRO_FS);
+	raw->gz = Counts(g[2] * 1000, GYRO_FS);
+	raw->ax = Counts(a[1] * 100000, ACCEL_FS);
+	raw->ay = Counts(-a[0] * 100000, ACCEL_FS);
+	raw->az = Counts(a[2] * 100000, ACCEL_FS);
+}
+
+static void Sensor_Mag(Quat_t q, const Sensor_t *s, uint64_t us, FS_Mag_Data_t *mag)
+{
+	const double field[3] = {
+			FIELD * cos(INCLINATION * DEG_TO_RAD), 0,
+			-FIELD * sin(INCLINATION * DEG_TO_RAD)};
+	double b[3];
+
+	Quat_ToBody(q, field, b);
+
+	mag->time = us / 1000;
+	mag->x = lround(b[1] + s->hardIron[0] + Gaussian(s->magNoise));
+	mag->y = lround(-b[0] + s->hardIron[1] + Gaussian(s->magNoise));
+	mag->z = lround(b[2] + s->hardIron[2] + Gaussian(s->magNoise));
+	mag->temperature = 250;
+}
+
+// Rotates at constant body rate w (rad/s) from q for the given time,
+// returning the final truth and the worst error after settle seconds
+static Quat_t Run(Quat_t q, const double *w, const Sensor_t *s,
+		double seconds, double settle, Error_t *worst)
+{
+	const uint32_t count = seconds * IMU_RATE;
+	const double norm = sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]);
+	const Quat_t step = norm > 0 ?
+			Quat_Axis(w[0] / norm, w[1] / norm, w[2] / norm, norm / IMU_RATE) :
+			(Quat_t) {1, 0, 0, 0};
+	FS_IMU_Raw_t raw;
+	FS_Mag_Data_t mag;
+	Error_t e;
+	uint32_t i;
+	uint64_t us;
+
+	memset(worst, 0, sizeof(*worst));
+
+	for (i = 0; i < count; ++i)
+	{
+		us = Host_GetTime();
+
+		if (i % (IMU_RATE / MAG_RATE) == 0)
+		{
+			Sensor_Mag(q, s, us, &mag);
+			FS_AHRS_UpdateMag(&mag);
+		}
+
+		Sensor_IMU(q, w, s, us, &raw);
+		FS_AHRS_UpdateIMU(&raw, 1);
+
+		if (i >= settle * IMU_RATE)
+		{
+			e = Compare(q);
+			worst->heading = fmax(worst->heading, e.heading);
+			worst->pitch = fmax(worst->pitch, e.pitch);
+			worst->roll = fmax(worst->roll, e.roll);
+			worst->angle = fmax(worst->angle, e.angle);
+		}
+
+		q = Quat_Mul(q, step);
+		Host_Advance(1000000 / IMU_RATE);
+	}
+
+	return q;
+}
+
+static void Start(void)
+{
+	Host_SetTime(1000000);
+	FS_AHRS_Init();
+}
+
+static void Test_Static(void)
+{
+	static const double headings[] = {0, 45, 90, 135, 180, 225, 270, 315};
+	static const double pitches[] = {-60, -20, 0, 30, 70};
+	static const double rolls[] = {-120, -45, 0, 30, 90, 180};
+	static const double still[3] = {0, 0, 0};
+	const Sensor_t s = {{0, 0, 0}, 0.1, 0.005, 3, {0, 0, 0}};
+	Error_t e, worst = {0};
+	uint32_t i, j, k;
+
+	// Estimator starts level facing north, so this also checks convergence
+	for (i = 0; i < sizeof(headings) / sizeof(headings[0]); ++i)
+	{
+		for (j = 0; j < sizeof(pitches) / sizeof(pitches[0]); ++j)
+		{
+			for (k = 0; k < sizeof(rolls) / sizeof(rolls[0]); ++k)
+			{
+				Start();
+				Run(Quat_Euler(headings[i], pitches[j], rolls[k]), still, &s, 10, 5, &e);
+
+				HOST_CHECK(e.angle < 1.5, "heading %.0f pitch %.0f roll %.0f: error %.2f deg",
+						headings[i], pitches[j], rolls[k], e.angle);
+
+				worst.heading = fmax(worst.heading, e.heading);
+				worst.pitch = fmax(worst.pitch, e.pitch);
+				worst.roll = fmax(worst.roll, e.roll);
+				worst.angle = fmax(worst.angle, e.angle);
+			}
+		}
+	}
+
+	HOST_CHECK(FS_AHRS_IsValid(), "valid after convergence");
+
+	printf("static, %lu orientations: heading %.2f, pitch %.2f, roll %.2f, attitude %.2f deg max\n",
+			(unsigned long) (i * j * k), worst.heading, worst.pitch, worst.roll, worst.angle);
+}
+
+// Turning about each body axis in turn, then about all three
+static void Test_Rotation(void)
+{
+	static const double rates[][3] = {
+			{90, 0, 0}, {0, 90, 0}, {0, 0, 90}, {0, 0, -360}, {40, -30, 60}};
+	const Sensor_t s = {{0, 0, 0}, 0.1, 0.005, 3, {0, 0, 0}};
+	double w[3], rate, limit;
+	Error_t e;
+	uint32_t i, j;
+
+	for (i = 0; i < sizeof(rates) / sizeof(rates[0]); ++i)
+	{
+		for (j = 0; j < 3; ++j) w[j] = rates[i][j] * DEG_TO_RAD;
+		rate = sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]) * RAD_TO_DEG;
+
+		Start();
+		Run(Quat_Euler(30, 10, -5), w, &s, 20, 5, &e);
+
+		// Accelerometer is pure gravity, so corrections stay on while
+		// turning. Allow for a degree per 100 deg/s of lag.
+		limit = 2 + rate / 100;
+		HOST_CHECK(e.angle < limit, "rotation %.0f %.0f %.0f deg/s: error %.2f deg",
+				rates[i][0], rates[i][1], rates[i][2], e.angle);
+
+		printf("rotation %4.0f %4.0f %4.0f deg/s: attitude %.2f deg max\n",
+				rates[i][0], rates[i][1], rates[i][2], e.angle);
+	}
+}
+
+// Integral feedback removes a constant gyro bias, with a time constant
+// of AHRS_KP / AHRS_KI = 100 s
+static void Test_Bias(void)
+{
+	static const double still[3] = {0, 0, 0};
+	const Sensor_t s = {{0.8, -0.5, 1.0}, 0.1, 0.005, 3, {0, 0, 0}};
+	Quat_t q = Quat_Euler(200, 15, 10);
+	Error_t early, late;
+
+	Start();
+	q = Run(q, still, &s, 20, 5, &early);
+	Run(q, still, &s, 300, 290, &late);
+
+	HOST_CHECK(late.angle < 1.0, "error %.2f deg with gyro bias", late.angle);
+	HOST_CHECK(late.angle < early.angle, "bias estimate improves error, %.2f then %.2f deg",
+			early.angle, late.angle);
+
+	printf("gyro bias: attitude %.2f deg max at 5-20 s, %.2f deg at 310-320 s\n",
+			early.angle, late.angle);
+}
+
+// Hard-iron offset rotates with the sensor and skews heading unless it
+// is removed with Mag_Off_X/Y/Z
+static void Test_HardIron(void)
+{
+	static const double still[3] = {0, 0, 0};
+	const Sensor_t s = {{0, 0, 0}, 0.1, 0.005, 3, {250, -180, 120}};
+	double raw = 0, corrected = 0, heading;
+	Error_t e;
+
+	for (heading = 0; heading < 360; heading += 30)
+	{
+		hostConfig.mag_off_x = 0;
+		hostConfig.mag_off_y = 0;
+		hostConfig.mag_off_z = 0;
+
+		Start();
+		Run(Quat_Euler(heading, 20, -10), still, &s, 10, 5, &e);
+		raw = fmax(raw, e.heading);
+
+		hostConfig.mag_off_x = s.hardIron[0];
+		hostConfig.mag_off_y = s.hardIron[1];
+		hostConfig.mag_off_z = s.hardIron[2];
+
+		Start();
+		Run(Quat_Euler(heading, 20, -10), still, &s, 10, 5, &e);
+		corrected = fmax(corrected, e.heading);
+	}
+
+	hostConfig.mag_off_x = 0;
+	hostConfig.mag_off_y = 0;
+	hostConfig.mag_off_z = 0;
+
+	HOST_CHECK(raw > 10, "offset skews heading by %.1f deg", raw);
+	HOST_CHECK(corrected < 1.5, "corrected heading error %.2f deg", corrected);
+
+	printf("hard iron: heading %.1f deg max uncorrected, %.2f deg corrected\n",
+			raw, corrected);
+}
+
+// Output decimation follows Ahrs_Log_Dec
+static void Test_Decimation(void)
+{
+	static const double still[3] = {0, 0, 0};
+	const Sensor_t s = {{0, 0, 0}, 0, 0, 0, {0, 0, 0}};
+	Error_t e;
+
+	hostConfig.ahrs_log_dec = 4;
+	outputs = 0;
+
+	Start();
+	Run(Quat_Euler(0, 0, 0), still, &s, 10, 10, &e);
+
+	HOST_CHECK(outputs == 10 * IMU_RATE / 4, "%lu outputs from %u samples",
+			(unsigned long) outputs, 10 * IMU_RATE);
+
+	hostConfig.ahrs_log_dec = 1;
+}
+
+static void Bench(void)
+{
+	static FS_IMU_Raw_t raw[64];
+	const Sensor_t s = {{0, 0, 0}, 0.1, 0.005, 3, {0, 0, 0}};
+	const Quat_t q = Quat_Euler(30, 10, -5);
+	const double w[3] = {0.5, -0.3, 1.0};
+	uint64_t t0, ns;
+	uint32_t i;
+
+	for (i = 0; i < sizeof(raw) / sizeof(raw[0]); ++i)
+	{
+		Sensor_IMU(q, w, &s, 1000000 + i * 1000000 / IMU_RATE, &raw[i]);
+	}
+
+	Start();
+	t0 = Host_Nanoseconds();
+	for (i = 0; i < BENCH_UPDATES; i += 64)
+	{
+		FS_AHRS_UpdateIMU(raw, 64);
+	}
+	ns = Host_Nanoseconds() - t0;
+
+	printf("update: %.1f host ns mean, %.0f cycles at 64 MHz, %lu cycles max\n",
+			(double) ns / BENCH_UPDATES, (double) ns * 64 / 1000 / BENCH_UPDATES,
+			(unsigned long) FS_AHRS_GetStats()->updateMax);
+
+	Host_SetVerbose(true);
+	FS_AHRS_DeInit();
+	Host_SetVerbose(false);
+
+	HOST_CHECK(FS_AHRS_GetStats()->updateCount == BENCH_UPDATES, "%lu updates",
+			(unsigned long) FS_AHRS_GetStats()->updateCount);
+}
+
+int main(void)
+{
+	hostConfig.ahrs_log_dec = 1;
+	srand(1);
+
+	Test_Static();
+	Test_Rotation();
+	Test_Bias();
+	Test_HardIron();
+	Test_Decimation();
+	Bench();
+
+	return Host_Finish("test_ahrs");
+}
@@ -0,0 +1,413 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+// Replays a jump through fused altitude and audio control with
+// barometer samples and GNSS epochs arriving at their own rates, and
+// reports the latency of each altitude alarm from the true crossing to
+// the audio action. Barometer-rate detection is compared against
+// detection on GNSS epochs alone.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "main.h"
+#include "ahrs.h"
+#include "altitude.h"
+#include "audio_control.h"
+#include "host.h"
+#include "host_audio.h"
+#include "kalman.h"
+#include "timestamp.h"
+#include "track.h"
+
+#define MAX_POINTS     200000
+#define TRUTH_STEP     0.01		// s
+#define GNSS_RATE_MS   200
+#define GNSS_DELAY_US  60000	// solution to delivery
+#define GNSS_NOISE     1.5		// m
+#define BARO_NOISE     2.0		// Pa
+#define TOW_START_MS   345600000
+#define LOCAL_START_US 5000000	// local clock at start of track
+#define ALARM_WINDOW   5.0		// s after crossing to look for action
+
+typedef struct
+{
+	int32_t     agl;		// m
+	uint8_t     type;
+	const char *filename;
+} Alarm_t;
+
+typedef struct
+{
+	const char *name;
+	uint32_t    baroPeriodUs;	// 0 for no barometer
+} Setup_t;
+
+static const Alarm_t alarms[] = {
+	{3000, 2, ""},
+	{2500, 4, "alt2500"},
+	{2000, 1, ""},
+	{1500, 3, ""},
+	{1200, 4, "pull"},
+	{300,  4, "alt300"},
+};
+
+#define NUM_ALARMS (sizeof(alarms) / sizeof(alarms[0]))
+
+static const Setup_t setups[] = {
+	{"GNSS 5 Hz",  0},
+	{"baro 10 Hz", 100000},
+	{"baro 25 Hz", 40000},
+	{"baro 50 Hz", 20000},
+};
+
+#define NUM_SETUPS (sizeof(setups) / sizeof(setups[0]))
+
+static Track_Point_t track[MAX_POINTS];
+static uint32_t trackCount;
+static double groundAlt;
+
+static FS_GNSS_Data_t gnssData;
+
+// Modules outside this harness
+uint16_t FS_GNSS_GetRate(void)
+{
+	return GNSS_RATE_MS;
+}
+
+const FS_GNSS_Data_t *FS_GNSS_GetData(void)
+{
+	return &gnssData;
+}
+
+bool FS_Kalman_IsValid(void)
+{
+	return false;
+}
+
+const FS_Kalman_Data_t *FS_Kalman_GetData(void)
+{
+	static FS_Kalman_Data_t data;
+	return &data;
+}
+
+bool FS_AHRS_IsValid(void)
+{
+	return false;
+}
+
+const FS_AHRS_Data_t *FS_AHRS_GetData(void)
+{
+	static FS_AHRS_Data_t data;
+	return &data;
+}
+
+static double Gaussian(double sigma)
+{
+	const double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+	const double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+	return sigma * sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static uint64_t Local(double t)
+{
+	return LOCAL_START_US + (uint64_t) llround(t * 1e6);
+}
+
+// First descending crossing after the highest point, interpolated
+// between truth samples
+static double Crossing(double elev)
+{
+	uint32_t i, top = 0;
+	double t = -1, h0, h1;
+
+	for (i = 1; i < trackCount; ++i)
+	{
+		if (track[i].hMSL > track[top].hMSL) top = i;
+	}
+
+	for (i = top + 1; i < trackCount && t < 0; ++i)
+	{
+		h0 = track[i - 1].hMSL;
+		h1 = track[i].hMSL;
+		if (h0 >= elev && h1 < elev)
+		{
+			t = track[i - 1].t + (h0 - elev) / (h0 - h1) * (track[i].t - track[i - 1].t);
+		}
+	}
+
+	return t;
+}
+
+static void Configure(void)
+{
+	uint32_t i;
+
+	memset(&hostConfig, 0, sizeof(hostConfig));
+	hostConfig.dz_elev = lround(groundAlt * 1000);
+	hostConfig.volume = 8;
+	hostConfig.sp_volume = 8;
+	hostConfig.enable_audio = 1;
+
+	for (i = 0; i < NUM_ALARMS; ++i)
+	{
+		hostConfig.alarms[i].elev = alarms[i].agl * 1000;
+		hostConfig.alarms[i].type = alarms[i].type;
+		strcpy(hostConfig.alarms[i].filename, alarms[i].filename);
+	}
+	hostConfig.num_alarms = NUM_ALARMS;
+}
+
+static void Deliver_Baro(double t)
+{
+	Track_Point_t p;
+	FS_Baro_Data_t baro;
+	uint32_t ms;
+	uint16_t us;
+
+	Track_Interpolate(track, trackCount, t, &p);
+
+	FS_Timestamp_Get(&ms, &us);
+	baro.time = ms;
+	baro.timeUs = us;
+	baro.pressure = lround((Track_Pressure(p.hMSL) + Gaussian(BARO_NOISE)) * 100);
+	baro.temperature = 1500;
+
+	// As the active controller's barometer task
+	FS_Altitude_UpdateBaro(&baro);
+	FS_AudioControl_UpdateBaro();
+}
+
+static void Deliver_GNSS(double t)
+{
+	Track_Point_t p;
+
+	Track_Interpolate(track, trackCount, t, &p);
+	p.hMSL += Gaussian(GNSS_NOISE);
+	p.velD += Gaussian(p.sAcc / 2);
+	Track_ToGNSS(&p, TOW_START_MS + lround(t * 1000), &gnssData);
+
+	// As the active controller's GNSS callback
+	FS_Altitude_UpdateGNSS(&gnssData);
+	FS_AudioControl_UpdateGNSS(&gnssData);
+}
+
+static void Deliver_Pulse(double t)
+{
+	uint32_t ms;
+	uint16_t us;
+
+	FS_Timestamp_Get(&ms, &us);
+	FS_Timestamp_Timepulse(ms, us, 2300, TOW_START_MS + lround(t * 1000), 0);
+}
+
+// Runs the track through one setup and fills latency (ms) per alarm,
+// NAN where the alarm did not sound
+static void Replay(const Setup_t *setup, double *latency, uint32_t *repeats)
+{
+	const double end = track[trackCount - 1].t;
+	double tBaro = 0, tGnss = 0, tPulse = 0, t, crossing;
+	uint32_t i, j, n;
+
+	srand(1);
+	Configure();
+	Host_SetTime(Local(0));
+	Host_Audio_Reset(800);
+	FS_Timestamp_Init();
+	FS_Timestamp_Reset();
+	FS_Altitude_Init();
+	FS_AudioControl_Init();
+
+	for (;;)
+	{
+		// Next event in time order
+		t = tGnss + GNSS_DELAY_US * 1e-6;
+		if (setup->baroPeriodUs) t = fmin(t, tBaro);
+		t = fmin(t, tPulse);
+		if (t > end) break;
+
+		Host_Advance(Local(t) - Host_GetTime());
+
+		if (t == tPulse)
+		{
+			Deliver_Pulse(t);
+			tPulse += 1;
+		}
+		else if (setup->baroPeriodUs && t == tBaro)
+		{
+			Deliver_Baro(t);
+			tBaro += setup->baroPeriodUs * 1e-6;
+		}
+		else
+		{
+			Deliver_GNSS(tGnss);
+			tGnss += GNSS_RATE_MS * 1e-3;
+		}
+
+		Host_RunTasks();
+	}
+
+	// Latency as measured by audio control itself
+	printf("%s:\n", setup->name);
+	Host_SetVerbose(true);
+	FS_AudioControl_DeInit();
+	Host_SetVerbose(false);
+
+	for (i = 0; i < NUM_ALARMS; ++i)
+	{
+		latency[i] = NAN;
+		repeats[i] = 0;
+
+		crossing = Crossing(groundAlt + alarms[i].agl);
+		if (crossing < 0) continue;
+
+		// Matching actions around the descending crossing
+		for (j = 0; j < Host_Audio_Count(); ++j)
+		{
+			const Host_Audio_Event_t *e = Host_Audio_Get(j);
+			const double te = (e->time - LOCAL_START_US) * 1e-6;
+
+			if (te < crossing - ALARM_WINDOW || te > crossing + ALARM_WINDOW) continue;
+
+			switch (alarms[i].type)
+			{
+			case 1:
+				n = (e->kind == HOST_AUDIO_BEEP && e->startFrequency == 1760 && e->endFrequency == 1760);
+				break;
+			case 2:
+				n = (e->kind == HOST_AUDIO_BEEP && e->startFrequency < e->endFrequency);
+				break;
+			case 3:
+				n = (e->kind == HOST_AUDIO_BEEP && e->startFrequency > e->endFrequency);
+				break;
+			default:
+				n = (e->kind == HOST_AUDIO_PLAY && !strncmp(e->filename, alarms[i].filename, strlen(alarms[i].filename)));
+				break;
+			}
+
+			if (!n) continue;
+
+			if (isnan(latency[i]))
+			{
+				latency[i] = (te - crossing) * 1000;
+			}
+			else
+			{
+				++repeats[i];
+			}
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	double latency[NUM_SETUPS][NUM_ALARMS];
+	uint32_t repeats[NUM_SETUPS][NUM_ALARMS];
+	double mean[NUM_SETUPS], worst[NUM_SETUPS];
+	uint32_t i, k, crossed = 0, heard;
+
+	if (argc > 1)
+	{
+		trackCount = Track_Load(argv[1], track, MAX_POINTS);
+		if (trackCount < 2)
+		{
+			printf("%s: no GNSS rows\n", argv[1]);
+			return 1;
+		}
+
+		// Lowest point of the recording is taken as the ground
+		groundAlt = track[0].hMSL;
+		for (i = 1; i < trackCount; ++i)
+		{
+			groundAlt = fmin(groundAlt, track[i].hMSL);
+		}
+	}
+	else
+	{
+		trackCount = Track_Synth(track, MAX_POINTS, TRUTH_STEP);
+		groundAlt = track[0].hMSL;
+	}
+
+	for (k = 0; k < NUM_SETUPS; ++k)
+	{
+		Replay(&setups[k], latency[k], repeats[k]);
+	}
+
+	printf("\nalarm (m AGL)  crossing (s)");
+	for (k = 0; k < NUM_SETUPS; ++k) printf("  %11s", setups[k].name);
+	printf("\n");
+
+	for (k = 0; k < NUM_SETUPS; ++k)
+	{
+		mean[k] = 0;
+		worst[k] = -INFINITY;
+	}
+
+	for (i = 0; i < NUM_ALARMS; ++i)
+	{
+		const double crossing = Crossing(groundAlt + alarms[i].agl);
+
+		if (crossing < 0) continue;
+		++crossed;
+
+		printf("%13d  %12.2f", alarms[i].agl, crossing);
+		for (k = 0; k < NUM_SETUPS; ++k)
+		{
+			printf("  %8.0f ms", latency[k][i]);
+			mean[k] += latency[k][i];
+			worst[k] = fmax(worst[k], latency[k][i]);
+		}
+		printf("\n");
+	}
+
+	printf("%27s", "mean");
+	for (k = 0; k < NUM_SETUPS; ++k) printf("  %8.0f ms", mean[k] / crossed);
+	printf("\n%27s", "max");
+	for (k = 0; k < NUM_SETUPS; ++k) printf("  %8.0f ms", worst[k]);
+	printf("\n\n");
+
+	for (k = 0; k < NUM_SETUPS; ++k)
+	{
+		heard = 0;
+		for (i = 0; i < NUM_ALARMS; ++i)
+		{
+			if (Crossing(groundAlt + alarms[i].agl) < 0) continue;
+			heard += !isnan(latency[k][i]);
+			HOST_CHECK(repeats[k][i] == 0, "%s: %d m alarm sounded %u extra times",
+					setups[k].name, alarms[i].agl, repeats[k][i]);
+		}
+		HOST_CHECK(heard == crossed, "%s: %u of %u alarms sounded",
+				setups[k].name, heard, crossed);
+	}
+
+	// Barometer detection should beat the GNSS epoch period plus delivery
+	for (k = 1; k < NUM_SETUPS; ++k)
+	{
+		HOST_CHECK(mean[k] < mean[0], "%s: mean latency %.0f ms, GNSS %.0f ms",
+				setups[k].name, mean[k] / crossed, mean[0] / crossed);
+	}
+
+	return Host_Finish("test_alarm");
+}
@@ -0,0 +1,578 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+// Drives the audio driver against a simulated SAI and codec. Tones are
+// compared sample for sample with the generator they replaced, which
+// wrapped the table index and divided rather than shifted. The test is
+// built twice, as test_audio and test_audio_dsp, to cover the plain C
+// and SMLAD interpolation paths, and times each against the old loop.
+//
+// Speech lists are played from loose WAV files and from a speech pack
+// in a scratch SD card directory. Every clip must come out intact, with
+// no silence between words, including when the update task runs late.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "audio.h"
+#include "host.h"
+#include "host_ff.h"
+#include "host_sai.h"
+#include "stm32_seq.h"
+#include "wav.h"
+
+#define FRAME_LEN      2048		// as audio.c
+#define INDEX_BITS     7
+#define INTERP_BITS    8
+#define VOLUME         0x10
+
+#define BENCH_BLOCKS   4096
+
+#define CLIP_COUNT     12		// digits, minus and dot
+#define CLIP_MAX       (2000 + 613 * CLIP_COUNT)
+#define WAV_HEADER     44
+#define PACK_HEADER    8		// as speech_pack.py
+#define PACK_ENTRY     20
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+#define TEST_NAME  "test_audio_dsp"
+#define SYNTH_PATH "SMLAD (emulated)"
+#else
+#define TEST_NAME  "test_audio"
+#define SYNTH_PATH "plain C"
+#endif
+
+typedef struct
+{
+	uint32_t startFrequency;	// Hz
+	uint32_t endFrequency;		// Hz
+	uint32_t duration;			// ms
+} Tone_t;
+
+static const int16_t sineTable[1 << INDEX_BITS] =
+{
+		 0,   1607,   3211,   4807,   6392,   7961,   9511,  11038,
+	 12539,  14009,  15446,  16845,  18204,  19519,  20787,  22004,
+	 23169,  24278,  25329,  26318,  27244,  28105,  28897,  29621,
+	 30272,  30851,  31356,  31785,  32137,  32412,  32609,  32727,
+	 32767,  32727,  32609,  32412,  32137,  31785,  31356,  30851,
+	 30272,  29621,  28897,  28105,  27244,  26318,  25329,  24278,
+	 23169,  22004,  20787,  19519,  18204,  16845,  15446,  14009,
+	 12539,  11038,   9511,   7961,   6392,   4807,   3211,   1607,
+		 0,  -1608,  -3212,  -4808,  -6393,  -7962,  -9512, -11039,
+	-12540, -14010, -15447, -16846, -18205, -19520, -20788, -22005,
+	-23170, -24279, -25330, -26319, -27245, -28106, -28898, -29622,
+	-30273, -30852, -31357, -31786, -32138, -32413, -32610, -32728,
+	-32767, -32728, -32610, -32413, -32138, -31786, -31357, -30852,
+	-30273, -29622, -28898, -28106, -27245, -26319, -25330, -24279,
+	-23170, -22005, -20788, -19520, -18205, -16846, -15447, -14010,
+	-12540, -11039,  -9512,  -7962,  -6393,  -4808,  -3212,  -1608
+};
+
+typedef struct
+{
+	const char *name;
+	int16_t  samples[CLIP_MAX];
+	uint32_t count;
+	uint8_t  wav[WAV_HEADER + 2 * CLIP_MAX];
+	uint32_t size;			// bytes
+} Clip_t;
+
+static const char *const clipNames[CLIP_COUNT] =
+{
+	"0.wav", "1.wav", "2.wav", "3.wav", "4.wav", "5.wav",
+	"6.wav", "7.wav", "8.wav", "9.wav", "minus.wav", "dot.wav"
+};
+
+static Clip_t clips[CLIP_COUNT];
+static char   sdRoot[] = "/tmp/test_audio.XXXXXX";
+
+// Generator state, carried from tone to tone as in the driver
+static uint32_t refPhase;
+static uint32_t refStep;
+static uint32_t refChirp;
+
+// Tone setup as in FS_Audio_Beep
+static uint32_t Ref_Beep(const Tone_t *tone)
+{
+	const uint32_t len = (tone->duration * WAV_OUTPUT_RATE) / 1000;
+	const uint32_t endStep = ((uint64_t) tone->endFrequency << 32) / WAV_OUTPUT_RATE;
+
+	refStep = ((uint64_t) tone->startFrequency << 32) / WAV_OUTPUT_RATE;
+	if (endStep > refStep) refChirp = (endStep - refStep) / len;
+	else                   refChirp = 0 - (refStep - endStep) / len;
+
+	return len;
+}
+
+// Sample loop from FS_Audio_LoadTone before tones were synthesized in
+// contiguous blocks
+static void Ref_Tone(int16_t *buf, uint32_t *writePos, uint32_t size)
+{
+	uint32_t i;
+
+	for (i = 0; i < size; ++i, refPhase += refStep, refStep += refChirp)
+	{
+		const uint32_t index = refPhase >> (32 - INDEX_BITS);
+		const uint32_t a1 = (refPhase << INDEX_BITS) >> (32 - INTERP_BITS);
+		const uint32_t a2 = (1 << INTERP_BITS) - a1;
+		const int16_t val1 = sineTable[index];
+		const int16_t val2 = sineTable[(index + 1) % (1 << INDEX_BITS)];
+		const int16_t val = (val1 * a2 + val2 * a1) / (1 << INTERP_BITS);
+
+		buf[*writePos % FRAME_LEN] = val;
+
+		++*writePos;
+	}
+}
+
+static void Test_Init(void)
+{
+	HOST_CHECK(FS_Audio_Init() == HAL_OK, "FS_Audio_Init failed");
+	HOST_CHECK(Host_SAI_CodecReg(0x05) == 0xfd,
+			"enable register 0x%02x after init", Host_SAI_CodecReg(0x05));
+	HOST_CHECK(Host_SAI_CodecReg(0x02) == 0x3f,
+			"volume register 0x%02x after init", Host_SAI_CodecReg(0x02));
+	HOST_CHECK(FS_Audio_IsIdle(), "driver busy after init");
+}
+
+// Plays one tone to the end and compares the stream with the old loop
+static void Test_Tone(const Tone_t *tone)
+{
+	const uint32_t first = Host_SAI_StreamCount();
+	const uint64_t limit = Host_GetTime() + (tone->duration + 1000) * 1000ULL;
+	const Host_SAI_Stream_t *s;
+	const int16_t *out;
+	int16_t ring[FRAME_LEN], *ref;
+	uint32_t len, pos = 0, n, i, bad = 0, firstBad = 0;
+
+	FS_Audio_Beep(tone->startFrequency, tone->endFrequency, tone->duration, VOLUME);
+
+	// Unroll the old frame buffer into one expected stream
+	len = Ref_Beep(tone);
+	ref = malloc(len * sizeof(ref[0]));
+	for (i = 0; i < len; i += n)
+	{
+		n = MIN(FRAME_LEN, len - i);
+		Ref_Tone(ring, &pos, n);
+		memcpy(&ref[i], ring, n * sizeof(ref[0]));
+	}
+
+	while (!FS_Audio_IsIdle() && (Host_GetTime() < limit))
+	{
+		Host_SAI_Advance(1000);
+	}
+
+	HOST_CHECK(FS_Audio_IsIdle(), "%lu-%lu Hz, %lu ms: still playing",
+			tone->startFrequency, tone->endFrequency, tone->duration);
+	HOST_CHECK(Host_SAI_CodecReg(0x02) == VOLUME, "%lu-%lu Hz, %lu ms: volume 0x%02x",
+			tone->startFrequency, tone->endFrequency, tone->duration, Host_SAI_CodecReg(0x02));
+	HOST_CHECK(Host_SAI_StreamCount() == first + 1, "%lu-%lu Hz, %lu ms: %lu streams",
+			tone->startFrequency, tone->endFrequency, tone->duration,
+			Host_SAI_StreamCount() - first);
+
+	if (Host_SAI_StreamCount() == first + 1)
+	{
+		s = Host_SAI_GetStream(first);
+		out = Host_SAI_Samples() + s->start;
+
+		HOST_CHECK(s->end - s->start == len, "%lu-%lu Hz, %lu ms: %lu samples played, expected %lu",
+				tone->startFrequency, tone->endFrequency, tone->duration, s->end - s->start, len);
+
+		for (i = 0; i < MIN(len, s->end - s->start); ++i)
+		{
+			if (out[i] != ref[i])
+			{
+				if (bad++ == 0) firstBad = i;
+			}
+		}
+
+		HOST_CHECK(bad == 0, "%lu-%lu Hz, %lu ms: %lu samples differ, first at %lu (%d, expected %d)",
+				tone->startFrequency, tone->endFrequency, tone->duration,
+				bad, firstBad, out[firstBad], ref[firstBad]);
+	}
+
+	printf("%5lu-%5lu Hz %5lu ms: %6lu samples, %lu differ\n",
+			tone->startFrequency, tone->endFrequency, tone->duration, len, bad);
+
+	free(ref);
+}
+
+// Host time per sample for the old loop and for FS_Audio_Beep, which
+// fills a whole frame before the stream starts
+static void Test_Bench(void)
+{
+	static const Tone_t tone = {1000, 2000, 100};
+	static int16_t buf[FRAME_LEN];
+	uint64_t t0, oldNs, newNs;
+	uint32_t pos = 0, i;
+
+	t0 = Host_Nanoseconds();
+	for (i = 0; i < BENCH_BLOCKS; ++i)
+	{
+		Ref_Beep(&tone);
+		Ref_Tone(buf, &pos, FRAME_LEN);
+	}
+	oldNs = Host_Nanoseconds() - t0;
+
+	t0 = Host_Nanoseconds();
+	for (i = 0; i < BENCH_BLOCKS; ++i)
+	{
+		FS_Audio_Beep(tone.startFrequency, tone.endFrequency, tone.duration, VOLUME);
+	}
+	newNs = Host_Nanoseconds() - t0;
+
+	FS_Audio_Stop();
+
+	printf("old loop: %.2f host ns per sample\n",
+			(double) oldNs / ((double) BENCH_BLOCKS * FRAME_LEN));
+	printf("FS_Audio_Beep, %s: %.2f host ns per sample, including call overhead\n",
+			SYNTH_PATH, (double) newNs / ((double) BENCH_BLOCKS * FRAME_LEN));
+
+	// Keep the compiler from discarding the old loop
+	HOST_CHECK(pos == BENCH_BLOCKS * FRAME_LEN, "old loop wrote %lu samples", pos);
+}
+
+static void PutU16(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void PutU32(uint8_t *p, uint32_t v)
+{
+	PutU16(p, v);
+	PutU16(p + 2, v >> 16);
+}
+
+static void SD_Path(char *buf, size_t len, const char *name)
+{
+	snprintf(buf, len, "%s/audio/%s", sdRoot, name);
+}
+
+static void SD_Write(const char *name, const void *data, size_t len)
+{
+	char path[256];
+	FILE *fp;
+
+	SD_Path(path, sizeof(path), name);
+	fp = fopen(path, "wb");
+	HOST_CHECK(fp && fwrite(data, 1, len, fp) == len, "couldn't write %s", path);
+	if (fp) fclose(fp);
+}
+
+static void SD_Remove(const char *name)
+{
+	char path[256];
+
+	SD_Path(path, sizeof(path), name);
+	remove(path);
+}
+
+// 16-bit PCM at the output rate. Each clip holds a distinct level with
+// a ramp on top and no zero samples, so words and gaps can be told apart.
+static void Clip_Make(Clip_t *clip, uint32_t k)
+{
+	uint8_t *p = clip->wav;
+	uint32_t i;
+
+	clip->name = clipNames[k];
+	clip->count = 2000 + 613 * k;
+	for (i = 0; i < clip->count; ++i)
+	{
+		clip->samples[i] = (k + 1) * 1000 + (i % 64);
+	}
+
+	memcpy(p, "RIFF", 4);
+	PutU32(p + 4, WAV_HEADER - 8 + 2 * clip->count);
+	memcpy(p + 8, "WAVEfmt ", 8);
+	PutU32(p + 16, 16);
+	PutU16(p + 20, WAV_FORMAT_PCM);
+	PutU16(p + 22, 1);
+	PutU32(p + 24, WAV_OUTPUT_RATE);
+	PutU32(p + 28, 2 * WAV_OUTPUT_RATE);
+	PutU16(p + 32, 2);
+	PutU16(p + 34, 16);
+	memcpy(p + 36, "data", 4);
+	PutU32(p + 40, 2 * clip->count);
+	for (i = 0; i < clip->count; ++i)
+	{
+		PutU16(p + WAV_HEADER + 2 * i, clip->samples[i]);
+	}
+	clip->size = WAV_HEADER + 2 * clip->count;
+}
+
+// Speech pack laid out as speech_pack.py writes it
+static void SD_WritePack(void)
+{
+	static uint8_t pack[PACK_HEADER + CLIP_COUNT * (PACK_ENTRY + sizeof(clips[0].wav))];
+	uint32_t offset = PACK_HEADER + CLIP_COUNT * PACK_ENTRY, k;
+	uint8_t *p = pack;
+
+	memcpy(p, "FSPK", 4);
+	PutU16(p + 4, 2);
+	PutU16(p + 6, CLIP_COUNT);
+	p += PACK_HEADER;
+
+	for (k = 0; k < CLIP_COUNT; ++k, p += PACK_ENTRY)
+	{
+		memset(p, 0, PACK_ENTRY);
+		memcpy(p, clips[k].name, strlen(clips[k].name));
+		PutU32(p + 12, offset);
+		PutU32(p + 16, clips[k].size);
+		offset += clips[k].size;
+	}
+
+	for (k = 0; k < CLIP_COUNT; ++k)
+	{
+		memcpy(p, clips[k].wav, clips[k].size);
+		p += clips[k].size;
+	}
+
+	SD_Write("speech.pak", pack, p - pack);
+}
+
+static int Clip_Index(char ch)
+{
+	if ('0' <= ch && ch <= '9') return ch - '0';
+	if (ch == '-') return 10;
+	if (ch == '.') return 11;
+	return -1;
+}
+
+// Runs until the driver is idle. With a delay, the update task is held
+// back that long each time it is set, as if other tasks were busy.
+static void Run(uint32_t delayMs, uint64_t limitUs)
+{
+	const UTIL_SEQ_bm_t task = 1 << CFG_TASK_FS_AUDIO_UPDATE_ID;
+	const uint64_t limit = Host_GetTime() + limitUs;
+
+	if (delayMs) UTIL_SEQ_PauseTask(task);
+
+	while (!FS_Audio_IsIdle() && (Host_GetTime() < limit))
+	{
+		Host_SAI_Advance(1000);
+		if (delayMs && Host_TaskPending(CFG_TASK_FS_AUDIO_UPDATE_ID))
+		{
+			Host_SAI_Advance(delayMs * 1000);
+			UTIL_SEQ_ResumeTask(task);
+			Host_RunTasks();
+			UTIL_SEQ_PauseTask(task);
+		}
+	}
+
+	UTIL_SEQ_ResumeTask(task);
+	Host_RunTasks();
+}
+
+// Plays a list and walks the output, matching each clip in turn and
+// counting the silent samples in front of it
+static uint32_t Test_List(const char *list, uint32_t delayMs, bool pack)
+{
+	const uint32_t firstStream = Host_SAI_StreamCount();
+	const uint32_t opens = Host_FF_Opens();
+	const int16_t *out = Host_SAI_Samples();
+	const Clip_t *clip;
+	uint32_t words = 0, streams, pos, end, gap, maxGap = 0, tail;
+	const char *ch;
+	int k;
+
+	FS_Audio_PlayList(list, VOLUME);
+	Run(delayMs, 10000000);
+
+	streams = Host_SAI_StreamCount() - firstStream;
+	HOST_CHECK(FS_Audio_IsIdle(), "\"%s\": still playing", list);
+	HOST_CHECK(streams == 1, "\"%s\", %lu ms late: %lu streams", list, delayMs, streams);
+	if (streams == 0) return 0;
+
+	pos = Host_SAI_GetStream(firstStream)->start;
+	end = Host_SAI_GetStream(firstStream + streams - 1)->end;
+
+	for (ch = list; *ch; ++ch)
+	{
+		if ((k = Clip_Index(*ch)) < 0) continue;
+		clip = &clips[k];
+
+		for (gap = 0; (pos < end) && (out[pos] == 0); ++pos, ++gap);
+		if (words++ > 0) maxGap = MAX(maxGap, gap);
+
+		HOST_CHECK((pos + clip->count <= end) &&
+				!memcmp(&out[pos], clip->samples, clip->count * sizeof(out[0])),
+				"\"%s\", %lu ms late: %s not played intact", list, delayMs, clip->name);
+		pos += clip->count;
+	}
+
+	// Padding to the end of the last frame
+	for (tail = 0; (pos + tail < end) && (out[pos + tail] == 0); ++tail);
+	HOST_CHECK((pos + tail == end) && (tail < FRAME_LEN),
+			"\"%s\": %lu samples after the last word", list, end - pos);
+
+	HOST_CHECK(maxGap == 0, "\"%s\", %lu ms late: %.2f ms between words",
+			list, delayMs, maxGap * 1000.0 / WAV_OUTPUT_RATE);
+	HOST_CHECK(Host_FF_Opens() - opens == (pack ? 0 : words),
+			"\"%s\": %lu files opened", list, Host_FF_Opens() - opens);
+
+	printf("%-6s %-10s %2lu ms late: %lu words, %lu stream, %.2f ms max gap, %lu files opened\n",
+			pack ? "pack" : "files", list, delayMs, words, streams,
+			maxGap * 1000.0 / WAV_OUTPUT_RATE, Host_FF_Opens() - opens);
+
+	return words - 1;
+}
+
+static void Test_Speech(bool pack)
+{
+	static const char *const lists[] = {"12.5", "-308", "9876543", "0", "4.-.7"};
+	char event[64];
+	uint32_t joins = 0, i;
+
+	Host_SAI_Reset();
+	Host_ClearEvents();
+	HOST_CHECK(FS_Audio_Init() == HAL_OK, "FS_Audio_Init failed");
+	HOST_CHECK(Host_FindEvent("Speech pack loaded with 12 clips") == pack,
+			"speech pack %s", pack ? "not loaded" : "loaded");
+
+	for (i = 0; i < sizeof(lists) / sizeof(lists[0]); ++i)
+	{
+		joins += Test_List(lists[i], 0, pack);
+	}
+
+	// Late updates, but inside the frame of headroom
+	joins += Test_List("9876543", 20, pack);
+	joins += Test_List("9876543", 40, pack);
+
+	Host_ClearEvents();
+	FS_Audio_DeInit();
+	snprintf(event, sizeof(event), "%lu clips joined without a gap, 0 restarted", joins);
+	HOST_CHECK(Host_FindEvent(event), "expected \"%s\" in event log", event);
+}
+
+// DeInit with the DAC disable write stuck on the bus or refused until
+// the wait times out
+static void Test_CodecFault(Host_SAI_CodecFault_t fault, const char *name)
+{
+	uint32_t writes;
+
+	Host_SAI_Reset();
+	HOST_CHECK(FS_Audio_Init() == HAL_OK, "%s: FS_Audio_Init failed", name);
+
+	Host_SAI_SetCodecFault(fault);
+	Host_SetTickStep(100);
+	Host_ClearEvents();
+	FS_Audio_DeInit();
+	Host_SetTickStep(0);
+
+	HOST_CHECK(Host_FindEvent("Couldn't disable audio DAC"),
+			"%s: DAC disable didn't time out", name);
+	HOST_CHECK(Host_FindEvent("codec writes failed"),
+			"%s: abandoned write not counted", name);
+	HOST_CHECK(Host_SAI_CodecAborts() == 1, "%s: %u transfers aborted, expected 1",
+			name, Host_SAI_CodecAborts());
+	HOST_CHECK(!Host_SAI_CodecReleasedBusy(), "%s: I2C1 de-initialized mid-write", name);
+
+	// Neither a late interrupt nor the retry timer reaches the bus
+	writes = Host_SAI_CodecWrites();
+	Host_SAI_SetCodecFault(HOST_SAI_CODEC_OK);
+	FS_Audio_CodecComplete();
+	FS_Audio_CodecError();
+	Host_Advance(2000000);
+	HOST_CHECK(Host_SAI_CodecWrites() == writes, "%s: %u codec writes after DeInit",
+			name, Host_SAI_CodecWrites() - writes);
+
+	// The next session configures the codec as usual
+	HOST_CHECK(FS_Audio_Init() == HAL_OK, "%s: FS_Audio_Init failed after timeout", name);
+	HOST_CHECK(Host_SAI_CodecReg(0x05) == 0xfd, "%s: enable register 0x%02x after Init",
+			name, Host_SAI_CodecReg(0x05));
+	FS_Audio_DeInit();
+	HOST_CHECK(Host_SAI_CodecReg(0x05) == 0, "%s: DAC still enabled after DeInit", name);
+	HOST_CHECK(Host_SAI_CodecAborts() == 1, "%s: abort without a timeout", name);
+}
+
+int main(void)
+{
+	static const Tone_t tones[] =
+	{
+		{ 440,  440,  100},		// steady
+		{1000, 2000,  250},		// chirp up
+		{2000, 1000,  250},		// chirp down
+		{ 500, 3000, 1000},		// several frames
+		{3000,  200,  600},
+		{1200, 1200,    7},		// shorter than a frame
+		{  50,   50,    1},
+		{ 100,  100, 2000},		// low, with fine interpolation
+		{8000, 8000,  300},		// high
+		{ 300, 11000, 400},		// chirp towards Nyquist
+	};
+	char path[256];
+	uint32_t i;
+
+	HOST_CHECK(mkdtemp(sdRoot) != NULL, "couldn't create %s", sdRoot);
+	snprintf(path, sizeof(path), "%s/audio", sdRoot);
+	mkdir(path, 0755);
+
+	for (i = 0; i < CLIP_COUNT; ++i)
+	{
+		Clip_Make(&clips[i], i);
+		SD_Write(clips[i].name, clips[i].wav, clips[i].size);
+	}
+
+	Host_SetTime(1000000);
+	Host_FF_SetRoot(sdRoot);
+	Host_SAI_Reset();
+
+	Test_Init();
+
+	printf("tones, %s synthesis\n", SYNTH_PATH);
+	for (i = 0; i < sizeof(tones) / sizeof(tones[0]); ++i)
+	{
+		Test_Tone(&tones[i]);
+	}
+
+	Test_Bench();
+
+	Host_ClearEvents();
+	FS_Audio_DeInit();
+	HOST_CHECK(Host_FindEvent("cycles maximum time spent in FS_Audio_Beep"),
+			"no Beep timing in event log");
+	HOST_CHECK(Host_SAI_CodecReg(0x05) == 0, "DAC still enabled after DeInit");
+
+	printf("speech\n");
+	Test_Speech(false);
+	SD_WritePack();
+	Test_Speech(true);
+
+	Test_CodecFault(HOST_SAI_CODEC_HANG, "codec hang");
+	Test_CodecFault(HOST_SAI_CODEC_BUSY, "codec busy");
+
+	SD_Remove("speech.pak");
+	for (i = 0; i < CLIP_COUNT; ++i)
+	{
+		SD_Remove(clips[i].name);
+	}
+	rmdir(path);
+	rmdir(sdRoot);
+
+	return Host_Finish(TEST_NAME);
+}
@@ -0,0 +1,400 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+// Streams IMU and barometer samples through the pre-trigger rings the
+// way the active controller does, fires button, acceleration and
+// vertical speed triggers, and checks each sample that comes out: full
+// rate exactly inside the merged capture windows, nothing lost or
+// reordered, and delay bounded by the pre-trigger length. Covers sample
+// rates where Cap_Pre is longer than a ring can hold, which must be
+// clamped so the window has no low-rate gap at its start.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "main.h"
+#include "host.h"
+#include "altitude.h"
+#include "capture.h"
+
+#define IMU_COUNT      1024	// ring depths, as capture.c
+#define BARO_COUNT     256
+#define ACCEL_FS       1600000	// g * 100000
+#define ONE_G          2048		// counts at ACCEL_FS
+#define MAX_TRIGGERS   4
+#define MAX_WINDOWS    MAX_TRIGGERS
+
+typedef struct
+{
+	FS_Capture_Trigger_t source;
+	uint32_t time;			// ms
+} Trigger_t;
+
+typedef struct
+{
+	const char *name;
+	uint32_t imuPeriod;		// us, 0 if disabled
+	uint32_t baroPeriod;	// us, 0 if disabled
+	uint8_t  capPre;		// s
+	uint16_t capPost;		// s
+	uint32_t duration;		// ms
+	Trigger_t triggers[MAX_TRIGGERS];
+	uint32_t triggerCount;
+} Case_t;
+
+typedef struct
+{
+	uint32_t start;			// ms
+	uint32_t end;
+} Window_t;
+
+typedef struct
+{
+	uint32_t pushed;
+	uint32_t popped;
+	uint32_t fullRate;
+	uint32_t expected;		// samples inside windows
+	uint32_t wrongRate;
+	uint32_t misordered;
+	uint32_t maxDelay;		// ms between push and pop
+	uint32_t maxHeld;		// samples in ring
+	uint32_t firstFull;		// time of first full-rate sample (ms)
+} Stream_t;
+
+static const FS_IMU_Scale_t imuScale = {2000000, ACCEL_FS};
+static uint32_t imuPeriod, baroPeriod;
+static FS_Altitude_Data_t altitude;
+static bool altitudeValid;
+
+static Window_t windows[MAX_WINDOWS];
+static uint32_t windowCount;
+static uint32_t preMs;
+
+const FS_IMU_Scale_t *FS_IMU_GetScale(void)
+{
+	return &imuScale;
+}
+
+uint32_t FS_IMU_GetPeriod(void)
+{
+	return imuPeriod;
+}
+
+uint32_t FS_Baro_GetPeriod(void)
+{
+	return baroPeriod;
+}
+
+bool FS_Altitude_IsValid(void)
+{
+	return altitudeValid;
+}
+
+const FS_Altitude_Data_t *FS_Altitude_GetData(void)
+{
+	return &altitude;
+}
+
+// Windows as FS_Capture_Trigger merges them
+static void Expect_Trigger(uint32_t time, uint32_t postMs)
+{
+	const uint32_t start = time - preMs, end = time + postMs;
+	Window_t *w = &windows[windowCount - 1];
+
+	if (windowCount > 0 && (int32_t) (start - w->end) <= 0)
+	{
+		if ((int32_t) (end - w->end) > 0) w->end = end;
+	}
+	else if (windowCount < MAX_WINDOWS)
+	{
+		windows[windowCount].start = start;
+		windows[windowCount].end = end;
+		++windowCount;
+	}
+}
+
+static bool Expect_FullRate(uint32_t time)
+{
+	uint32_t i;
+
+	for (i = 0; i < windowCount; ++i)
+	{
+		if ((int32_t) (time - windows[i].start) >= 0 && (int32_t) (time - windows[i].end) < 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void Check_Sample(Stream_t *s, uint32_t time, uint32_t *last, uint32_t now, bool fullRate)
+{
+	if (s->popped > 0 && (int32_t) (time - *last) < 0) ++s->misordered;
+	*last = time;
+
+	++s->popped;
+	s->maxDelay = MAX(s->maxDelay, now - time);
+
+	if (fullRate)
+	{
+		if (s->fullRate == 0) s->firstFull = time;
+		++s->fullRate;
+	}
+}
+
+// Samples are scored once all triggers are known
+static void Score(Stream_t *s, const uint32_t *times, const bool *rates, uint32_t count)
+{
+	uint32_t i;
+
+	for (i = 0; i < count; ++i)
+	{
+		s->expected += Expect_FullRate(times[i]);
+		s->wrongRate += (rates[i] != Expect_FullRate(times[i]));
+	}
+}
+
+static void Report(const Case_t *c, const char *sensor, const Stream_t *s,
+		uint32_t count, uint32_t period)
+{
+	HOST_CHECK(s->popped == s->pushed, "%s %s: %lu of %lu samples out", c->name, sensor,
+			(unsigned long) s->popped, (unsigned long) s->pushed);
+	HOST_CHECK(s->misordered == 0, "%s %s: %lu samples out of order", c->name, sensor,
+			(unsigned long) s->misordered);
+	HOST_CHECK(s->wrongRate == 0, "%s %s: %lu samples at the wrong rate", c->name, sensor,
+			(unsigned long) s->wrongRate);
+	HOST_CHECK(s->maxHeld <= count, "%s %s: %lu samples held in a %lu ring", c->name, sensor,
+			(unsigned long) s->maxHeld, (unsigned long) count);
+	// Samples leave on the push that takes the ring past the pre-trigger length
+	HOST_CHECK(s->maxDelay <= preMs + period / 1000 + 1, "%s %s: delayed %lu ms, pre-trigger %lu ms",
+			c->name, sensor, (unsigned long) s->maxDelay, (unsigned long) preMs);
+
+	printf("  %-4s  %7lu samples, %6lu full rate, delay %5lu ms, ring %4lu of %4lu\n",
+			sensor, (unsigned long) s->popped, (unsigned long) s->fullRate,
+			(unsigned long) s->maxDelay, (unsigned long) s->maxHeld, (unsigned long) count);
+}
+
+static void Run(const Case_t *c)
+{
+	static uint32_t imuTimes[2000000], baroTimes[200000];
+	static bool imuRates[2000000], baroRates[200000];
+	const uint32_t postMs = c->capPost * 1000;
+	Stream_t imu = {0}, baro = {0};
+	FS_IMU_Raw_t in, out;
+	FS_Baro_Data_t bin, bout;
+	uint64_t tImu = 0, tBaro = 0, t;
+	uint32_t lastImu = 0, lastBaro = 0, next = 0, now, limit, start;
+	bool fullRate, clamped;
+
+	memset(&hostConfig, 0, sizeof(hostConfig));
+	hostConfig.enable_imu = (c->imuPeriod != 0);
+	hostConfig.enable_baro = (c->baroPeriod != 0);
+	hostConfig.cap_pre = c->capPre;
+	hostConfig.cap_post = c->capPost;
+	hostConfig.cap_accel = 3000;
+	hostConfig.cap_vel_d = 1000;
+
+	imuPeriod = c->imuPeriod;
+	baroPeriod = c->baroPeriod;
+	altitudeValid = true;
+	altitude.velD = 0;
+
+	// Expected pre-trigger length
+	preMs = c->capPre * 1000;
+	if (imuPeriod) preMs = MIN(preMs, (IMU_COUNT - 1) * imuPeriod / 1000);
+	if (baroPeriod) preMs = MIN(preMs, (BARO_COUNT - 1) * baroPeriod / 1000);
+	windowCount = 0;
+
+	Host_ClearEvents();
+	FS_Capture_Init();
+	clamped = Host_FindEvent("Cap_Pre limited");
+
+	limit = (uint64_t) c->duration * 1000;
+	for (;;)
+	{
+		t = MIN(imuPeriod ? tImu : UINT64_MAX, baroPeriod ? tBaro : UINT64_MAX);
+		if (t >= limit) break;
+		now = t / 1000;
+
+		// Button triggers arrive between samples
+		while (next < c->triggerCount && c->triggers[next].time <= now
+				&& c->triggers[next].source == FS_CAPTURE_TRIGGER_BUTTON)
+		{
+			FS_Capture_Trigger(FS_CAPTURE_TRIGGER_BUTTON, c->triggers[next].time);
+			Expect_Trigger(c->triggers[next].time, postMs);
+			++next;
+		}
+
+		if (imuPeriod && t == tImu)
+		{
+			memset(&in, 0, sizeof(in));
+			in.time = now;
+			in.timeUs = t % 1000;
+			in.az = ONE_G;
+
+			if (next < c->triggerCount && c->triggers[next].time <= now
+					&& c->triggers[next].source == FS_CAPTURE_TRIGGER_ACCEL)
+			{
+				in.az = 5 * ONE_G;
+				Expect_Trigger(now, postMs);
+				++next;
+			}
+
+			FS_Capture_PushIMU(&in);
+			++imu.pushed;
+			imu.maxHeld = MAX(imu.maxHeld, imu.pushed - imu.popped);
+
+			while (FS_Capture_PopIMU(&out, &fullRate, false))
+			{
+				imuTimes[imu.popped] = out.time;
+				imuRates[imu.popped] = fullRate;
+				Check_Sample(&imu, out.time, &lastImu, now, fullRate);
+			}
+
+			tImu += imuPeriod;
+		}
+		else
+		{
+			memset(&bin, 0, sizeof(bin));
+			bin.time = now;
+			bin.timeUs = t % 1000;
+			bin.pressure = 101325 * 100;
+
+			altitude.velD = 0;
+			if (next < c->triggerCount && c->triggers[next].time <= now
+					&& c->triggers[next].source == FS_CAPTURE_TRIGGER_VEL_D)
+			{
+				altitude.velD = 20000;
+				Expect_Trigger(now, postMs);
+				++next;
+			}
+
+			FS_Capture_PushBaro(&bin);
+			++baro.pushed;
+			baro.maxHeld = MAX(baro.maxHeld, baro.pushed - baro.popped);
+
+			while (FS_Capture_PopBaro(&bout, &fullRate, false))
+			{
+				baroTimes[baro.popped] = bout.time;
+				baroRates[baro.popped] = fullRate;
+				Check_Sample(&baro, bout.time, &lastBaro, now, fullRate);
+			}
+
+			tBaro += baroPeriod;
+		}
+	}
+
+	// Flush at the end of the session
+	now = limit / 1000;
+	while (FS_Capture_PopIMU(&out, &fullRate, true))
+	{
+		imuTimes[imu.popped] = out.time;
+		imuRates[imu.popped] = fullRate;
+		Check_Sample(&imu, out.time, &lastImu, out.time, fullRate);
+	}
+	while (FS_Capture_PopBaro(&bout, &fullRate, true))
+	{
+		baroTimes[baro.popped] = bout.time;
+		baroRates[baro.popped] = fullRate;
+		Check_Sample(&baro, bout.time, &lastBaro, bout.time, fullRate);
+	}
+
+	Score(&imu, imuTimes, imuRates, imu.popped);
+	Score(&baro, baroTimes, baroRates, baro.popped);
+
+	printf("\n%s: Cap_Pre %u s, pre-trigger %lu ms%s\n", c->name, c->capPre,
+			(unsigned long) preMs, clamped ? " (clamped)" : "");
+
+	HOST_CHECK(clamped == (preMs < c->capPre * 1000u), "%s: clamp %s logged",
+			c->name, clamped ? "" : "not");
+	HOST_CHECK(FS_Capture_GetStats()->triggerCount == windowCount, "%s: %lu windows, %lu expected",
+			c->name, (unsigned long) FS_Capture_GetStats()->triggerCount, (unsigned long) windowCount);
+
+	if (imuPeriod)
+	{
+		Report(c, "IMU", &imu, IMU_COUNT, imuPeriod);
+
+		// First window is full rate from its start, or from the first
+		// sample, with no gap
+		start = ((int32_t) windows[0].start < 0) ? 0 : windows[0].start;
+		HOST_CHECK(windowCount == 0 || imu.firstFull - start <= imuPeriod / 1000 + 1,
+				"%s IMU: full rate from %lu ms, window from %lu ms", c->name,
+				(unsigned long) imu.firstFull, (unsigned long) start);
+		HOST_CHECK(FS_Capture_GetStats()->imuCount == imu.expected, "%s IMU: %lu full rate, %lu expected",
+				c->name, (unsigned long) FS_Capture_GetStats()->imuCount, (unsigned long) imu.expected);
+	}
+	if (baroPeriod)
+	{
+		Report(c, "baro", &baro, BARO_COUNT, baroPeriod);
+		HOST_CHECK(FS_Capture_GetStats()->baroCount == baro.expected, "%s baro: %lu full rate, %lu expected",
+				c->name, (unsigned long) FS_Capture_GetStats()->baroCount, (unsigned long) baro.expected);
+	}
+
+	FS_Capture_DeInit();
+}
+
+int main(void)
+{
+	static const Case_t cases[] =
+	{
+		// Rings hold the whole pre-trigger length
+		{"104 Hz button", 9615, 40000, 5, 10, 120000,
+				{{FS_CAPTURE_TRIGGER_BUTTON, 30000}}, 1},
+		{"104 Hz accel", 9615, 40000, 5, 10, 120000,
+				{{FS_CAPTURE_TRIGGER_ACCEL, 30000}}, 1},
+		{"104 Hz vel_d", 9615, 40000, 5, 10, 120000,
+				{{FS_CAPTURE_TRIGGER_VEL_D, 30000}}, 1},
+
+		// Second trigger extends the window, third starts another
+		{"104 Hz extend", 9615, 40000, 5, 10, 120000,
+				{{FS_CAPTURE_TRIGGER_BUTTON, 30000}, {FS_CAPTURE_TRIGGER_ACCEL, 38000},
+				 {FS_CAPTURE_TRIGGER_VEL_D, 80000}}, 3},
+
+		// Trigger before the ring has filled
+		{"104 Hz early", 9615, 40000, 5, 10, 60000,
+				{{FS_CAPTURE_TRIGGER_BUTTON, 2000}}, 1},
+
+		// Rings fill before Cap_Pre has passed
+		{"833 Hz", 1200, 40000, 10, 10, 60000,
+				{{FS_CAPTURE_TRIGGER_BUTTON, 30000}}, 1},
+		{"baro 200 Hz", 9615, 5000, 10, 10, 60000,
+				{{FS_CAPTURE_TRIGGER_ACCEL, 30000}}, 1},
+		{"104 Hz Cap_Pre 60", 9615, 40000, 60, 10, 120000,
+				{{FS_CAPTURE_TRIGGER_BUTTON, 70000}}, 1},
+		{"6666 Hz", 150, 0, 1, 5, 20000,
+				{{FS_CAPTURE_TRIGGER_ACCEL, 10000}}, 1},
+
+		// Barometer only
+		{"baro only", 0, 40000, 20, 10, 120000,
+				{{FS_CAPTURE_TRIGGER_VEL_D, 60000}}, 1},
+	};
+	uint32_t i;
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+	{
+		Run(&cases[i]);
+	}
+
+	return Host_Finish("test_capture");
+}
@@ -0,0 +1,574 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+// Replays a jump through audio control twice for each of a range of
+// configurations: once with the configuration compiled at
+// FS_AudioControl_Init, and once through ref_audio_control.c, which
+// reads it on every epoch. Both must produce the same audio timeline.
+// The host time spent in the tasks run after each GNSS epoch and each
+// barometer sample is printed for comparison, with the producer cost
+// each logs at FS_AudioControl_DeInit.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "main.h"
+#include "ahrs.h"
+#include "altitude.h"
+#include "audio_control.h"
+#include "host.h"
+#include "host_audio.h"
+#include "kalman.h"
+#include "timestamp.h"
+#include "track.h"
+
+#define MAX_POINTS     200000
+#define TRUTH_STEP     0.01		// s
+#define GNSS_RATE_MS   200
+#define GNSS_DELAY_US  60000	// solution to delivery
+#define BARO_PERIOD_US 40000
+#define GNSS_NOISE     1.5		// m
+#define BARO_NOISE     2.0		// Pa
+#define TOW_START_MS   345600000
+#define LOCAL_START_US 5000000	// local clock at start of track
+#define MAX_EVENTS     65536
+
+typedef struct
+{
+	const char *name;
+	void (*Init)(void);
+	void (*DeInit)(void);
+	void (*UpdateGNSS)(const FS_GNSS_Data_t *current);
+	void (*UpdateBaro)(void);
+} Impl_t;
+
+typedef struct
+{
+	const char *name;
+	void (*Setup)(FS_Config_Data_t *config);
+} Case_t;
+
+typedef struct
+{
+	uint64_t gnssNs;		// host time in tasks after GNSS epochs
+	uint32_t gnssCount;
+	uint64_t baroNs;		// host time in tasks after barometer samples
+	uint32_t baroCount;
+	uint32_t cycles;		// mean producer cost logged by the module
+} Cost_t;
+
+// Reference module, see ref_audio_control.c
+void Ref_AudioControl_Init(void);
+void Ref_AudioControl_DeInit(void);
+void Ref_AudioControl_UpdateGNSS(const FS_GNSS_Data_t *current);
+void Ref_AudioControl_UpdateBaro(void);
+
+static const Impl_t implRef = {
+	"per epoch",
+	Ref_AudioControl_Init,
+	Ref_AudioControl_DeInit,
+	Ref_AudioControl_UpdateGNSS,
+	Ref_AudioControl_UpdateBaro
+};
+
+static const Impl_t implNew = {
+	"compiled",
+	FS_AudioControl_Init,
+	FS_AudioControl_DeInit,
+	FS_AudioControl_UpdateGNSS,
+	FS_AudioControl_UpdateBaro
+};
+
+static Track_Point_t track[MAX_POINTS];
+static uint32_t trackCount;
+static double groundAlt;
+static int32_t destLat, destLon;
+
+static FS_GNSS_Data_t gnssData;
+
+static Host_Audio_Event_t refEvents[MAX_EVENTS];
+static uint32_t refCount;
+
+// Modules outside this harness
+uint16_t FS_GNSS_GetRate(void)
+{
+	return GNSS_RATE_MS;
+}
+
+const FS_GNSS_Data_t *FS_GNSS_GetData(void)
+{
+	return &gnssData;
+}
+
+bool FS_Kalman_IsValid(void)
+{
+	return false;
+}
+
+const FS_Kalman_Data_t *FS_Kalman_GetData(void)
+{
+	static FS_Kalman_Data_t data;
+	return &data;
+}
+
+bool FS_AHRS_IsValid(void)
+{
+	return false;
+}
+
+const FS_AHRS_Data_t *FS_AHRS_GetData(void)
+{
+	static FS_AHRS_Data_t data;
+	return &data;
+}
+
+static void Alarm(FS_Config_Data_t *config, int32_t agl, uint8_t type, const char *filename)
+{
+	FS_Config_Alarm_t *alarm = &config->alarms[config->num_alarms++];
+
+	alarm->elev = agl * 1000;
+	alarm->type = type;
+	strcpy(alarm->filename, filename);
+}
+
+static void Speech(FS_Config_Data_t *config, uint8_t mode, uint8_t units, int32_t decimals)
+{
+	FS_Config_Speech_t *speech = &config->speech[config->num_speech++];
+
+	speech->mode = mode;
+	speech->units = units;
+	speech->decimals = decimals;
+}
+
+static void Setup_Glide(FS_Config_Data_t *config)
+{
+	Speech(config, FS_CONFIG_MODE_GLIDE_RATIO, 0, 2);
+}
+
+static void Setup_HorizontalSAS(FS_Config_Data_t *config)
+{
+	config->mode = FS_CONFIG_MODE_HORIZONTAL_SPEED;
+	config->min = 0;
+	config->max = 8000;
+	config->mode_2 = FS_CONFIG_MODE_MAGNITUDE_OF_VALUE_1;
+	config->min_2 = 0;
+	config->max_2 = 8000;
+	config->use_sas = 1;
+	Speech(config, FS_CONFIG_MODE_HORIZONTAL_SPEED, FS_CONFIG_UNITS_KMH, 1);
+}
+
+static void Setup_VerticalMPH(FS_Config_Data_t *config)
+{
+	config->mode = FS_CONFIG_MODE_VERTICAL_SPEED;
+	config->min = 1000;
+	config->max = 6000;
+	config->limits = 0;
+	config->use_sas = 0;
+	config->hThreshold = 500;
+	Speech(config, FS_CONFIG_MODE_VERTICAL_SPEED, FS_CONFIG_UNITS_MPH, 0);
+}
+
+static void Setup_TotalKnots(FS_Config_Data_t *config)
+{
+	config->mode = FS_CONFIG_MODE_TOTAL_SPEED;
+	config->min = 2000;
+	config->max = 7000;
+	config->limits = 3;
+	config->flatline = 1;
+	Speech(config, FS_CONFIG_MODE_TOTAL_SPEED, FS_CONFIG_UNITS_KNOTS, 1);
+	Speech(config, FS_CONFIG_MODE_DIVE_ANGLE, 0, 0);
+	Speech(config, FS_CONFIG_MODE_INVERSE_GLIDE_RATIO, 0, 1);
+}
+
+static void Setup_Navigation(FS_Config_Data_t *config)
+{
+	config->mode = FS_CONFIG_MODE_DIRECTION_TO_DESTINATION;
+	config->lat = destLat;
+	config->lon = destLon;
+	config->max_dist = 0;
+	config->end_nav = 0;
+	config->bearing = 90;
+	Speech(config, FS_CONFIG_MODE_DIRECTION_TO_DESTINATION, 0, 0);
+	Speech(config, FS_CONFIG_MODE_DISTANCE_TO_DESTINATION, FS_CONFIG_UNITS_METERS, 1);
+	Speech(config, FS_CONFIG_MODE_DIRECTION_TO_BEARING, 0, 0);
+}
+
+// Destination out of range, so direction is never spoken
+static void Setup_NavigationLimits(FS_Config_Data_t *config)
+{
+	Setup_Navigation(config);
+	config->max_dist = 1;
+}
+
+static void Setup_Distance(FS_Config_Data_t *config)
+{
+	config->mode = FS_CONFIG_MODE_DIRECTION_TO_BEARING;
+	config->bearing = 270;
+	config->lat = destLat;
+	config->lon = destLon;
+	Speech(config, FS_CONFIG_MODE_DISTANCE_TO_DESTINATION, FS_CONFIG_UNITS_FEET, 1);
+	Speech(config, FS_CONFIG_MODE_DISTANCE_TO_DESTINATION, FS_CONFIG_UNITS_NM, 1);
+}
+
+static void Setup_AltitudeSpeech(FS_Config_Data_t *config)
+{
+	config->mode = FS_CONFIG_MODE_INVERSE_GLIDE_RATIO;
+	config->min = 0;
+	config->max = 300;
+	Speech(config, FS_CONFIG_MODE_ALTITUDE, FS_CONFIG_UNITS_FEET, 100);
+	Speech(config, FS_CONFIG_MODE_ALTITUDE, FS_CONFIG_UNITS_METERS, 50);
+}
+
+// Alarms out of order, sharing elevations, and beyond the jump
+static void Setup_Alarms(FS_Config_Data_t *config)
+{
+	Alarm(config, 1000, 4, "pull");
+	Alarm(config, 3000, 2, "");
+	Alarm(config, 3000, 1, "");
+	Alarm(config, 2500, 4, "alt2500");
+	Alarm(config, 1000, 3, "");
+	Alarm(config, 2000, 1, "");
+	Alarm(config, 2000, 4, "alt2000");
+	Alarm(config, 300, 4, "alt300");
+	Alarm(config, 9000, 1, "");
+	Alarm(config, -100, 3, "");
+	config->alarm_window_above = 300 * 1000;
+	config->alarm_window_below = 100 * 1000;
+}
+
+static void Setup_AltStepFeet(FS_Config_Data_t *config)
+{
+	Setup_Alarms(config);
+	config->alt_units = FS_CONFIG_UNITS_FEET;
+	config->alt_step = 1000;
+}
+
+static void Setup_AltStepMeters(FS_Config_Data_t *config)
+{
+	Alarm(config, 1500, 4, "alt1500");
+	Alarm(config, 1000, 2, "");
+	config->alt_units = FS_CONFIG_UNITS_METERS;
+	config->alt_step = 500;
+	config->alarm_window_above = 50 * 1000;
+	config->alarm_window_below = 50 * 1000;
+	Speech(config, FS_CONFIG_MODE_HORIZONTAL_SPEED, FS_CONFIG_UNITS_KMH, 0);
+}
+
+static void Setup_Windows(FS_Config_Data_t *config)
+{
+	Setup_AltStepMeters(config);
+	config->windows[0].top = 3200 * 1000;
+	config->windows[0].bottom = 2700 * 1000;
+	config->windows[1].top = 1800 * 1000;
+	config->windows[1].bottom = 1200 * 1000;
+	config->num_windows = 2;
+}
+
+static const Case_t cases[] = {
+	{"glide ratio",               Setup_Glide},
+	{"horizontal speed, SAS",     Setup_HorizontalSAS},
+	{"vertical speed, mph",       Setup_VerticalMPH},
+	{"total speed, knots",        Setup_TotalKnots},
+	{"navigation",                Setup_Navigation},
+	{"navigation out of range",   Setup_NavigationLimits},
+	{"distance, feet and nm",     Setup_Distance},
+	{"altitude speech",           Setup_AltitudeSpeech},
+	{"alarms",                    Setup_Alarms},
+	{"altitude step, feet",       Setup_AltStepFeet},
+	{"altitude step, meters",     Setup_AltStepMeters},
+	{"silence windows",           Setup_Windows},
+};
+
+#define NUM_CASES (sizeof(cases) / sizeof(cases[0]))
+
+static double Gaussian(double sigma)
+{
+	const double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+	const double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+	return sigma * sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static uint64_t Local(double t)
+{
+	return LOCAL_START_US + (uint64_t) llround(t * 1e6);
+}
+
+static void Configure(const Case_t *c)
+{
+	memset(&hostConfig, 0, sizeof(hostConfig));
+	hostConfig.mode = FS_CONFIG_MODE_GLIDE_RATIO;
+	hostConfig.min = 0;
+	hostConfig.max = 300;
+	hostConfig.limits = 1;
+	hostConfig.volume = 6;
+	hostConfig.mode_2 = FS_CONFIG_MODE_CHANGE_IN_VALUE_1;
+	hostConfig.min_2 = 300;
+	hostConfig.max_2 = 1500;
+	hostConfig.min_rate = FS_CONFIG_RATE_ONE_HZ;
+	hostConfig.max_rate = 5 * FS_CONFIG_RATE_ONE_HZ;
+	hostConfig.sp_rate = 4000;
+	hostConfig.sp_volume = 7;
+	hostConfig.threshold = 1000;
+	hostConfig.use_sas = 1;
+	hostConfig.dz_elev = lround(groundAlt * 1000);
+	hostConfig.alt_units = FS_CONFIG_UNITS_FEET;
+	hostConfig.max_dist = 10000;
+	hostConfig.min_angle = 5;
+	hostConfig.enable_audio = 1;
+
+	c->Setup(&hostConfig);
+}
+
+static void Deliver_Baro(const Impl_t *impl, double t)
+{
+	Track_Point_t p;
+	FS_Baro_Data_t baro;
+	uint32_t ms;
+	uint16_t us;
+
+	Track_Interpolate(track, trackCount, t, &p);
+
+	FS_Timestamp_Get(&ms, &us);
+	baro.time = ms;
+	baro.timeUs = us;
+	baro.pressure = lround((Track_Pressure(p.hMSL) + Gaussian(BARO_NOISE)) * 100);
+	baro.temperature = 1500;
+
+	FS_Altitude_UpdateBaro(&baro);
+	impl->UpdateBaro();
+}
+
+static void Deliver_GNSS(const Impl_t *impl, double t)
+{
+	Track_Point_t p;
+
+	Track_Interpolate(track, trackCount, t, &p);
+	p.hMSL += Gaussian(GNSS_NOISE);
+	p.velD += Gaussian(p.sAcc / 2);
+	Track_ToGNSS(&p, TOW_START_MS + lround(t * 1000), &gnssData);
+
+	FS_Altitude_UpdateGNSS(&gnssData);
+	impl->UpdateGNSS(&gnssData);
+}
+
+static void Deliver_Pulse(double t)
+{
+	uint32_t ms;
+	uint16_t us;
+
+	FS_Timestamp_Get(&ms, &us);
+	FS_Timestamp_Timepulse(ms, us, 2300, TOW_START_MS + lround(t * 1000), 0);
+}
+
+// Runs the track through one implementation and measures its cost
+static void Replay(const Impl_t *impl, const Case_t *c, Cost_t *cost)
+{
+	const double end = track[trackCount - 1].t;
+	double tBaro = 0, tGnss = 0, tPulse = 0, t;
+	const char *event;
+	uint32_t calls, max;
+	uint64_t start;
+
+	memset(cost, 0, sizeof(*cost));
+
+	srand(1);
+	Configure(c);
+	Host_SetTime(Local(0));
+	Host_Audio_Reset(800);
+	FS_Timestamp_Init();
+	FS_Timestamp_Reset();
+	FS_Altitude_Init();
+	impl->Init();
+
+	for (;;)
+	{
+		// Next event in time order
+		t = fmin(tGnss + GNSS_DELAY_US * 1e-6, fmin(tBaro, tPulse));
+		if (t > end) break;
+
+		Host_Advance(Local(t) - Host_GetTime());
+
+		if (t == tPulse)
+		{
+			Deliver_Pulse(t);
+			tPulse += 1;
+			Host_RunTasks();
+		}
+		else if (t == tBaro)
+		{
+			Deliver_Baro(impl, t);
+			tBaro += BARO_PERIOD_US * 1e-6;
+
+			start = Host_Nanoseconds();
+			Host_RunTasks();
+			cost->baroNs += Host_Nanoseconds() - start;
+			++cost->baroCount;
+		}
+		else
+		{
+			Deliver_GNSS(impl, tGnss);
+			tGnss += GNSS_RATE_MS * 1e-3;
+
+			start = Host_Nanoseconds();
+			Host_RunTasks();
+			cost->gnssNs += Host_Nanoseconds() - start;
+			++cost->gnssCount;
+		}
+	}
+
+	Host_ClearEvents();
+	impl->DeInit();
+
+	event = Host_MatchEvent("Audio control producer:");
+	HOST_CHECK(event != NULL, "%s, %s: no producer cost logged", c->name, impl->name);
+	if (event)
+	{
+		sscanf(event, "Audio control producer: %u calls, mean %u cycles, max %u cycles",
+				&calls, &cost->cycles, &max);
+	}
+}
+
+static bool Same(const Host_Audio_Event_t *a, const Host_Audio_Event_t *b)
+{
+	return a->time == b->time &&
+	       a->kind == b->kind &&
+	       a->startFrequency == b->startFrequency &&
+	       a->endFrequency == b->endFrequency &&
+	       a->duration == b->duration &&
+	       a->volume == b->volume &&
+	       !strcmp(a->filename, b->filename);
+}
+
+static void Compare(const Case_t *c)
+{
+	uint32_t i, n, beeps = 0, plays = 0;
+
+	n = MIN(refCount, Host_Audio_Count());
+	for (i = 0; i < n && Same(&refEvents[i], Host_Audio_Get(i)); ++i)
+	{
+		if (refEvents[i].kind == HOST_AUDIO_BEEP) ++beeps;
+		if (refEvents[i].kind == HOST_AUDIO_PLAY) ++plays;
+	}
+
+	HOST_CHECK(refCount == Host_Audio_Count(), "%s: %u actions per epoch, %u compiled",
+			c->name, refCount, Host_Audio_Count());
+
+	if (i < n)
+	{
+		const Host_Audio_Event_t *a = &refEvents[i];
+		const Host_Audio_Event_t *b = Host_Audio_Get(i);
+
+		HOST_CHECK(false, "%s: action %u differs at %.3f s: kind %d %u-%u Hz %s vol %u"
+				" per epoch, kind %d %u-%u Hz %s vol %u at %.3f s compiled",
+				c->name, i, (a->time - LOCAL_START_US) * 1e-6,
+				a->kind, a->startFrequency, a->endFrequency, a->filename, a->volume,
+				b->kind, b->startFrequency, b->endFrequency, b->filename, b->volume,
+				(b->time - LOCAL_START_US) * 1e-6);
+	}
+
+	HOST_CHECK(beeps > 0 && plays > 0, "%s: %u beeps and %u clips, expected both",
+			c->name, beeps, plays);
+}
+
+static void Print(const char *name, uint32_t actions, const Cost_t *ref, const Cost_t *cur)
+{
+	printf("%-24s  %7u  %7.0f  %7.0f  %7.0f  %7.0f  %6u  %6u\n", name, actions,
+			(double) ref->gnssNs / ref->gnssCount, (double) cur->gnssNs / cur->gnssCount,
+			(double) ref->baroNs / ref->baroCount, (double) cur->baroNs / cur->baroCount,
+			ref->cycles, cur->cycles);
+}
+
+int main(int argc, char **argv)
+{
+	Cost_t ref, cur, refTotal, curTotal;
+	uint32_t i, k, actions = 0;
+
+	if (argc > 1)
+	{
+		trackCount = Track_Load(argv[1], track, MAX_POINTS);
+		if (trackCount < 2)
+		{
+			printf("%s: no GNSS rows\n", argv[1]);
+			return 1;
+		}
+
+		// Lowest point of the recording is taken as the ground
+		groundAlt = track[0].hMSL;
+		for (i = 1; i < trackCount; ++i)
+		{
+			groundAlt = fmin(groundAlt, track[i].hMSL);
+		}
+	}
+	else
+	{
+		trackCount = Track_Synth(track, MAX_POINTS, TRUTH_STEP);
+		groundAlt = track[0].hMSL;
+	}
+
+	// Destination at the last point of the track
+	destLat = lround(track[trackCount - 1].lat * 1e7);
+	destLon = lround(track[trackCount - 1].lon * 1e7);
+
+	memset(&refTotal, 0, sizeof(refTotal));
+	memset(&curTotal, 0, sizeof(curTotal));
+
+	printf("%-24s  %7s  %16s  %16s  %14s\n", "", "", "GNSS epoch (ns)",
+			"baro sample (ns)", "producer (cyc)");
+	printf("%-24s  %7s  %7s  %7s  %7s  %7s  %6s  %6s\n", "configuration", "actions",
+			"epoch", "init", "epoch", "init", "epoch", "init");
+
+	for (k = 0; k < NUM_CASES; ++k)
+	{
+		Replay(&implRef, &cases[k], &ref);
+		refCount = MIN(Host_Audio_Count(), MAX_EVENTS);
+		for (i = 0; i < refCount; ++i)
+		{
+			refEvents[i] = *Host_Audio_Get(i);
+		}
+
+		Replay(&implNew, &cases[k], &cur);
+		Compare(&cases[k]);
+
+		Print(cases[k].name, refCount, &ref, &cur);
+
+		actions += refCount;
+		refTotal.gnssNs += ref.gnssNs;
+		refTotal.gnssCount += ref.gnssCount;
+		refTotal.baroNs += ref.baroNs;
+		refTotal.baroCount += ref.baroCount;
+		refTotal.cycles += ref.cycles;
+		curTotal.gnssNs += cur.gnssNs;
+		curTotal.gnssCount += cur.gnssCount;
+		curTotal.baroNs += cur.baroNs;
+		curTotal.baroCount += cur.baroCount;
+		curTotal.cycles += cur.cycles;
+	}
+
+	refTotal.cycles /= NUM_CASES;
+	curTotal.cycles /= NUM_CASES;
+	Print("all", actions, &refTotal, &curTotal);
+
+	return Host_Finish("test_control");
+}
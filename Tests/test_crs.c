@@ -0,0 +1,376 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+// Reads a file through crs.c and custom_app.c over a simulated BLE link
+// that drops a share of the notifications, as a phone does when its
+// buffers overflow. The client follows Scripts/ble_test.py: selective
+// repeat acknowledges every packet with a bitmap of those received
+// beyond a gap, while go-back-N accepts only the next packet in order.
+// Both must deliver the file intact. Goodput is printed at each loss
+// rate, with the notifications repeated to get there.
+//
+// The same read is then repeated on a clean link with TX pools of
+// different sizes, checking the counters custom_app.c keeps for its
+// bursts against what the stack saw.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "crs.h"
+#include "custom_app.h"
+#include "host.h"
+#include "host_ble.h"
+#include "host_ff.h"
+#include "resource_manager.h"
+
+#define TEST_NAME      "test_crs"
+#define FILE_NAME      "CRS.BIN"
+#define FILE_SIZE      (100 * 1024 + 77)
+#define FRAME_LENGTH   242			// as in crs.c
+#define SACK_LENGTH    FS_CRS_WINDOW_MAX
+#define PENDING_SLOTS  64
+#define RX_TIMEOUT_US  10000000		// client gives up, as in ble_test.py
+#define RUN_SEED       7
+
+// Connection at 15 ms with up to six notifications per event, and a TX
+// pool holding eight of them
+#define LINK_INTERVAL  15000
+#define LINK_PER_EVENT 6
+#define LINK_POOL      8
+
+typedef struct
+{
+	bool     done;
+	double   goodput;		// kB/s
+	uint32_t sent;			// notifications sent, including repeats
+	Custom_CRS_Stats_t stats;
+} Result_t;
+
+static char sdRoot[] = "/tmp/test_crs.XXXXXX";
+
+static uint8_t fileData[FILE_SIZE];
+
+static struct
+{
+	bool     sack;
+	uint32_t next;			// next packet expected
+	uint32_t last;			// one past the end of file packet
+	uint64_t done;			// time the last packet was delivered
+	uint64_t heard;			// time of the last notification
+	uint32_t pendingNum[PENDING_SLOTS];
+	uint8_t  pendingLen[PENDING_SLOTS];
+	uint8_t  pendingData[PENDING_SLOTS][FRAME_LENGTH];
+	uint8_t  data[FILE_SIZE + FRAME_LENGTH];
+	uint32_t size;
+	bool     overflow;
+} client;
+
+static uint32_t resourceHeld;
+
+FS_ResourceManager_Result_t FS_ResourceManager_RequestResource(FS_Resource_t resource)
+{
+	UNUSED(resource);
+	++resourceHeld;
+	return FS_RESOURCE_MANAGER_SUCCESS;
+}
+
+void FS_ResourceManager_ReleaseResource(FS_Resource_t resource)
+{
+	UNUSED(resource);
+	--resourceHeld;
+}
+
+static void Client_Deliver(const uint8_t *data, uint32_t length)
+{
+	if (client.size + length > sizeof(client.data))
+	{
+		client.overflow = true;
+		return;
+	}
+
+	memcpy(&client.data[client.size], data, length);
+	client.size += length;
+}
+
+static void Client_ReceiveGBN(const uint8_t *data, uint8_t length)
+{
+	uint8_t ack[2] = {0x12, data[1]};
+
+	if (data[1] != (client.next & 0xff)) return;
+
+	if (length > 2)
+	{
+		Client_Deliver(&data[2], length - 2);
+	}
+	else
+	{
+		client.last = client.next + 1;
+	}
+
+	++client.next;
+	Host_BLE_Write(ack, sizeof(ack));
+}
+
+static void Client_ReceiveSACK(const uint8_t *data, uint8_t length)
+{
+	const uint8_t delta = data[1] - client.next;
+	uint8_t ack[6] = {0x12};
+	uint32_t bitmap = 0, num, i;
+
+	// Recover full packet number
+	if (delta < SACK_LENGTH + 1)
+	{
+		num = client.next + delta;
+		i = num % PENDING_SLOTS;
+		client.pendingNum[i] = num;
+		client.pendingLen[i] = length - 2;
+		memcpy(client.pendingData[i], &data[2], length - 2);
+
+		if (length == 2)
+		{
+			client.last = num + 1;
+		}
+	}
+
+	// Deliver in order
+	while (client.pendingNum[i = client.next % PENDING_SLOTS] == client.next)
+	{
+		Client_Deliver(client.pendingData[i], client.pendingLen[i]);
+		client.pendingNum[i] = UINT32_MAX;
+		++client.next;
+	}
+
+	// Acknowledge next expected packet and those received beyond it
+	for (i = 0; i < SACK_LENGTH; ++i)
+	{
+		num = client.next + 1 + i;
+		if (client.pendingNum[num % PENDING_SLOTS] == num)
+		{
+			bitmap |= 1UL << i;
+		}
+	}
+
+	ack[1] = client.next & 0xff;
+	memcpy(&ack[2], &bitmap, sizeof(bitmap));
+	Host_BLE_Write(ack, sizeof(ack));
+}
+
+static void Client_Receive(const uint8_t *data, uint8_t length)
+{
+	client.heard = Host_GetTime();
+
+	if ((length < 2) || (data[0] != 0x10)) return;
+
+	if (client.sack) Client_ReceiveSACK(data, length);
+	else             Client_ReceiveGBN(data, length);
+
+	if ((client.next == client.last) && !client.done)
+	{
+		client.done = Host_GetTime();
+	}
+}
+
+static void Test_Read(bool sack, const Host_BLE_Link_t *link, Result_t *result)
+{
+	const uint32_t loss = link->loss;
+	const char *name = sack ? "selective repeat" : "go-back-N";
+	uint8_t command[9 + sizeof(FILE_NAME)] = {sack ? 0x06 : 0x02};
+	uint64_t start;
+	uint32_t i;
+
+	memset(&client, 0, sizeof(client));
+	client.sack = sack;
+	client.last = UINT32_MAX;
+	for (i = 0; i < PENDING_SLOTS; ++i)
+	{
+		client.pendingNum[i] = UINT32_MAX;
+	}
+
+	srand(RUN_SEED);
+	Host_BLE_Connect(link, Client_Receive);
+
+	// Offset and stride of zero, then the file name
+	memcpy(&command[9], FILE_NAME, sizeof(FILE_NAME) - 1);
+	Host_BLE_Write(command, sizeof(command) - 1);
+
+	start = client.heard = Host_GetTime();
+	while (!client.done && (Host_GetTime() - client.heard < RX_TIMEOUT_US))
+	{
+		Host_BLE_Advance(LINK_INTERVAL);
+	}
+
+	// Let the final acknowledgement through
+	Host_BLE_Advance(10 * LINK_INTERVAL);
+
+	result->done = client.done;
+	result->goodput = client.done ? FILE_SIZE * 1e3 / (client.done - start) : 0;
+	result->sent = Host_BLE_Sent();
+	Custom_CRS_GetStats(&result->stats);
+
+	HOST_CHECK(client.done, "%s at %.1f%% loss: stalled after %u of %u bytes",
+			name, loss * 0.1, client.size, FILE_SIZE);
+	HOST_CHECK(!client.overflow && (client.size == FILE_SIZE) &&
+			!memcmp(client.data, fileData, FILE_SIZE),
+			"%s at %.1f%% loss: file differs (%u of %u bytes)",
+			name, loss * 0.1, client.size, FILE_SIZE);
+	HOST_CHECK(resourceHeld == 0, "%s at %.1f%% loss: transfer still open",
+			name, loss * 0.1);
+
+	Host_BLE_Disconnect();
+	resourceHeld = 0;
+}
+
+static void Test_Pool(uint32_t pool, uint32_t packets)
+{
+	const Host_BLE_Link_t link = {LINK_INTERVAL, LINK_PER_EVENT, pool, 0};
+	const double capacity = LINK_PER_EVENT * FRAME_LENGTH * 1e3 / LINK_INTERVAL;
+	const Custom_CRS_Stats_t *stats;
+	Result_t result;
+	char text[64];
+
+	Host_ClearEvents();
+	Test_Read(true, &link, &result);
+	stats = &result.stats;
+
+	printf("%4u  %8.1f  %8u  %8u  %8u  %8u\n", pool, result.goodput,
+			stats->bursts, stats->max_burst, stats->pool_full, Host_BLE_PoolPeak());
+
+	HOST_CHECK(stats->notifications == Host_BLE_Sent(),
+			"pool of %u: %u notifications counted, %u reached the stack",
+			pool, stats->notifications, Host_BLE_Sent());
+	HOST_CHECK(stats->notifications == packets + 1,
+			"pool of %u: %u notifications for %u packets", pool,
+			stats->notifications, packets);
+	HOST_CHECK(stats->pool_full == Host_BLE_PoolFull(),
+			"pool of %u: %u full pools counted, stack refused %u",
+			pool, stats->pool_full, Host_BLE_PoolFull());
+	HOST_CHECK(Host_BLE_PoolPeak() <= pool, "pool of %u held %u notifications",
+			pool, Host_BLE_PoolPeak());
+	HOST_CHECK(stats->max_burst <= pool, "pool of %u: burst of %u notifications",
+			pool, stats->max_burst);
+	HOST_CHECK(stats->conn_interval == LINK_INTERVAL / 1250,
+			"pool of %u: connection interval %u", pool, stats->conn_interval);
+
+	// Selective repeat keeps more in flight than these pools hold, so
+	// they fill and sending resumes on TX pool available
+	if (pool < FS_CRS_WINDOW_LENGTH)
+	{
+		HOST_CHECK(stats->pool_full > 0 && Host_BLE_PoolAvailable() > 0,
+				"pool of %u: never full (%u), %u resumes", pool,
+				stats->pool_full, Host_BLE_PoolAvailable());
+	}
+
+	// A pool covering a connection event keeps the link busy
+	if (pool >= LINK_PER_EVENT)
+	{
+		HOST_CHECK(result.goodput >= 0.9 * capacity,
+				"pool of %u: %.1f kB/s of %.1f kB/s", pool, result.goodput, capacity);
+	}
+
+	// Logged on disconnect
+	snprintf(text, sizeof(text), "CRS: %u notifications, %u bytes",
+			stats->notifications, stats->bytes);
+	HOST_CHECK(Host_FindEvent(text), "pool of %u: no \"%s\" event", pool, text);
+	HOST_CHECK(Host_FindEvent("per connection event"),
+			"pool of %u: no rate event", pool);
+}
+
+int main(void)
+{
+	static const uint32_t losses[] = {0, 5, 10, 20, 50, 100, 200};
+	static const uint32_t pools[] = {1, 2, 4, 6, 8, 16, 32};
+	// Data packets, the empty end of file packet and the acknowledgement
+	// of the read command
+	const uint32_t packets = (FILE_SIZE + FRAME_LENGTH - 1) / FRAME_LENGTH + 1;
+	Result_t sack, gbn;
+	char path[256];
+	FILE *fp;
+	uint32_t i;
+
+	HOST_CHECK(mkdtemp(sdRoot) != NULL, "couldn't create %s", sdRoot);
+	snprintf(path, sizeof(path), "%s/%s", sdRoot, FILE_NAME);
+
+	srand(1);
+	for (i = 0; i < FILE_SIZE; ++i)
+	{
+		fileData[i] = rand();
+	}
+
+	fp = fopen(path, "wb");
+	HOST_CHECK(fp && fwrite(fileData, 1, FILE_SIZE, fp) == FILE_SIZE,
+			"couldn't write %s", path);
+	if (fp) fclose(fp);
+
+	Host_SetTime(1000000);
+	Host_FF_SetRoot(sdRoot);
+
+	Custom_APP_Init();
+	FS_CRS_Init();
+
+	printf("%u bytes in %u packets, %u ms interval, %u per event, pool of %u\n",
+			FILE_SIZE, packets, LINK_INTERVAL / 1000, LINK_PER_EVENT, LINK_POOL);
+	printf("%6s  %22s  %22s\n", "", "selective repeat", "go-back-N");
+	printf("%6s  %10s  %10s  %10s  %10s\n", "loss", "kB/s", "sent", "kB/s", "sent");
+
+	for (i = 0; i < sizeof(losses) / sizeof(losses[0]); ++i)
+	{
+		const Host_BLE_Link_t link = {LINK_INTERVAL, LINK_PER_EVENT, LINK_POOL, losses[i]};
+
+		Test_Read(true, &link, &sack);
+		Test_Read(false, &link, &gbn);
+
+		printf("%5.1f%%  %10.1f  %10u  %10.1f  %10u\n", losses[i] * 0.1,
+				sack.goodput, sack.sent, gbn.goodput, gbn.sent);
+
+		if (losses[i] == 0)
+		{
+			HOST_CHECK(sack.sent == packets + 1, "selective repeat sent %u notifications"
+					" for %u packets on a clean link", sack.sent, packets);
+			HOST_CHECK(gbn.sent == packets + 1, "go-back-N sent %u notifications"
+					" for %u packets on a clean link", gbn.sent, packets);
+		}
+		else
+		{
+			HOST_CHECK(sack.goodput > gbn.goodput, "selective repeat at %.1f kB/s"
+					" slower than go-back-N at %.1f kB/s with %.1f%% loss",
+					sack.goodput, gbn.goodput, losses[i] * 0.1);
+		}
+	}
+
+	printf("\n%4s  %8s  %8s  %8s  %8s  %8s\n", "pool", "kB/s", "bursts",
+			"largest", "full", "peak");
+
+	for (i = 0; i < sizeof(pools) / sizeof(pools[0]); ++i)
+	{
+		Test_Pool(pools[i], packets);
+	}
+
+	remove(path);
+	rmdir(sdRoot);
+
+	return Host_Finish(TEST_NAME);
+}
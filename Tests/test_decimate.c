@@ -0,0 +1,234 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+// Measures the CIC3 decimator's frequency response against the
+// theoretical |sin(pi f R) / (R sin(pi f))|^3, checks DC gain, range
+// and timestamps, and times it per input sample.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "main.h"
+#include "decimate.h"
+#include "host.h"
+
+#define OUTPUTS       2000
+#define AMPLITUDE     1000000.0
+#define STEPS         48
+
+static const uint8_t rates[] = {2, 4, 8, 16, 25, 64};
+
+static double Theory(double f, uint8_t rate)
+{
+	const double num = sin(M_PI * f * rate);
+	const double den = rate * sin(M_PI * f);
+
+	return (fabs(den) < 1e-12) ? 1 : pow(fabs(num / den), FS_DECIMATE_ORDER);
+}
+
+// Feeds a sinusoid of frequency f (cycles per input sample) and fits
+// the amplitude of the output at the same frequency
+static double Measure(double f, uint8_t rate)
+{
+	FS_Decimate_t dec;
+	int32_t in[1], out[1];
+	uint32_t ms = 0, n = 0, k = 0;
+	uint16_t us = 0;
+	double ss = 0, sc = 0, cc = 0, sy = 0, cy = 0, t, a, b, det;
+
+	FS_Decimate_Init(&dec, 1, rate);
+
+	while (n < OUTPUTS)
+	{
+		in[0] = lround(AMPLITUDE * sin(2 * M_PI * f * k + 0.3));
+		if (FS_Decimate_Update(&dec, in, out, &ms, &us))
+		{
+			// Output is centred on the filter window
+			t = k - FS_DECIMATE_ORDER * (rate - 1) / 2.0;
+			ss += sin(2 * M_PI * f * t) * sin(2 * M_PI * f * t);
+			sc += sin(2 * M_PI * f * t) * cos(2 * M_PI * f * t);
+			cc += cos(2 * M_PI * f * t) * cos(2 * M_PI * f * t);
+			sy += sin(2 * M_PI * f * t) * out[0];
+			cy += cos(2 * M_PI * f * t) * out[0];
+			++n;
+		}
+		++k;
+	}
+
+	det = ss * cc - sc * sc;
+	a = (sy * cc - cy * sc) / det;
+	b = (cy * ss - sy * sc) / det;
+
+	return sqrt(a * a + b * b) / AMPLITUDE;
+}
+
+static void Test_Response(void)
+{
+	double f, h, theory, err, maxErr, droop, alias;
+	uint32_t i, j;
+	uint8_t rate;
+
+	printf("rate  max |H| error  |H| at 0.1 fout  |H| at 0.9 fout\n");
+
+	for (i = 0; i < sizeof(rates); ++i)
+	{
+		rate = rates[i];
+		maxErr = 0;
+
+		// Up to twice the output rate, avoiding frequencies that alias
+		// onto DC or the output Nyquist, where the phase is not
+		// observable
+		for (j = 1; j < STEPS; ++j)
+		{
+			f = 2.0 * j / (STEPS * rate);
+			err = fabs(f * rate - lround(f * rate));
+			if ((err < 0.03) || (err > 0.47)) continue;
+
+			h = Measure(f, rate);
+			theory = Theory(f, rate);
+			err = fabs(h - theory);
+			maxErr = fmax(maxErr, err);
+
+			HOST_CHECK(err < 2e-5, "rate %u, f %.4f: |H| %.6f, theory %.6f",
+					rate, f, h, theory);
+		}
+
+		// Droop at a tenth of the output rate, and rejection of the
+		// band that aliases onto it
+		droop = 20 * log10(Measure(0.1 / rate, rate));
+		alias = 20 * log10(Measure(0.9 / rate, rate));
+
+		HOST_CHECK(alias < -45, "rate %u: alias rejection %.1f dB", rate, alias);
+
+		printf("%4u  %13.2e  %12.2f dB  %12.1f dB\n", rate, maxErr, droop, alias);
+	}
+}
+
+static void Test_Dc(void)
+{
+	static const int32_t levels[] = {0, 1, -1, 12345, -12345, INT32_MAX, INT32_MIN};
+	FS_Decimate_t dec;
+	int32_t in[FS_DECIMATE_MAX_CHANNELS], out[FS_DECIMATE_MAX_CHANNELS];
+	uint32_t i, k, ms = 0, outputs;
+	uint16_t us = 0;
+	uint8_t c, rate;
+	bool exact;
+
+	for (i = 0; i < sizeof(rates); ++i)
+	{
+		rate = rates[i];
+		FS_Decimate_Init(&dec, FS_DECIMATE_MAX_CHANNELS, rate);
+		exact = true;
+		outputs = 0;
+
+		// One level per channel, held long enough for the integrators
+		// to wrap
+		for (c = 0; c < FS_DECIMATE_MAX_CHANNELS; ++c)
+		{
+			in[c] = levels[c];
+		}
+
+		for (k = 0; k < 200000; ++k)
+		{
+			if (FS_Decimate_Update(&dec, in, out, &ms, &us))
+			{
+				++outputs;
+				for (c = 0; c < FS_DECIMATE_MAX_CHANNELS; ++c)
+				{
+					exact = exact && (out[c] == in[c]);
+				}
+			}
+		}
+
+		HOST_CHECK(exact, "rate %u: DC levels pass unchanged", rate);
+		HOST_CHECK(outputs == 200000 / rate - (FS_DECIMATE_ORDER - 1),
+				"rate %u: %lu outputs after warm-up", rate, (unsigned long) outputs);
+	}
+}
+
+static void Test_Time(void)
+{
+	FS_Decimate_t dec;
+	int32_t in[1] = {0}, out[1];
+	uint32_t k, ms, center;
+	uint16_t us;
+	bool ok = true;
+	uint8_t rate = 8;
+
+	// Input every 1250 us (800 Hz)
+	FS_Decimate_Init(&dec, 1, rate);
+	for (k = 0; k < 1000; ++k)
+	{
+		ms = (k * 1250) / 1000;
+		us = (k * 1250) % 1000;
+		if (FS_Decimate_Update(&dec, in, out, &ms, &us))
+		{
+			// Middle of the CIC3 impulse response
+			center = k * 1250 - FS_DECIMATE_ORDER * (rate - 1) * 1250 / 2;
+			ok = ok && (ms * 1000 + us == center);
+		}
+	}
+
+	HOST_CHECK(ok, "output time is the centre of the filter window");
+}
+
+static void Test_Cost(void)
+{
+	static const uint8_t channels[] = {2, 7};
+	FS_Decimate_t dec;
+	int32_t in[FS_DECIMATE_MAX_CHANNELS] = {0}, out[FS_DECIMATE_MAX_CHANNELS];
+	uint32_t i, k, ms = 0, n = 4000000;
+	uint16_t us = 0;
+	uint64_t t0, dt;
+	int64_t sum = 0;
+
+	for (i = 0; i < sizeof(channels); ++i)
+	{
+		FS_Decimate_Init(&dec, channels[i], 8);
+
+		t0 = Host_Nanoseconds();
+		for (k = 0; k < n; ++k)
+		{
+			in[0] = k;
+			if (FS_Decimate_Update(&dec, in, out, &ms, &us))
+			{
+				sum += out[0];
+			}
+		}
+		dt = Host_Nanoseconds() - t0;
+
+		printf("%u channels, rate 8: %.2f host ns per input sample (%lld)\n",
+				channels[i], (double) dt / n, (long long) (sum & 1));
+	}
+}
+
+int main(void)
+{
+	Test_Response();
+	Test_Dc();
+	Test_Time();
+	Test_Cost();
+
+	return Host_Finish("test_decimate");
+}
@@ -0,0 +1,461 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+// Replays a jump through gnss.c as a u-blox receiver would stream it
+// and checks every epoch against the values the former two-message
+// mode logged. That mode copied speed, gSpeed and heading from
+// NAV-VELNED and all other fields from NAV-PVT, firing once both
+// messages of an epoch had arrived.
+//
+// Usage: test_gnss [TRACK.CSV]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "main.h"
+#include "gnss.h"
+#include "host.h"
+#include "timestamp.h"
+#include "track.h"
+
+#define UBX_SYNC_1      0xb5
+#define UBX_SYNC_2      0x62
+#define UBX_NAV         0x01
+#define UBX_NAV_PVT     0x07
+#define UBX_NAV_VELNED  0x12
+#define UBX_ACK         0x05
+#define UBX_ACK_ACK     0x01
+#define UBX_CFG         0x06
+#define UBX_CFG_MSG     0x01
+
+#define GNSS_RATE_MS    200
+#define TRACK_MAX       100000
+
+extern uint8_t gnssRxData[GNSS_RX_BUF_LEN];
+
+UART_HandleTypeDef huart1;
+static DMA_Channel_TypeDef rxChannel;
+static DMA_HandleTypeDef rxDma = {&rxChannel};
+
+// Receiver state
+static uint32_t rxWrite;
+static uint8_t  txFrame[16 + 1024];
+static uint32_t txLen;
+static uint8_t  velnedRate = 1;
+static uint8_t  pvtRate = 1;
+static uint32_t msgCount;
+
+// Epochs reported by gnss.c
+static FS_GNSS_Data_t expected;
+static uint32_t epochCount;
+static uint32_t mismatchCount;
+
+static void Receiver_Put(uint8_t ch)
+{
+	gnssRxData[rxWrite] = ch;
+	rxWrite = (rxWrite + 1) % GNSS_RX_BUF_LEN;
+	rxChannel.CNDTR = GNSS_RX_BUF_LEN - rxWrite;
+}
+
+static void Receiver_Send(uint8_t msgClass, uint8_t msgId, uint16_t len, const uint8_t *payload)
+{
+	uint8_t ckA = 0, ckB = 0;
+	uint16_t i;
+
+	#define SEND_BYTE(a) { Receiver_Put(a); ckA += (a); ckB += ckA; }
+
+	Receiver_Put(UBX_SYNC_1);
+	Receiver_Put(UBX_SYNC_2);
+	SEND_BYTE(msgClass);
+	SEND_BYTE(msgId);
+	SEND_BYTE(len & 0xff);
+	SEND_BYTE(len >> 8);
+	for (i = 0; i < len; ++i)
+	{
+		SEND_BYTE(payload[i]);
+	}
+	Receiver_Put(ckA);
+	Receiver_Put(ckB);
+
+	#undef SEND_BYTE
+
+	++msgCount;
+}
+
+static void Receiver_HandleFrame(void)
+{
+	const uint8_t msgClass = txFrame[2];
+	const uint8_t msgId = txFrame[3];
+	const uint8_t *payload = &txFrame[6];
+	uint8_t ack[2] = {msgClass, msgId};
+
+	if (msgClass != UBX_CFG) return;
+
+	if (msgId == UBX_CFG_MSG && payload[0] == UBX_NAV)
+	{
+		if (payload[1] == UBX_NAV_PVT)    pvtRate = payload[2];
+		if (payload[1] == UBX_NAV_VELNED) velnedRate = payload[2];
+	}
+
+	Receiver_Send(UBX_ACK, UBX_ACK_ACK, sizeof(ack), ack);
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart,
+		const uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+	uint16_t i, len;
+
+	UNUSED(huart);
+	UNUSED(Timeout);
+
+	for (i = 0; i < Size; ++i)
+	{
+		if ((txLen == 0 && pData[i] != UBX_SYNC_1) ||
+				(txLen == 1 && pData[i] != UBX_SYNC_2) ||
+				txLen >= sizeof(txFrame))
+		{
+			txLen = 0;
+			continue;
+		}
+
+		txFrame[txLen++] = pData[i];
+		if (txLen >= 6)
+		{
+			len = txFrame[4] | (txFrame[5] << 8);
+			if (txLen == len + 8u)
+			{
+				Receiver_HandleFrame();
+				txLen = 0;
+			}
+		}
+	}
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Init(UART_HandleTypeDef *huart)
+{
+	UNUSED(huart);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Abort(UART_HandleTypeDef *huart)
+{
+	UNUSED(huart);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_DMAStop(UART_HandleTypeDef *huart)
+{
+	UNUSED(huart);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Receive_DMA(UART_HandleTypeDef *huart,
+		uint8_t *pData, uint16_t Size)
+{
+	UNUSED(huart);
+	UNUSED(pData);
+	UNUSED(Size);
+
+	// Circular transfer restarts at the beginning of the buffer
+	rxWrite = 0;
+	rxChannel.CNDTR = GNSS_RX_BUF_LEN;
+	return HAL_OK;
+}
+
+void FS_Timestamp_Init(void)
+{
+}
+
+void FS_Timestamp_Get(uint32_t *ms, uint16_t *us)
+{
+	*ms = HAL_GetTick();
+	*us = 0;
+}
+
+void FS_Timestamp_Timepulse(uint32_t ms, uint16_t us, uint16_t week, uint32_t towMS, uint16_t towUs)
+{
+	UNUSED(ms);
+	UNUSED(us);
+	UNUSED(week);
+	UNUSED(towMS);
+	UNUSED(towUs);
+}
+
+const FS_Timestamp_Model_t *FS_Timestamp_GetModel(void)
+{
+	static const FS_Timestamp_Model_t model;
+	return &model;
+}
+
+static void Put32(uint8_t *buf, uint32_t val)
+{
+	buf[0] = val;
+	buf[1] = val >> 8;
+	buf[2] = val >> 16;
+	buf[3] = val >> 24;
+}
+
+static void Put16(uint8_t *buf, uint16_t val)
+{
+	buf[0] = val;
+	buf[1] = val >> 8;
+}
+
+// Round half away from zero, as the receiver reports integer fields
+static int32_t Round(double val)
+{
+	return (int32_t) ((val < 0) ? ceil(val - 0.5) : floor(val + 0.5));
+}
+
+// Sends one epoch with velocities in mm/s and records what the
+// two-message mode logged for it
+static void Receiver_Epoch(uint32_t iTOW, const Track_Point_t *p,
+		int32_t velN, int32_t velE, int32_t velD)
+{
+	uint8_t pvt[92] = {0};
+	uint8_t velned[36] = {0};
+	const uint32_t sec = iTOW / 1000;
+	const double vh = sqrt((double) velN * velN + (double) velE * velE);
+	const double v = sqrt((double) velN * velN + (double) velE * velE + (double) velD * velD);
+	const int32_t gSpeed = Round(vh);
+	double heading = atan2(velE, velN) * 180 / M_PI;
+
+	if (heading < 0) heading += 360;
+
+	memset(&expected, 0, sizeof(expected));
+	expected.iTOW = iTOW;
+	expected.year = 2024;
+	expected.month = 6;
+	expected.day = 1;
+	expected.hour = (sec / 3600) % 24;
+	expected.min = (sec / 60) % 60;
+	expected.sec = sec % 60;
+	expected.nano = (iTOW % 1000) * 1000000;
+	expected.lon = Round(p->lon * 1e7);
+	expected.lat = Round(p->lat * 1e7);
+	expected.hMSL = Round(p->hMSL * 1000);
+	expected.velN = velN;
+	expected.velE = velE;
+	expected.velD = velD;
+	expected.tAcc = 20;
+	expected.hAcc = Round(p->hAcc * 1000);
+	expected.vAcc = Round(p->vAcc * 1000);
+	expected.sAcc = Round(p->sAcc * 1000);
+	expected.gpsFix = 3;
+	expected.numSV = p->numSV;
+
+	// NAV-VELNED fields are rounded to cm/s from the same solution
+	expected.speed = Round(v / 10);
+	expected.gSpeed = Round(gSpeed / 10.0);
+	expected.heading = Round(heading * 1e5);
+
+	Put32(&pvt[0], iTOW);
+	Put16(&pvt[4], expected.year);
+	pvt[6] = expected.month;
+	pvt[7] = expected.day;
+	pvt[8] = expected.hour;
+	pvt[9] = expected.min;
+	pvt[10] = expected.sec;
+	pvt[11] = 0x07;
+	Put32(&pvt[12], expected.tAcc);
+	Put32(&pvt[16], expected.nano);
+	pvt[20] = expected.gpsFix;
+	pvt[21] = 0x01;
+	pvt[23] = expected.numSV;
+	Put32(&pvt[24], expected.lon);
+	Put32(&pvt[28], expected.lat);
+	Put32(&pvt[32], expected.hMSL + 17000);
+	Put32(&pvt[36], expected.hMSL);
+	Put32(&pvt[40], expected.hAcc);
+	Put32(&pvt[44], expected.vAcc);
+	Put32(&pvt[48], velN);
+	Put32(&pvt[52], velE);
+	Put32(&pvt[56], velD);
+	Put32(&pvt[60], gSpeed);
+	Put32(&pvt[64], expected.heading);
+	Put32(&pvt[68], expected.sAcc);
+	Put32(&pvt[72], 500000);
+	Put16(&pvt[76], 120);
+
+	Put32(&velned[0], iTOW);
+	Put32(&velned[4], Round(velN / 10.0));
+	Put32(&velned[8], Round(velE / 10.0));
+	Put32(&velned[12], Round(velD / 10.0));
+	Put32(&velned[16], expected.speed);
+	Put32(&velned[20], expected.gSpeed);
+	Put32(&velned[24], expected.heading);
+	Put32(&velned[28], Round(p->sAcc * 100));
+	Put32(&velned[32], 500000);
+
+	if (pvtRate)    Receiver_Send(UBX_NAV, UBX_NAV_PVT, sizeof(pvt), pvt);
+	if (velnedRate) Receiver_Send(UBX_NAV, UBX_NAV_VELNED, sizeof(velned), velned);
+
+	// Let the GNSS update task drain the UART buffer
+	Host_Advance(GNSS_RATE_MS * 1000);
+}
+
+static void DataReady(void)
+{
+	const FS_GNSS_Data_t *data = FS_GNSS_GetData();
+	bool match = true;
+
+	++epochCount;
+
+	#define CHECK_FIELD(f) \
+		if (data->f != expected.f) \
+		{ \
+			printf("iTOW %lu: " #f " %ld, two-message mode %ld\n", \
+					(unsigned long) expected.iTOW, (long) data->f, (long) expected.f); \
+			match = false; \
+		}
+
+	CHECK_FIELD(iTOW);
+	CHECK_FIELD(year);
+	CHECK_FIELD(month);
+	CHECK_FIELD(day);
+	CHECK_FIELD(hour);
+	CHECK_FIELD(min);
+	CHECK_FIELD(sec);
+	CHECK_FIELD(nano);
+	CHECK_FIELD(lon);
+	CHECK_FIELD(lat);
+	CHECK_FIELD(hMSL);
+	CHECK_FIELD(velN);
+	CHECK_FIELD(velE);
+	CHECK_FIELD(velD);
+	CHECK_FIELD(speed);
+	CHECK_FIELD(gSpeed);
+	CHECK_FIELD(heading);
+	CHECK_FIELD(tAcc);
+	CHECK_FIELD(hAcc);
+	CHECK_FIELD(vAcc);
+	CHECK_FIELD(sAcc);
+	CHECK_FIELD(gpsFix);
+	CHECK_FIELD(numSV);
+
+	#undef CHECK_FIELD
+
+	HOST_CHECK(match, "iTOW %lu matches two-message mode",
+			(unsigned long) expected.iTOW);
+	if (!match) ++mismatchCount;
+}
+
+int main(int argc, char **argv)
+{
+	static Track_Point_t track[TRACK_MAX];
+	static const int32_t edges[][3] =
+	{
+		// Ground and 3D speeds on either side of the +5 mm rounding step
+		{     0,      0,      0},
+		{     4,      0,      0},
+		{     5,      0,      0},
+		{     0,     14,      0},
+		{     0,    -15,      0},
+		{     3,      4,      0},
+		{     9,     12,      0},
+		{     6,      8,     -1},
+		{     0,      0,    -25},
+		{  7404,  -7404,      0},
+		{ 12345,      0,  54321},
+		{-12344,      5, -54325},
+		{  2000,   3000,   6000},
+		{ 48000, -36000,  60005},
+		{-99995,      0,      0}
+	};
+	Track_Synth_t synth;
+	uint32_t count, i, iTOW, epochs = 0;
+	const double dt = GNSS_RATE_MS / 1000.0;
+
+	huart1.hdmarx = &rxDma;
+	hostConfig.rate = GNSS_RATE_MS;
+	hostConfig.model = 7;
+
+	FS_GNSS_Init();
+	FS_GNSS_DataReady_SetCallback(DataReady);
+	FS_GNSS_Start();
+
+	HOST_CHECK(pvtRate == 1, "NAV-PVT enabled at rate %u", pvtRate);
+	HOST_CHECK(velnedRate == 0, "NAV-VELNED disabled, rate %u", velnedRate);
+
+	// Receivers with the old configuration saved to flash still send
+	// NAV-VELNED, which must not change the output
+	velnedRate = 1;
+
+	Track_SynthInit(&synth);
+
+	iTOW = 300000000;
+	if (argc > 1)
+	{
+		count = Track_Load(argv[1], track, TRACK_MAX);
+		HOST_CHECK(count > 0, "%s has $GNSS rows", argv[1]);
+		for (i = 0; i < count; ++i)
+		{
+			Receiver_Epoch(iTOW + Round(track[i].t * 1000), &track[i],
+					Round(track[i].velN * 1000),
+					Round(track[i].velE * 1000),
+					Round(track[i].velD * 1000));
+			++epochs;
+		}
+		iTOW += Round(track[count - 1].t * 1000) + GNSS_RATE_MS;
+	}
+	else
+	{
+		while (synth.p.phase != TRACK_LANDED || synth.p.t < synth.landTime + 10)
+		{
+			for (i = 0; i < GNSS_RATE_MS; ++i)
+			{
+				Track_SynthStep(&synth, dt / GNSS_RATE_MS);
+			}
+			Receiver_Epoch(iTOW, &synth.p,
+					Round(synth.p.velN * 1000),
+					Round(synth.p.velE * 1000),
+					Round(synth.p.velD * 1000));
+			iTOW += GNSS_RATE_MS;
+			++epochs;
+		}
+	}
+
+	// Edge cases, sent with and without NAV-VELNED
+	for (i = 0; i < 2 * sizeof(edges) / sizeof(edges[0]); ++i)
+	{
+		velnedRate = (i & 1);
+		Receiver_Epoch(iTOW, &synth.p,
+				edges[i / 2][0], edges[i / 2][1], edges[i / 2][2]);
+		iTOW += GNSS_RATE_MS;
+		++epochs;
+	}
+
+	HOST_CHECK(epochCount == epochs, "%lu epochs reported, %lu sent",
+			(unsigned long) epochCount, (unsigned long) epochs);
+
+	printf("%lu epochs replayed, %lu UBX messages, %lu mismatched\n",
+			(unsigned long) epochs, (unsigned long) msgCount,
+			(unsigned long) mismatchCount);
+
+	FS_GNSS_DeInit();
+
+	return Host_Finish("test_gnss");
+}
@@ -0,0 +1,219 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+// Checks FS_IMU_Convert against the expressions the SPI read callback
+// used before raw counts were logged, for every count at every full
+// scale, and compares the cost of per-sample and batch conversion.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "main.h"
+#include "host.h"
+#include "imu.h"
+
+#define BENCH_SAMPLES  1000000
+#define BENCH_BATCH    32       // Samples per FIFO batch
+
+SPI_HandleTypeDef hspi1;
+
+static const int32_t gyroFactors[] = {250 * 1000, 500 * 1000, 1000 * 1000, 2000 * 1000};
+static const int32_t accelFactors[] = {2 * 100000, 4 * 100000, 8 * 100000, 16 * 100000};
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData,
+		uint16_t Size, uint32_t Timeout)
+{
+	UNUSED(hspi);
+	UNUSED(pData);
+	UNUSED(Size);
+	UNUSED(Timeout);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *pData,
+		uint16_t Size, uint32_t Timeout)
+{
+	UNUSED(hspi);
+	UNUSED(Timeout);
+	memset(pData, 0, Size);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef *hspi,
+		uint8_t *pTxData, uint8_t *pRxData, uint16_t Size)
+{
+	UNUSED(hspi);
+	UNUSED(pTxData);
+	UNUSED(pRxData);
+	UNUSED(Size);
+	return HAL_OK;
+}
+
+// Sample registers as read over SPI: temperature, gyro, accel
+static void Raw_ToBytes(const FS_IMU_Raw_t *raw, uint8_t *dataBuf)
+{
+	const int16_t words[7] =
+	{
+		raw->temperature, raw->gx, raw->gy, raw->gz, raw->ax, raw->ay, raw->az
+	};
+	int i;
+
+	dataBuf[0] = 0;
+	for (i = 0; i < 7; ++i)
+	{
+		dataBuf[1 + 2 * i] = (uint16_t) words[i] & 0xff;
+		dataBuf[2 + 2 * i] = (uint16_t) words[i] >> 8;
+	}
+}
+
+// Conversion formerly done in FS_IMU_Read_Callback
+static void Old_Convert(const uint8_t *dataBuf, int32_t gyroFactor,
+		int32_t accelFactor, FS_IMU_Data_t *imuData)
+{
+	imuData->temperature = (((int16_t) ((dataBuf[2] << 8) | dataBuf[1])) * 100) / 256 + 2500;
+
+	imuData->wy = (((int64_t) (int16_t) ((dataBuf[4] << 8) | dataBuf[3])) * gyroFactor) / 32768;
+	imuData->wx = -(((int64_t) (int16_t) ((dataBuf[6] << 8) | dataBuf[5])) * gyroFactor) / 32768;
+	imuData->wz = (((int64_t) (int16_t) ((dataBuf[8] << 8) | dataBuf[7])) * gyroFactor) / 32768;
+
+	imuData->ay = (((int64_t) (int16_t) ((dataBuf[10] << 8) | dataBuf[9])) * accelFactor) / 32768;
+	imuData->ax = -(((int64_t) (int16_t) ((dataBuf[12] << 8) | dataBuf[11])) * accelFactor) / 32768;
+	imuData->az = (((int64_t) (int16_t) ((dataBuf[14] << 8) | dataBuf[13])) * accelFactor) / 32768;
+}
+
+static bool Data_Equal(const FS_IMU_Data_t *a, const FS_IMU_Data_t *b)
+{
+	return a->wx == b->wx && a->wy == b->wy && a->wz == b->wz &&
+			a->ax == b->ax && a->ay == b->ay && a->az == b->az &&
+			a->temperature == b->temperature;
+}
+
+static void Test_Exhaustive(void)
+{
+	FS_IMU_Scale_t scale;
+	FS_IMU_Raw_t raw = {0};
+	FS_IMU_Data_t data, old;
+	uint8_t dataBuf[15];
+	uint32_t i, mismatch;
+	int32_t v;
+
+	for (i = 0; i < 4; ++i)
+	{
+		scale.gyroFactor = gyroFactors[i];
+		scale.accelFactor = accelFactors[i];
+		mismatch = 0;
+
+		// Every count on every axis, with the axes permuted so that
+		// each carries a different value
+		for (v = -32768; v <= 32767; ++v)
+		{
+			raw.gx = v;
+			raw.gy = ~v;
+			raw.gz = v ^ 0x5555;
+			raw.ax = v ^ 0x2aaa;
+			raw.ay = -1 - (v ^ 0x0f0f);
+			raw.az = v ^ 0x7f00;
+			raw.temperature = v;
+
+			FS_IMU_Convert(&scale, &raw, &data, 1);
+			Raw_ToBytes(&raw, dataBuf);
+			Old_Convert(dataBuf, scale.gyroFactor, scale.accelFactor, &old);
+
+			if (!Data_Equal(&data, &old)) ++mismatch;
+		}
+
+		HOST_CHECK(mismatch == 0, "%lu counts differ at %ld dps / %ld g full scale",
+				(unsigned long) mismatch, (long) gyroFactors[i] / 1000,
+				(long) accelFactors[i] / 100000);
+	}
+}
+
+static void Test_Benchmark(void)
+{
+	static FS_IMU_Raw_t raw[BENCH_SAMPLES];
+	static uint8_t bytes[BENCH_SAMPLES][15];
+	static FS_IMU_Data_t single[BENCH_SAMPLES];
+	static FS_IMU_Data_t batch[BENCH_SAMPLES];
+	static FS_IMU_Data_t old[BENCH_SAMPLES];
+	const FS_IMU_Scale_t scale = {gyroFactors[3], accelFactors[3]};
+	uint64_t t0, tOld, tSingle, tBatch;
+	uint32_t i, mismatch = 0;
+
+	srand(1);
+	for (i = 0; i < BENCH_SAMPLES; ++i)
+	{
+		raw[i].time = i;
+		raw[i].gx = rand();
+		raw[i].gy = rand();
+		raw[i].gz = rand();
+		raw[i].ax = rand();
+		raw[i].ay = rand();
+		raw[i].az = rand();
+		raw[i].temperature = rand();
+		Raw_ToBytes(&raw[i], bytes[i]);
+	}
+
+	t0 = Host_Nanoseconds();
+	for (i = 0; i < BENCH_SAMPLES; ++i)
+	{
+		Old_Convert(bytes[i], scale.gyroFactor, scale.accelFactor, &old[i]);
+	}
+	tOld = Host_Nanoseconds() - t0;
+
+	t0 = Host_Nanoseconds();
+	for (i = 0; i < BENCH_SAMPLES; ++i)
+	{
+		FS_IMU_Convert(&scale, &raw[i], &single[i], 1);
+	}
+	tSingle = Host_Nanoseconds() - t0;
+
+	t0 = Host_Nanoseconds();
+	for (i = 0; i < BENCH_SAMPLES; i += BENCH_BATCH)
+	{
+		FS_IMU_Convert(&scale, &raw[i], &batch[i], MIN(BENCH_BATCH, BENCH_SAMPLES - i));
+	}
+	tBatch = Host_Nanoseconds() - t0;
+
+	for (i = 0; i < BENCH_SAMPLES; ++i)
+	{
+		if (!Data_Equal(&single[i], &old[i]) || !Data_Equal(&batch[i], &old[i]) ||
+				batch[i].time != raw[i].time)
+		{
+			++mismatch;
+		}
+	}
+
+	HOST_CHECK(mismatch == 0, "%lu benchmark samples differ", (unsigned long) mismatch);
+
+	printf("host ns/sample: old callback %.2f, per-sample convert %.2f, batch of %d %.2f\n",
+			(double) tOld / BENCH_SAMPLES, (double) tSingle / BENCH_SAMPLES,
+			BENCH_BATCH, (double) tBatch / BENCH_SAMPLES);
+}
+
+int main(void)
+{
+	Test_Exhaustive();
+	Test_Benchmark();
+
+	return Host_Finish("test_imu");
+}
@@ -0,0 +1,496 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+// Runs the navigation filter on a synthetic jump, or on a recorded
+// TRACK.CSV and SENSOR.CSV pair, with IMU batches, barometer samples,
+// GNSS epochs and time pulses delivered in local time order through the
+// sequencer. Reports filter cost per measurement and the error of its
+// outputs against truth (synthetic) or GNSS (recorded), alongside the
+// error of the latest GNSS solution available at the same moment.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "main.h"
+#include "host.h"
+#include "kalman.h"
+#include "timestamp.h"
+#include "track.h"
+
+#define TRUTH_STEP     0.005	// s
+#define IMU_PERIOD     (1 / 104.0)	// s
+#define IMU_BATCH      8		// samples per FIFO read
+#define BARO_PERIOD    0.1		// s
+#define GNSS_PERIOD    0.2		// s
+#define GNSS_DELAY     0.06		// solution to delivery (s)
+#define LOCAL_START    5.0		// local time at start of synthetic track (s)
+#define TOW_START      345600.0	// time of week at start of synthetic track (s)
+#define WEEK           2300
+#define ACCEL_FS       1600000	// accel full scale (g * 100000)
+#define GYRO_FS        2000000	// gyro full scale (deg/s * 1000)
+#define MAX_POINTS     400000
+#define GRAVITY        9.80665
+
+typedef struct
+{
+	double t;				// local time (s)
+	double a[3];			// specific force, converted frame (g)
+} Imu_t;
+
+typedef struct
+{
+	double t;				// local time (s)
+	double pressure;		// Pa
+} Baro_t;
+
+typedef struct
+{
+	double t;				// local time (s)
+	double tow;				// s
+} Pulse_t;
+
+typedef struct
+{
+	double   sum2;
+	double   max;
+	uint32_t count;
+} Error_t;
+
+typedef struct
+{
+	uint64_t total;			// host ns
+	uint64_t max;
+	uint32_t count;
+} Cost_t;
+
+static Track_Point_t *ref;		// reference, t in local time
+static uint32_t refCount;
+static Track_Point_t *gnss;		// solutions, t in local time of epoch
+static uint32_t gnssCount;
+static Imu_t *imu;
+static uint32_t imuCount;
+static Baro_t *baro;
+static uint32_t baroCount;
+static Pulse_t *pulse;
+static uint32_t pulseCount;
+
+static uint32_t latest;			// latest GNSS solution delivered
+static bool     hasLatest;
+
+static Error_t errKF[4], errGNSS[4];
+static uint32_t outputs;
+
+static const char *const errNames[4] = {"hMSL (m)", "velN (m/s)", "velE (m/s)", "velD (m/s)"};
+
+static const FS_IMU_Scale_t imuScale = {GYRO_FS, ACCEL_FS};
+
+// IMU driver, as imu.c
+const FS_IMU_Scale_t *FS_IMU_GetScale(void)
+{
+	return &imuScale;
+}
+
+void FS_IMU_Convert(const FS_IMU_Scale_t *scale, const FS_IMU_Raw_t *raw,
+		FS_IMU_Data_t *data, uint32_t count)
+{
+	uint32_t i;
+
+	for (i = 0; i < count; ++i)
+	{
+		data[i].time = raw[i].time;
+		data[i].timeUs = raw[i].timeUs;
+
+		data[i].wy = (((int64_t) raw[i].gx) * scale->gyroFactor) / 32768;
+		data[i].wx = -(((int64_t) raw[i].gy) * scale->gyroFactor) / 32768;
+		data[i].wz = (((int64_t) raw[i].gz) * scale->gyroFactor) / 32768;
+
+		data[i].ay = (((int64_t) raw[i].ax) * scale->accelFactor) / 32768;
+		data[i].ax = -(((int64_t) raw[i].ay) * scale->accelFactor) / 32768;
+		data[i].az = (((int64_t) raw[i].az) * scale->accelFactor) / 32768;
+
+		data[i].temperature = (raw[i].temperature * 100) / 256 + 2500;
+	}
+}
+
+static void Error_Add(Error_t *e, double err)
+{
+	e->sum2 += err * err;
+	e->max = fmax(e->max, fabs(err));
+	++e->count;
+}
+
+static double Error_RMS(const Error_t *e)
+{
+	return e->count ? sqrt(e->sum2 / e->count) : 0;
+}
+
+static void Compare(Error_t *e, const Track_Point_t *r, double h, double vn, double ve, double vd)
+{
+	Error_Add(&e[0], h - r->hMSL);
+	Error_Add(&e[1], vn - r->velN);
+	Error_Add(&e[2], ve - r->velE);
+	Error_Add(&e[3], vd - r->velD);
+}
+
+void FS_Kalman_DataReady_Callback(void)
+{
+	const FS_Kalman_Data_t *kf = FS_Kalman_GetData();
+	const Track_Point_t *g = &gnss[latest];
+	const double t = kf->time * 1e-3 + kf->timeUs * 1e-6;
+	Track_Point_t r;
+
+	Track_Interpolate(ref, refCount, t, &r);
+
+	Compare(errKF, &r, kf->hMSL * 1e-3, kf->velN * 1e-3, kf->velE * 1e-3, kf->velD * 1e-3);
+	++outputs;
+
+	// What audio would use without the filter
+	if (hasLatest)
+	{
+		Compare(errGNSS, &r, g->hMSL, g->velN, g->velE, g->velD);
+	}
+}
+
+static double Gaussian(double sigma)
+{
+	const double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+	const double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+	return sigma * sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static void *Grow(void *buf, uint32_t count, uint32_t *max, size_t size)
+{
+	if (count < *max) return buf;
+	*max = *max ? 2 * *max : 4096;
+	return realloc(buf, *max * size);
+}
+
+// Synthetic jump with sensor noise
+static void Build_Synthetic(void)
+{
+	uint32_t i, n;
+	double t, end;
+	Track_Point_t p;
+
+	ref = malloc(MAX_POINTS * sizeof(Track_Point_t));
+	refCount = Track_Synth(ref, MAX_POINTS, TRUTH_STEP);
+	for (i = 0; i < refCount; ++i)
+	{
+		ref[i].tow = TOW_START + ref[i].t;
+		ref[i].t += LOCAL_START;
+	}
+	end = ref[refCount - 1].t;
+
+	srand(1);
+
+	n = (end - LOCAL_START) / GNSS_PERIOD;
+	gnss = malloc(n * sizeof(Track_Point_t));
+	for (gnssCount = 0; gnssCount < n; ++gnssCount)
+	{
+		Track_Interpolate(ref, refCount, LOCAL_START + gnssCount * GNSS_PERIOD, &p);
+		p.hMSL += Gaussian(1.5);
+		p.velN += Gaussian(0.1);
+		p.velE += Gaussian(0.1);
+		p.velD += Gaussian(0.15);
+		gnss[gnssCount] = p;
+	}
+
+	n = (end - LOCAL_START) / IMU_PERIOD;
+	imu = malloc(n * sizeof(Imu_t));
+	for (imuCount = 0; imuCount < n; ++imuCount)
+	{
+		t = LOCAL_START + imuCount * IMU_PERIOD;
+		Track_Interpolate(ref, refCount, t, &p);
+
+		// Level sensor: x north, y east, z up
+		imu[imuCount].t = t;
+		imu[imuCount].a[0] = p.accN / GRAVITY + Gaussian(0.01);
+		imu[imuCount].a[1] = p.accE / GRAVITY + Gaussian(0.01);
+		imu[imuCount].a[2] = (GRAVITY - p.accD) / GRAVITY + Gaussian(0.01);
+	}
+
+	n = (end - LOCAL_START) / BARO_PERIOD;
+	baro = malloc(n * sizeof(Baro_t));
+	for (baroCount = 0; baroCount < n; ++baroCount)
+	{
+		t = LOCAL_START + baroCount * BARO_PERIOD;
+		Track_Interpolate(ref, refCount, t, &p);
+		baro[baroCount].t = t;
+		baro[baroCount].pressure = Track_Pressure(p.hMSL) + Gaussian(2.0);
+	}
+
+	n = end - LOCAL_START;
+	pulse = malloc(n * sizeof(Pulse_t));
+	for (pulseCount = 0; pulseCount < n; ++pulseCount)
+	{
+		pulse[pulseCount].t = LOCAL_START + pulseCount;
+		pulse[pulseCount].tow = TOW_START + pulseCount;
+	}
+}
+
+// Local time of a GNSS time of week from the nearest time pulse
+static double Local(double tow)
+{
+	uint32_t i, best = 0;
+
+	for (i = 1; i < pulseCount; ++i)
+	{
+		if (fabs(pulse[i].tow - tow) < fabs(pulse[best].tow - tow)) best = i;
+	}
+
+	return pulse[best].t + (tow - pulse[best].tow);
+}
+
+// Recorded session: GNSS from TRACK.CSV as both input and reference,
+// sensors and time pulses from SENSOR.CSV
+static bool Build_Recorded(const char *trackPath, const char *sensorPath)
+{
+	uint32_t maxImu = 0, maxBaro = 0, maxPulse = 0, i;
+	double t, v[7], tow;
+	char line[256];
+	int week;
+	FILE *file;
+
+	gnss = malloc(MAX_POINTS * sizeof(Track_Point_t));
+	gnssCount = Track_Load(trackPath, gnss, MAX_POINTS);
+
+	file = fopen(sensorPath, "r");
+	if (!file || gnssCount < 2) return false;
+
+	while (fgets(line, sizeof(line), file))
+	{
+		if (sscanf(line, "$IMU,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf",
+				&t, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6]) == 8)
+		{
+			imu = Grow(imu, imuCount, &maxImu, sizeof(Imu_t));
+			imu[imuCount].t = t;
+			imu[imuCount].a[0] = v[3];
+			imu[imuCount].a[1] = v[4];
+			imu[imuCount].a[2] = v[5];
+			++imuCount;
+		}
+		else if (sscanf(line, "$BARO,%lf,%lf,%lf", &t, &v[0], &v[1]) == 3)
+		{
+			baro = Grow(baro, baroCount, &maxBaro, sizeof(Baro_t));
+			baro[baroCount].t = t;
+			baro[baroCount].pressure = v[0];
+			++baroCount;
+		}
+		else if (sscanf(line, "$TIME,%lf,%lf,%d", &t, &tow, &week) == 3)
+		{
+			pulse = Grow(pulse, pulseCount, &maxPulse, sizeof(Pulse_t));
+			pulse[pulseCount].t = t;
+			pulse[pulseCount].tow = tow;
+			++pulseCount;
+		}
+	}
+	fclose(file);
+
+	if (!imuCount || !baroCount || !pulseCount) return false;
+
+	// Same week as the track
+	for (i = 0; i < pulseCount; ++i)
+	{
+		pulse[i].tow = fmod(pulse[i].tow, 604800.0);
+	}
+
+	for (i = 0; i < gnssCount; ++i)
+	{
+		gnss[i].t = Local(gnss[i].tow);
+	}
+
+	ref = gnss;
+	refCount = gnssCount;
+
+	return true;
+}
+
+static void Timestamp(double t, uint32_t *ms, uint16_t *us)
+{
+	const uint64_t local = llround(t * 1e6);
+
+	*ms = local / 1000;
+	*us = local % 1000;
+}
+
+static void Run_Tasks(Cost_t *cost)
+{
+	const uint64_t t0 = Host_Nanoseconds();
+	uint64_t dt;
+
+	Host_RunTasks();
+	dt = Host_Nanoseconds() - t0;
+
+	cost->total += dt;
+	cost->max = MAX(cost->max, dt);
+	++cost->count;
+}
+
+static void Replay(Cost_t *cost)
+{
+	FS_IMU_Raw_t batch[IMU_BATCH];
+	FS_Baro_Data_t b;
+	FS_GNSS_Data_t g;
+	uint32_t i = 0, j = 0, k = 0, m = 0, n, c;
+	double tImu, tBaro, tGnss, tPulse, t;
+	uint32_t ms;
+	uint16_t us, tus;
+
+	Host_SetTime(0);
+	FS_Timestamp_Init();
+	FS_Timestamp_Reset();
+	FS_Kalman_Init();
+
+	for (;;)
+	{
+		// IMU batches arrive with their last sample
+		n = MIN(IMU_BATCH, imuCount - i);
+		tImu   = n ? imu[i + n - 1].t : INFINITY;
+		tBaro  = (j < baroCount) ? baro[j].t : INFINITY;
+		tGnss  = (k < gnssCount) ? gnss[k].t + GNSS_DELAY : INFINITY;
+		tPulse = (m < pulseCount) ? pulse[m].t : INFINITY;
+
+		t = fmin(fmin(tImu, tBaro), fmin(tGnss, tPulse));
+		if (isinf(t)) break;
+
+		if ((uint64_t) llround(t * 1e6) > Host_GetTime())
+		{
+			Host_Advance(llround(t * 1e6) - Host_GetTime());
+		}
+
+		if (t == tPulse)
+		{
+			FS_Timestamp_Get(&ms, &us);
+			tus = llround(fmod(pulse[m].tow, 1) * 1e6) % 1000;
+			FS_Timestamp_Timepulse(ms, us, WEEK, llround(pulse[m].tow * 1000), tus);
+			++m;
+			Run_Tasks(&cost[3]);
+		}
+		else if (t == tImu)
+		{
+			for (c = 0; c < n; ++c)
+			{
+				const Imu_t *s = &imu[i + c];
+
+				memset(&batch[c], 0, sizeof(batch[c]));
+				Timestamp(s->t, &batch[c].time, &batch[c].timeUs);
+				batch[c].ax = lround(s->a[1] * 1e5 * 32768 / ACCEL_FS);
+				batch[c].ay = -lround(s->a[0] * 1e5 * 32768 / ACCEL_FS);
+				batch[c].az = lround(s->a[2] * 1e5 * 32768 / ACCEL_FS);
+			}
+			i += n;
+
+			FS_Kalman_UpdateIMU(batch, n);
+			Run_Tasks(&cost[0]);
+		}
+		else if (t == tBaro)
+		{
+			Timestamp(baro[j].t, &b.time, &b.timeUs);
+			b.pressure = lround(baro[j].pressure * 100);
+			b.temperature = 1500;
+			++j;
+
+			FS_Kalman_UpdateBaro(&b);
+			Run_Tasks(&cost[1]);
+		}
+		else
+		{
+			Track_ToGNSS(&gnss[k], llround(gnss[k].tow * 1000), &g);
+			latest = k;
+			hasLatest = true;
+			++k;
+
+			FS_Kalman_UpdateGNSS(&g);
+			Run_Tasks(&cost[2]);
+		}
+	}
+
+	Host_SetVerbose(true);
+	FS_Kalman_DeInit();
+	Host_SetVerbose(false);
+}
+
+int main(int argc, char **argv)
+{
+	static const char *const costNames[4] = {"IMU batch", "barometer", "GNSS", "time pulse"};
+	Cost_t cost[4] = {0};
+	const FS_Kalman_Stats_t *stats;
+	const bool recorded = (argc > 2);
+	double duration;
+	uint32_t i;
+
+	if (recorded)
+	{
+		if (!Build_Recorded(argv[1], argv[2]))
+		{
+			printf("usage: test_kalman [TRACK.CSV SENSOR.CSV]\n");
+			return 1;
+		}
+	}
+	else
+	{
+		Build_Synthetic();
+	}
+
+	Replay(cost);
+	stats = FS_Kalman_GetStats();
+	duration = imu[imuCount - 1].t - imu[0].t;
+
+	printf("\n%u IMU, %u barometer, %u GNSS, %u outputs over %.0f s\n",
+			imuCount, baroCount, gnssCount, outputs, duration);
+
+	printf("\nhost cost       calls    mean ns    max ns\n");
+	for (i = 0; i < 4; ++i)
+	{
+		printf("%-12s  %7u  %9.0f  %8lu\n", costNames[i], cost[i].count,
+				cost[i].count ? (double) cost[i].total / cost[i].count : 0,
+				(unsigned long) cost[i].max);
+	}
+
+	printf("\nerror vs %-9s  filter RMS  filter max  latest GNSS RMS  latest GNSS max\n",
+			recorded ? "GNSS" : "truth");
+	for (i = 0; i < 4; ++i)
+	{
+		printf("%-18s  %10.3f  %10.3f  %15.3f  %15.3f\n", errNames[i],
+				Error_RMS(&errKF[i]), errKF[i].max,
+				Error_RMS(&errGNSS[i]), errGNSS[i].max);
+	}
+
+	HOST_CHECK(stats->dropCount == 0, "%lu samples dropped", stats->dropCount);
+	HOST_CHECK(outputs >= 0.98 * duration / 0.04, "%u outputs at 25 Hz", outputs);
+
+	if (!recorded)
+	{
+		// Filter outputs should track truth better than stale GNSS
+		HOST_CHECK(Error_RMS(&errKF[3]) < Error_RMS(&errGNSS[3]),
+				"velD RMS %.3f m/s, latest GNSS %.3f m/s",
+				Error_RMS(&errKF[3]), Error_RMS(&errGNSS[3]));
+		HOST_CHECK(Error_RMS(&errKF[0]) < 2.0, "hMSL RMS %.3f m", Error_RMS(&errKF[0]));
+		HOST_CHECK(stats->rejectCount * 100 < stats->updateCount,
+				"%lu of %lu updates rejected", stats->rejectCount, stats->updateCount);
+	}
+
+	return Host_Finish("test_kalman");
+}
@@ -0,0 +1,423 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+// Feeds WAV files through the microphone feature extractor as ADC scan
+// blocks and checks RMS, peak and band levels against the signal that
+// was written. Synthetic cases are written to WAV and read back; a
+// recording given on the command line is printed as a timeline.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "adc.h"
+#include "host.h"
+#include "mic.h"
+
+#define MID          2048		// ADC counts at zero input
+#define UV_PER_COUNT (3300000.0 / 0xFFF)
+#define LP_ALPHA     (1.0 / 8)	// matches MIC_LP_SHIFT
+#define MAX_OUTPUTS  4096
+
+typedef struct
+{
+	int16_t *data;
+	uint32_t count;
+	uint32_t rate;
+} Wav_t;
+
+static FS_Mic_Data_t outputs[MAX_OUTPUTS];
+static uint32_t outputCount;
+
+void FS_Mic_DataReady_Callback(void)
+{
+	if (outputCount < MAX_OUTPUTS)
+	{
+		outputs[outputCount++] = *FS_Mic_GetData();
+	}
+}
+
+static void Put16(FILE *f, uint16_t v)
+{
+	fputc(v & 0xff, f);
+	fputc(v >> 8, f);
+}
+
+static void Put32(FILE *f, uint32_t v)
+{
+	Put16(f, v & 0xffff);
+	Put16(f, v >> 16);
+}
+
+static uint32_t Get16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t Get32(const uint8_t *p)
+{
+	return Get16(p) | (Get16(p + 2) << 16);
+}
+
+static void Wav_Write(const char *path, const int16_t *data, uint32_t count, uint32_t rate)
+{
+	FILE *f = fopen(path, "wb");
+	uint32_t i;
+
+	fwrite("RIFF", 1, 4, f);
+	Put32(f, 36 + 2 * count);
+	fwrite("WAVEfmt ", 1, 8, f);
+	Put32(f, 16);
+	Put16(f, 1);			// PCM
+	Put16(f, 1);			// mono
+	Put32(f, rate);
+	Put32(f, 2 * rate);
+	Put16(f, 2);
+	Put16(f, 16);
+	fwrite("data", 1, 4, f);
+	Put32(f, 2 * count);
+	for (i = 0; i < count; ++i)
+	{
+		Put16(f, data[i]);
+	}
+	fclose(f);
+}
+
+// Reads 16-bit PCM, keeping the first channel
+static bool Wav_Read(const char *path, Wav_t *wav)
+{
+	FILE *f = fopen(path, "rb");
+	uint8_t *buf, *p, *end;
+	uint32_t size, channels = 0, bits = 0, i;
+	long len;
+
+	if (!f) return false;
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf = malloc(len);
+	len = fread(buf, 1, len, f);
+	fclose(f);
+
+	memset(wav, 0, sizeof(*wav));
+	if (len < 12 || memcmp(buf, "RIFF", 4) || memcmp(buf + 8, "WAVE", 4))
+	{
+		free(buf);
+		return false;
+	}
+
+	for (p = buf + 12, end = buf + len; p + 8 <= end; p += 8 + ((size + 1) & ~1))
+	{
+		size = Get32(p + 4);
+		if (!memcmp(p, "fmt ", 4) && Get16(p + 8) == 1)
+		{
+			channels = Get16(p + 10);
+			wav->rate = Get32(p + 12);
+			bits = Get16(p + 22);
+		}
+		else if (!memcmp(p, "data", 4) && channels && bits == 16)
+		{
+			size = MIN(size, (uint32_t) (end - p - 8));
+			wav->count = size / (2 * channels);
+			wav->data = malloc(wav->count * sizeof(int16_t));
+			for (i = 0; i < wav->count; ++i)
+			{
+				wav->data[i] = Get16(p + 8 + 2 * channels * i);
+			}
+			break;
+		}
+	}
+
+	free(buf);
+	return wav->data != 0;
+}
+
+// Scales to the 12-bit ADC around mid-scale, resampling linearly to
+// FS_ADC_RATE, and feeds half-buffers at the DMA rate. Returns host ns
+// per block.
+static double Feed(const Wav_t *wav, int32_t offset)
+{
+	uint16_t block[FS_ADC_BLOCK_LEN * FS_ADC_CHANNELS];
+	const double step = (double) wav->rate / FS_ADC_RATE;
+	uint32_t i, j, blocks = 0;
+	double t = 0, x, frac;
+	uint64_t t0, ns = 0;
+	int32_t counts;
+
+	outputCount = 0;
+	Host_SetTime(0);
+	FS_Mic_Init();
+
+	while (t + step * FS_ADC_BLOCK_LEN < wav->count - 1)
+	{
+		for (i = 0; i < FS_ADC_BLOCK_LEN; ++i, t += step)
+		{
+			j = (uint32_t) t;
+			frac = t - j;
+			x = wav->data[j] * (1 - frac) + wav->data[j + 1] * frac;
+
+			counts = MID + offset + lround(x / 16);
+			block[i * FS_ADC_CHANNELS + FS_ADC_RANK_MIC] = MIN(MAX(counts, 0), 0xFFF);
+			block[i * FS_ADC_CHANNELS + FS_ADC_RANK_VBAT] = 2600;
+		}
+
+		Host_Advance((uint64_t) FS_ADC_BLOCK_LEN * 1000000 / FS_ADC_RATE);
+
+		t0 = Host_Nanoseconds();
+		FS_Mic_ProcessBlock(block, FS_ADC_BLOCK_LEN);
+		ns += Host_Nanoseconds() - t0;
+		++blocks;
+	}
+
+	FS_Mic_DeInit();
+
+	return blocks ? (double) ns / blocks : 0;
+}
+
+// Gain of the one-pole low-pass and its complement at f Hz
+static void Band_Gain(double f, double *low, double *high)
+{
+	const double w = 2 * M_PI * f / FS_ADC_RATE;
+	const double b = 1 - LP_ALPHA;
+	const double re = 1 - b * cos(w), im = b * sin(w);
+	const double d = re * re + im * im;
+	const double hr = LP_ALPHA * re / d, hi = -LP_ALPHA * im / d;
+
+	*low = sqrt(hr * hr + hi * hi);
+	*high = sqrt((1 - hr) * (1 - hr) + hi * hi);
+}
+
+// Writes a synthetic signal to WAV, reads it back and feeds it
+static double Run(const char *name, const int16_t *data, uint32_t count,
+		uint32_t rate, int32_t offset)
+{
+	char path[] = "/tmp/test_mic_XXXXXX";
+	Wav_t wav;
+	double ns;
+	int fd;
+
+	fd = mkstemp(path);
+	close(fd);
+	Wav_Write(path, data, count, rate);
+	HOST_CHECK(Wav_Read(path, &wav) && wav.count == count && wav.rate == rate,
+			"%s: WAV round trip", name);
+	remove(path);
+
+	ns = Feed(&wav, offset);
+	free(wav.data);
+
+	return ns;
+}
+
+// Compares every output after the first against expected levels in
+// counts, within a relative tolerance. A negative peak is not checked.
+static void Expect(const char *name, double rms, double peak,
+		double low, double high, double tol)
+{
+	uint32_t i;
+	double e, worst = 0;
+
+	HOST_CHECK(outputCount >= 3, "%s: %u outputs", name, outputCount);
+
+	for (i = 1; i < outputCount; ++i)
+	{
+		const FS_Mic_Data_t *d = &outputs[i];
+
+		e = fabs(d->rms - rms * UV_PER_COUNT);
+		e = fmax(e, fabs(d->low - low * UV_PER_COUNT));
+		e = fmax(e, fabs(d->high - high * UV_PER_COUNT));
+		if (peak >= 0) e = fmax(e, fabs(d->peak - peak * UV_PER_COUNT));
+		worst = fmax(worst, e);
+	}
+
+	printf("%-16s rms %7d  peak %7d  low %7d  high %7d uV  worst %.0f uV\n",
+			name, outputs[1].rms, outputs[1].peak, outputs[1].low,
+			outputs[1].high, worst);
+
+	HOST_CHECK(worst <= tol * fmax(rms, peak) * UV_PER_COUNT + 2 * UV_PER_COUNT,
+			"%s: levels within %.0f%%", name, tol * 100);
+}
+
+static void Test_Tones(void)
+{
+	static const double freqs[] = {40, 160, 1000, 3000};
+	const uint32_t rate = FS_ADC_RATE, count = 6 * rate;
+	int16_t *data = malloc(count * sizeof(int16_t));
+	double amp = 1000, low, high;
+	char name[32];
+	uint32_t i, k;
+
+	for (k = 0; k < sizeof(freqs) / sizeof(freqs[0]); ++k)
+	{
+		for (i = 0; i < count; ++i)
+		{
+			data[i] = lround(16 * amp * sin(2 * M_PI * freqs[k] * i / rate));
+		}
+
+		snprintf(name, sizeof(name), "%.0f Hz", freqs[k]);
+		Run(name, data, count, rate, 0);
+		Band_Gain(freqs[k], &low, &high);
+		Expect(name, amp / sqrt(2), amp, low * amp / sqrt(2), high * amp / sqrt(2), 0.02);
+	}
+
+	// Same tone from a 44.1 kHz file and with the DC level off centre
+	free(data);
+	data = malloc(6 * 44100 * sizeof(int16_t));
+	for (i = 0; i < 6 * 44100; ++i)
+	{
+		data[i] = lround(16 * amp * sin(2 * M_PI * 1000 * i / 44100.0));
+	}
+	Run("1000 Hz 44.1k", data, 6 * 44100, 44100, 0);
+	Band_Gain(1000, &low, &high);
+	Expect("1000 Hz 44.1k", amp / sqrt(2), amp, low * amp / sqrt(2), high * amp / sqrt(2), 0.02);
+
+	for (i = 0; i < count; ++i)
+	{
+		data[i] = lround(16 * amp * sin(2 * M_PI * 1000 * i / rate));
+	}
+	Run("1000 Hz offset", data, count, rate, 400);
+	Expect("1000 Hz offset", amp / sqrt(2), amp, low * amp / sqrt(2), high * amp / sqrt(2), 0.02);
+
+	free(data);
+}
+
+static void Test_Silence(void)
+{
+	const uint32_t count = 4 * FS_ADC_RATE;
+	int16_t *data = calloc(count, sizeof(int16_t));
+
+	Run("silence", data, count, FS_ADC_RATE, 0);
+	Expect("silence", 0, 0, 0, 0, 0);
+
+	free(data);
+}
+
+// White noise splits between the bands by the noise gain of the
+// low-pass, alpha / (2 - alpha)
+static void Test_Noise(void)
+{
+	const uint32_t count = 8 * FS_ADC_RATE;
+	int16_t *data = malloc(count * sizeof(int16_t));
+	const double sigma = 300;
+	const double lowGain = sqrt(LP_ALPHA / (2 - LP_ALPHA));
+	const double highGain = (1 - LP_ALPHA) * sqrt(2 / (2 - LP_ALPHA));
+	double u, v;
+	uint32_t i;
+
+	srand(1);
+	for (i = 0; i < count; ++i)
+	{
+		u = (rand() + 1.0) / (RAND_MAX + 2.0);
+		v = (rand() + 1.0) / (RAND_MAX + 2.0);
+		data[i] = lround(16 * fmin(fmax(sigma * sqrt(-2 * log(u)) * cos(2 * M_PI * v), -2000), 2000));
+	}
+
+	Run("white noise", data, count, FS_ADC_RATE, 0);
+	Expect("white noise", sigma, -1, sigma * lowGain, sigma * highGain, 0.05);
+
+	free(data);
+}
+
+// A full-scale tone clips at the rails; peak is bounded by mid-scale,
+// give or take the ripple of the DC tracker
+static void Test_Clipping(void)
+{
+	const uint32_t count = 4 * FS_ADC_RATE;
+	int16_t *data = malloc(count * sizeof(int16_t));
+	uint32_t i;
+	bool bounded = true;
+
+	for (i = 0; i < count; ++i)
+	{
+		data[i] = lround(32767 * sin(2 * M_PI * 500 * i / FS_ADC_RATE));
+	}
+
+	Run("clipped", data, count, FS_ADC_RATE, 0);
+
+	for (i = 0; i < outputCount; ++i)
+	{
+		bounded = bounded && (outputs[i].peak <= lround((MID + 8) * UV_PER_COUNT));
+	}
+	HOST_CHECK(bounded && outputCount > 0, "clipped: peak within rails");
+}
+
+static void Test_Cost(void)
+{
+	const uint32_t count = 60 * FS_ADC_RATE;
+	int16_t *data = malloc(count * sizeof(int16_t));
+	Wav_t wav = {data, count, FS_ADC_RATE};
+	uint32_t i;
+	double ns;
+
+	for (i = 0; i < count; ++i)
+	{
+		data[i] = rand() % 8192 - 4096;
+	}
+
+	ns = Feed(&wav, 0);
+	printf("%.0f host ns per %u-scan block (%.2f ns per sample)\n",
+			ns, FS_ADC_BLOCK_LEN, ns / FS_ADC_BLOCK_LEN);
+
+	free(data);
+}
+
+static void Print_File(const char *path)
+{
+	Wav_t wav;
+	uint32_t i;
+
+	if (!Wav_Read(path, &wav))
+	{
+		printf("%s: not a 16-bit PCM WAV file\n", path);
+		exit(1);
+	}
+
+	Feed(&wav, 0);
+	free(wav.data);
+
+	printf("time (ms)  rms (uV)  peak (uV)  low (uV)  high (uV)\n");
+	for (i = 0; i < outputCount; ++i)
+	{
+		printf("%9u  %8d  %9d  %8d  %9d\n", outputs[i].time, outputs[i].rms,
+				outputs[i].peak, outputs[i].low, outputs[i].high);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+	{
+		Print_File(argv[1]);
+		return 0;
+	}
+
+	Test_Silence();
+	Test_Tones();
+	Test_Noise();
+	Test_Clipping();
+	Test_Cost();
+
+	return Host_Finish("test_mic");
+}
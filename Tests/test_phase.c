@@ -0,0 +1,510 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+// Replays synthetic sessions through the phase detector, with GNSS and
+// barometer data delivered as the active controller does, and scores
+// the detected phase against the phase each sample was generated in:
+// fraction of time correct, latency of each transition and spurious
+// transitions. Also checks that each phase's rate profile is applied.
+// Given a TRACK.CSV, prints the detected timeline instead.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "main.h"
+#include "host.h"
+#include "altitude.h"
+#include "phase.h"
+#include "timestamp.h"
+#include "track.h"
+
+#define STEP           0.05		// track resolution (s)
+#define GNSS_PERIOD    0.2		// s
+#define BARO_PERIOD    0.1		// s
+#define GNSS_NOISE     1.5		// hMSL (m)
+#define BARO_NOISE     2.0		// Pa
+#define TOW_START_MS   345600000
+#define MAX_POINTS     100000
+#define MAX_CHANGES    32
+
+typedef struct
+{
+	const char *name;
+	uint32_t (*build)(void);
+	bool baro;
+} Scenario_t;
+
+typedef struct
+{
+	double     t;
+	FS_Phase_t phase;
+} Change_t;
+
+static const char *const phaseNames[FS_PHASE_COUNT] =
+{
+	"ground", "climb", "exit", "freefall", "canopy", "landed"
+};
+
+// Worst latency accepted entering each phase (s)
+static const double maxLatency[FS_PHASE_COUNT] =
+{
+	40,		// ground, after a 30 s dwell
+	10,		// climb, 5 s dwell while the aircraft accelerates
+	4,		// exit, 0.5 s dwell after 10 m/s, reached about 2.5 s
+			// after leaving a climbing aircraft
+	1,		// freefall, no dwell
+	6,		// canopy, 2 s dwell after deceleration to 15 m/s
+	15		// landed, 10 s dwell
+};
+
+static Track_Point_t track[MAX_POINTS];
+static FS_Phase_t expected[MAX_POINTS];
+static bool settled[MAX_POINTS];		// past the latency allowed for the last transition
+static uint32_t trackCount;
+
+static Change_t changes[MAX_CHANGES];
+static uint32_t changeCount;
+
+static uint16_t gnssRate;
+static uint32_t syncInterval;
+
+void FS_GNSS_SetRate(uint16_t rate)
+{
+	gnssRate = rate;
+}
+
+void FS_Log_SetSyncInterval(uint32_t interval)
+{
+	syncInterval = interval;
+}
+
+static double Gaussian(double sigma)
+{
+	const double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+	const double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+	return sigma * sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+// Phase the detector should report for a synthetic point. Exit lasts
+// until freefall speed is first reached.
+static FS_Phase_t Expected(const Track_Point_t *p, FS_Phase_t previous, bool jumped)
+{
+	switch (p->phase)
+	{
+	case TRACK_GROUND:
+		return jumped ? FS_PHASE_LANDED : FS_PHASE_GROUND;
+	case TRACK_CLIMB:
+		return FS_PHASE_CLIMB;
+	case TRACK_FREEFALL:
+		if (previous == FS_PHASE_FREEFALL || p->velD > 25) return FS_PHASE_FREEFALL;
+		return FS_PHASE_EXIT;
+	case TRACK_DEPLOY:
+	case TRACK_CANOPY:
+		return FS_PHASE_CANOPY;
+	case TRACK_LANDED:
+	default:
+		return FS_PHASE_LANDED;
+	}
+}
+
+// Appends a synthetic jump, starting on the ground where the last one
+// finished. With drop > 0, deploys that far below the exit point
+// instead of at deployAlt.
+static void Append_Jump(double exitAlt, double deployAlt, double drop)
+{
+	const bool jumped = trackCount > 0;
+	const double t0 = jumped ? track[trackCount - 1].t + STEP : 0;
+	FS_Phase_t previous = jumped ? expected[trackCount - 1] : FS_PHASE_GROUND;
+	Track_Synth_t s;
+
+	Track_SynthInit(&s);
+	s.exitAlt = exitAlt;
+	s.deployAlt = deployAlt;
+	s.exitTime = 1e9;
+
+	while (trackCount < MAX_POINTS && !(s.p.phase == TRACK_LANDED && s.p.t > s.landTime + 60))
+	{
+		// Exit once the aircraft reaches exit altitude
+		if (s.p.phase == TRACK_CLIMB && s.p.hMSL - s.groundAlt >= exitAlt && s.exitTime > s.p.t)
+		{
+			s.exitTime = s.p.t;
+		}
+
+		if (drop > 0 && s.p.phase == TRACK_FREEFALL && s.deployAlt == deployAlt)
+		{
+			s.deployAlt = s.p.hMSL - s.groundAlt - drop;
+		}
+
+		track[trackCount] = s.p;
+		track[trackCount].t += t0;
+		previous = expected[trackCount] = Expected(&s.p, previous, jumped || s.p.phase == TRACK_LANDED);
+		++trackCount;
+		Track_SynthStep(&s, STEP);
+	}
+}
+
+static uint32_t Build_Jump(void)
+{
+	trackCount = 0;
+	Append_Jump(4000, 1000, 0);
+	return trackCount;
+}
+
+// Deployment before freefall speed is reached
+static uint32_t Build_HopAndPop(void)
+{
+	trackCount = 0;
+	Append_Jump(1500, 0, 20);
+	return trackCount;
+}
+
+static uint32_t Build_TwoJumps(void)
+{
+	trackCount = 0;
+	Append_Jump(4000, 1000, 0);
+	Append_Jump(3000, 900, 0);
+	return trackCount;
+}
+
+// Aircraft climbs and lands again with the jumper on board
+static uint32_t Build_RideDown(void)
+{
+	Track_Synth_t s;
+	Track_Point_t *p;
+	double stopped = -1;
+
+	trackCount = 0;
+	Track_SynthInit(&s);
+	s.exitTime = 1e9;
+
+	while (s.p.hMSL - s.groundAlt < 1500)
+	{
+		track[trackCount] = s.p;
+		expected[trackCount++] = (s.p.phase == TRACK_GROUND) ? FS_PHASE_GROUND : FS_PHASE_CLIMB;
+		Track_SynthStep(&s, STEP);
+	}
+
+	// Descend at 6 m/s, then roll out and stop
+	while (trackCount < MAX_POINTS)
+	{
+		p = &track[trackCount];
+		*p = track[trackCount - 1];
+		p->t += STEP;
+
+		if (p->hMSL > s.groundAlt)
+		{
+			p->velD = 6;
+			p->hMSL = fmax(p->hMSL - p->velD * STEP, s.groundAlt);
+		}
+		else
+		{
+			p->velD = 0;
+			p->velE = fmax(p->velE - 3 * STEP, 0);
+			if (p->velE == 0 && stopped < 0) stopped = p->t;
+		}
+		p->lon += p->velE * STEP / 70000;
+
+		expected[trackCount] = (stopped >= 0 && p->t >= stopped) ? FS_PHASE_GROUND : FS_PHASE_CLIMB;
+		++trackCount;
+
+		if (stopped >= 0 && p->t > stopped + 60) break;
+	}
+
+	return trackCount;
+}
+
+static void Mark_Settled(void)
+{
+	double changed = track[0].t;
+	uint32_t i;
+
+	for (i = 0; i < trackCount; ++i)
+	{
+		if (i > 0 && expected[i] != expected[i - 1]) changed = track[i].t;
+		settled[i] = (i == 0) || (track[i].t - changed > maxLatency[expected[i]]);
+	}
+}
+
+static uint32_t Build_Recorded(const char *path)
+{
+	trackCount = Track_Load(path, track, MAX_POINTS);
+	return trackCount;
+}
+
+static void Configure(void)
+{
+	memset(&hostConfig, 0, sizeof(hostConfig));
+	hostConfig.rate = 200;
+	hostConfig.imu_log_dec = 1;
+	hostConfig.baro_log_dec = 1;
+
+	// Slow down and sync rarely on the ground, speed up in freefall
+	hostConfig.phases[FS_PHASE_GROUND].rate = 1000;
+	hostConfig.phases[FS_PHASE_GROUND].log_sync = 50;
+	hostConfig.phases[FS_PHASE_LANDED].rate = 1000;
+	hostConfig.phases[FS_PHASE_LANDED].log_sync = 50;
+	hostConfig.phases[FS_PHASE_FREEFALL].rate = 100;
+	hostConfig.phases[FS_PHASE_FREEFALL].log_sync = 5;
+}
+
+static uint16_t Profile_Rate(FS_Phase_t phase)
+{
+	const uint16_t rate = hostConfig.phases[phase].rate;
+	return rate ? rate : hostConfig.rate;
+}
+
+static void Deliver_Baro(double t)
+{
+	Track_Point_t p;
+	FS_Baro_Data_t baro;
+	uint32_t ms;
+	uint16_t us;
+
+	Track_Interpolate(track, trackCount, t, &p);
+
+	FS_Timestamp_Get(&ms, &us);
+	baro.time = ms;
+	baro.timeUs = us;
+	baro.pressure = lround((Track_Pressure(p.hMSL) + Gaussian(BARO_NOISE)) * 100);
+	baro.temperature = 1500;
+
+	// As the active controller's barometer task
+	FS_Altitude_UpdateBaro(&baro);
+	FS_Phase_UpdateBaro();
+}
+
+static void Deliver_GNSS(double t, bool noise)
+{
+	FS_GNSS_Data_t gnss;
+	Track_Point_t p;
+
+	Track_Interpolate(track, trackCount, t, &p);
+	if (noise)
+	{
+		p.hMSL += Gaussian(GNSS_NOISE);
+		p.velN += Gaussian(p.sAcc / 2);
+		p.velE += Gaussian(p.sAcc / 2);
+		p.velD += Gaussian(p.sAcc / 2);
+	}
+	Track_ToGNSS(&p, TOW_START_MS + lround(t * 1000), &gnss);
+
+	// As the active controller's GNSS callback
+	FS_Altitude_UpdateGNSS(&gnss);
+	FS_Phase_UpdateGNSS(&gnss);
+}
+
+static void Deliver_Pulse(double t)
+{
+	uint32_t ms;
+	uint16_t us;
+
+	FS_Timestamp_Get(&ms, &us);
+	FS_Timestamp_Timepulse(ms, us, 2300, TOW_START_MS + lround(t * 1000), 0);
+}
+
+// Runs the track and records detected transitions. Fills the fraction of
+// GNSS epochs classified as expected, overall and once each transition
+// has had its allowed latency, and counts epochs where the GNSS rate did
+// not match the current phase's profile.
+static void Replay(bool baro, bool synthetic, double *accuracy, double *settledAccuracy,
+		uint32_t *rateErrors)
+{
+	const double t0 = track[0].t, end = track[trackCount - 1].t;
+	double tBaro = t0, tGnss = t0, tPulse = t0, t;
+	uint32_t epochs = 0, correct = 0, settledEpochs = 0, settledCorrect = 0, i = 0;
+	bool match;
+	FS_Phase_t last;
+
+	srand(1);
+	Configure();
+	Host_SetTime(1000000);
+	FS_Timestamp_Init();
+	FS_Timestamp_Reset();
+	FS_Altitude_Init();
+	FS_Phase_Init();
+
+	last = FS_Phase_Get();
+	changeCount = 0;
+	*rateErrors = 0;
+
+	for (;;)
+	{
+		t = tGnss;
+		if (baro) t = fmin(t, tBaro);
+		t = fmin(t, tPulse);
+		if (t > end) break;
+
+		Host_SetTime(1000000 + llround((t - t0) * 1e6));
+
+		if (t == tPulse)
+		{
+			Deliver_Pulse(t);
+			tPulse += 1;
+		}
+		else if (baro && t == tBaro)
+		{
+			Deliver_Baro(t);
+			tBaro += BARO_PERIOD;
+		}
+		else
+		{
+			Deliver_GNSS(t, synthetic);
+			tGnss += GNSS_PERIOD;
+		}
+
+		Host_RunTasks();
+
+		if (FS_Phase_Get() != last)
+		{
+			last = FS_Phase_Get();
+			if (changeCount < MAX_CHANGES)
+			{
+				changes[changeCount].t = t;
+				changes[changeCount].phase = last;
+				++changeCount;
+			}
+		}
+
+		if (t == tGnss - GNSS_PERIOD)
+		{
+			while (i + 1 < trackCount && track[i + 1].t <= t) ++i;
+			match = synthetic && (FS_Phase_Get() == expected[i]);
+			correct += match;
+			if (synthetic && settled[i])
+			{
+				settledCorrect += match;
+				++settledEpochs;
+			}
+			if (gnssRate != Profile_Rate(FS_Phase_Get())) ++*rateErrors;
+			++epochs;
+		}
+	}
+
+	Host_SetVerbose(!synthetic);
+	FS_Phase_DeInit();
+	Host_SetVerbose(false);
+
+	*accuracy = epochs ? (double) correct / epochs : 0;
+	*settledAccuracy = settledEpochs ? (double) settledCorrect / settledEpochs : 0;
+}
+
+// Matches each expected transition to the first detected transition into
+// the same phase, and reports latency
+static void Score(const Scenario_t *scenario, double accuracy, double settledAccuracy)
+{
+	Change_t want[MAX_CHANGES];
+	uint32_t wantCount = 0, i, j, used = 0;
+	double latency;
+
+	for (i = 1; i < trackCount && wantCount < MAX_CHANGES; ++i)
+	{
+		if (expected[i] != expected[i - 1])
+		{
+			want[wantCount].t = track[i].t;
+			want[wantCount].phase = expected[i];
+			++wantCount;
+		}
+	}
+
+	printf("\n%s%s: %.1f%% of epochs correct, %.2f%% outside transitions\n",
+			scenario->name, scenario->baro ? "" : ", GNSS only",
+			accuracy * 100, settledAccuracy * 100);
+
+	for (i = 0, j = 0; i < wantCount; ++i)
+	{
+		while (j < changeCount && changes[j].phase != want[i].phase) ++j;
+
+		if (j == changeCount)
+		{
+			HOST_CHECK(false, "%s: %s at %.1f s not detected",
+					scenario->name, phaseNames[want[i].phase], want[i].t);
+			break;
+		}
+
+		latency = changes[j].t - want[i].t;
+		printf("  %-8s at %6.1f s, detected after %5.1f s\n",
+				phaseNames[want[i].phase], want[i].t, latency);
+
+		HOST_CHECK(latency > -1 && latency <= maxLatency[want[i].phase],
+				"%s: %s detected after %.1f s", scenario->name,
+				phaseNames[want[i].phase], latency);
+
+		++j;
+		++used;
+	}
+
+	HOST_CHECK(changeCount == used, "%s: %lu transitions detected, %lu expected",
+			scenario->name, (unsigned long) changeCount, (unsigned long) used);
+	HOST_CHECK(settledAccuracy > 0.999, "%s: %.2f%% of epochs correct outside transitions",
+			scenario->name, settledAccuracy * 100);
+}
+
+int main(int argc, char **argv)
+{
+	static const Scenario_t scenarios[] =
+	{
+		{"jump",         Build_Jump,      true},
+		{"jump",         Build_Jump,      false},
+		{"hop and pop",  Build_HopAndPop, true},
+		{"two jumps",    Build_TwoJumps,  true},
+		{"ride down",    Build_RideDown,  true},
+	};
+	uint32_t i, rateErrors;
+	double accuracy, settledAccuracy;
+
+	if (argc > 1)
+	{
+		if (Build_Recorded(argv[1]) < 2)
+		{
+			printf("usage: test_phase [TRACK.CSV]\n");
+			return 1;
+		}
+
+		Replay(false, false, &accuracy, &settledAccuracy, &rateErrors);
+
+		printf("%s:\n", argv[1]);
+		for (i = 0; i < changeCount; ++i)
+		{
+			printf("  %7.1f s  %-8s\n", changes[i].t - track[0].t, phaseNames[changes[i].phase]);
+		}
+
+		return 0;
+	}
+
+	for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); ++i)
+	{
+		scenarios[i].build();
+		Mark_Settled();
+		Replay(scenarios[i].baro, true, &accuracy, &settledAccuracy, &rateErrors);
+		Score(&scenarios[i], accuracy, settledAccuracy);
+
+		HOST_CHECK(rateErrors == 0, "%s: %lu epochs at the wrong GNSS rate",
+				scenarios[i].name, (unsigned long) rateErrors);
+		HOST_CHECK(Host_FindEvent("Phase changed from ground to climb"),
+				"%s: transition logged", scenarios[i].name);
+	}
+
+	return Host_Finish("test_phase");
+}
@@ -0,0 +1,621 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+// Replays a jump through audio control and writes the timeline of tones,
+// speech clips and alarms it hands to the audio driver. Without a track
+// the synthetic jump is replayed once for each value of Mode, Mode_2,
+// Sp_Mode and Alarm_Type, and each timeline is compared with its golden
+// copy in golden/timeline/. The host time spent in the tasks after each
+// GNSS epoch and barometer sample is printed with the task cost and the
+// latency from GNSS epoch to audio action logged by the module.
+//
+//   ./test_timeline                    compare with golden timelines
+//   ./test_timeline -w                 rewrite golden timelines
+//   ./test_timeline TRACK.CSV [NAME]   print timelines for a recording
+
+#include <errno.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "main.h"
+#include "ahrs.h"
+#include "altitude.h"
+#include "audio_control.h"
+#include "host.h"
+#include "host_audio.h"
+#include "kalman.h"
+#include "timestamp.h"
+#include "track.h"
+
+#define MAX_POINTS     200000
+#define TRUTH_STEP     0.01		// s
+#define GNSS_RATE_MS   200
+#define GNSS_DELAY_US  60000	// solution to delivery
+#define BARO_PERIOD_US 40000
+#define TICK_US        10000	// task runs between deliveries
+#define TOW_START_MS   345600000
+#define LOCAL_START_US 5000000	// local clock at start of track
+#define CLIP_MS        800
+#define DEST_NORTH     1000		// m
+#define GOLDEN_DIR     "golden/timeline"
+#define TIMELINE_LEN   (1 << 20)
+
+typedef enum
+{
+	CASE_MODE = 0,		// tone pitch from Mode, constant rate
+	CASE_MODE_2,		// tone rate from Mode_2, pitch from horizontal speed
+	CASE_SPEECH,		// Sp_Mode, no tones
+	CASE_ALARM			// Alarm_Type with altitude callouts, no tones
+} Case_Kind_t;
+
+typedef struct
+{
+	const char *name;
+	Case_Kind_t kind;
+	uint8_t     value;
+	uint8_t     units;
+} Case_t;
+
+typedef struct
+{
+	uint64_t gnssNs;		// host time in tasks after GNSS epochs
+	uint32_t gnssCount;
+	uint64_t baroNs;		// host time in tasks after barometer samples
+	uint32_t baroCount;
+} Cost_t;
+
+static const Case_t cases[] = {
+	{"mode_0_horizontal_speed",     CASE_MODE,   FS_CONFIG_MODE_HORIZONTAL_SPEED, 0},
+	{"mode_1_vertical_speed",       CASE_MODE,   FS_CONFIG_MODE_VERTICAL_SPEED, 0},
+	{"mode_2_glide_ratio",          CASE_MODE,   FS_CONFIG_MODE_GLIDE_RATIO, 0},
+	{"mode_3_inverse_glide_ratio",  CASE_MODE,   FS_CONFIG_MODE_INVERSE_GLIDE_RATIO, 0},
+	{"mode_4_total_speed",          CASE_MODE,   FS_CONFIG_MODE_TOTAL_SPEED, 0},
+	{"mode_5_direction_to_dest",    CASE_MODE,   FS_CONFIG_MODE_DIRECTION_TO_DESTINATION, 0},
+	{"mode_6_distance_to_dest",     CASE_MODE,   FS_CONFIG_MODE_DISTANCE_TO_DESTINATION, 0},
+	{"mode_7_direction_to_bearing", CASE_MODE,   FS_CONFIG_MODE_DIRECTION_TO_BEARING, 0},
+	{"mode_10_left_right",          CASE_MODE,   FS_CONFIG_MODE_LEFT_RIGHT, 0},
+	{"mode_11_dive_angle",          CASE_MODE,   FS_CONFIG_MODE_DIVE_ANGLE, 0},
+	{"mode_13_body_pitch",          CASE_MODE,   FS_CONFIG_MODE_BODY_PITCH, 0},
+	{"mode_14_body_roll",           CASE_MODE,   FS_CONFIG_MODE_BODY_ROLL, 0},
+	{"mode2_0_horizontal_speed",    CASE_MODE_2, FS_CONFIG_MODE_HORIZONTAL_SPEED, 0},
+	{"mode2_1_vertical_speed",      CASE_MODE_2, FS_CONFIG_MODE_VERTICAL_SPEED, 0},
+	{"mode2_2_glide_ratio",         CASE_MODE_2, FS_CONFIG_MODE_GLIDE_RATIO, 0},
+	{"mode2_3_inverse_glide_ratio", CASE_MODE_2, FS_CONFIG_MODE_INVERSE_GLIDE_RATIO, 0},
+	{"mode2_4_total_speed",         CASE_MODE_2, FS_CONFIG_MODE_TOTAL_SPEED, 0},
+	{"mode2_5_direction_to_dest",   CASE_MODE_2, FS_CONFIG_MODE_DIRECTION_TO_DESTINATION, 0},
+	{"mode2_6_distance_to_dest",    CASE_MODE_2, FS_CONFIG_MODE_DISTANCE_TO_DESTINATION, 0},
+	{"mode2_7_direction_to_bearing", CASE_MODE_2, FS_CONFIG_MODE_DIRECTION_TO_BEARING, 0},
+	{"mode2_8_magnitude_of_value_1", CASE_MODE_2, FS_CONFIG_MODE_MAGNITUDE_OF_VALUE_1, 0},
+	{"mode2_9_change_in_value_1",   CASE_MODE_2, FS_CONFIG_MODE_CHANGE_IN_VALUE_1, 0},
+	{"mode2_11_dive_angle",         CASE_MODE_2, FS_CONFIG_MODE_DIVE_ANGLE, 0},
+	{"mode2_13_body_pitch",         CASE_MODE_2, FS_CONFIG_MODE_BODY_PITCH, 0},
+	{"mode2_14_body_roll",          CASE_MODE_2, FS_CONFIG_MODE_BODY_ROLL, 0},
+	{"speech_0_horizontal_speed",   CASE_SPEECH, FS_CONFIG_MODE_HORIZONTAL_SPEED, FS_CONFIG_UNITS_KMH},
+	{"speech_1_vertical_speed",     CASE_SPEECH, FS_CONFIG_MODE_VERTICAL_SPEED, FS_CONFIG_UNITS_MPH},
+	{"speech_2_glide_ratio",        CASE_SPEECH, FS_CONFIG_MODE_GLIDE_RATIO, 0},
+	{"speech_3_inverse_glide_ratio", CASE_SPEECH, FS_CONFIG_MODE_INVERSE_GLIDE_RATIO, 0},
+	{"speech_4_total_speed",        CASE_SPEECH, FS_CONFIG_MODE_TOTAL_SPEED, FS_CONFIG_UNITS_KNOTS},
+	{"speech_5_direction_to_dest",  CASE_SPEECH, FS_CONFIG_MODE_DIRECTION_TO_DESTINATION, 0},
+	{"speech_6_distance_to_dest",   CASE_SPEECH, FS_CONFIG_MODE_DISTANCE_TO_DESTINATION, FS_CONFIG_UNITS_NM},
+	{"speech_7_direction_to_bearing", CASE_SPEECH, FS_CONFIG_MODE_DIRECTION_TO_BEARING, 0},
+	{"speech_11_dive_angle",        CASE_SPEECH, FS_CONFIG_MODE_DIVE_ANGLE, 0},
+	{"speech_12_altitude",          CASE_SPEECH, FS_CONFIG_MODE_ALTITUDE, FS_CONFIG_UNITS_FEET},
+	{"alarm_0_none",                CASE_ALARM,  0, 0},
+	{"alarm_1_beep",                CASE_ALARM,  1, 0},
+	{"alarm_2_chirp_up",            CASE_ALARM,  2, 0},
+	{"alarm_3_chirp_down",          CASE_ALARM,  3, 0},
+	{"alarm_4_play_file",           CASE_ALARM,  4, 0},
+};
+
+#define NUM_CASES (sizeof(cases) / sizeof(cases[0]))
+
+static Track_Point_t track[MAX_POINTS];
+static uint32_t trackCount;
+static double groundAlt;
+static int32_t destLat, destLon;
+
+static FS_GNSS_Data_t gnssData;
+static FS_AHRS_Data_t ahrsData;
+
+static char timeline[TIMELINE_LEN];
+static char golden[TIMELINE_LEN];
+static size_t timelineLen;
+
+// Modules outside this harness
+uint16_t FS_GNSS_GetRate(void)
+{
+	return GNSS_RATE_MS;
+}
+
+const FS_GNSS_Data_t *FS_GNSS_GetData(void)
+{
+	return &gnssData;
+}
+
+bool FS_Kalman_IsValid(void)
+{
+	return false;
+}
+
+const FS_Kalman_Data_t *FS_Kalman_GetData(void)
+{
+	static FS_Kalman_Data_t data;
+	return &data;
+}
+
+// Attitude of a body following the flight path in coordinated turns
+bool FS_AHRS_IsValid(void)
+{
+	return true;
+}
+
+const FS_AHRS_Data_t *FS_AHRS_GetData(void)
+{
+	return &ahrsData;
+}
+
+static uint64_t Local(double t)
+{
+	return LOCAL_START_US + (uint64_t) llround(t * 1e6);
+}
+
+// Tone range for a value of Mode or Mode_2, where audio control does
+// not choose its own
+static void Range(uint8_t mode, int32_t *min, int32_t *max)
+{
+	switch (mode)
+	{
+	case FS_CONFIG_MODE_VERTICAL_SPEED:
+		*min = 1000;
+		*max = 6000;
+		break;
+	case FS_CONFIG_MODE_GLIDE_RATIO:
+	case FS_CONFIG_MODE_INVERSE_GLIDE_RATIO:
+		*min = 0;
+		*max = 300;
+		break;
+	case FS_CONFIG_MODE_TOTAL_SPEED:
+		*min = 0;
+		*max = 7000;
+		break;
+	case FS_CONFIG_MODE_CHANGE_IN_VALUE_1:
+		*min = 300;
+		*max = 1500;
+		break;
+	case FS_CONFIG_MODE_DIVE_ANGLE:
+		*min = 0;
+		*max = 90;
+		break;
+	case FS_CONFIG_MODE_BODY_PITCH:
+		*min = -90;
+		*max = 90;
+		break;
+	case FS_CONFIG_MODE_BODY_ROLL:
+		*min = -45;
+		*max = 45;
+		break;
+	default:
+		*min = 0;
+		*max = 6000;
+		break;
+	}
+}
+
+static void Alarm(int32_t agl, uint8_t type, const char *filename)
+{
+	FS_Config_Alarm_t *alarm = &hostConfig.alarms[hostConfig.num_alarms++];
+
+	alarm->elev = agl * 1000;
+	alarm->type = type;
+	strcpy(alarm->filename, filename);
+}
+
+static void Configure(const Case_t *c)
+{
+	memset(&hostConfig, 0, sizeof(hostConfig));
+	hostConfig.mode = FS_CONFIG_MODE_HORIZONTAL_SPEED;
+	hostConfig.limits = 1;
+	hostConfig.volume = 6;
+	hostConfig.mode_2 = FS_CONFIG_MODE_MAGNITUDE_OF_VALUE_1;
+	hostConfig.min_rate = FS_CONFIG_RATE_ONE_HZ;
+	hostConfig.max_rate = FS_CONFIG_RATE_ONE_HZ;
+	hostConfig.sp_volume = 7;
+	hostConfig.threshold = 2000;		// freefall only
+	hostConfig.use_sas = 1;
+	hostConfig.dz_elev = lround(groundAlt * 1000);
+	hostConfig.alt_units = FS_CONFIG_UNITS_FEET;
+	hostConfig.enable_audio = 1;
+	hostConfig.enable_ahrs = 1;
+	hostConfig.lat = destLat;
+	hostConfig.lon = destLon;
+	hostConfig.bearing = 45;
+	hostConfig.min_angle = 5;
+
+	Range(hostConfig.mode, &hostConfig.min, &hostConfig.max);
+	Range(hostConfig.mode_2, &hostConfig.min_2, &hostConfig.max_2);
+
+	switch (c->kind)
+	{
+	case CASE_MODE:
+		hostConfig.mode = c->value;
+		Range(c->value, &hostConfig.min, &hostConfig.max);
+		Range(c->value, &hostConfig.min_2, &hostConfig.max_2);
+		break;
+	case CASE_MODE_2:
+		hostConfig.mode_2 = c->value;
+		hostConfig.max_rate = 2 * FS_CONFIG_RATE_ONE_HZ;
+		Range(c->value, &hostConfig.min_2, &hostConfig.max_2);
+		break;
+	case CASE_SPEECH:
+		hostConfig.min_rate = 0;
+		hostConfig.max_rate = 0;
+		hostConfig.sp_rate = 5000;
+		hostConfig.speech[0].mode = c->value;
+		hostConfig.speech[0].units = c->units;
+		hostConfig.speech[0].decimals = (c->value == FS_CONFIG_MODE_ALTITUDE) ? 500 : 1;
+		hostConfig.num_speech = 1;
+
+		// Direction is no longer said once the jumper drifts away
+		hostConfig.max_dist = 1005;
+		break;
+	case CASE_ALARM:
+		hostConfig.min_rate = 0;
+		hostConfig.max_rate = 0;
+		hostConfig.alt_step = 1000;
+		Alarm(3000, c->value, "alt3000");
+		Alarm(1500, c->value, "alt1500");
+		Alarm(1000, c->value, "pull");
+		Alarm(300, c->value, "alt300");
+		break;
+	}
+}
+
+static void Deliver_Baro(double t)
+{
+	Track_Point_t p;
+	FS_Baro_Data_t baro;
+	uint32_t ms;
+	uint16_t us;
+
+	Track_Interpolate(track, trackCount, t, &p);
+
+	FS_Timestamp_Get(&ms, &us);
+	baro.time = ms;
+	baro.timeUs = us;
+	baro.pressure = lround(Track_Pressure(p.hMSL) * 100);
+	baro.temperature = 1500;
+
+	FS_Altitude_UpdateBaro(&baro);
+	FS_AudioControl_UpdateBaro();
+}
+
+static void Deliver_GNSS(double t)
+{
+	Track_Point_t p;
+	double vh, bank;
+
+	Track_Interpolate(track, trackCount, t, &p);
+	Track_ToGNSS(&p, TOW_START_MS + lround(t * 1000), &gnssData);
+
+	// Flight path angle and the bank of a coordinated turn
+	vh = sqrt(p.velN * p.velN + p.velE * p.velE);
+	bank = (vh > 1) ? atan((p.velN * p.accE - p.velE * p.accN) / vh / 9.81) : 0;
+	ahrsData.pitch = lround(-atan2(p.velD, vh) * 1800 / M_PI);
+	ahrsData.roll = lround(bank * 1800 / M_PI);
+
+	FS_Altitude_UpdateGNSS(&gnssData);
+	FS_AudioControl_UpdateGNSS(&gnssData);
+}
+
+static void Deliver_Pulse(double t)
+{
+	uint32_t ms;
+	uint16_t us;
+
+	FS_Timestamp_Get(&ms, &us);
+	FS_Timestamp_Timepulse(ms, us, 2300, TOW_START_MS + lround(t * 1000), 0);
+}
+
+static void Timeline_Print(const char *format, ...)
+	__attribute__((format(printf, 1, 2)));
+
+static void Timeline_Print(const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	timelineLen += vsnprintf(timeline + timelineLen, TIMELINE_LEN - timelineLen, format, args);
+	va_end(args);
+
+	timelineLen = MIN(timelineLen, TIMELINE_LEN - 1);
+}
+
+// One line per action, with time from the start of the track
+static void Timeline_Build(const Case_t *c)
+{
+	uint32_t i;
+
+	timelineLen = 0;
+	Timeline_Print("# %s\n", c->name);
+
+	for (i = 0; i < Host_Audio_Count(); ++i)
+	{
+		const Host_Audio_Event_t *e = Host_Audio_Get(i);
+
+		Timeline_Print("%9.3f  ", (e->time - LOCAL_START_US) * 1e-6);
+
+		switch (e->kind)
+		{
+		case HOST_AUDIO_BEEP:
+			Timeline_Print("beep  %4lu -> %4lu Hz  %3lu ms  volume %u\n",
+					e->startFrequency, e->endFrequency, e->duration, e->volume);
+			break;
+		case HOST_AUDIO_PLAY:
+			Timeline_Print("play  %-12s  volume %u\n", e->filename, e->volume);
+			break;
+		case HOST_AUDIO_STOP:
+			Timeline_Print("stop\n");
+			break;
+		}
+	}
+}
+
+static void Golden_Path(char *buf, size_t len, const Case_t *c)
+{
+	snprintf(buf, len, "%s/%s.txt", GOLDEN_DIR, c->name);
+}
+
+static void Golden_Write(const Case_t *c)
+{
+	char path[256];
+	FILE *fp;
+
+	Golden_Path(path, sizeof(path), c);
+
+	fp = fopen(path, "w");
+	HOST_CHECK(fp != NULL, "couldn't write %s: %s", path, strerror(errno));
+	if (!fp) return;
+
+	fwrite(timeline, 1, timelineLen, fp);
+	fclose(fp);
+}
+
+static void Golden_Compare(const Case_t *c)
+{
+	char path[256];
+	const char *a, *b;
+	size_t len;
+	uint32_t line = 1;
+	FILE *fp;
+
+	Golden_Path(path, sizeof(path), c);
+
+	fp = fopen(path, "r");
+	HOST_CHECK(fp != NULL, "%s missing, run ./test_timeline -w", path);
+	if (!fp) return;
+
+	len = fread(golden, 1, TIMELINE_LEN - 1, fp);
+	golden[len] = '\0';
+	fclose(fp);
+
+	// First line that differs
+	for (a = timeline, b = golden; *a && *a == *b; ++a, ++b)
+	{
+		if (*a == '\n') ++line;
+	}
+
+	if (*a || *b)
+	{
+		while (a > timeline && a[-1] != '\n') --a;
+		while (b > golden && b[-1] != '\n') --b;
+
+		HOST_CHECK(false, "%s:%u: timeline differs\n  got:      %.*s\n  expected: %.*s",
+				path, line, (int) strcspn(a, "\n"), a, (int) strcspn(b, "\n"), b);
+	}
+	else
+	{
+		HOST_CHECK(true, "%s", path);
+	}
+}
+
+static uint32_t Event_Value(const char *text, const char *format, uint32_t *a, uint32_t *b, uint32_t *c)
+{
+	const char *event = Host_MatchEvent(text);
+
+	*a = *b = *c = 0;
+	return event ? sscanf(event, format, a, b, c) : 0;
+}
+
+static void Replay(const Case_t *c, Cost_t *cost)
+{
+	const double end = track[trackCount - 1].t;
+	double tBaro = 0, tGnss = 0, tPulse = 0, tTick = 0, t;
+	uint64_t start;
+
+	memset(cost, 0, sizeof(*cost));
+
+	Configure(c);
+	Host_SetTime(Local(0));
+	Host_Audio_Reset(CLIP_MS);
+	FS_Timestamp_Init();
+	FS_Timestamp_Reset();
+	FS_Altitude_Init();
+	FS_AudioControl_Init();
+
+	for (;;)
+	{
+		// Next event in time order
+		t = fmin(fmin(tGnss + GNSS_DELAY_US * 1e-6, tBaro), fmin(tPulse, tTick));
+		if (t > end) break;
+
+		Host_Advance(Local(t) - Host_GetTime());
+
+		if (t == tPulse)
+		{
+			Deliver_Pulse(t);
+			tPulse += 1;
+			Host_RunTasks();
+		}
+		else if (t == tBaro)
+		{
+			Deliver_Baro(t);
+			tBaro += BARO_PERIOD_US * 1e-6;
+
+			start = Host_Nanoseconds();
+			Host_RunTasks();
+			cost->baroNs += Host_Nanoseconds() - start;
+			++cost->baroCount;
+		}
+		else if (t == tTick)
+		{
+			tTick += TICK_US * 1e-6;
+			Host_RunTasks();
+		}
+		else
+		{
+			Deliver_GNSS(tGnss);
+			tGnss += GNSS_RATE_MS * 1e-3;
+
+			start = Host_Nanoseconds();
+			Host_RunTasks();
+			cost->gnssNs += Host_Nanoseconds() - start;
+			++cost->gnssCount;
+		}
+	}
+
+	Host_ClearEvents();
+	FS_AudioControl_DeInit();
+}
+
+static void Report(const Case_t *c, const Cost_t *cost)
+{
+	uint32_t decision[3], speech[3], alarms[3], producer[3], consumer[3];
+
+	Event_Value("mean decision latency", "%u GNSS epochs, mean decision latency %u us, max %u us",
+			&decision[0], &decision[1], &decision[2]);
+	Event_Value("values spoken", "%u values spoken, mean latency from epoch %u us, max %u us",
+			&speech[0], &speech[1], &speech[2]);
+	Event_Value("alarms from barometer", "%u alarms from barometer, mean latency %u us, max %u us",
+			&alarms[0], &alarms[1], &alarms[2]);
+	Event_Value("Audio control producer", "Audio control producer: %u calls, mean %u cycles, max %u cycles",
+			&producer[0], &producer[1], &producer[2]);
+	Event_Value("Audio control consumer", "Audio control consumer: %u calls, mean %u cycles, max %u cycles",
+			&consumer[0], &consumer[1], &consumer[2]);
+
+	HOST_CHECK(decision[0] > 0, "%s: no GNSS epochs logged", c->name);
+
+	printf("%-30s %7u %6.0f %6.0f %6u %6u %7.1f %7.1f %7.1f %7.1f %7.1f %7.1f\n",
+			c->name, Host_Audio_Count(),
+			(double) cost->gnssNs / MAX(cost->gnssCount, 1),
+			(double) cost->baroNs / MAX(cost->baroCount, 1),
+			producer[1], consumer[1],
+			decision[1] * 1e-3, decision[2] * 1e-3,
+			speech[1] * 1e-3, speech[2] * 1e-3,
+			alarms[1] * 1e-3, alarms[2] * 1e-3);
+}
+
+int main(int argc, char **argv)
+{
+	const char *trackPath = NULL, *only = NULL;
+	bool write = false;
+	Cost_t cost;
+	uint32_t i, k;
+
+	if (argc > 1 && !strcmp(argv[1], "-w"))
+	{
+		write = true;
+	}
+	else if (argc > 1)
+	{
+		trackPath = argv[1];
+		only = (argc > 2) ? argv[2] : NULL;
+	}
+
+	if (trackPath)
+	{
+		trackCount = Track_Load(trackPath, track, MAX_POINTS);
+		if (trackCount < 2)
+		{
+			printf("%s: no GNSS rows\n", trackPath);
+			return 1;
+		}
+
+		// Lowest point of the recording is taken as the ground
+		groundAlt = track[0].hMSL;
+		for (i = 1; i < trackCount; ++i)
+		{
+			groundAlt = fmin(groundAlt, track[i].hMSL);
+		}
+	}
+	else
+	{
+		trackCount = Track_Synth(track, MAX_POINTS, TRUTH_STEP);
+		groundAlt = track[0].hMSL;
+	}
+
+	// Destination 1 km north of the highest point
+	for (i = 1, k = 0; i < trackCount; ++i)
+	{
+		if (track[i].hMSL > track[k].hMSL) k = i;
+	}
+	destLat = lround((track[k].lat + DEST_NORTH / 6371000.0 * 180 / M_PI) * 1e7);
+	destLon = lround(track[k].lon * 1e7);
+
+	if (write)
+	{
+		mkdir("golden", 0755);
+		mkdir(GOLDEN_DIR, 0755);
+	}
+
+	printf("%-30s %7s %13s %13s %15s %15s %15s\n", "", "", "host ns", "mean cycles",
+			"decision ms", "speech ms", "alarm ms");
+	printf("%-30s %7s %6s %6s %6s %6s %7s %7s %7s %7s %7s %7s\n", "configuration", "actions",
+			"epoch", "baro", "prod", "cons", "mean", "max", "mean", "max", "mean", "max");
+
+	for (k = 0; k < NUM_CASES; ++k)
+	{
+		if (only && strcmp(only, cases[k].name)) continue;
+
+		Replay(&cases[k], &cost);
+		Timeline_Build(&cases[k]);
+		Report(&cases[k], &cost);
+
+		if (trackPath)
+		{
+			fputs(timeline, stdout);
+		}
+		else if (write)
+		{
+			Golden_Write(&cases[k]);
+		}
+		else
+		{
+			Golden_Compare(&cases[k]);
+		}
+	}
+
+	return Host_Finish("test_timeline");
+}
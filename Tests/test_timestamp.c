@@ -0,0 +1,291 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+// Drives the timestamp clock model with synthetic time pulses from a
+// local oscillator with drift, interrupt latency jitter, pulse dropouts
+// and GNSS time steps, and checks the error of converted timestamps.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "main.h"
+#include "host.h"
+#include "timestamp.h"
+
+#define WEEK_S      604800
+
+typedef struct
+{
+	double   drift;     // Local clock rate error       (ppm)
+	double   driftRate; // Drift change                 (ppm/s)
+	double   jitter;    // Pulse capture latency, peak  (us)
+	double   local;     // Local time                   (us)
+	uint64_t gnss;      // GNSS time of next pulse      (us since week 0)
+} Clock_t;
+
+typedef struct
+{
+	uint32_t queries;
+	uint32_t invalid;
+	double   maxError;  // us
+} Stats_t;
+
+static void Clock_Init(Clock_t *c, double drift, double jitter)
+{
+	memset(c, 0, sizeof(*c));
+	c->drift = drift;
+	c->jitter = jitter;
+
+	// Start shortly before a week rollover
+	c->local = 5e6;
+	c->gnss = ((uint64_t) 2300 * WEEK_S + WEEK_S - 60) * 1000000;
+
+	FS_Timestamp_Reset();
+}
+
+// Local time of a point dt seconds after the next pulse
+static double Clock_Local(const Clock_t *c, double dt)
+{
+	return c->local + dt * 1e6 * (1 + c->drift * 1e-6);
+}
+
+// Emits the pulse for the current second, offset by step us, and
+// advances to the next
+static void Clock_Pulse(Clock_t *c, bool emit, int64_t step)
+{
+	const double latency = c->jitter * rand() / RAND_MAX;
+	const uint64_t gnss = c->gnss + step;
+	uint32_t ms;
+	uint16_t us;
+
+	if (emit)
+	{
+		Host_SetTime((uint64_t) llround(c->local + latency));
+		FS_Timestamp_Get(&ms, &us);
+		FS_Timestamp_Timepulse(ms, us, gnss / (WEEK_S * 1000000ULL),
+				(gnss / 1000) % (WEEK_S * 1000ULL), gnss % 1000);
+		Host_RunTasks();
+	}
+
+	c->local = Clock_Local(c, 1.0);
+	c->gnss += 1000000;
+	c->drift += c->driftRate;
+}
+
+// Converts a local time half way to the next pulse
+static void Clock_Query(const Clock_t *c, Stats_t *s)
+{
+	const uint64_t truth = c->gnss - 500000;
+	uint16_t week, towUs;
+	uint32_t towMS, ms;
+	uint16_t us;
+	int64_t gnss;
+	double err;
+
+	Host_SetTime((uint64_t) llround(Clock_Local(c, -0.5)));
+	FS_Timestamp_Get(&ms, &us);
+
+	++s->queries;
+	if (!FS_Timestamp_ToGNSS(ms, us, &week, &towMS, &towUs))
+	{
+		++s->invalid;
+		return;
+	}
+
+	gnss = ((int64_t) week * WEEK_S * 1000 + towMS) * 1000 + towUs;
+	err = fabs((double) (gnss - (int64_t) truth));
+	s->maxError = fmax(s->maxError, err);
+}
+
+static void Stats_Print(const char *name, const Stats_t *s)
+{
+	printf("%-28s %5lu queries, %4lu invalid, max error %7.1f us\n", name,
+			(unsigned long) s->queries, (unsigned long) s->invalid, s->maxError);
+}
+
+// Converges with drift and jitter across a week rollover
+static void Test_Drift(double drift, double jitter, double maxError)
+{
+	const FS_Timestamp_Model_t *model = FS_Timestamp_GetModel();
+	Clock_t c;
+	Stats_t s = {0};
+	char name[64];
+	int i;
+
+	Clock_Init(&c, drift, jitter);
+
+	for (i = 0; i < 16; ++i)
+	{
+		Clock_Pulse(&c, true, 0);
+	}
+
+	HOST_CHECK(model->valid, "model valid after 16 pulses");
+	HOST_CHECK(labs(model->drift - lround(drift * 1000)) < 200 + 50 * jitter,
+			"drift %ld ppb, expected %ld", (long) model->drift, lround(drift * 1000));
+
+	for (i = 0; i < 120; ++i)
+	{
+		Clock_Query(&c, &s);
+		Clock_Pulse(&c, true, 0);
+	}
+
+	snprintf(name, sizeof(name), "%+.0f ppm, %.0f us jitter", drift, jitter);
+	Stats_Print(name, &s);
+
+	HOST_CHECK(s.invalid == 0, "%s: all conversions valid", name);
+	HOST_CHECK(s.maxError <= maxError, "%s: max error %.1f us", name, s.maxError);
+	HOST_CHECK(model->residual <= 1000 * jitter, "%s: residual %lu ns",
+			name, (unsigned long) model->residual);
+}
+
+// Pulses stop; conversions hold over for 600 s after the last pulse
+static void Test_Holdover(void)
+{
+	Clock_t c;
+	Stats_t s = {0}, late = {0};
+	uint16_t week, towUs;
+	uint32_t towMS, ms;
+	uint16_t us;
+	int i;
+
+	Clock_Init(&c, 15, 2);
+
+	for (i = 0; i < 32; ++i)
+	{
+		Clock_Pulse(&c, true, 0);
+	}
+
+	// The last pulse was one second before c.gnss
+	for (i = 1; i < 600; ++i)
+	{
+		Clock_Query(&c, &s);
+		Clock_Pulse(&c, false, 0);
+	}
+
+	Stats_Print("600 s holdover", &s);
+	HOST_CHECK(s.invalid == 0, "conversions valid during holdover");
+	HOST_CHECK(s.maxError < 100, "holdover error %.1f us", s.maxError);
+
+	// Just under and at the holdover limit
+	Host_SetTime((uint64_t) llround(Clock_Local(&c, -1.0) - 1e6 * 1e-3));
+	FS_Timestamp_Get(&ms, &us);
+	HOST_CHECK(FS_Timestamp_ToGNSS(ms, us, &week, &towMS, &towUs),
+			"conversion valid 1 ms before holdover limit");
+
+	for (i = 0; i < 5; ++i)
+	{
+		Clock_Pulse(&c, false, 0);
+		Clock_Query(&c, &late);
+	}
+
+	HOST_CHECK(late.invalid == late.queries, "%lu/%lu conversions after holdover",
+			(unsigned long) (late.queries - late.invalid), (unsigned long) late.queries);
+
+	// Pulses resume and the old model is corrected
+	s.queries = s.invalid = 0;
+	s.maxError = 0;
+	for (i = 0; i < 60; ++i)
+	{
+		Clock_Pulse(&c, true, 0);
+		Clock_Query(&c, &s);
+	}
+
+	Stats_Print("resume after holdover", &s);
+	HOST_CHECK(s.invalid == 0, "conversions valid after pulses resume");
+	HOST_CHECK(s.maxError < 5, "error after resume %.1f us", s.maxError);
+}
+
+// Isolated missing pulses while the drift wanders
+static void Test_Dropouts(void)
+{
+	Clock_t c;
+	Stats_t s = {0};
+	int i;
+
+	Clock_Init(&c, -30, 3);
+	c.driftRate = 0.01;
+
+	for (i = 0; i < 600; ++i)
+	{
+		Clock_Pulse(&c, (rand() % 4) != 0 || i < 16, 0);
+		if (i >= 16) Clock_Query(&c, &s);
+	}
+
+	Stats_Print("25% dropouts, drift ramp", &s);
+	HOST_CHECK(s.invalid == 0, "conversions valid with dropouts");
+	HOST_CHECK(s.maxError < 10, "dropout error %.1f us", s.maxError);
+}
+
+// A GNSS time step resets the model, which then converges again
+static void Test_Step(void)
+{
+	const FS_Timestamp_Model_t *model = FS_Timestamp_GetModel();
+	Clock_t c;
+	Stats_t s = {0};
+	int i;
+
+	Clock_Init(&c, 10, 2);
+
+	for (i = 0; i < 20; ++i)
+	{
+		Clock_Pulse(&c, true, 0);
+	}
+
+	Clock_Pulse(&c, true, 5000);
+	HOST_CHECK(!model->valid || model->count == 1, "model reset by 5 ms step");
+	HOST_CHECK(labs(model->error) > 4000000, "step prediction error %ld ns",
+			(long) model->error);
+
+	for (i = 0; i < 20; ++i)
+	{
+		Clock_Pulse(&c, true, 5000);
+	}
+
+	for (i = 0; i < 20; ++i)
+	{
+		Clock_Pulse(&c, true, 5000);
+		Clock_Query(&c, &s);
+	}
+
+	// Queries compare against the unstepped time, so subtract the step
+	HOST_CHECK(fabs(s.maxError - 5000) < 5, "converged on stepped time, error %.1f us",
+			s.maxError);
+}
+
+int main(void)
+{
+	srand(1);
+
+	FS_Timestamp_Init();
+
+	Test_Drift(0, 0, 2);
+	Test_Drift(20, 2, 4);
+	Test_Drift(-50, 5, 8);
+	Test_Drift(100, 20, 25);
+	Test_Holdover();
+	Test_Dropouts();
+	Test_Step();
+
+	return Host_Finish("test_timestamp");
+}
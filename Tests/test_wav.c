@@ -0,0 +1,590 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+// Checks the WAV reader in wav.c. IMA-ADPCM files made by a reference
+// encoder are decoded through FS_WAV_Read and compared sample for sample
+// with a whole-buffer reference decoder and with the encoder's own
+// reconstruction, across block sizes, partial last blocks, fact and odd
+// sized chunks. The linear resampler is measured by its SNR against an
+// ideal sine at each supported source rate, and decode cost is timed
+// per block.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "main.h"
+#include "host.h"
+#include "wav.h"
+
+#define WAV_MAX        (1 << 20)	// bytes
+#define SAMPLES_MAX    (4 * WAV_OUTPUT_RATE)
+#define READ_CHUNK     97			// odd, so reads straddle blocks
+#define BENCH_REPEAT   200
+
+typedef enum
+{
+	SIGNAL_SINE,
+	SIGNAL_CHIRP,
+	SIGNAL_SQUARE,		// full scale, clips the predictor
+	SIGNAL_NOISE
+} Signal_t;
+
+typedef struct
+{
+	const char *name;
+	uint32_t rate;			// Hz
+	uint16_t blockAlign;	// bytes
+	uint32_t frames;		// source samples
+	Signal_t signal;
+	bool     shortFmt;		// 16-byte fmt chunk without samplesPerBlock
+	uint32_t factFrames;	// 0 for no fact chunk
+	bool     oddChunk;		// odd sized chunk ahead of the data
+} ImaCase_t;
+
+static const int8_t indexTable[16] =
+{
+	-1, -1, -1, -1, 2, 4, 6, 8,
+	-1, -1, -1, -1, 2, 4, 6, 8
+};
+
+static const int16_t stepTable[89] =
+{
+	    7,     8,     9,    10,    11,    12,    13,    14,
+	   16,    17,    19,    21,    23,    25,    28,    31,
+	   34,    37,    41,    45,    50,    55,    60,    66,
+	   73,    80,    88,    97,   107,   118,   130,   143,
+	  157,   173,   190,   209,   230,   253,   279,   307,
+	  337,   371,   408,   449,   494,   544,   598,   658,
+	  724,   796,   876,   963,  1060,  1166,  1282,  1411,
+	 1552,  1707,  1878,  2066,  2272,  2499,  2749,  3024,
+	 3327,  3660,  4026,  4428,  4871,  5358,  5894,  6484,
+	 7132,  7845,  8630,  9493, 10442, 11487, 12635, 13899,
+	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+	32767
+};
+
+static uint8_t  wavBuf[WAV_MAX];
+static int16_t  source[SAMPLES_MAX];
+static int16_t  encoded[SAMPLES_MAX];	// encoder reconstruction
+static int16_t  expected[SAMPLES_MAX];
+static int16_t  output[SAMPLES_MAX + READ_CHUNK];
+
+static void PutU16(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void PutU32(uint8_t *p, uint32_t v)
+{
+	PutU16(p, v);
+	PutU16(p + 2, v >> 16);
+}
+
+static int16_t Clamp16(int32_t v)
+{
+	return (v > 32767) ? 32767 : (v < -32768) ? -32768 : v;
+}
+
+static void Signal_Make(Signal_t signal, uint32_t rate, uint32_t count)
+{
+	uint32_t i;
+	double t;
+
+	srand(1);
+	for (i = 0; i < count; ++i)
+	{
+		t = (double) i / rate;
+		switch (signal)
+		{
+		case SIGNAL_SINE:
+			source[i] = lround(20000 * sin(2 * M_PI * 440 * t));
+			break;
+		case SIGNAL_CHIRP:
+			source[i] = lround(12000 * sin(2 * M_PI * (100 + 0.3 * rate * t) * t));
+			break;
+		case SIGNAL_SQUARE:
+			source[i] = ((i / 37) & 1) ? 32767 : -32768;
+			break;
+		case SIGNAL_NOISE:
+			source[i] = (rand() % 40001) - 20000;
+			break;
+		}
+	}
+}
+
+// IMA ADPCM encoder, as in the IMA recommended practice. Keeps the
+// decoder's state, so its reconstruction is what a decoder must produce.
+static uint8_t Ima_Encode(int16_t sample, int32_t *pred, int32_t *index)
+{
+	int32_t step = stepTable[*index];
+	int32_t diff = sample - *pred;
+	int32_t vpdiff = step >> 3;
+	uint8_t nibble = 0;
+
+	if (diff < 0)
+	{
+		nibble = 8;
+		diff = -diff;
+	}
+	if (diff >= step)
+	{
+		nibble |= 4;
+		diff -= step;
+		vpdiff += step;
+	}
+	step >>= 1;
+	if (diff >= step)
+	{
+		nibble |= 2;
+		diff -= step;
+		vpdiff += step;
+	}
+	step >>= 1;
+	if (diff >= step)
+	{
+		nibble |= 1;
+		vpdiff += step;
+	}
+
+	*pred = Clamp16((nibble & 8) ? *pred - vpdiff : *pred + vpdiff);
+	*index = MAX(0, MIN(88, *index + indexTable[nibble]));
+
+	return nibble;
+}
+
+// Encodes source[0..frames) into Microsoft IMA ADPCM mono blocks. The
+// last block holds only the samples left.
+static uint32_t Ima_EncodeData(uint8_t *dst, uint32_t frames, uint16_t blockAlign)
+{
+	const uint32_t perBlock = (blockAlign - 4) * 2 + 1;
+	int32_t pred, index = 0;
+	uint32_t i = 0, n, j, len = 0;
+	uint8_t nibble, byte = 0;
+
+	while (i < frames)
+	{
+		n = MIN(perBlock, frames - i);
+
+		// Header sample is stored as is
+		pred = source[i];
+		encoded[i] = pred;
+		PutU16(dst + len, pred);
+		dst[len + 2] = index;
+		dst[len + 3] = 0;
+		len += 4;
+
+		for (j = 1; j < n; ++j)
+		{
+			nibble = Ima_Encode(source[i + j], &pred, &index);
+			encoded[i + j] = pred;
+			if (j & 1)
+			{
+				byte = nibble;
+			}
+			else
+			{
+				dst[len++] = byte | (nibble << 4);
+			}
+		}
+		if (!(n & 1))
+		{
+			dst[len++] = byte;
+		}
+
+		i += n;
+	}
+
+	return len;
+}
+
+// Whole-buffer IMA ADPCM decoder, walking the data block by block
+static uint32_t Ima_DecodeData(const uint8_t *src, uint32_t len, uint16_t blockAlign,
+		uint32_t maxFrames, int16_t *dst)
+{
+	uint32_t pos = 0, end, n = 0, k;
+	int32_t pred, index, step, diff;
+	uint8_t nibble;
+
+	while ((pos + 4 <= len) && (n < maxFrames))
+	{
+		end = MIN(pos + blockAlign, len);
+
+		pred = (int16_t) (src[pos] | (src[pos + 1] << 8));
+		index = MIN(src[pos + 2], 88);
+		dst[n++] = pred;
+
+		for (pos += 4; (pos < end) && (n < maxFrames); ++pos)
+		{
+			for (k = 0; (k < 2) && (n < maxFrames); ++k)
+			{
+				nibble = (src[pos] >> (4 * k)) & 0x0f;
+				step = stepTable[index];
+
+				diff = step >> 3;
+				if (nibble & 4) diff += step;
+				if (nibble & 2) diff += step >> 1;
+				if (nibble & 1) diff += step >> 2;
+
+				pred = Clamp16((nibble & 8) ? pred - diff : pred + diff);
+				index = MAX(0, MIN(88, index + indexTable[nibble]));
+				dst[n++] = pred;
+			}
+		}
+		pos = end;
+	}
+
+	return n;
+}
+
+// Lays out a WAV file around the given data
+static uint32_t Wav_Build(uint16_t formatTag, uint32_t rate, uint16_t blockAlign,
+		uint16_t bits, uint16_t samplesPerBlock, bool shortFmt, uint32_t factFrames,
+		bool oddChunk, uint32_t dataLen)
+{
+	uint8_t *p = wavBuf + 12;
+	const uint32_t fmtLen = shortFmt ? 16 : 20;
+	static uint8_t data[WAV_MAX];
+
+	memcpy(data, wavBuf + WAV_MAX / 2, dataLen);
+
+	memcpy(p, "fmt ", 4);
+	PutU32(p + 4, fmtLen);
+	PutU16(p + 8, formatTag);
+	PutU16(p + 10, 1);
+	PutU32(p + 12, rate);
+	PutU32(p + 16, rate * blockAlign / MAX(samplesPerBlock, 1));
+	PutU16(p + 20, blockAlign);
+	PutU16(p + 22, bits);
+	if (!shortFmt)
+	{
+		PutU16(p + 24, 2);
+		PutU16(p + 26, samplesPerBlock);
+	}
+	p += 8 + fmtLen;
+
+	if (factFrames)
+	{
+		memcpy(p, "fact", 4);
+		PutU32(p + 4, 4);
+		PutU32(p + 8, factFrames);
+		p += 12;
+	}
+
+	if (oddChunk)
+	{
+		// Padded to an even length
+		memcpy(p, "LIST", 4);
+		PutU32(p + 4, 5);
+		memcpy(p + 8, "INFO\\0\\0", 6);
+		p += 14;
+	}
+
+	memcpy(p, "data", 4);
+	PutU32(p + 4, dataLen);
+	memcpy(p + 8, data, dataLen);
+	p += 8 + dataLen;
+
+	memcpy(wavBuf, "RIFF", 4);
+	PutU32(wavBuf + 4, (p - wavBuf) - 8);
+	memcpy(wavBuf + 8, "WAVE", 4);
+
+	return p - wavBuf;
+}
+
+static bool Wav_Open(FS_WAV_Decoder_t *dec, FIL *file, uint32_t len)
+{
+	file->fp = fmemopen(wavBuf, len, "rb");
+	file->fptr = 0;
+	file->fsize = len;
+
+	return FS_WAV_Open(dec, file);
+}
+
+static void Wav_Close(FIL *file)
+{
+	f_close(file);
+}
+
+static uint32_t Wav_ReadAll(FS_WAV_Decoder_t *dec, uint32_t count)
+{
+	uint32_t i, n;
+
+	for (i = 0; i < count; i += n)
+	{
+		n = FS_WAV_Read(dec, &output[i], MIN(READ_CHUNK, count - i));
+		if (n == 0) break;
+	}
+
+	return i;
+}
+
+static double Snr(const int16_t *ref, const int16_t *out, uint32_t count)
+{
+	double s = 0, e = 0, d;
+	uint32_t i;
+
+	for (i = 0; i < count; ++i)
+	{
+		d = out[i] - ref[i];
+		s += (double) ref[i] * ref[i];
+		e += d * d;
+	}
+
+	return (e > 0) ? 10 * log10(s / e) : INFINITY;
+}
+
+static void Test_Ima(const ImaCase_t *c)
+{
+	const uint16_t perBlock = (c->blockAlign - 4) * 2 + 1;
+	FS_WAV_Decoder_t dec;
+	FIL file;
+	uint32_t dataLen, rem, frames, len, n, outLen, i, bad = 0, badRef = 0;
+
+	Signal_Make(c->signal, c->rate, c->frames);
+	dataLen = Ima_EncodeData(wavBuf + WAV_MAX / 2, c->frames, c->blockAlign);
+
+	// Without a fact chunk, a last block with an even number of samples
+	// reads as one longer, since its final byte holds a single nibble
+	rem = dataLen % c->blockAlign;
+	frames = (dataLen / c->blockAlign) * perBlock + ((rem >= 4) ? (rem - 4) * 2 + 1 : 0);
+	if (c->factFrames) frames = MIN(frames, c->factFrames);
+	Ima_DecodeData(wavBuf + WAV_MAX / 2, dataLen, c->blockAlign, frames, expected);
+	len = Wav_Build(WAV_FORMAT_IMA, c->rate, c->blockAlign, 4, c->shortFmt ? 0 : perBlock,
+			c->shortFmt, c->factFrames, c->oddChunk, dataLen);
+
+	HOST_CHECK(Wav_Open(&dec, &file, len), "%s: FS_WAV_Open failed", c->name);
+	HOST_CHECK(dec.format.samplesPerBlock == perBlock, "%s: %u samples per block",
+			c->name, dec.format.samplesPerBlock);
+	HOST_CHECK(dec.format.frames == frames, "%s: %lu frames, expected %lu",
+			c->name, dec.format.frames, frames);
+
+	outLen = FS_WAV_GetLength(&dec);
+	HOST_CHECK(outLen == ((uint64_t) frames * WAV_OUTPUT_RATE + c->rate - 1) / c->rate,
+			"%s: length %lu", c->name, outLen);
+
+	n = Wav_ReadAll(&dec, outLen);
+	HOST_CHECK(n == outLen, "%s: read %lu of %lu", c->name, n, outLen);
+	Wav_Close(&file);
+
+	if (c->rate == WAV_OUTPUT_RATE)
+	{
+		// Decoder output straight through
+		for (i = 0; i < frames; ++i)
+		{
+			bad += (output[i] != expected[i]);
+		}
+	}
+	else
+	{
+		// Through the resampler, computed as in FS_WAV_Read
+		const uint32_t step = ((uint64_t) c->rate << 16) / WAV_OUTPUT_RATE;
+		uint64_t pos = 0;
+		uint32_t k, phase;
+		int16_t s0, s1;
+
+		for (i = 0; i < outLen; ++i, pos += step)
+		{
+			k = pos >> 16;
+			phase = pos & 0xffff;
+			s0 = expected[MIN(k, frames - 1)];
+			s1 = expected[MIN(k + 1, frames - 1)];
+			bad += (output[i] != (int16_t) (s0 + (((int32_t) (s1 - s0) * (int32_t) (phase >> 1)) >> 15)));
+		}
+	}
+
+	for (i = 0; i < MIN(frames, c->frames); ++i)
+	{
+		badRef += (expected[i] != encoded[i]);
+	}
+
+	HOST_CHECK(badRef == 0, "%s: reference decoder differs from encoder in %lu samples",
+			c->name, badRef);
+	HOST_CHECK(bad == 0, "%s: %lu samples differ from the reference decoder", c->name, bad);
+
+	printf("%-24s %5lu Hz %4u-byte blocks %6lu frames: %lu differ, encoder SNR %5.1f dB\n",
+			c->name, c->rate, c->blockAlign, frames, bad,
+			Snr(source, expected, MIN(frames, c->frames)));
+}
+
+// Source sine through the resampler, against the ideal sine at the
+// source positions of each output sample. The loss against linear
+// interpolation in double precision shows the cost of fixed point.
+static void Test_Resample(uint32_t rate, double freq, double minSnr)
+{
+	const uint32_t frames = rate;	// one second
+	const uint32_t step = ((uint64_t) rate << 16) / WAV_OUTPUT_RATE;
+	FS_WAV_Decoder_t dec;
+	FIL file;
+	uint32_t len, outLen, n, i, k, skip;
+	double s = 0, e = 0, eLin = 0, ideal, pos, lin, snr, snrLin;
+
+	for (i = 0; i < frames; ++i)
+	{
+		source[i] = lround(16000 * sin(2 * M_PI * freq * i / rate));
+		PutU16(wavBuf + WAV_MAX / 2 + 2 * i, source[i]);
+	}
+	len = Wav_Build(WAV_FORMAT_PCM, rate, 2, 16, 1, true, 0, false, 2 * frames);
+
+	HOST_CHECK(Wav_Open(&dec, &file, len), "PCM %lu Hz: FS_WAV_Open failed", rate);
+	outLen = FS_WAV_GetLength(&dec);
+	n = Wav_ReadAll(&dec, outLen);
+	Wav_Close(&file);
+	HOST_CHECK(n == outLen, "PCM %lu Hz: read %lu of %lu", rate, n, outLen);
+
+	// Leave out the held last sample
+	skip = (WAV_OUTPUT_RATE + rate - 1) / rate + 1;
+	for (i = 0; i + skip < outLen; ++i)
+	{
+		pos = (double) i * step / 65536;
+		k = (uint32_t) pos;
+		ideal = 16000 * sin(2 * M_PI * freq * pos / rate);
+		lin = 16000 * ((k + 1 - pos) * sin(2 * M_PI * freq * k / rate)
+				+ (pos - k) * sin(2 * M_PI * freq * (k + 1) / rate));
+		s += ideal * ideal;
+		e += (output[i] - ideal) * (output[i] - ideal);
+		eLin += (lin - ideal) * (lin - ideal);
+	}
+	snr = 10 * log10(s / e);
+	snrLin = 10 * log10(s / eLin);
+
+	HOST_CHECK(snr >= minSnr, "PCM %lu Hz, %.0f Hz sine: SNR %.1f dB, expected %.0f",
+			rate, freq, snr, minSnr);
+	HOST_CHECK(snr >= MIN(snrLin, 80) - 0.5, "PCM %lu Hz, %.0f Hz sine: SNR %.1f dB, %.1f dB in double",
+			rate, freq, snr, snrLin);
+
+	printf("resample %5lu Hz, %5.0f Hz sine: SNR %5.1f dB (%5.1f dB in double), rate error %+.1f ppm\n",
+			rate, freq, snr, MIN(snrLin, 999), ((double) step * WAV_OUTPUT_RATE / 65536 / rate - 1) * 1e6);
+}
+
+static void Test_Reject(void)
+{
+	FS_WAV_Decoder_t dec;
+	FIL file;
+	uint32_t len;
+
+	memset(wavBuf + WAV_MAX / 2, 0, 1024);
+
+	len = Wav_Build(WAV_FORMAT_PCM, 48000, 2, 16, 1, true, 0, false, 1024);
+	HOST_CHECK(!Wav_Open(&dec, &file, len), "48 kHz PCM accepted");
+	Wav_Close(&file);
+
+	len = Wav_Build(WAV_FORMAT_PCM, 16000, 1, 8, 1, true, 0, false, 1024);
+	HOST_CHECK(!Wav_Open(&dec, &file, len), "8-bit PCM accepted");
+	Wav_Close(&file);
+
+	len = Wav_Build(WAV_FORMAT_IMA, 8000, 256, 4, 500, false, 0, false, 1024);
+	HOST_CHECK(!Wav_Open(&dec, &file, len), "IMA with bad samples per block accepted");
+	Wav_Close(&file);
+
+	len = Wav_Build(WAV_FORMAT_IMA, 8000, 4, 4, 1, false, 0, false, 1024);
+	HOST_CHECK(!Wav_Open(&dec, &file, len), "IMA with header-only blocks accepted");
+	Wav_Close(&file);
+
+	len = Wav_Build(0x0003, 8000, 4, 32, 1, true, 0, false, 1024);
+	HOST_CHECK(!Wav_Open(&dec, &file, len), "float format accepted");
+	Wav_Close(&file);
+
+	len = Wav_Build(WAV_FORMAT_PCM, 24000, 2, 16, 1, true, 0, false, 1024);
+	PutU16(wavBuf + 22, 2);
+	HOST_CHECK(!Wav_Open(&dec, &file, len), "stereo accepted");
+	Wav_Close(&file);
+
+	memcpy(wavBuf + 12, "junk", 4);
+	HOST_CHECK(!Wav_Open(&dec, &file, len), "file without fmt chunk accepted");
+	Wav_Close(&file);
+}
+
+// Decode cost per IMA block, straight through and resampled
+static void Test_Bench(uint32_t rate, uint16_t blockAlign)
+{
+	const uint16_t perBlock = (blockAlign - 4) * 2 + 1;
+	const uint32_t blocks = 32;
+	FS_WAV_Decoder_t dec;
+	FIL file;
+	uint32_t dataLen, len, outLen, i;
+	uint64_t t0, ns = 0;
+
+	Signal_Make(SIGNAL_CHIRP, rate, blocks * perBlock);
+	dataLen = Ima_EncodeData(wavBuf + WAV_MAX / 2, blocks * perBlock, blockAlign);
+	len = Wav_Build(WAV_FORMAT_IMA, rate, blockAlign, 4, perBlock, false, 0, false, dataLen);
+
+	for (i = 0; i < BENCH_REPEAT; ++i)
+	{
+		Wav_Open(&dec, &file, len);
+		outLen = FS_WAV_GetLength(&dec);
+
+		t0 = Host_Nanoseconds();
+		Wav_ReadAll(&dec, outLen);
+		ns += Host_Nanoseconds() - t0;
+
+		Wav_Close(&file);
+	}
+
+	printf("IMA %5lu Hz, %4u-byte blocks: %.0f host ns per block, %.2f ns per output sample\n",
+			rate, blockAlign, (double) ns / (BENCH_REPEAT * blocks),
+			(double) ns / ((double) BENCH_REPEAT * outLen));
+}
+
+int main(void)
+{
+	static const ImaCase_t imaCases[] =
+	{
+		{"sine",              24000,  256, 24000, SIGNAL_SINE,   false,     0, false},
+		{"chirp",             24000,  512, 30011, SIGNAL_CHIRP,  false,     0, false},
+		{"noise",             24000, 1024, 20000, SIGNAL_NOISE,  false,     0, false},
+		{"square, clipping",  24000,  256, 12000, SIGNAL_SQUARE, false,     0, false},
+		{"short fmt",         24000,  256,  5000, SIGNAL_SINE,   true,      0, false},
+		{"fact trims block",  24000,  256,  5050, SIGNAL_CHIRP,  false,  4990, false},
+		{"odd chunk",         24000,  256,  5000, SIGNAL_SINE,   false,     0, true},
+		{"partial block",     24000,  256,  1012, SIGNAL_CHIRP,  false,     0, false},
+		{"one sample block",  24000,  256,  1011, SIGNAL_CHIRP,  false,     0, false},
+		{"8 kHz",              8000,  256, 16000, SIGNAL_CHIRP,  false,     0, false},
+		{"11025 Hz",          11025,  512, 11025, SIGNAL_SINE,   false,     0, true},
+		{"16 kHz",            16000,  256,  9999, SIGNAL_NOISE,  false, 9000, false},
+	};
+	uint32_t i;
+
+	for (i = 0; i < sizeof(imaCases) / sizeof(imaCases[0]); ++i)
+	{
+		Test_Ima(&imaCases[i]);
+	}
+
+	// Minimum SNR about 1 dB under linear interpolation of each sine
+	Test_Resample( 8000,  300, 44);
+	Test_Resample( 8000, 1000, 24);
+	Test_Resample(11025, 1000, 29);
+	Test_Resample(16000, 1000, 36);
+	Test_Resample(16000, 3000, 17);
+	Test_Resample(22050, 1000, 41);
+	Test_Resample(24000, 1000, 85);
+
+	Test_Reject();
+
+	Test_Bench(24000, 256);
+	Test_Bench( 8000, 256);
+	Test_Bench(16000, 512);
+
+	return Host_Finish("test_wav");
+}
@@ -0,0 +1,302 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "track.h"
+
+#define GRAVITY      9.80665
+#define TERMINAL     55.0      // Freefall terminal speed     (m/s)
+#define CANOPY_VD    5.0       // Canopy descent rate         (m/s)
+#define CANOPY_VH    10.0      // Canopy ground speed         (m/s)
+#define PLANE_VH     40.0      // Aircraft ground speed       (m/s)
+#define CLIMB_RATE   12.0      // Aircraft climb rate         (m/s)
+#define GROUND_TIME  30.0      // Time before takeoff         (s)
+#define EARTH_RADIUS 6371000.0
+#define TRACK_LEAP   18        // GPS time ahead of UTC       (s)
+#define TRACK_WEEK   604800.0  // GPS week                    (s)
+
+static double Track_Approach(double v, double target, double rate, double dt)
+{
+	if (v < target) return fmin(v + rate * dt, target);
+	else            return fmax(v - rate * dt, target);
+}
+
+void Track_SynthInit(Track_Synth_t *s)
+{
+	memset(s, 0, sizeof(*s));
+
+	s->groundAlt = 500;
+	s->exitAlt = 4000;
+	s->deployAlt = 1000;
+	s->exitTime = GROUND_TIME + s->exitAlt / CLIMB_RATE;
+	s->deployTime = 0;
+	s->landTime = 0;
+
+	s->p.lat = 51.0;
+	s->p.lon = -114.0;
+	s->p.hMSL = s->groundAlt;
+	s->p.hAcc = 3.0;
+	s->p.vAcc = 5.0;
+	s->p.sAcc = 0.3;
+	s->p.numSV = 14;
+	s->p.phase = TRACK_GROUND;
+}
+
+void Track_SynthStep(Track_Synth_t *s, double dt)
+{
+	Track_Point_t *p = &s->p;
+	const double agl = p->hMSL - s->groundAlt;
+	double vn = p->velN, ve = p->velE, vd = p->velD;
+	double vh, heading;
+
+	p->t += dt;
+
+	switch (p->phase)
+	{
+	case TRACK_GROUND:
+		if (p->t >= GROUND_TIME) p->phase = TRACK_CLIMB;
+		break;
+	case TRACK_CLIMB:
+		ve = Track_Approach(ve, PLANE_VH, 2.0, dt);
+		vd = Track_Approach(vd, -CLIMB_RATE, 1.0, dt);
+		if (p->t >= s->exitTime) p->phase = TRACK_FREEFALL;
+		break;
+	case TRACK_FREEFALL:
+		// Quadratic drag with terminal speed TERMINAL
+		vd += (GRAVITY - GRAVITY * vd * fabs(vd) / (TERMINAL * TERMINAL)) * dt;
+		vn -= vn / 5.0 * dt;
+		ve -= ve / 5.0 * dt;
+		if (agl <= s->deployAlt)
+		{
+			p->phase = TRACK_DEPLOY;
+			s->deployTime = p->t;
+		}
+		break;
+	case TRACK_DEPLOY:
+		vd = Track_Approach(vd, CANOPY_VD, 20.0, dt);
+		ve = Track_Approach(ve, CANOPY_VH, 5.0, dt);
+		if (vd <= CANOPY_VD) p->phase = TRACK_CANOPY;
+		break;
+	case TRACK_CANOPY:
+		// Alternate straight flight and 90 degree turns
+		vh = sqrt(vn * vn + ve * ve);
+		heading = atan2(ve, vn);
+		if (fmod(p->t - s->deployTime, 40.0) >= 30.0)
+		{
+			heading += 9.0 * M_PI / 180 * dt;
+		}
+		vn = vh * cos(heading);
+		ve = vh * sin(heading);
+		if (agl < 10)
+		{
+			// Flare
+			vd = Track_Approach(vd, fmax(agl / 2, 1.0), 5.0, dt);
+			vn = Track_Approach(vn, 0, 2.0, dt);
+			ve = Track_Approach(ve, 0, 2.0, dt);
+		}
+		if (agl <= 0)
+		{
+			p->phase = TRACK_LANDED;
+			s->landTime = p->t;
+			vn = ve = vd = 0;
+			p->hMSL = s->groundAlt;
+		}
+		break;
+	case TRACK_LANDED:
+		break;
+	}
+
+	p->accN = (vn - p->velN) / dt;
+	p->accE = (ve - p->velE) / dt;
+	p->accD = (vd - p->velD) / dt;
+
+	p->velN = vn;
+	p->velE = ve;
+	p->velD = vd;
+
+	p->lat += vn * dt / EARTH_RADIUS * 180 / M_PI;
+	p->lon += ve * dt / (EARTH_RADIUS * cos(p->lat * M_PI / 180)) * 180 / M_PI;
+	if (p->phase != TRACK_LANDED)
+	{
+		p->hMSL -= vd * dt;
+	}
+}
+
+// Days from 1970-01-01 to a civil date
+static int32_t Track_Days(int32_t y, int32_t m, int32_t d)
+{
+	int32_t era, yoe, doy, doe;
+
+	y -= (m <= 2);
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = y - era * 400;
+	doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return era * 146097 + doe - 719468;
+}
+
+static double Track_ParseTime(const char *str)
+{
+	int year, month, day, hour, min;
+	double sec;
+
+	// ISO 8601 UTC time, e.g. 2023-05-13T16:23:57.400Z
+	if (sscanf(str, "%d-%d-%dT%d:%d:%lfZ", &year, &month, &day, &hour, &min, &sec) != 6)
+	{
+		return -1;
+	}
+
+	// Seconds since the GPS epoch, 1980-01-06
+	return (Track_Days(year, month, day) - Track_Days(1980, 1, 6)) * 86400.0
+			+ hour * 3600.0 + min * 60.0 + sec + TRACK_LEAP;
+}
+
+uint32_t Track_Load(const char *path, Track_Point_t *buf, uint32_t max)
+{
+	FILE *file;
+	char line[256], time[32];
+	uint32_t n = 0;
+	double t0 = 0, week0 = 0, dt;
+	Track_Point_t *p;
+
+	file = fopen(path, "r");
+	if (!file) return 0;
+
+	while (n < max && fgets(line, sizeof(line), file))
+	{
+		p = &buf[n];
+		memset(p, 0, sizeof(*p));
+
+		if (sscanf(line, "$GNSS,%31[^,],%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%d",
+				time, &p->lat, &p->lon, &p->hMSL, &p->velN, &p->velE, &p->velD,
+				&p->hAcc, &p->vAcc, &p->sAcc, &p->numSV) != 11)
+		{
+			continue;
+		}
+
+		p->t = Track_ParseTime(time);
+		if (p->t < 0) continue;
+
+		if (n == 0)
+		{
+			t0 = p->t;
+			week0 = floor(t0 / TRACK_WEEK);
+		}
+		p->tow = p->t - week0 * TRACK_WEEK;
+		p->t -= t0;
+
+		if (n > 0)
+		{
+			dt = p->t - buf[n - 1].t;
+			if (dt > 0)
+			{
+				p->accN = (p->velN - buf[n - 1].velN) / dt;
+				p->accE = (p->velE - buf[n - 1].velE) / dt;
+				p->accD = (p->velD - buf[n - 1].velD) / dt;
+			}
+		}
+
+		++n;
+	}
+
+	fclose(file);
+	return n;
+}
+
+uint32_t Track_Synth(Track_Point_t *buf, uint32_t max, double dt)
+{
+	Track_Synth_t s;
+	uint32_t n = 0;
+
+	Track_SynthInit(&s);
+
+	while (n < max && !(s.p.phase == TRACK_LANDED && s.p.t > s.landTime + 30))
+	{
+		buf[n++] = s.p;
+		Track_SynthStep(&s, dt);
+	}
+
+	return n;
+}
+
+void Track_Interpolate(const Track_Point_t *buf, uint32_t count, double t, Track_Point_t *p)
+{
+	uint32_t lo = 0, hi = count - 1, mid;
+	double f;
+
+	if (t <= buf[0].t)  { *p = buf[0];  return; }
+	if (t >= buf[hi].t) { *p = buf[hi]; return; }
+
+	while (hi - lo > 1)
+	{
+		mid = (lo + hi) / 2;
+		if (buf[mid].t <= t) lo = mid;
+		else                 hi = mid;
+	}
+
+	f = (t - buf[lo].t) / (buf[hi].t - buf[lo].t);
+
+	*p = buf[lo];
+	p->t = t;
+	p->lat += f * (buf[hi].lat - buf[lo].lat);
+	p->lon += f * (buf[hi].lon - buf[lo].lon);
+	p->hMSL += f * (buf[hi].hMSL - buf[lo].hMSL);
+	p->velN += f * (buf[hi].velN - buf[lo].velN);
+	p->velE += f * (buf[hi].velE - buf[lo].velE);
+	p->velD += f * (buf[hi].velD - buf[lo].velD);
+}
+
+void Track_ToGNSS(const Track_Point_t *p, uint32_t iTOW, FS_GNSS_Data_t *gnss)
+{
+	const double gSpeed = sqrt(p->velN * p->velN + p->velE * p->velE);
+	double heading = atan2(p->velE, p->velN) * 180 / M_PI;
+
+	if (heading < 0) heading += 360;
+
+	memset(gnss, 0, sizeof(*gnss));
+	gnss->iTOW = iTOW;
+	gnss->lat = lround(p->lat * 1e7);
+	gnss->lon = lround(p->lon * 1e7);
+	gnss->hMSL = lround(p->hMSL * 1000);
+	gnss->velN = lround(p->velN * 1000);
+	gnss->velE = lround(p->velE * 1000);
+	gnss->velD = lround(p->velD * 1000);
+	gnss->gSpeed = lround(gSpeed * 100);
+	gnss->speed = lround(sqrt(gSpeed * gSpeed + p->velD * p->velD) * 100);
+	gnss->heading = lround(heading * 1e5);
+	gnss->hAcc = lround(p->hAcc * 1000);
+	gnss->vAcc = lround(p->vAcc * 1000);
+	gnss->sAcc = lround(p->sAcc * 1000);
+	gnss->gpsFix = 3;
+	gnss->numSV = p->numSV;
+}
+
+double Track_Pressure(double hMSL)
+{
+	return 101325.0 * pow(1 - 2.25577e-5 * hMSL, 5.25588);
+}
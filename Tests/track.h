@@ -0,0 +1,94 @@
+/***************************************************************************
+**                                                                        **
+**  FlySight 2 firmware                                                   **
+**  Copyright 2023 Bionic Avionics Inc.                                   **
+**                                                                        **
+**  This program is free software: you can redistribute it and/or modify  **
+**  it under the terms of the GNU General Public License as published by  **
+**  the Free Software Foundation, either version 3 of the License, or     **
+**  (at your option) any later version.                                   **
+**                                                                        **
+**  This program is distributed in the hope that it will be useful,       **
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of        **
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         **
+**  GNU General Public License for more details.                          **
+**                                                                        **
+**  You should have received a copy of the GNU General Public License     **
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>. **
+**                                                                        **
+****************************************************************************
+**  Contact: Bionic Avionics Inc.                                         **
+**  Website: http://flysight.ca/                                          **
+****************************************************************************/
+
+#ifndef TRACK_H_
+#define TRACK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gnss.h"
+
+typedef enum
+{
+	TRACK_GROUND = 0,
+	TRACK_CLIMB,
+	TRACK_FREEFALL,
+	TRACK_DEPLOY,
+	TRACK_CANOPY,
+	TRACK_LANDED
+} Track_Phase_t;
+
+typedef struct
+{
+	double t;          // Time since start             (s)
+	double lat;        // Latitude                     (deg)
+	double lon;        // Longitude                    (deg)
+	double hMSL;       // Height above mean sea level  (m)
+	double velN;       // North velocity               (m/s)
+	double velE;       // East velocity                (m/s)
+	double velD;       // Down velocity                (m/s)
+	double accN;       // North acceleration           (m/s^2)
+	double accE;       // East acceleration            (m/s^2)
+	double accD;       // Down acceleration            (m/s^2)
+	double hAcc;       // Horizontal accuracy          (m)
+	double vAcc;       // Vertical accuracy            (m)
+	double sAcc;       // Speed accuracy               (m/s)
+	int    numSV;      // Number of SVs in solution
+	double tow;        // GPS time of week of the first point, plus t (s)
+	Track_Phase_t phase;
+} Track_Point_t;
+
+// Synthetic skydive: ground, climb, exit, freefall, deployment, canopy
+// with turns, landing
+typedef struct
+{
+	double groundAlt;  // Ground elevation             (m)
+	double exitAlt;    // Exit altitude above ground   (m)
+	double deployAlt;  // Deployment altitude          (m)
+	double exitTime;   // Time of exit                 (s)
+	double deployTime; // Time of deployment           (s)
+	double landTime;   // Time of landing              (s)
+	Track_Point_t p;   // Current state
+} Track_Synth_t;
+
+void Track_SynthInit(Track_Synth_t *s);
+void Track_SynthStep(Track_Synth_t *s, double dt);
+
+// Recorded FlySight 2 TRACK.CSV. Accelerations are differenced from
+// consecutive velocities.
+uint32_t Track_Load(const char *path, Track_Point_t *buf, uint32_t max);
+
+// Synthetic jump sampled every dt seconds until a while after landing
+uint32_t Track_Synth(Track_Point_t *buf, uint32_t max, double dt);
+
+// State at time t, interpolated linearly between points
+void Track_Interpolate(const Track_Point_t *buf, uint32_t count, double t, Track_Point_t *p);
+
+// Receiver solution for a point, without noise
+void Track_ToGNSS(const Track_Point_t *p, uint32_t iTOW, FS_GNSS_Data_t *gnss);
+
+// Standard atmosphere pressure at altitude (Pa)
+double Track_Pressure(double hMSL);
+
+#endif /* TRACK_H_ */